@@ -0,0 +1,569 @@
+#include <algorithm>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "arcs.h"
+#include "error.h"
+#include "exceptions.h"
+#include "log.h"
+
+#define KSEG0(phys)	(0x80000000 | uint32_t(phys))	// as the guest sees it
+#define BUS_KSEG0(phys)	(0xffffffff80000000ll | (phys))	// on the memory bus
+#define BUS_KSEG1(phys)	(0xffffffffa0000000ll | (phys))
+
+#define REG_V0	2
+#define REG_A0	4
+#define REG_A1	5
+#define REG_A2	6
+#define REG_A3	7
+#define REG_SP	29
+#define REG_RA	31
+
+#define MAX_STRING	256
+
+static const char *call_names[ARCS_N_CALLS] = {
+	"Load", "Invoke", "Execute", "Halt", "PowerDown", "Restart", "Reboot",
+	"EnterInteractiveMode", "ReturnFromMain", "GetPeer", "GetChild", "GetParent",
+	"GetConfigurationData", "AddChild", "DeleteComponent", "GetComponent",
+	"SaveConfiguration", "GetSystemId", "GetMemoryDescriptor", "Signal",
+	"GetTime", "GetRelativeTime", "GetDirectoryEntry", "Open", "Close", "Read",
+	"GetReadStatus", "Write", "Seek", "Mount", "GetEnvironmentVariable",
+	"SetEnvironmentVariable", "GetFileInformation", "SetFileInformation",
+	"FlushAllCaches", "TestUnicodeCharacter", "GetDisplayStatus"
+};
+
+static void hle_trampoline(void *ctx, processor *p, uint32_t code)
+{
+	((arcs *)ctx) -> call(code);
+}
+
+arcs::arcs(debug_console *pdc_in, processor *pp_in, memory *low, uint64_t low_phys_in) : pdc(pdc_in), pp(pp_in), low_phys(low_phys_in), pool(ARCS_POOL), mem_desc(0), n_mem_desc(0), root_component(0), system_id(0), time_info(0), console_out(NULL), console_in(NULL), halt_cb(NULL), halt_ctx(NULL), halted(false), n_calls(0)
+{
+	pmb = pp -> get_memory_bus();
+
+	// the kernel uses the firmware data and the vectors through KSEG0/1
+	pmb -> register_memory(BUS_KSEG0(0), 512 * 1024, low);
+	pmb -> register_memory(BUS_KSEG1(0), 512 * 1024, low);
+}
+
+arcs::~arcs()
+{
+	pp -> set_hle_handler(NULL, NULL);
+}
+
+void arcs::add_ram(uint64_t phys, uint64_t size)
+{
+	arcs_range_t r = { ARCS_MEM_FREE, phys, size };
+
+	banks.push_back(r);
+}
+
+uint32_t arcs::alloc(uint32_t n)
+{
+	n = (n + 7) & ~7;
+
+	if (pool + n > ARCS_POOL_END)
+		return 0;
+
+	uint32_t a = pool;
+	pool += n;
+
+	return a;
+}
+
+void arcs::put_u32(uint32_t phys, uint32_t v)
+{
+	pmb -> write_32b(BUS_KSEG1(phys), v);
+}
+
+uint32_t arcs::put_string(const std::string & s)
+{
+	uint32_t a = alloc(s.size() + 1);
+
+	if (a)
+		pmb -> write_block(BUS_KSEG1(a), (const uint8_t *)s.c_str(), s.size() + 1);
+
+	return a;
+}
+
+std::string arcs::get_string(uint64_t addr)
+{
+	std::string s;
+
+	for(int index=0; index<MAX_STRING; index++)
+	{
+		uint8_t c = 0;
+		pmb -> read_8b(addr + index, &c);
+
+		if (!c)
+			break;
+
+		s += char(c);
+	}
+
+	return s;
+}
+
+bool arcs::set_env(const std::string & name, const std::string & value)
+{
+	uint32_t a = put_string(value);
+
+	if (!a)
+		return false;
+
+	for(size_t index=0; index<env.size(); index++)
+	{
+		if (strcasecmp(env.at(index).first.c_str(), name.c_str()) == 0)
+		{
+			env.at(index).second = a;
+			return true;
+		}
+	}
+
+	env.push_back(std::pair<std::string, uint32_t>(name, a));
+
+	return true;
+}
+
+static bool range_cmp(const arcs_range_t & a, const arcs_range_t & b)
+{
+	return a.base < b.base;
+}
+
+void arcs::build_memory_map(const elf_image_t & image)
+{
+	if (banks.empty())
+		error_exit("arcs: no RAM");
+
+	std::vector<arcs_range_t> used;
+
+	arcs_range_t eb = { ARCS_MEM_EXCEPTION_BLOCK, 0, ARCS_PAGE };
+	used.push_back(eb);
+	arcs_range_t spb = { ARCS_MEM_SPB, ARCS_PAGE, ARCS_PAGE };
+	used.push_back(spb);
+
+	if (low_phys)
+	{
+		// the pages at physical 0 are the same RAM
+		arcs_range_t fw = { ARCS_MEM_FIRMWARE_PERMANENT, low_phys, ARCS_POOL_END };
+		used.push_back(fw);
+	}
+
+	const arcs_range_t & first = banks.at(0);
+	arcs_range_t stack = { ARCS_MEM_FIRMWARE_TEMPORARY, first.base + first.size - ARCS_STACK, ARCS_STACK };
+
+	for(size_t index=0; index<image.segments.size(); index++)
+	{
+		const elf_segment_t & s = image.segments.at(index);
+		uint64_t start = (s.vaddr & 0x1fffffff) & ~uint64_t(ARCS_PAGE - 1);
+		uint64_t end = ((s.vaddr & 0x1fffffff) + s.size + ARCS_PAGE - 1) & ~uint64_t(ARCS_PAGE - 1);
+
+		for(size_t u=0; u<used.size(); u++)
+		{
+			const arcs_range_t & r = used.at(u);
+
+			if (r.type != ARCS_MEM_LOADED_PROGRAM && start < r.base + r.size && end > r.base)
+				error_exit("arcs: kernel segment at %016llx overlaps the firmware data", s.vaddr);
+		}
+
+		if (start < stack.base + stack.size && end > stack.base)
+			error_exit("arcs: kernel segment at %016llx overlaps the firmware stack", s.vaddr);
+
+		arcs_range_t lp = { ARCS_MEM_LOADED_PROGRAM, start, end - start };
+		used.push_back(lp);
+	}
+
+	used.push_back(stack);
+
+	std::sort(used.begin(), used.end(), range_cmp);
+
+	// segments that share a page become one descriptor
+	std::vector<arcs_range_t> merged;
+	for(size_t index=0; index<used.size(); index++)
+	{
+		const arcs_range_t & r = used.at(index);
+
+		if (!merged.empty() && merged.back().type == r.type && merged.back().base + merged.back().size >= r.base)
+			merged.back().size = std::max(merged.back().base + merged.back().size, r.base + r.size) - merged.back().base;
+		else
+			merged.push_back(r);
+	}
+
+	// what is left of the banks is free
+	std::vector<arcs_range_t> map = merged;
+	for(size_t b=0; b<banks.size(); b++)
+	{
+		uint64_t cursor = banks.at(b).base, end = banks.at(b).base + banks.at(b).size;
+
+		for(size_t index=0; index<merged.size(); index++)
+		{
+			const arcs_range_t & r = merged.at(index);
+
+			if (r.base + r.size <= cursor || r.base >= end)
+				continue;
+
+			if (r.base > cursor)
+			{
+				arcs_range_t f = { ARCS_MEM_FREE, cursor, r.base - cursor };
+				map.push_back(f);
+			}
+
+			cursor = std::max(cursor, r.base + r.size);
+		}
+
+		if (cursor < end)
+		{
+			arcs_range_t f = { ARCS_MEM_FREE, cursor, end - cursor };
+			map.push_back(f);
+		}
+	}
+
+	std::sort(map.begin(), map.end(), range_cmp);
+
+	mem_desc = alloc(map.size() * ARCS_MEM_DESC_SIZE);
+	if (!mem_desc)
+		error_exit("arcs: no room for %zu memory descriptors", map.size());
+
+	n_mem_desc = map.size();
+
+	for(size_t index=0; index<map.size(); index++)
+	{
+		const arcs_range_t & r = map.at(index);
+		uint32_t a = mem_desc + index * ARCS_MEM_DESC_SIZE;
+
+		put_u32(a + 0, r.type);
+		put_u32(a + 4, r.base / ARCS_PAGE);
+		put_u32(a + 8, r.size / ARCS_PAGE);
+
+		dolog("arcs: memory %d, pages %llx-%llx", r.type, r.base / ARCS_PAGE, (r.base + r.size) / ARCS_PAGE - 1);
+	}
+}
+
+void arcs::boot(std::string kernel, const std::vector<std::string> & args)
+{
+	elf_image_t image = load_elf(pmb, kernel);
+
+	// system parameter block, firmware vector and the stubs it points to
+	put_u32(ARCS_SPB + 0x00, ARCS_SPB_SIGNATURE);
+	put_u32(ARCS_SPB + 0x04, 0x30);		// length
+	pmb -> write_16b(BUS_KSEG1(ARCS_SPB + 0x08), 1);	// version
+	pmb -> write_16b(BUS_KSEG1(ARCS_SPB + 0x0a), 2);	// revision
+	put_u32(ARCS_SPB + 0x0c, 0);		// restart block
+	put_u32(ARCS_SPB + 0x10, 0);		// debug block
+	put_u32(ARCS_SPB + 0x14, 0);		// GEVector
+	put_u32(ARCS_SPB + 0x18, 0);		// UTLBMissVector
+	put_u32(ARCS_SPB + 0x1c, ARCS_N_CALLS * 4);
+	put_u32(ARCS_SPB + 0x20, KSEG0(ARCS_VECTOR));
+	put_u32(ARCS_SPB + 0x24, 0);		// private vector
+	put_u32(ARCS_SPB + 0x28, 0);
+	put_u32(ARCS_SPB + 0x2c, 0);		// adapters
+
+	for(uint32_t index=0; index<ARCS_N_CALLS; index++)
+	{
+		uint32_t stub = ARCS_STUBS + index * ARCS_STUB_SIZE;
+
+		put_u32(ARCS_VECTOR + index * 4, KSEG0(stub));
+
+		put_u32(stub + 0x0, HLE_TRAP(index));
+		put_u32(stub + 0x4, 0x03e00008);	// jr ra
+		put_u32(stub + 0x8, 0);
+		put_u32(stub + 0xc, 0);
+	}
+
+	// system id, the root of the (otherwise empty) configuration tree
+	system_id = alloc(16);
+	pmb -> write_block(BUS_KSEG1(system_id), (const uint8_t *)"SGI\0\0\0\0\0IP22\0\0\0\0", 16);
+
+	uint32_t root_name = put_string("SGI-IP22");
+	root_component = alloc(36);
+	put_u32(root_component + 0x00, 0);	// SystemClass
+	put_u32(root_component + 0x04, 0);	// ARC
+	put_u32(root_component + 0x08, 0);	// flags
+	pmb -> write_16b(BUS_KSEG1(root_component + 0x0c), 1);
+	pmb -> write_16b(BUS_KSEG1(root_component + 0x0e), 2);
+	put_u32(root_component + 0x10, 0);	// key
+	put_u32(root_component + 0x14, 1);	// affinity mask
+	put_u32(root_component + 0x18, 0);	// configuration data size
+	put_u32(root_component + 0x1c, strlen("SGI-IP22") + 1);
+	put_u32(root_component + 0x20, KSEG0(root_name));
+
+	time_info = alloc(14);
+
+	build_memory_map(image);
+
+	// environment and arguments
+	set_env("ConsoleIn", "serial(0)");
+	set_env("ConsoleOut", "serial(0)");
+	set_env("console", "d");
+
+	std::vector<std::string> argv;
+	argv.push_back(kernel);
+
+	for(size_t index=0; index<args.size(); index++)
+	{
+		const std::string & a = args.at(index);
+
+		argv.push_back(a);
+
+		size_t is = a.find('=');
+		if (is != std::string::npos && is > 0 && !set_env(a.substr(0, is), a.substr(is + 1)))
+			error_exit("arcs: no room for environment variable %s", a.c_str());
+	}
+
+	uint32_t argv_a = alloc((argv.size() + 1) * 4);
+	uint32_t envp_a = alloc((env.size() + 1) * 4);
+	if (!argv_a || !envp_a)
+		error_exit("arcs: no room for the arguments");
+
+	for(size_t index=0; index<argv.size(); index++)
+	{
+		uint32_t s = put_string(argv.at(index));
+		if (!s)
+			error_exit("arcs: no room for the arguments");
+
+		put_u32(argv_a + index * 4, KSEG0(s));
+	}
+	put_u32(argv_a + argv.size() * 4, 0);
+
+	for(size_t index=0; index<env.size(); index++)
+	{
+		uint32_t s = put_string(env.at(index).first + "=" + get_string(BUS_KSEG1(env.at(index).second)));
+		if (!s)
+			error_exit("arcs: no room for the environment");
+
+		put_u32(envp_a + index * 4, KSEG0(s));
+	}
+	put_u32(envp_a + env.size() * 4, 0);
+
+	pp -> set_hle_handler(hle_trampoline, this);
+
+	// enter the kernel like the PROM would: main(argc, argv, envp)
+	const arcs_range_t & first = banks.at(0);
+
+	pp -> set_register_32b_se(REG_A0, argv.size());
+	pp -> set_register_32b_se(REG_A1, KSEG0(argv_a));
+	pp -> set_register_32b_se(REG_A2, KSEG0(envp_a));
+	pp -> set_register_32b_se(REG_A3, 0);
+	pp -> set_register_32b_se(REG_SP, KSEG0(first.base + first.size - 16));
+	pp -> set_register_32b_se(REG_RA, KSEG0(ARCS_STUBS + ARCS_RETURN_FROM_MAIN * ARCS_STUB_SIZE));
+	pp -> set_status_register(pp -> get_SR() & ~(SR_IE | SR_EXL | SR_ERL | SR_BEV));
+	pp -> set_PC(image.entry);
+
+	dolog("arcs: entering %s at %016llx, %zu arguments, %zu bytes of firmware data", kernel.c_str(), image.entry, argv.size(), size_t(pool - ARCS_POOL));
+}
+
+// the trap is executed again until the call can complete: sleeps until
+// host input (which wakes the processor) or the next event
+void arcs::wait()
+{
+	pp -> hle_wait();
+}
+
+uint32_t arcs::read_console(uint64_t buf, uint32_t n, uint64_t count)
+{
+	if (!console_in)
+		return ARCS_EIO;
+
+	uint32_t done = 0;
+	uint8_t c = 0;
+
+	while(done < n && console_in -> get_input(&c))
+		pmb -> write_8b(buf + done++, c);
+
+	if (n && !done)
+	{
+		wait();
+		return ARCS_ESUCCESS;
+	}
+
+	pmb -> write_32b(count, done);
+
+	return ARCS_ESUCCESS;
+}
+
+uint32_t arcs::write_console(uint64_t buf, uint32_t n, uint64_t count)
+{
+	for(uint32_t index=0; index<n; index++)
+	{
+		uint8_t c = 0;
+		pmb -> read_8b(buf + index, &c);
+
+		if (console_out)
+			console_out -> put(c);
+	}
+
+	pmb -> write_32b(count, n);
+
+	return ARCS_ESUCCESS;
+}
+
+uint32_t arcs::get_env(uint64_t name)
+{
+	std::string n = get_string(name);
+
+	for(size_t index=0; index<env.size(); index++)
+	{
+		if (strcasecmp(env.at(index).first.c_str(), n.c_str()) == 0)
+			return KSEG0(env.at(index).second);
+	}
+
+	return 0;
+}
+
+uint32_t arcs::get_memory_descriptor(uint64_t current)
+{
+	size_t index = 0;
+
+	if (current)
+		index = ((current & 0x1fffffff) - mem_desc) / ARCS_MEM_DESC_SIZE + 1;
+
+	if (index >= n_mem_desc)
+		return 0;
+
+	return KSEG0(mem_desc + index * ARCS_MEM_DESC_SIZE);
+}
+
+uint32_t arcs::get_time()
+{
+	time_t now = time(NULL);
+	struct tm tm;
+	gmtime_r(&now, &tm);
+
+	uint16_t fields[7] = { uint16_t(tm.tm_year + 1900), uint16_t(tm.tm_mon + 1), uint16_t(tm.tm_mday), uint16_t(tm.tm_hour), uint16_t(tm.tm_min), uint16_t(tm.tm_sec), 0 };
+
+	for(int index=0; index<7; index++)
+		pmb -> write_16b(BUS_KSEG1(time_info + index * 2), fields[index]);
+
+	return KSEG0(time_info);
+}
+
+void arcs::call(uint32_t code)
+{
+	n_calls++;
+
+	// o32: pointers are 32 bit, sign extended KSEG addresses
+	uint64_t a0 = pp -> get_register_64b_unsigned(REG_A0);
+	uint64_t a1 = pp -> get_register_64b_unsigned(REG_A1);
+	uint64_t a2 = pp -> get_register_64b_unsigned(REG_A2);
+	uint64_t a3 = pp -> get_register_64b_unsigned(REG_A3);
+	uint32_t rc = ARCS_ESUCCESS;
+
+	try
+	{
+		switch(code)
+		{
+			case ARCS_HALT:
+			case ARCS_POWER_DOWN:
+			case ARCS_RESTART:
+			case ARCS_REBOOT:
+			case ARCS_ENTER_INTERACTIVE:
+			case ARCS_RETURN_FROM_MAIN:
+				if (!halted)
+					dolog("arcs: %s", call_names[code]);
+				halted = true;
+
+				if (halt_cb)
+					halt_cb(halt_ctx);
+
+				// the kernel is done: stays in the stub
+				wait();
+				return;
+
+			case ARCS_GET_PEER:
+			case ARCS_GET_PARENT:
+				rc = 0;
+				break;
+
+			case ARCS_GET_CHILD:
+				rc = a0 ? 0 : KSEG0(root_component);
+				break;
+
+			case ARCS_GET_COMPONENT:
+				rc = 0;
+				break;
+
+			case ARCS_GET_SYSTEM_ID:
+				rc = KSEG0(system_id);
+				break;
+
+			case ARCS_GET_MEMORY_DESC:
+				rc = get_memory_descriptor(a0);
+				break;
+
+			case ARCS_GET_TIME:
+				rc = get_time();
+				break;
+
+			case ARCS_GET_RELATIVE_TIME:
+				rc = pp -> get_cycle_count() / CPU_CLOCK_HZ;
+				break;
+
+			case ARCS_OPEN:
+			{
+				std::string path = get_string(a0);
+
+				// only the console
+				if (strcasecmp(path.c_str(), "serial(0)") && strcasecmp(path.c_str(), "console"))
+				{
+					rc = ARCS_ENOENT;
+					break;
+				}
+
+				pmb -> write_32b(a2, a1 == 0 ? ARCS_STDIN : ARCS_STDOUT);
+				break;
+			}
+
+			case ARCS_CLOSE:
+				rc = a0 == ARCS_STDIN || a0 == ARCS_STDOUT ? ARCS_ESUCCESS : ARCS_EBADF;
+				break;
+
+			case ARCS_READ:
+				rc = a0 == ARCS_STDIN ? read_console(a1, a2, a3) : ARCS_EBADF;
+				break;
+
+			case ARCS_GET_READ_STATUS:
+				if (a0 != ARCS_STDIN)
+					rc = ARCS_EBADF;
+				else
+					rc = console_in && console_in -> has_input() ? ARCS_ESUCCESS : ARCS_EAGAIN;
+				break;
+
+			case ARCS_WRITE:
+				rc = a0 == ARCS_STDOUT ? write_console(a1, a2, a3) : ARCS_EBADF;
+				break;
+
+			case ARCS_SEEK:
+				rc = ARCS_EINVAL;
+				break;
+
+			case ARCS_GET_ENV:
+				rc = get_env(a0);
+				break;
+
+			case ARCS_SET_ENV:
+				rc = set_env(get_string(a0), get_string(a1)) ? ARCS_ESUCCESS : ARCS_ENOMEM;
+				break;
+
+			case ARCS_FLUSH_CACHES:	// caches are not emulated
+				break;
+
+			case ARCS_GET_DISPLAY_STATUS:
+				rc = 0;
+				break;
+
+			default:
+				dolog("arcs: %s (%d) is not supported", code < ARCS_N_CALLS ? call_names[code] : "?", code);
+				rc = ARCS_EINVAL;
+				break;
+		}
+	}
+	catch(processor_exception & pe)
+	{
+		// a bad pointer from the kernel
+		dolog("arcs: %s with an invalid address", code < ARCS_N_CALLS ? call_names[code] : "?");
+		rc = ARCS_EINVAL;
+	}
+
+	pp -> set_register_32b_se(REG_V0, rc);
+}
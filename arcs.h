@@ -0,0 +1,177 @@
+#ifndef __ARCS__H__
+#define __ARCS__H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "debug_console.h"
+#include "elf_loader.h"
+#include "memory.h"
+#include "memory_bus.h"
+#include "processor.h"
+#include "serial_host.h"
+#include "serial_output.h"
+
+// the firmware data, physical: below the first page a kernel can use
+#define ARCS_SPB		0x1000	// the kernel looks at 0xa0001000
+#define ARCS_VECTOR		0x1040	// the firmware vector: pointers to the stubs
+#define ARCS_STUBS		0x1100
+#define ARCS_STUB_SIZE		16
+#define ARCS_POOL		0x1400	// descriptors, strings etc.
+#define ARCS_POOL_END		0x2000
+#define ARCS_STACK		0x10000	// at the top of the first bank
+
+#define ARCS_PAGE		4096
+#define ARCS_SPB_SIGNATURE	0x53435241	// "ARCS"
+
+// the firmware vector, in ARC order
+#define ARCS_LOAD		0
+#define ARCS_INVOKE		1
+#define ARCS_EXECUTE		2
+#define ARCS_HALT		3
+#define ARCS_POWER_DOWN		4
+#define ARCS_RESTART		5
+#define ARCS_REBOOT		6
+#define ARCS_ENTER_INTERACTIVE	7
+#define ARCS_RETURN_FROM_MAIN	8
+#define ARCS_GET_PEER		9
+#define ARCS_GET_CHILD		10
+#define ARCS_GET_PARENT		11
+#define ARCS_GET_CONFIG_DATA	12
+#define ARCS_ADD_CHILD		13
+#define ARCS_DELETE_COMPONENT	14
+#define ARCS_GET_COMPONENT	15
+#define ARCS_SAVE_CONFIG	16
+#define ARCS_GET_SYSTEM_ID	17
+#define ARCS_GET_MEMORY_DESC	18
+#define ARCS_SIGNAL		19
+#define ARCS_GET_TIME		20
+#define ARCS_GET_RELATIVE_TIME	21
+#define ARCS_GET_DIR_ENTRY	22
+#define ARCS_OPEN		23
+#define ARCS_CLOSE		24
+#define ARCS_READ		25
+#define ARCS_GET_READ_STATUS	26
+#define ARCS_WRITE		27
+#define ARCS_SEEK		28
+#define ARCS_MOUNT		29
+#define ARCS_GET_ENV		30
+#define ARCS_SET_ENV		31
+#define ARCS_GET_FILE_INFO	32
+#define ARCS_SET_FILE_INFO	33
+#define ARCS_FLUSH_CACHES	34
+#define ARCS_TEST_UNICODE	35
+#define ARCS_GET_DISPLAY_STATUS	36
+#define ARCS_N_CALLS		37
+
+// memory descriptor types
+#define ARCS_MEM_EXCEPTION_BLOCK	0
+#define ARCS_MEM_SPB			1
+#define ARCS_MEM_FREE_CONTIGUOUS	2
+#define ARCS_MEM_FREE			3
+#define ARCS_MEM_BAD			4
+#define ARCS_MEM_LOADED_PROGRAM		5
+#define ARCS_MEM_FIRMWARE_TEMPORARY	6
+#define ARCS_MEM_FIRMWARE_PERMANENT	7
+
+#define ARCS_MEM_DESC_SIZE	12	// type, base page, page count
+
+// status codes
+#define ARCS_ESUCCESS		0
+#define ARCS_EACCES		2
+#define ARCS_EAGAIN		3
+#define ARCS_EBADF		4
+#define ARCS_EINVAL		7
+#define ARCS_EIO		8
+#define ARCS_ENOENT		14
+#define ARCS_ENOMEM		16
+
+// console file ids
+#define ARCS_STDIN		0
+#define ARCS_STDOUT		1
+
+typedef struct
+{
+	uint32_t type;
+	uint64_t base, size;	// physical, bytes
+} arcs_range_t;
+
+// Firmware for a kernel that is booted directly (-k), without the PROM:
+// the ELF file is loaded into RAM, the system parameter block with its
+// firmware vector is set up at 0xa0001000 and the kernel is entered like
+// the PROM would do it, with argc/argv/envp in a0..a2.
+//
+// Each entry of the firmware vector points to a stub of which the first
+// instruction is an HLE_TRAP with the number of the call: the call is
+// answered here, with the arguments and the result in the o32 registers,
+// and the stub returns to the kernel. Console I/O goes to the serial
+// console of the machine; the memory descriptors describe the banks given
+// with add_ram(), minus the firmware pages, the kernel and the firmware
+// stack. What a kernel needs from the firmware beyond that (devices in
+// the configuration tree, loading other programs) is not provided.
+class arcs
+{
+private:
+	debug_console *pdc;
+	processor *pp;
+	memory_bus *pmb;
+	uint64_t low_phys;
+
+	std::vector<arcs_range_t> banks;
+
+	uint32_t pool;	// next free byte, physical
+	uint32_t mem_desc;
+	size_t n_mem_desc;
+	uint32_t root_component, system_id, time_info;
+
+	std::vector<std::pair<std::string, uint32_t> > env;	// name, address of the value
+
+	serial_output *console_out;
+	serial_host *console_in;
+
+	void (*halt_cb)(void *ctx);
+	void *halt_ctx;
+	bool halted;
+
+	uint64_t n_calls;
+
+	uint32_t alloc(uint32_t n);
+	uint32_t put_string(const std::string & s);
+	std::string get_string(uint64_t addr);
+	void put_u32(uint32_t phys, uint32_t v);
+	bool set_env(const std::string & name, const std::string & value);
+
+	void build_memory_map(const elf_image_t & image);
+
+	void wait();
+	uint32_t read_console(uint64_t buf, uint32_t n, uint64_t count);
+	uint32_t write_console(uint64_t buf, uint32_t n, uint64_t count);
+	uint32_t get_env(uint64_t name);
+	uint32_t get_memory_descriptor(uint64_t current);
+	uint32_t get_time();
+
+public:
+	// low: the RAM that also appears at physical 0 (exception vectors,
+	// firmware data), at physical address low_phys_in
+	arcs(debug_console *pdc_in, processor *pp_in, memory *low, uint64_t low_phys_in);
+	~arcs();
+
+	// for the memory descriptors; the first bank gets the stack
+	void add_ram(uint64_t phys, uint64_t size);
+
+	void set_console(serial_output *out, serial_host *in) { console_out = out; console_in = in; }
+
+	// Halt, Reboot etc.: the guest then waits in the stub
+	void set_halt_callback(void (*cb)(void *ctx), void *ctx) { halt_cb = cb; halt_ctx = ctx; }
+
+	// args: argv[1...]; "name=value" ones also go into the environment
+	void boot(std::string kernel, const std::vector<std::string> & args);
+
+	// HLE_TRAP handler
+	void call(uint32_t code);
+
+	uint64_t get_n_calls() const { return n_calls; }
+};
+
+#endif
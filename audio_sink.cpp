@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "audio_sink.h"
+#include "error.h"
+#include "placement.h"
+
+static void *audio_sink_thread(void *arg)
+{
+	place_thread(PLACE_IO, "audio");
+
+	((audio_sink *)arg) -> output_thread();
+
+	return NULL;
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	put_le16(p, v);
+	put_le16(p + 2, v >> 16);
+}
+
+audio_sink::audio_sink(std::string target) : buffer(AUDIO_BUFFER_SIZE), rate(48000), channels(2), header_rate(0), header_channels(0), header_written(false), n_data_bytes(0), n_dropped(0), stop_flag(false)
+{
+	if (target == "-")
+		fd = 1;
+	else
+	{
+		fd = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd == -1)
+			error_exit("audio_sink: cannot create %s", target.c_str());
+	}
+
+	struct stat st;
+	seekable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+
+	if (pthread_create(&th, NULL, audio_sink_thread, this))
+		error_exit("audio_sink: cannot start thread");
+}
+
+audio_sink::~audio_sink()
+{
+	stop_flag = true;
+
+	pthread_join(th, NULL);
+
+	drain();
+
+	if (header_written && seekable && lseek(fd, 0, SEEK_SET) == 0)
+		write_header(n_data_bytes);
+
+	if (fd != 1)
+		close(fd);
+}
+
+void audio_sink::set_format(uint32_t rate_in, uint32_t channels_in)
+{
+	rate = rate_in;
+	channels = channels_in;
+}
+
+void audio_sink::put(const uint8_t *data, size_t n)
+{
+	// all or nothing so that the samples stay aligned
+	if (buffer.capacity() - buffer.size() < n)
+	{
+		n_dropped += n;
+		return;
+	}
+
+	for(size_t index=0; index<n; index++)
+		buffer.push(data[index]);
+}
+
+void audio_sink::write_header(uint32_t data_len)
+{
+	uint8_t h[44];
+	uint32_t block_align = header_channels * 2;
+
+	memcpy(&h[0], "RIFF", 4);
+	put_le32(&h[4], data_len == 0xffffffff ? data_len : 36 + data_len);
+	memcpy(&h[8], "WAVE", 4);
+	memcpy(&h[12], "fmt ", 4);
+	put_le32(&h[16], 16);
+	put_le16(&h[20], 1);	// PCM
+	put_le16(&h[22], header_channels);
+	put_le32(&h[24], header_rate);
+	put_le32(&h[28], header_rate * block_align);
+	put_le16(&h[32], block_align);
+	put_le16(&h[34], 16);
+	memcpy(&h[36], "data", 4);
+	put_le32(&h[40], data_len);
+
+	if (write(fd, h, sizeof h) != sizeof h)
+		error_exit("audio_sink: write failed");
+}
+
+void audio_sink::drain()
+{
+	uint8_t chunk[4096];
+
+	for(;;)
+	{
+		// whole samples only, a trailing half is taken next time
+		size_t n = std::min(buffer.size(), sizeof chunk) & ~size_t(1);
+		if (n == 0)
+			break;
+
+		for(size_t index=0; index<n; index++)
+			buffer.pop(&chunk[index]);
+
+		if (!header_written)
+		{
+			header_rate = rate;
+			header_channels = channels;
+
+			write_header(0xffffffff);	// unknown length
+
+			header_written = true;
+		}
+
+		// the guest produces big endian samples, WAV is little endian
+		for(size_t index=0; index<n; index += 2)
+			std::swap(chunk[index], chunk[index + 1]);
+
+		if (write(fd, chunk, n) != ssize_t(n))
+			error_exit("audio_sink: write failed");
+
+		n_data_bytes += n;
+	}
+}
+
+void audio_sink::output_thread()
+{
+	while(!stop_flag)
+	{
+		usleep(1000000 / AUDIO_REFRESH_HZ);
+
+		drain();
+	}
+}
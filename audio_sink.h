@@ -0,0 +1,54 @@
+#ifndef __AUDIO_SINK__H__
+#define __AUDIO_SINK__H__
+
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+#include "ring_buffer.h"
+
+#define AUDIO_REFRESH_HZ	50	// max. number of host writes per second
+#define AUDIO_BUFFER_SIZE	(1 << 18)	// bytes, > 1s of 48kHz stereo
+
+// Writes 16 bit audio as a WAV stream to a file, a named pipe or stdout
+// ("-"). The emulation thread queues big endian samples with put(), which
+// never blocks: when the writer thread cannot keep up samples are dropped.
+// For regular files the WAV header gets the real sizes when closing, for
+// pipes it says "unknown length".
+class audio_sink
+{
+private:
+	int fd;
+	bool seekable;
+
+	ring_buffer<uint8_t> buffer;
+
+	std::atomic<uint32_t> rate, channels;
+	uint32_t header_rate, header_channels;
+	bool header_written;
+	uint64_t n_data_bytes;
+	std::atomic<uint64_t> n_dropped;
+
+	pthread_t th;
+	std::atomic_bool stop_flag;
+
+	void write_header(uint32_t data_len);
+	void drain();
+
+public:
+	audio_sink(std::string target);
+	~audio_sink();
+
+	void output_thread();
+
+	// the WAV header uses the format that is set when the first samples
+	// are written
+	void set_format(uint32_t rate_in, uint32_t channels_in);
+
+	void put(const uint8_t *data, size_t n);
+
+	uint64_t get_n_dropped() const { return n_dropped; }
+};
+
+#endif
@@ -0,0 +1,144 @@
+// Measures the drawing throughput (pixels per second) of the LG1 pixel
+// kernels (vectorized and scalar) and of the emulated drawing engine when
+// driven through its registers (including the hand-off to the render
+// thread: every engine test waits for the FIFO to drain).
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "debug_console_testcases.h"
+#include "graphics_lg1.h"
+#include "lg1_kernels.h"
+#include "utils.h"
+
+const char *logfile = NULL;
+
+double duration = 1.0;
+
+#define N_PIXELS (LG1_WIDTH * LG1_HEIGHT)
+
+uint8_t *fb = NULL, *fb2 = NULL;
+uint32_t *rgb = NULL, palette[256];
+
+// every test does one full screen per iteration
+template <typename F>
+void bench(const char *name, F f)
+{
+	uint64_t n = 0;
+	double start_ts = get_ts(), end_ts = start_ts + duration, now;
+
+	do
+	{
+		f();
+		n += N_PIXELS;
+		now = get_ts();
+	}
+	while(now < end_ts);
+
+	printf("%-32s %10.1f Mpixels/s\n", name, n / (now - start_ts) / 1000000.0);
+}
+
+void bench_kernels()
+{
+	bench("fill (memset path)", [] { lg1_fill(fb, N_PIXELS, 0x12, 0xff, REX_LO_SRC); });
+	bench("fill xor, wrmask 0x0f", [] { lg1_fill(fb, N_PIXELS, 0x12, 0x0f, REX_LO_XOR); });
+	bench("fill xor, wrmask 0x0f (scalar)", [] { lg1_fill_scalar(fb, N_PIXELS, 0x12, 0x0f, REX_LO_XOR); });
+
+	bench("pattern, transparent", [] { lg1_pattern_fill(fb, N_PIXELS, 0xf0f0a5a5, 3, 1, 2, false, 0xff, REX_LO_SRC); });
+	bench("pattern, transparent (scalar)", [] { lg1_pattern_fill_scalar(fb, N_PIXELS, 0xf0f0a5a5, 3, 1, 2, false, 0xff, REX_LO_SRC); });
+	bench("pattern, opaque", [] { lg1_pattern_fill(fb, N_PIXELS, 0xf0f0a5a5, 3, 1, 2, true, 0xff, REX_LO_SRC); });
+	bench("pattern, opaque (scalar)", [] { lg1_pattern_fill_scalar(fb, N_PIXELS, 0xf0f0a5a5, 3, 1, 2, true, 0xff, REX_LO_SRC); });
+
+	bench("copy (memmove path)", [] { lg1_copy(fb2, fb, N_PIXELS, 0xff, REX_LO_SRC); });
+	bench("copy xor", [] { lg1_copy(fb2, fb, N_PIXELS, 0xff, REX_LO_XOR); });
+	bench("copy xor (scalar)", [] { lg1_copy_scalar(fb2, fb, N_PIXELS, 0xff, REX_LO_XOR); });
+
+	bench("index to rgb32", [] { lg1_to_rgb32(rgb, fb, N_PIXELS, palette); });
+	bench("index to rgb32 (scalar)", [] { lg1_to_rgb32_scalar(rgb, fb, N_PIXELS, palette); });
+}
+
+void bench_engine()
+{
+	debug_console *dc = new debug_console_testcases();
+	static graphics_lg1 *lg1 = new graphics_lg1(dc, "");
+
+	lg1 -> write_32b(LG1_XSTART, 0);
+	lg1 -> write_32b(LG1_XENDI, LG1_WIDTH - 1);
+	lg1 -> write_32b(LG1_WRMASK, 0xff);
+
+	// full screen rectangle, one go
+	bench("engine: block fill", []
+		{
+			lg1 -> write_32b(LG1_YSTART, 0);
+			lg1 -> write_32b(LG1_YENDI, LG1_HEIGHT - 1);
+			lg1 -> write_32b(LG1_COLORREDI, 0x34);
+			lg1 -> write_32b(LG1_COMMAND | LG1_GO, LG1_OP_DRAW | LG1_CMD_BLOCK | (REX_LO_XOR << LG1_CMD_LOGICOP_SHIFT));
+			lg1 -> sync();
+		});
+
+	// one go per span, as a driver drawing a polygon would
+	bench("engine: span fills", []
+		{
+			lg1 -> write_32b(LG1_YSTART, 0);
+			lg1 -> write_32b(LG1_COMMAND, LG1_OP_DRAW | LG1_CMD_ENZPATTERN | LG1_CMD_OPAQUE | (REX_LO_SRC << LG1_CMD_LOGICOP_SHIFT));
+			lg1 -> write_32b(LG1_ZPATTERN, 0xaaaa5555);
+
+			for(int y=0; y<LG1_HEIGHT; y++)
+				lg1 -> write_32b(LG1_COLORREDI | LG1_GO, y);
+
+			lg1 -> sync();
+		});
+
+	// scroll up by 16 lines; the lines scrolled in are not redrawn
+	bench("engine: screen to screen copy", []
+		{
+			lg1 -> write_32b(LG1_YSTART, 16);
+			lg1 -> write_32b(LG1_YENDI, LG1_HEIGHT - 1);
+			lg1 -> write_32b(LG1_XYMOVE, -16 & 0xffff);
+			lg1 -> write_32b(LG1_COMMAND | LG1_GO, LG1_OP_SCR2SCR | LG1_CMD_BLOCK | (REX_LO_SRC << LG1_CMD_LOGICOP_SHIFT));
+			lg1 -> sync();
+		});
+
+	printf("engine pixels drawn: %llu\n", (unsigned long long)lg1 -> get_n_pixels());
+	printf("engine FIFO high water: %zu of %d, %llu stalls\n", lg1 -> get_fifo_high_water(), LG1_FIFO_SIZE, (unsigned long long)lg1 -> get_n_fifo_stalls());
+	printf("render thread busy: %.1f%%\n", lg1 -> get_render_utilisation() * 100.0);
+
+	delete lg1;
+	delete dc;
+}
+
+int main(int argc, char *argv[])
+{
+	int c = -1;
+
+	while((c = getopt(argc, argv, "t:")) != -1)
+	{
+		if (c == 't')
+			duration = atof(optarg);
+		else
+		{
+			fprintf(stderr, "-t x   duration of each test in seconds (default 1)\n");
+			return 1;
+		}
+	}
+
+	fb = new uint8_t[N_PIXELS];
+	fb2 = new uint8_t[N_PIXELS];
+	rgb = new uint32_t[N_PIXELS];
+
+	for(int index=0; index<N_PIXELS; index++)
+		fb[index] = fb2[index] = rand();
+
+	for(int index=0; index<256; index++)
+		palette[index] = index * 0x010101;
+
+	bench_kernels();
+	bench_engine();
+
+	delete [] rgb;
+	delete [] fb2;
+	delete [] fb;
+
+	return 0;
+}
@@ -0,0 +1,179 @@
+// Measures the cost of the event scheduler: dispatching events (devices
+// that reschedule themselves, as a periodic timer does), scheduling and
+// cancelling (as DMA that gets stopped by the driver does) and the check
+// the processor does after every instruction.
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "scheduler.h"
+#include "utils.h"
+
+const char *logfile = NULL;
+
+double duration = 1.0;
+
+scheduler *s = NULL;
+uint64_t now = 0;
+
+typedef struct
+{
+	uint64_t period;
+	uint64_t n;
+} device_t;
+
+static void periodic_event(void *ctx, uint64_t now_in)
+{
+	device_t *d = (device_t *)ctx;
+
+	d -> n++;
+
+	s -> schedule(now_in + d -> period, periodic_event, d);
+}
+
+static void nop_event(void *ctx, uint64_t now_in)
+{
+}
+
+template <typename F>
+void bench(const char *name, const char *unit, F f)
+{
+	uint64_t n = 0;
+	double start_ts = get_ts(), end_ts = start_ts + duration, ts;
+
+	do
+	{
+		n += f();
+		ts = get_ts();
+	}
+	while(ts < end_ts);
+
+	printf("%-40s %8.1f M%s/s %8.2f ns each\n", name, n / (ts - start_ts) / 1000000.0, unit, (ts - start_ts) * 1000000000.0 / n);
+}
+
+// n_devices periodic events with different periods; the processor loop
+// jumps straight to the next event
+void bench_dispatch(int n_devices)
+{
+	s = new scheduler();
+	now = 0;
+
+	device_t *devices = new device_t[n_devices];
+
+	for(int index=0; index<n_devices; index++)
+	{
+		devices[index].period = 1000 + index * 37;
+		devices[index].n = 0;
+
+		s -> schedule(devices[index].period, periodic_event, &devices[index]);
+	}
+
+	char name[64];
+	snprintf(name, sizeof name, "dispatch, %d periodic devices", n_devices);
+
+	bench(name, "events", []
+		{
+			uint64_t before = s -> get_n_dispatched();
+
+			for(int loop=0; loop<10000; loop++)
+			{
+				now = s -> get_next_event();
+				s -> run(now);
+			}
+
+			return s -> get_n_dispatched() - before;
+		});
+
+	delete [] devices;
+	delete s;
+}
+
+void bench_cancel(int n_pending)
+{
+	s = new scheduler();
+	now = 0;
+
+	// background events that never fire
+	for(int index=0; index<n_pending; index++)
+		s -> schedule(UINT64_MAX - index, nop_event, NULL);
+
+	char name[64];
+	snprintf(name, sizeof name, "schedule + cancel, %d pending", n_pending);
+
+	bench(name, "pairs", []
+		{
+			for(int loop=0; loop<10000; loop++)
+			{
+				sched_id_t id = s -> schedule(now + (loop & 1023), nop_event, NULL);
+				s -> cancel(id);
+			}
+
+			return 10000;
+		});
+
+	delete s;
+}
+
+// what processor::tick() does after each instruction
+void bench_tick_check(uint64_t interval)
+{
+	s = new scheduler();
+
+	device_t d = { interval, 0 };
+
+	if (interval)
+		s -> schedule(interval, periodic_event, &d);
+
+	char name[64];
+	if (interval)
+		snprintf(name, sizeof name, "tick check, event every %llu cycles", (unsigned long long)interval);
+	else
+		snprintf(name, sizeof name, "tick check, no events");
+
+	static volatile uint64_t cycles = 0;
+
+	bench(name, "ticks", []
+		{
+			for(int loop=0; loop<100000; loop++)
+			{
+				uint64_t c = cycles + 4;
+				cycles = c;
+
+				if (__builtin_expect(c >= s -> get_next_event(), 0))
+					s -> run(c);
+			}
+
+			return 100000;
+		});
+
+	delete s;
+}
+
+int main(int argc, char *argv[])
+{
+	int c = -1;
+
+	while((c = getopt(argc, argv, "t:")) != -1)
+	{
+		if (c == 't')
+			duration = atof(optarg);
+		else
+		{
+			fprintf(stderr, "-t x   duration of each test in seconds (default 1)\n");
+			return 1;
+		}
+	}
+
+	bench_dispatch(1);
+	bench_dispatch(8);
+	bench_dispatch(64);
+
+	bench_cancel(0);
+	bench_cancel(64);
+
+	bench_tick_check(0);
+	bench_tick_check(1000);
+	bench_tick_check(100);
+
+	return 0;
+}
@@ -0,0 +1,113 @@
+// Measures the throughput between two vswitch ports (two "instances")
+// connected to an in-process vswitch on one host.
+#include <atomic>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "io_reactor.h"
+#include "utils.h"
+#include "vswitch.h"
+
+const char *logfile = NULL;
+
+std::atomic_bool stop_sender(false);
+int frame_size = 1514;
+
+void *sender(void *arg)
+{
+	vswitch_port *vp = (vswitch_port *)arg;
+
+	uint8_t frame[NET_MAX_FRAME];
+	memset(frame, 0xaa, sizeof frame);
+
+	// unicast from 02:00:00:00:00:01 to 02:00:00:00:00:02
+	const uint8_t dst[6] = { 0x02, 0, 0, 0, 0, 0x02 };
+	const uint8_t src[6] = { 0x02, 0, 0, 0, 0, 0x01 };
+	memcpy(&frame[0], dst, 6);
+	memcpy(&frame[6], src, 6);
+
+	while(!stop_sender)
+	{
+		if (!vp -> send_frame(frame, frame_size))
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int c = -1;
+	double duration = 5.0;
+
+	while((c = getopt(argc, argv, "s:t:")) != -1)
+	{
+		if (c == 's')
+			frame_size = atoi(optarg);
+		else if (c == 't')
+			duration = atof(optarg);
+		else
+		{
+			fprintf(stderr, "-s x   frame size (default 1514)\n-t x   duration in seconds (default 5)\n");
+			return 1;
+		}
+	}
+
+	if (frame_size < 14 || frame_size > NET_MAX_FRAME)
+	{
+		fprintf(stderr, "frame size must be between 14 and %d\n", NET_MAX_FRAME);
+		return 1;
+	}
+
+	char path[64];
+	snprintf(path, sizeof path, "/tmp/bench_vswitch.%d", getpid());
+
+	vswitch *vs = new vswitch(path, NULL);
+	vs -> start();
+
+	// each instance has an I/O thread of its own
+	io_reactor *io_a = new io_reactor("a"), *io_b = new io_reactor("b");
+	vswitch_port *a = new vswitch_port(io_a, path, NULL);
+	vswitch_port *b = new vswitch_port(io_b, path, NULL);
+
+	pthread_t th;
+	pthread_create(&th, NULL, sender, a);
+
+	net_frame_t frame;
+	uint64_t n_frames = 0, n_bytes = 0;
+	double start_ts = get_ts(), end_ts = start_ts + duration;
+
+	for(;;)
+	{
+		if (b -> receive_frame(&frame))
+		{
+			n_frames++;
+			n_bytes += frame.len;
+		}
+		else if (get_ts() >= end_ts)
+			break;
+		else
+			sched_yield();
+	}
+
+	double took = get_ts() - start_ts;
+
+	stop_sender = true;
+	pthread_join(th, NULL);
+
+	printf("frame size:   %d bytes\n", frame_size);
+	printf("frames sent:  %llu\n", (unsigned long long)a -> get_n_tx());
+	printf("frames recv:  %llu (%llu dropped at the receiving port)\n", (unsigned long long)n_frames, (unsigned long long)b -> get_n_rx_dropped());
+	printf("throughput:   %.0f frames/s, %.2f MB/s\n", n_frames / took, n_bytes / took / 1000000.0);
+
+	delete b;
+	delete a;
+	delete io_b;
+	delete io_a;
+	delete vs;
+
+	return 0;
+}
@@ -1,7 +1,7 @@
-#include <assert.h>
+#include "error.h"
 
 #ifdef _DEBUG
-	#define ASSERT(x)	assert(x)
+	#define ASSERT(x)	do { if (!(x)) assert_failed(#x, __FILE__, __LINE__); } while(0)
 	#define DEBUG(x)	do { (x); } while(0)
 #else
 	#define ASSERT(x)
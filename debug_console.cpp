@@ -1,9 +1,11 @@
+#include <atomic>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
 
 #include "debug_console.h"
+#include "machine_context.h"
 #include "processor.h"
 #include "processor_utils.h"
 #include "exceptions.h"
@@ -12,12 +14,10 @@
 
 #define SCREEN_REFRESHES_PER_SECOND	3
 
-extern bool single_step;
-extern const char *logfile;
+// there is only one terminal
+static std::atomic_bool term_change(false);
 
-bool term_change = false;
-
-void sigh(int sig)
+static void sigh(int sig)
 {
 	// will always be SIGWINCH
 	signal(SIGWINCH, sigh);
@@ -64,6 +64,8 @@ debug_console::debug_console()
 
 	refresh_limit = refresh_counter = 0;
 	refresh_limit_valid = false;
+
+	pthread_mutex_init(&term_lock, NULL);
 }
 
 void debug_console::init()
@@ -122,6 +124,8 @@ debug_console::~debug_console()
 
 		endwin();
 	}
+
+	pthread_mutex_destroy(&term_lock);
 }
 
 void debug_console::recreate_terminal()
@@ -219,10 +223,12 @@ void debug_console::tick(processor *p)
 		instruction_counts.insert(std::pair<std::string, long int>(instruction_name, 1));
 #endif
 
-	if ((++refresh_counter >= refresh_limit && refresh_limit_valid == true) || single_step)
+	if ((++refresh_counter >= refresh_limit && refresh_limit_valid == true) || get_machine_context() -> single_step)
 	{
 		double now_ts = get_ts();
 
+		pthread_mutex_lock(&term_lock);
+
 		if (term_change)
 			recreate_terminal();
 
@@ -305,6 +311,8 @@ void debug_console::tick(processor *p)
 		wnoutrefresh(win_regs);
 		doupdate();
 
+		pthread_mutex_unlock(&term_lock);
+
 		if (refresh_limit_valid)
 			refresh_counter = 0;
 	}
@@ -312,7 +320,7 @@ void debug_console::tick(processor *p)
 
 void debug_console::dc_log(const char *fmt, ...)
 {
-	if (logfile || win_logs)
+	if (log_enabled() || win_logs)
 	{
 		char buffer[4096];
 		va_list ap;
@@ -322,7 +330,11 @@ void debug_console::dc_log(const char *fmt, ...)
 		va_end(ap);
 
 		if (win_logs)
+		{
+			pthread_mutex_lock(&term_lock);
 			wprintw(win_logs, "\n%s", buffer);
+			pthread_mutex_unlock(&term_lock);
+		}
 
 		dolog("%s", buffer);
 
@@ -336,11 +348,31 @@ void debug_console::dc_term(const char *fmt, ...)
 	{
 		va_list ap;
 
+		pthread_mutex_lock(&term_lock);
+
 		va_start(ap, fmt);
 		vwprintw(win_term, fmt, ap);
 		va_end(ap);
 
 		wnoutrefresh(win_term);
 		doupdate();
+
+		pthread_mutex_unlock(&term_lock);
+	}
+}
+
+void debug_console::dc_term_write(const char *data, size_t len)
+{
+	if (win_term)
+	{
+		pthread_mutex_lock(&term_lock);
+
+		for(size_t index=0; index<len; index++)
+			waddch(win_term, (unsigned char)data[index]);
+
+		wnoutrefresh(win_term);
+		doupdate();
+
+		pthread_mutex_unlock(&term_lock);
 	}
 }
@@ -2,6 +2,7 @@
 #define __DEBUG_CONSOLE__H__
 
 #include <map>
+#include <pthread.h>
 #include <string>
 
 #include <ncurses.h>
@@ -21,6 +22,10 @@ private:
 	bool had_logging;
 	std::map<std::string, long int> instruction_counts;
 
+	// ncurses is not thread safe and the serial output thread also
+	// writes to win_term
+	pthread_mutex_t term_lock;
+
 	void recreate_terminal();
 	void create_windows();
 
@@ -39,6 +44,9 @@ public:
 	virtual void dc_log(const char *fmt, ...);
 
 	virtual void dc_term(const char *fmt, ...);
+
+	// called from the serial output thread
+	virtual void dc_term_write(const char *data, size_t len);
 };
 
 #endif
@@ -46,3 +46,8 @@ void debug_console_simple::dc_term(const char *fmt, ...)
 	vfprintf(stderr, fmt, ap);
 	va_end(ap);
 }
+
+void debug_console_simple::dc_term_write(const char *data, size_t len)
+{
+	fwrite(data, 1, len, stderr);
+}
@@ -17,4 +17,6 @@ public:
 	void dc_log(const char *fmt, ...);
 
 	void dc_term(const char *fmt, ...);
+
+	void dc_term_write(const char *data, size_t len);
 };
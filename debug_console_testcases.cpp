@@ -9,8 +9,6 @@
 #include "log.h"
 #include "utils.h"
 
-extern const char *logfile;
-
 debug_console_testcases::debug_console_testcases()
 {
 }
@@ -32,7 +30,7 @@ void debug_console_testcases::tick(processor *p)
 
 void debug_console_testcases::dc_log(const char *fmt, ...)
 {
-	if (logfile)
+	if (log_enabled())
 	{
 		char buffer[4096];
 		va_list ap;
@@ -48,3 +46,7 @@ void debug_console_testcases::dc_log(const char *fmt, ...)
 void debug_console_testcases::dc_term(const char *fmt, ...)
 {
 }
+
+void debug_console_testcases::dc_term_write(const char *data, size_t len)
+{
+}
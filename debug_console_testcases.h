@@ -16,6 +16,8 @@ public:
 	void dc_log(const char *fmt, ...);
 
 	void dc_term(const char *fmt, ...);
+
+	void dc_term_write(const char *data, size_t len);
 };
 
 #endif
@@ -0,0 +1,179 @@
+#include "device_thread.h"
+#include "error.h"
+#include "placement.h"
+#include "processor.h"
+#include "utils.h"
+
+static void *device_thread_main(void *arg)
+{
+	place_thread(PLACE_IO, "device");
+
+	((device_thread *)arg) -> run();
+
+	return NULL;
+}
+
+static void boundary_event(void *ctx, uint64_t now)
+{
+	((device_thread *)ctx) -> boundary(now);
+}
+
+device_thread::device_thread(processor *pp_in, uint64_t quantum_in) : pp(pp_in), quantum(quantum_in), batch_pending(false), batch_done(false), stop_flag(false), event(SCHED_NONE), n_jobs(0), n_quanta(0), n_syncs(0), n_waits(0), busy_us(0.0)
+{
+	if (quantum == 0)
+		error_exit("device_thread: quantum must be at least 1 cycle");
+
+	start();
+}
+
+device_thread::~device_thread()
+{
+	sync(pp -> get_cycle_count());
+
+	pthread_mutex_lock(&lock);
+	stop_flag = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	pthread_join(th, NULL);
+
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&lock);
+}
+
+void device_thread::start()
+{
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&cond, NULL);
+
+	if (pthread_create(&th, NULL, device_thread_main, this))
+		error_exit("device_thread: cannot start thread");
+}
+
+// a batch that was in flight at the fork is run by the new thread
+void device_thread::after_fork()
+{
+	start();
+}
+
+void device_thread::run()
+{
+	pthread_mutex_lock(&lock);
+
+	for(;;)
+	{
+		while(!batch_pending && !stop_flag)
+			pthread_cond_wait(&cond, &lock);
+
+		if (!batch_pending)
+			break;
+
+		pthread_mutex_unlock(&lock);
+
+		double start_ts = get_ts();
+
+		for(const device_job_t & j : batch)
+			j.work(j.ctx);
+
+		double took = get_ts() - start_ts;
+
+		pthread_mutex_lock(&lock);
+
+		busy_us += took * 1000000.0;
+		batch_pending = false;
+		batch_done = true;
+		pthread_cond_broadcast(&cond);
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+void device_thread::wait_batch()
+{
+	pthread_mutex_lock(&lock);
+
+	if (batch_pending)
+		n_waits++;
+
+	while(batch_pending)
+		pthread_cond_wait(&cond, &lock);
+
+	pthread_mutex_unlock(&lock);
+}
+
+// the done callbacks may post new jobs: those go to the next quantum
+void device_thread::complete(uint64_t now)
+{
+	if (batch.empty())
+		return;
+
+	wait_batch();
+
+	std::vector<device_job_t> finished;
+	finished.swap(batch);
+
+	for(const device_job_t & j : finished)
+		j.done(j.ctx, now);
+}
+
+void device_thread::hand_over()
+{
+	if (open.empty())
+		return;
+
+	batch.swap(open);
+
+	pthread_mutex_lock(&lock);
+	batch_pending = true;
+	batch_done = false;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+// boundaries are at multiples of the quantum
+void device_thread::schedule_boundary(uint64_t now)
+{
+	event = pp -> get_scheduler() -> schedule((now / quantum + 1) * quantum, boundary_event, this);
+}
+
+void device_thread::post(device_work_t work, device_done_t done, void *ctx)
+{
+	device_job_t j = { work, done, ctx };
+	open.push_back(j);
+
+	n_jobs++;
+
+	if (event == SCHED_NONE)
+		schedule_boundary(pp -> get_cycle_count());
+}
+
+void device_thread::boundary(uint64_t now)
+{
+	event = SCHED_NONE;
+
+	n_quanta++;
+
+	complete(now);
+	hand_over();
+
+	if (!idle())
+		schedule_boundary(now);
+}
+
+void device_thread::sync(uint64_t now)
+{
+	if (idle())
+		return;
+
+	n_syncs++;
+
+	pp -> get_scheduler() -> cancel(event);
+	event = SCHED_NONE;
+
+	complete(now);
+	hand_over();
+	complete(now);
+
+	if (!idle())
+		schedule_boundary(now);
+}
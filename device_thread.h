@@ -0,0 +1,91 @@
+#ifndef __DEVICE_THREAD__H__
+#define __DEVICE_THREAD__H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+#include "scheduler.h"
+
+class processor;
+
+#define DEVICE_QUANTUM_DEFAULT	100000	// cycles, 1ms of guest time
+
+// runs on the device thread: no guest visible state may change here
+typedef void (*device_work_t)(void *ctx);
+// runs on the processor thread at the end of a quantum: the results
+// become visible to the guest
+typedef void (*device_done_t)(void *ctx, uint64_t now);
+
+typedef struct
+{
+	device_work_t work;
+	device_done_t done;
+	void *ctx;
+} device_job_t;
+
+// Runs the heavy part of device models (DMA copies) on a second thread,
+// in lock-step with the processor. Time is cut in quanta of `quantum'
+// cycles: the jobs posted during quantum k run on the device thread
+// while the processor executes quantum k + 1, and at the end of that one
+// their done callbacks run on the processor thread. The device thread so
+// is never more than one quantum behind and the guest sees the results
+// at a quantum boundary, like an interrupt that comes a bit late.
+//
+// A device whose state the guest reads while a job of it is in flight
+// calls sync(): a rendezvous that waits for all jobs and completes them
+// at once. The quantum boundary is a scheduler event that only exists
+// while there are jobs, so a machine without DMA pays nothing.
+class device_thread
+{
+private:
+	processor *pp;
+	uint64_t quantum;
+
+	std::vector<device_job_t> open;	// posted in the current quantum
+	std::vector<device_job_t> batch;	// handed to the thread
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool batch_pending, batch_done, stop_flag;
+
+	pthread_t th;
+
+	sched_id_t event;
+
+	uint64_t n_jobs, n_quanta, n_syncs, n_waits;
+	double busy_us;
+
+	void start();
+	void wait_batch();
+	void complete(uint64_t now);
+	void hand_over();
+	void schedule_boundary(uint64_t now);
+
+public:
+	device_thread(processor *pp_in, uint64_t quantum_in);
+	~device_thread();
+
+	void run();
+
+	// in the child of a fork: the thread is gone, start it again
+	void after_fork();
+
+	// processor thread
+	void post(device_work_t work, device_done_t done, void *ctx);
+	void sync(uint64_t now);
+	bool idle() const { return open.empty() && batch.empty(); }
+
+	// scheduler callback
+	void boundary(uint64_t now);
+
+	uint64_t get_quantum() const { return quantum; }
+	uint64_t get_n_jobs() const { return n_jobs; }
+	uint64_t get_n_quanta() const { return n_quanta; }
+	uint64_t get_n_syncs() const { return n_syncs; }
+	// boundaries at which the processor had to wait for the thread
+	uint64_t get_n_waits() const { return n_waits; }
+	double get_busy_us() const { return busy_us; }
+};
+
+#endif
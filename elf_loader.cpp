@@ -0,0 +1,114 @@
+#include <elf.h>
+#include <endian.h>
+#include <string.h>
+
+#include "elf_loader.h"
+#include "error.h"
+#include "exceptions.h"
+#include "log.h"
+#include "utils.h"
+
+static void load_segment(memory_bus *pmb, const std::string & file, const unsigned char *data, uint64_t len, uint64_t offset, uint64_t filesz, uint64_t vaddr, uint64_t memsz)
+{
+	if (filesz > memsz || offset > len || filesz > len - offset)
+		error_exit("load_elf: %s has an invalid program header", file.c_str());
+
+	try
+	{
+		pmb -> write_block(vaddr, &data[offset], filesz);
+
+		if (memsz > filesz)
+		{
+			std::vector<uint8_t> zero(memsz - filesz);
+			pmb -> write_block(vaddr + filesz, zero.data(), zero.size());
+		}
+	}
+	catch(processor_exception & pe)
+	{
+		error_exit("load_elf: segment at %016llx of %s is not in RAM", vaddr, file.c_str());
+	}
+
+	dolog("load_elf: %llu bytes at %016llx (%llu from the file)", memsz, vaddr, filesz);
+}
+
+elf_image_t load_elf(memory_bus *pmb, std::string file)
+{
+	unsigned char *data = NULL;
+	uint64_t len = 0;
+	load_file(file, &data, &len);
+
+	if (len < EI_NIDENT || memcmp(data, ELFMAG, SELFMAG) || data[EI_DATA] != ELFDATA2MSB)
+		error_exit("load_elf: %s is not a big endian ELF file", file.c_str());
+
+	elf_image_t image;
+
+	if (data[EI_CLASS] == ELFCLASS32)
+	{
+		const Elf32_Ehdr *eh = (const Elf32_Ehdr *)data;
+
+		if (len < sizeof(Elf32_Ehdr) || be16toh(eh -> e_machine) != EM_MIPS)
+			error_exit("load_elf: %s is not a MIPS executable", file.c_str());
+
+		image.entry = uint64_t(int64_t(int32_t(be32toh(eh -> e_entry))));
+
+		uint32_t phoff = be32toh(eh -> e_phoff);
+		uint16_t phnum = be16toh(eh -> e_phnum);
+
+		if (phoff > len || uint64_t(phnum) * sizeof(Elf32_Phdr) > len - phoff)
+			error_exit("load_elf: %s is truncated", file.c_str());
+
+		for(uint16_t index=0; index<phnum; index++)
+		{
+			const Elf32_Phdr *ph = (const Elf32_Phdr *)&data[phoff + index * sizeof(Elf32_Phdr)];
+
+			if (be32toh(ph -> p_type) != PT_LOAD)
+				continue;
+
+			elf_segment_t s = { uint64_t(int64_t(int32_t(be32toh(ph -> p_vaddr)))), be32toh(ph -> p_memsz) };
+
+			load_segment(pmb, file, data, len, be32toh(ph -> p_offset), be32toh(ph -> p_filesz), s.vaddr, s.size);
+
+			image.segments.push_back(s);
+		}
+	}
+	else if (data[EI_CLASS] == ELFCLASS64)
+	{
+		const Elf64_Ehdr *eh = (const Elf64_Ehdr *)data;
+
+		if (len < sizeof(Elf64_Ehdr) || be16toh(eh -> e_machine) != EM_MIPS)
+			error_exit("load_elf: %s is not a MIPS executable", file.c_str());
+
+		image.entry = be64toh(eh -> e_entry);
+
+		uint64_t phoff = be64toh(eh -> e_phoff);
+		uint16_t phnum = be16toh(eh -> e_phnum);
+
+		if (phoff > len || uint64_t(phnum) * sizeof(Elf64_Phdr) > len - phoff)
+			error_exit("load_elf: %s is truncated", file.c_str());
+
+		for(uint16_t index=0; index<phnum; index++)
+		{
+			const Elf64_Phdr *ph = (const Elf64_Phdr *)&data[phoff + index * sizeof(Elf64_Phdr)];
+
+			if (be32toh(ph -> p_type) != PT_LOAD)
+				continue;
+
+			elf_segment_t s = { be64toh(ph -> p_vaddr), be64toh(ph -> p_memsz) };
+
+			load_segment(pmb, file, data, len, be64toh(ph -> p_offset), be64toh(ph -> p_filesz), s.vaddr, s.size);
+
+			image.segments.push_back(s);
+		}
+	}
+	else
+	{
+		error_exit("load_elf: %s has an unknown ELF class", file.c_str());
+	}
+
+	delete [] data;
+
+	if (image.segments.empty())
+		error_exit("load_elf: %s has nothing to load", file.c_str());
+
+	return image;
+}
@@ -0,0 +1,27 @@
+#ifndef __ELF_LOADER__H__
+#define __ELF_LOADER__H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "memory_bus.h"
+
+typedef struct
+{
+	uint64_t vaddr, size;	// in memory, including the zero filled part
+} elf_segment_t;
+
+typedef struct
+{
+	uint64_t entry;
+	std::vector<elf_segment_t> segments;
+} elf_image_t;
+
+// Copies the loadable segments of a big endian MIPS ELF file (32 or 64
+// bit, e.g. an IRIX kernel) into guest memory through the bus, at their
+// virtual addresses: 32 bit ones are sign extended, so KSEG0 addresses
+// end up where the processor would look for them. Errors are fatal.
+elf_image_t load_elf(memory_bus *pmb, std::string file);
+
+#endif
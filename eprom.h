@@ -1,3 +1,6 @@
+#ifndef __EPROM__H__
+#define __EPROM__H__
+
 #include <string>
 
 #include "memory.h"
@@ -13,3 +16,5 @@ public:
 
 	virtual ~eprom();
 };
+
+#endif
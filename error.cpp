@@ -5,6 +5,8 @@
 #include <ncurses.h>
 #include <sys/types.h>
 
+static void (*abort_hook)() = NULL;
+
 void error_exit(const char *format, ...)
 {
 	va_list ap;
@@ -19,3 +21,20 @@ void error_exit(const char *format, ...)
 
 	exit(1);
 }
+
+void set_abort_hook(void (*hook)())
+{
+	abort_hook = hook;
+}
+
+void assert_failed(const char *what, const char *file, int line)
+{
+	endwin();
+
+	fprintf(stderr, "%s:%d: assertion \"%s\" failed\n", file, line, what);
+
+	if (abort_hook)
+		abort_hook();
+
+	abort();
+}
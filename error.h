@@ -1 +1,6 @@
 void error_exit(const char *format, ...);
+
+// a failed ASSERT: reports it, runs the abort hook (which writes out the
+// queued log lines) and aborts
+void assert_failed(const char *what, const char *file, int line);
+void set_abort_hook(void (*hook)());
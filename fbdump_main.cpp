@@ -0,0 +1,151 @@
+// Dumps the LG1 framebuffer of a running miep (started with -F name) to a
+// PPM file and optionally lists the rectangles drawn since the previous
+// run with -r.
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "lg1_kernels.h"
+#include "lg1_shm.h"
+
+const char *logfile = NULL;
+
+void help()
+{
+	fprintf(stderr, "-s x   name of the shared memory segment (as given to miep -F)\n");
+	fprintf(stderr, "-o x   write the PPM to file x (default stdout)\n");
+	fprintf(stderr, "-r     list the changed rectangles on stderr and acknowledge them\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int c = -1;
+	std::string name;
+	const char *out_file = NULL;
+	bool list_dirty = false;
+
+	while((c = getopt(argc, argv, "s:o:r")) != -1)
+	{
+		if (c == 's')
+			name = optarg;
+		else if (c == 'o')
+			out_file = optarg;
+		else if (c == 'r')
+			list_dirty = true;
+		else
+		{
+			help();
+			return 1;
+		}
+	}
+
+	if (name.empty())
+	{
+		help();
+		return 1;
+	}
+
+	if (name[0] != '/')
+		name = "/" + name;
+
+	int fd = shm_open(name.c_str(), O_RDWR, 0);
+	if (fd == -1)
+		error_exit("cannot open shared memory %s", name.c_str());
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || size_t(st.st_size) < sizeof(lg1_shm_header_t))
+		error_exit("%s is too small", name.c_str());
+
+	uint8_t *shm = (uint8_t *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (shm == MAP_FAILED)
+		error_exit("cannot map %s", name.c_str());
+
+	close(fd);
+
+	lg1_shm_header_t *hdr = (lg1_shm_header_t *)shm;
+
+	if (hdr -> magic != LG1_SHM_MAGIC || hdr -> version != LG1_SHM_VERSION)
+		error_exit("%s is not an LG1 framebuffer (or a different version)", name.c_str());
+
+	if (hdr -> fb_offset + uint64_t(hdr -> stride) * hdr -> height > uint64_t(st.st_size))
+		error_exit("%s: framebuffer outside of the segment", name.c_str());
+
+	// consistent copy of the header
+	uint32_t palette[256];
+	lg1_rect_t dirty[LG1_SHM_MAX_DIRTY];
+	uint32_t n_dirty = 0;
+	uint64_t generation = 0;
+
+	for(;;)
+	{
+		generation = hdr -> generation.load(std::memory_order_acquire);
+		if (generation & 1)
+		{
+			sched_yield();
+			continue;
+		}
+
+		memcpy(palette, hdr -> palette, sizeof palette);
+		n_dirty = hdr -> n_dirty;
+		if (n_dirty <= LG1_SHM_MAX_DIRTY)
+			memcpy(dirty, hdr -> dirty, n_dirty * sizeof(lg1_rect_t));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (hdr -> generation.load(std::memory_order_relaxed) == generation)
+			break;
+	}
+
+	if (list_dirty)
+	{
+		fprintf(stderr, "generation %llu\n", (unsigned long long)generation);
+
+		if (n_dirty > LG1_SHM_MAX_DIRTY)
+			fprintf(stderr, "everything changed\n");
+
+		for(uint32_t index=0; index<n_dirty && index<LG1_SHM_MAX_DIRTY; index++)
+			fprintf(stderr, "%d,%d - %d,%d\n", dirty[index].x0, dirty[index].y0, dirty[index].x1, dirty[index].y1);
+
+		hdr -> ack_generation.store(generation, std::memory_order_release);
+	}
+
+	FILE *fh = out_file ? fopen(out_file, "wb") : stdout;
+	if (!fh)
+		error_exit("cannot create %s", out_file);
+
+	fprintf(fh, "P6\n%u %u\n255\n", hdr -> width, hdr -> height);
+
+	uint32_t *line = new uint32_t[hdr -> width];
+	uint8_t *rgb = new uint8_t[hdr -> width * 3];
+
+	for(uint32_t y=0; y<hdr -> height; y++)
+	{
+		lg1_to_rgb32(line, &shm[hdr -> fb_offset + y * hdr -> stride], hdr -> width, palette);
+
+		for(uint32_t x=0; x<hdr -> width; x++)
+		{
+			rgb[x * 3 + 0] = line[x] >> 16;
+			rgb[x * 3 + 1] = line[x] >> 8;
+			rgb[x * 3 + 2] = line[x];
+		}
+
+		if (fwrite(rgb, 1, hdr -> width * 3, fh) != hdr -> width * 3)
+			error_exit("short write");
+	}
+
+	if (out_file)
+		fclose(fh);
+
+	delete [] rgb;
+	delete [] line;
+
+	munmap(shm, st.st_size);
+
+	return 0;
+}
@@ -0,0 +1,395 @@
+#include <algorithm>
+#include <time.h>
+
+#include "error.h"
+#include "fleet.h"
+#include "log.h"
+#include "placement.h"
+#include "utils.h"
+
+static void *fleet_worker_thread(void *arg)
+{
+	fleet_worker_t *w = (fleet_worker_t *)arg;
+
+	// a core each, so that two workers never compete for one
+	place_thread(PLACE_CPU, format("fleet worker %d", w -> nr).c_str(), w -> nr);
+
+	w -> f -> work(w);
+
+	return NULL;
+}
+
+static bool later(const fleet_entry_t *a, const fleet_entry_t *b)
+{
+	return a -> wake_ns > b -> wake_ns;
+}
+
+fleet::fleet(int n_workers) : n_sleeping(0), n_active(0), stop(NULL)
+{
+	if (n_workers < 1)
+		error_exit("fleet: invalid number of workers %d", n_workers);
+
+	for(int nr=0; nr<n_workers; nr++)
+	{
+		fleet_worker_t *w = new fleet_worker_t;
+
+		w -> f = this;
+		w -> nr = nr;
+		w -> node = get_thread_node(PLACE_CPU, nr);
+		w -> n_slices = w -> n_steals = 0;
+		pthread_mutex_init(&w -> lock, NULL);
+
+		workers.push_back(w);
+	}
+
+	pthread_mutex_init(&park_lock, NULL);
+	pthread_mutex_init(&idle_lock, NULL);
+	pthread_cond_init(&idle_cond, NULL);
+}
+
+fleet::~fleet()
+{
+	for(size_t nr=0; nr<workers.size(); nr++)
+	{
+		pthread_mutex_destroy(&workers[nr] -> lock);
+		delete workers[nr];
+	}
+
+	for(size_t nr=0; nr<entries.size(); nr++)
+		delete entries[nr];
+
+	pthread_cond_destroy(&idle_cond);
+	pthread_mutex_destroy(&idle_lock);
+	pthread_mutex_destroy(&park_lock);
+}
+
+uint64_t fleet::get_ns()
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		error_exit("clock_gettime failed");
+
+	return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void fleet::add(machine *m, uint64_t max_cycles)
+{
+	fleet_entry_t *e = new fleet_entry_t;
+
+	e -> m = m;
+	e -> end_cycle = max_cycles ? m -> get_processor() -> get_cycle_count() + max_cycles : UINT64_MAX;
+	e -> wake_ns = 0;
+	e -> home = entries.size() % workers.size();
+	e -> node = get_ram_node(e -> home);
+	e -> last_worker = -1;
+	e -> n_slices = e -> n_migrations = 0;
+	e -> done = false;
+
+	// the worker sleeps for it
+	m -> get_processor() -> set_idle_yield(true);
+
+	if (e -> node != PLACE_NODE_NONE)
+		m -> bind_ram(e -> node);
+
+	entries.push_back(e);
+}
+
+void fleet::push(fleet_worker_t *w, fleet_entry_t *e)
+{
+	pthread_mutex_lock(&w -> lock);
+	w -> queue.push_back(e);
+	pthread_mutex_unlock(&w -> lock);
+
+	if (n_sleeping > 0)
+	{
+		pthread_mutex_lock(&idle_lock);
+		pthread_cond_signal(&idle_cond);
+		pthread_mutex_unlock(&idle_lock);
+	}
+}
+
+// round robin over the own queue
+fleet_entry_t * fleet::pop(fleet_worker_t *w)
+{
+	fleet_entry_t *e = NULL;
+
+	pthread_mutex_lock(&w -> lock);
+
+	if (!w -> queue.empty())
+	{
+		e = w -> queue.front();
+		w -> queue.pop_front();
+	}
+
+	pthread_mutex_unlock(&w -> lock);
+
+	return e;
+}
+
+// the victim is the worker with the longest queue, on the own node if
+// one there has work; taken from the back, where the owner would get to
+// last
+fleet_entry_t * fleet::steal(fleet_worker_t *thief)
+{
+	for(;;)
+	{
+		fleet_worker_t *victim = NULL;
+		size_t longest = 0;
+		bool victim_local = false;
+
+		for(size_t nr=0; nr<workers.size(); nr++)
+		{
+			fleet_worker_t *w = workers[nr];
+
+			// a racy peek, checked again under the lock
+			pthread_mutex_lock(&w -> lock);
+			size_t n = w -> queue.size();
+			pthread_mutex_unlock(&w -> lock);
+
+			bool local = w -> node == thief -> node;
+
+			if (w != thief && n > 0 && (local > victim_local || (local == victim_local && n > longest)))
+			{
+				victim = w;
+				longest = n;
+				victim_local = local;
+			}
+		}
+
+		if (!victim)
+			return NULL;
+
+		fleet_entry_t *e = NULL;
+
+		pthread_mutex_lock(&victim -> lock);
+
+		if (!victim -> queue.empty())
+		{
+			e = victim -> queue.back();
+			victim -> queue.pop_back();
+		}
+
+		pthread_mutex_unlock(&victim -> lock);
+
+		if (e)
+		{
+			thief -> n_steals++;
+			return e;
+		}
+	}
+}
+
+void fleet::park(fleet_entry_t *e)
+{
+	pthread_mutex_lock(&park_lock);
+	parked.push_back(e);
+	std::push_heap(parked.begin(), parked.end(), later);
+	pthread_mutex_unlock(&park_lock);
+}
+
+// a parked machine whose time has come, else when the next one is due
+fleet_entry_t * fleet::unpark(uint64_t now_ns, uint64_t *next_ns)
+{
+	fleet_entry_t *e = NULL;
+
+	pthread_mutex_lock(&park_lock);
+
+	if (!parked.empty())
+	{
+		if (parked[0] -> wake_ns <= now_ns)
+		{
+			e = parked[0];
+			std::pop_heap(parked.begin(), parked.end(), later);
+			parked.pop_back();
+		}
+		else
+		{
+			*next_ns = std::min(*next_ns, parked[0] -> wake_ns);
+		}
+	}
+
+	pthread_mutex_unlock(&park_lock);
+
+	return e;
+}
+
+void fleet::finish(fleet_entry_t *e)
+{
+	e -> done = true;
+
+	dolog("fleet: %s done at cycle %llu, %llu slices, %llu migrations", e -> m -> get_context() -> name.c_str(), e -> m -> get_processor() -> get_cycle_count(), e -> n_slices, e -> n_migrations);
+	e -> m -> log_statistics();
+
+	if (--n_active == 0)
+	{
+		pthread_mutex_lock(&idle_lock);
+		pthread_cond_broadcast(&idle_cond);
+		pthread_mutex_unlock(&idle_lock);
+	}
+}
+
+void fleet::stop_machine(machine *m)
+{
+	m -> get_context() -> terminate = true;
+
+	// parked: due now
+	pthread_mutex_lock(&park_lock);
+
+	for(fleet_entry_t *e : parked)
+	{
+		if (e -> m == m)
+		{
+			e -> wake_ns = 0;
+			std::make_heap(parked.begin(), parked.end(), later);
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&park_lock);
+
+	pthread_mutex_lock(&idle_lock);
+	pthread_cond_broadcast(&idle_cond);
+	pthread_mutex_unlock(&idle_lock);
+}
+
+void fleet::run_slice(fleet_worker_t *w, fleet_entry_t *e)
+{
+	if (e -> last_worker != -1 && e -> last_worker != w -> nr)
+		e -> n_migrations++;
+
+	e -> last_worker = w -> nr;
+	e -> n_slices++;
+	w -> n_slices++;
+
+	machine_context *ctx = e -> m -> get_context();
+	processor *p = e -> m -> get_processor();
+
+	set_machine_context(ctx);
+
+	uint64_t end = std::min(uint64_t(p -> get_cycle_count() + FLEET_SLICE_US * (CPU_CLOCK_HZ / 1000000)), e -> end_cycle);
+
+	while(p -> get_cycle_count() < end && !p -> yield_pending() && !ctx -> terminate)
+		p -> tick();
+
+	if (p -> get_cycle_count() >= e -> end_cycle || ctx -> terminate)
+	{
+		p -> take_yield_us();
+		finish(e);
+	}
+	else if (p -> yield_pending())
+	{
+		e -> wake_ns = get_ns() + p -> take_yield_us() * 1000;
+		park(e);
+	}
+	else
+	{
+		// stolen by a worker on another node: back to its RAM
+		push(e -> node != PLACE_NODE_NONE && e -> node != w -> node ? workers[e -> home] : w, e);
+	}
+
+	// the machine may already run on another worker now: no more
+	// references to it
+	set_machine_context(NULL);
+}
+
+void fleet::work(fleet_worker_t *w)
+{
+	while(!*stop && n_active > 0)
+	{
+		uint64_t next_ns = UINT64_MAX;
+
+		fleet_entry_t *e = unpark(get_ns(), &next_ns);
+
+		if (!e)
+			e = pop(w);
+
+		if (!e)
+			e = steal(w);
+
+		if (e)
+		{
+			run_slice(w, e);
+			continue;
+		}
+
+		// nothing runnable: until a machine is queued or wakes up
+		uint64_t now_ns = get_ns();
+		uint64_t wait_ns = std::min(next_ns > now_ns ? next_ns - now_ns : 0, uint64_t(FLEET_MAX_WAIT_US) * 1000);
+
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		uint64_t ns = deadline.tv_nsec + wait_ns;
+		deadline.tv_sec += ns / 1000000000;
+		deadline.tv_nsec = ns % 1000000000;
+
+		pthread_mutex_lock(&idle_lock);
+		n_sleeping++;
+		if (!*stop && n_active > 0)
+			pthread_cond_timedwait(&idle_cond, &idle_lock, &deadline);
+		n_sleeping--;
+		pthread_mutex_unlock(&idle_lock);
+	}
+}
+
+void fleet::run(const std::atomic_bool & stop_in)
+{
+	stop = &stop_in;
+	n_active = entries.size();
+
+	// spread evenly to start with, stealing takes care of the rest
+	for(size_t nr=0; nr<entries.size(); nr++)
+	{
+		if (!entries[nr] -> done)
+			workers[entries[nr] -> home] -> queue.push_back(entries[nr]);
+		else
+			n_active--;
+	}
+
+	for(size_t nr=0; nr<workers.size(); nr++)
+	{
+		if (pthread_create(&workers[nr] -> th, NULL, fleet_worker_thread, workers[nr]))
+			error_exit("fleet: cannot start worker %zu", nr);
+	}
+
+	for(size_t nr=0; nr<workers.size(); nr++)
+		pthread_join(workers[nr] -> th, NULL);
+
+	// after a stop: whatever is still queued or parked
+	for(size_t nr=0; nr<workers.size(); nr++)
+		workers[nr] -> queue.clear();
+
+	parked.clear();
+
+	dolog("fleet: %llu slices, %llu steals, %llu migrations", get_n_slices(), get_n_steals(), get_n_migrations());
+}
+
+uint64_t fleet::get_n_slices() const
+{
+	uint64_t n = 0;
+
+	for(size_t nr=0; nr<workers.size(); nr++)
+		n += workers[nr] -> n_slices;
+
+	return n;
+}
+
+uint64_t fleet::get_n_steals() const
+{
+	uint64_t n = 0;
+
+	for(size_t nr=0; nr<workers.size(); nr++)
+		n += workers[nr] -> n_steals;
+
+	return n;
+}
+
+uint64_t fleet::get_n_migrations() const
+{
+	uint64_t n = 0;
+
+	for(size_t nr=0; nr<entries.size(); nr++)
+		n += entries[nr] -> n_migrations;
+
+	return n;
+}
@@ -0,0 +1,110 @@
+#ifndef __FLEET__H__
+#define __FLEET__H__
+
+#include <atomic>
+#include <deque>
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+
+#include "machine.h"
+
+#define FLEET_SLICE_US		10000	// guest time a machine runs before it is queued again
+#define FLEET_MAX_WAIT_US	10000	// a worker without work looks again after this
+
+typedef struct
+{
+	machine *m;
+	uint64_t end_cycle;	// UINT64_MAX: runs until stopped
+	uint64_t wake_ns;	// parked: the guest is idle until then
+
+	int home;	// worker on the node of the guest RAM
+	int node;	// of the guest RAM, PLACE_NODE_NONE: not bound
+	int last_worker;	// -1: did not run yet
+	uint64_t n_slices, n_migrations;
+	bool done;
+} fleet_entry_t;
+
+class fleet;
+
+typedef struct
+{
+	fleet *f;
+	int nr;
+	int node;	// of its core, -1: not pinned
+	pthread_t th;
+
+	pthread_mutex_t lock;
+	std::deque<fleet_entry_t *> queue;
+
+	uint64_t n_slices, n_steals;
+} fleet_worker_t;
+
+// Runs many machines in one process on a pool of worker threads. A
+// machine runs for a slice of FLEET_SLICE_US guest time, then goes to the
+// back of the queue of the worker that ran it; a worker whose queue is
+// empty steals from the back of another one. A machine can so only move
+// to another worker between two slices, and there is no lock on the
+// machine itself: it is in at most one queue or running on one worker.
+//
+// Instead of sleeping in an idle loop, a machine is parked until the time
+// it would have slept has passed, and the worker goes on with the next
+// one. The thread that runs a slice makes the context of the machine its
+// current one, so logging goes to that machine.
+//
+// The guest RAM of a machine is bound to the NUMA node of the core of
+// the worker that it is added to (its home, see get_ram_node()). A thief
+// prefers a victim on its own node, and a machine that ran on another
+// node goes back to the queue of its home worker after the slice, so a
+// machine runs away from its RAM for one slice at a time at most.
+//
+// stop_machine() ends one machine while the others run on: it sets the
+// terminate flag of its context, which ends a running slice, and a
+// parked machine is woken up for it.
+class fleet
+{
+private:
+	std::vector<fleet_worker_t *> workers;
+	std::vector<fleet_entry_t *> entries;
+
+	pthread_mutex_t park_lock;
+	std::vector<fleet_entry_t *> parked;	// min-heap on wake_ns
+
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle_cond;
+	std::atomic_int n_sleeping, n_active;
+
+	const std::atomic_bool *stop;
+
+	static uint64_t get_ns();
+
+	void push(fleet_worker_t *w, fleet_entry_t *e);
+	fleet_entry_t * pop(fleet_worker_t *w);
+	fleet_entry_t * steal(fleet_worker_t *thief);
+	void park(fleet_entry_t *e);
+	fleet_entry_t * unpark(uint64_t now_ns, uint64_t *next_ns);
+	void finish(fleet_entry_t *e);
+	void run_slice(fleet_worker_t *w, fleet_entry_t *e);
+
+public:
+	fleet(int n_workers);
+	~fleet();
+
+	// max_cycles 0: until stopped
+	void add(machine *m, uint64_t max_cycles);
+
+	// returns when all machines are done or stop is set
+	void run(const std::atomic_bool & stop_in);
+
+	// any thread: m finishes at the end of its current slice
+	void stop_machine(machine *m);
+
+	// the thread of a worker
+	void work(fleet_worker_t *w);
+
+	uint64_t get_n_slices() const;
+	uint64_t get_n_steals() const;
+	uint64_t get_n_migrations() const;
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "error.h"
+#include "fork_server.h"
+#include "log.h"
+#include "utils.h"
+
+fork_server::fork_server(std::string path_in, std::string condition) : path(path_in), listen_fd(-1), boot(BOOT_NONE), boot_value(0), matched(0), serial_reached(false), n_jobs(0)
+{
+	if (condition.substr(0, 7) == "cycles:")
+	{
+		boot = BOOT_CYCLES;
+		boot_value = strtoull(condition.substr(7).c_str(), NULL, 10);
+	}
+	else if (condition.substr(0, 3) == "pc:")
+	{
+		boot = BOOT_PC;
+		boot_value = strtoull(condition.substr(3).c_str(), NULL, 16);
+	}
+	else if (condition.substr(0, 7) == "serial:" && condition.size() > 7)
+	{
+		boot = BOOT_SERIAL;
+		boot_text = condition.substr(7);
+	}
+	else if (!condition.empty())
+	{
+		error_exit("fork_server: boot condition \"%s\" is not understood, use cycles:<n>, pc:<hex> or serial:<text>", condition.c_str());
+	}
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd == -1)
+		error_exit("fork_server: cannot create socket");
+
+	struct sockaddr_un addr;
+	memset(&addr, 0x00, sizeof addr);
+	addr.sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof addr.sun_path)
+		error_exit("fork_server: path %s too long", path.c_str());
+
+	strcpy(addr.sun_path, path.c_str());
+
+	unlink(path.c_str());
+
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof addr) == -1)
+		error_exit("fork_server: cannot bind to %s", path.c_str());
+
+	if (listen(listen_fd, SOMAXCONN) == -1)
+		error_exit("fork_server: listen failed");
+}
+
+fork_server::~fork_server()
+{
+	close(listen_fd);
+}
+
+// a plain prefix match: enough for the banners that boot conditions use
+void fork_server::serial_tx(void *ctx, uint8_t c)
+{
+	fork_server *fs = (fork_server *)ctx;
+
+	if (fs -> serial_reached)
+		return;
+
+	if (c == uint8_t(fs -> boot_text[fs -> matched]))
+		fs -> matched++;
+	else
+		fs -> matched = c == uint8_t(fs -> boot_text[0]) ? 1 : 0;
+
+	if (fs -> matched == fs -> boot_text.size())
+		fs -> serial_reached = true;
+}
+
+// reads the request from a new connection and forks the job; returns
+// true in the job
+bool fork_server::start_job(int fd, int *console_fd, uint64_t *max_cycles)
+{
+	char request[FORK_SERVER_MAX_REQUEST + 1];
+	char control[CMSG_SPACE(sizeof(int))];
+
+	struct iovec iov = { request, FORK_SERVER_MAX_REQUEST };
+
+	struct msghdr msg;
+	memset(&msg, 0x00, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof control;
+
+	ssize_t n = recvmsg(fd, &msg, 0);
+	if (n <= 0)
+		return false;
+
+	request[n] = 0x00;
+
+	int job_fd = -1;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg -> cmsg_level == SOL_SOCKET && cmsg -> cmsg_type == SCM_RIGHTS)
+		memcpy(&job_fd, CMSG_DATA(cmsg), sizeof job_fd);
+
+	if (job_fd == -1)
+	{
+		dolog("fork_server: request without a console descriptor");
+		return false;
+	}
+
+	uint64_t cycles = 0;
+	if (strncmp(request, "cycles ", 7) == 0)
+		cycles = strtoull(&request[7], NULL, 10);
+
+	pid_t pid = fork();
+
+	if (pid == -1)
+	{
+		dolog("fork_server: fork failed: %s", strerror(errno));
+		close(job_fd);
+		return false;
+	}
+
+	if (pid == 0)
+	{
+		close(listen_fd);
+		close(fd);
+
+		*console_fd = job_fd;
+		*max_cycles = cycles;
+
+		return true;
+	}
+
+	close(job_fd);
+
+	n_jobs++;
+
+	std::string reply = format("%d\n", pid);
+	(void)write(fd, reply.c_str(), reply.size());
+
+	return false;
+}
+
+bool fork_server::serve(const std::atomic_bool & stop, int *console_fd, uint64_t *max_cycles)
+{
+	dolog("fork_server: ready on %s", path.c_str());
+
+	while(!stop)
+	{
+		// finished jobs
+		while(waitpid(-1, NULL, WNOHANG) > 0)
+		{
+		}
+
+		struct pollfd pfd = { listen_fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 1000) <= 0)
+			continue;
+
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd == -1)
+			continue;
+
+		bool job = start_job(fd, console_fd, max_cycles);
+
+		if (job)
+			return true;
+
+		close(fd);
+	}
+
+	dolog("fork_server: %llu jobs started", n_jobs);
+
+	unlink(path.c_str());
+
+	return false;
+}
@@ -0,0 +1,70 @@
+#ifndef __FORK_SERVER__H__
+#define __FORK_SERVER__H__
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+#include "processor.h"
+
+#define FORK_SERVER_MAX_REQUEST	256
+
+// Boots a machine once and then starts jobs from it by forking: each
+// child continues from the booted state with the guest RAM shared
+// copy-on-write with the server.
+//
+// The machine runs until the boot condition is met:
+//	cycles:<n>	the cycle count reaches n
+//	pc:<hex>	the PC is at an address
+//	serial:<text>	serial channel 1 printed a text
+// Then the server accepts connections on a unix socket. A client sends
+// one message with a connected descriptor (SCM_RIGHTS) that becomes the
+// serial console of the job; the text of the message may be
+// "cycles <n>" to end the job after n cycles. The server answers with
+// the process id of the job and closes the connection.
+class fork_server
+{
+private:
+	std::string path;
+	int listen_fd;
+
+	enum { BOOT_NONE, BOOT_CYCLES, BOOT_PC, BOOT_SERIAL } boot;
+	uint64_t boot_value;
+	std::string boot_text;
+	size_t matched;	// length of the boot_text prefix seen last
+	bool serial_reached;
+
+	uint64_t n_jobs;
+
+	bool start_job(int fd, int *console_fd, uint64_t *max_cycles);
+
+public:
+	fork_server(std::string path_in, std::string condition);
+	~fork_server();
+
+	// checked after each instruction while booting
+	inline bool reached(const processor *p) const
+	{
+		switch(boot)
+		{
+			case BOOT_CYCLES:
+				return uint64_t(p -> get_cycle_count()) >= boot_value;
+			case BOOT_PC:
+				return p -> get_PC() == boot_value;
+			case BOOT_SERIAL:
+				return serial_reached;
+			default:
+				return true;
+		}
+	}
+
+	// z85c30 transmit callback of serial channel 1
+	static void serial_tx(void *ctx, uint8_t c);
+
+	// accepts requests until `stop' is set, then returns false; returns
+	// true in each forked job, with the console descriptor and a cycle
+	// limit (0: none) for it
+	bool serve(const std::atomic_bool & stop, int *console_fd, uint64_t *max_cycles);
+};
+
+#endif
@@ -1,9 +1,677 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <new>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "debug.h"
+#include "error.h"
 #include "graphics_lg1.h"
+#include "lg1_kernels.h"
+#include "placement.h"
+#include "utils.h"
+
+// LG1 ("light" graphics, REX chip): 1024x768, 8 bit color index per pixel,
+// palette in the DAC. The drawing engine fills spans and rectangles (solid
+// or with a 32 bit pattern), copies rectangles and moves pixels from/to the
+// host through HOSTRW.
+
+static uint64_t rect_area(const lg1_rect_t & r)
+{
+	return uint64_t(r.x1 - r.x0 + 1) * (r.y1 - r.y0 + 1);
+}
+
+// appends r to the list; it is merged with the entries before it as long
+// as their bounding box is not larger than the two areas together, so
+// consecutive spans and pixels end up as one rectangle
+static void add_dirty(lg1_rect_t *list, uint32_t *n, lg1_rect_t r)
+{
+	if (*n == LG1_SHM_ALL_DIRTY)
+		return;
+
+	while(*n > 0)
+	{
+		const lg1_rect_t & last = list[*n - 1];
+
+		lg1_rect_t bbox = { std::min(last.x0, r.x0), std::min(last.y0, r.y0), std::max(last.x1, r.x1), std::max(last.y1, r.y1) };
+
+		if (rect_area(bbox) > rect_area(last) + rect_area(r))
+			break;
+
+		r = bbox;
+		(*n)--;
+	}
+
+	if (*n == LG1_SHM_MAX_DIRTY)
+		*n = LG1_SHM_ALL_DIRTY;
+	else
+		list[(*n)++] = r;
+}
+
+static void *lg1_render_thread(void *arg)
+{
+	place_thread(PLACE_RENDER, "lg1 render");
+
+	((graphics_lg1 *)arg) -> render_thread();
+
+	return NULL;
+}
 
-graphics_lg1::graphics_lg1() : memory(1024 * 768, true)
+graphics_lg1::graphics_lg1(debug_console *pdc_in, std::string shm_name_in) : pdc(pdc_in), fifo(LG1_FIFO_SIZE), stop_flag(false), done_cb(NULL), done_ctx(NULL), deterministic(false), n_submitted(0), n_completed(0), fifo_high_water(0), n_fifo_stalls(0), busy_us(0), shm_name(shm_name_in), n_pixels(0)
 {
+	size_t fb_offset = (sizeof(lg1_shm_header_t) + getpagesize() - 1) & ~size_t(getpagesize() - 1);
+	shm_size = fb_offset + LG1_WIDTH * LG1_HEIGHT;
+
+	void *p = NULL;
+
+	if (shm_name.empty())
+		p = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	else
+	{
+		if (shm_name[0] != '/')
+			shm_name = "/" + shm_name;
+
+		int fd = shm_open(shm_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd == -1)
+			error_exit("graphics_lg1: cannot create shared memory %s", shm_name.c_str());
+
+		if (ftruncate(fd, shm_size) == -1)
+			error_exit("graphics_lg1: cannot resize shared memory %s", shm_name.c_str());
+
+		p = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+		close(fd);
+	}
+
+	if (p == MAP_FAILED)
+		error_exit("graphics_lg1: cannot map framebuffer");
+
+	// both kinds of mapping start out zeroed
+	shm = (uint8_t *)p;
+	hdr = new (shm) lg1_shm_header_t;
+	hdr -> magic = LG1_SHM_MAGIC;
+	hdr -> version = LG1_SHM_VERSION;
+	hdr -> width = LG1_WIDTH;
+	hdr -> height = LG1_HEIGHT;
+	hdr -> stride = LG1_WIDTH;
+	hdr -> fb_offset = fb_offset;
+	hdr -> generation = 0;
+	hdr -> ack_generation = 0;
+	hdr -> n_dirty = LG1_SHM_ALL_DIRTY;
+
+	fb = &shm[fb_offset];
+
+	// grey ramp until the PROM loads the DAC
+	for(int index=0; index<256; index++)
+		palette[index] = index * 0x010101;
+
+	memcpy(hdr -> palette, palette, sizeof palette);
+
+	n_pending = 0;
+	palette_changed = false;
+
+	command = aux1 = colorredi = colorback = zpattern = 0;
+	wrmask = 0xff;
+	xstart = ystart = xend = yend = xmove = ymove = 0;
+	xoffset = yoffset = 0;
+	x = y = 0;
+
+	cfgsel = 0;
+	dac_addr = dac_component = 0;
+	memset(dac_rgb, 0x00, sizeof dac_rgb);
+
+	pthread_mutex_init(&wake_lock, NULL);
+	pthread_cond_init(&wake_cond, NULL);
+
+	start_ts = get_ts();
+
+	if (pthread_create(&th, NULL, lg1_render_thread, this))
+		error_exit("graphics_lg1: cannot start render thread");
 }
 
 graphics_lg1::~graphics_lg1()
 {
+	stop_flag = true;
+
+	pthread_mutex_lock(&wake_lock);
+	pthread_cond_signal(&wake_cond);
+	pthread_mutex_unlock(&wake_lock);
+
+	pthread_join(th, NULL);
+
+	pthread_cond_destroy(&wake_cond);
+	pthread_mutex_destroy(&wake_lock);
+
+	munmap(shm, shm_size);
+
+	if (!shm_name.empty())
+		shm_unlink(shm_name.c_str());
+}
+
+void graphics_lg1::after_fork()
+{
+	if (!shm_name.empty())
+	{
+		void *p = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			error_exit("graphics_lg1: cannot map framebuffer");
+
+		memcpy(p, shm, shm_size);
+		munmap(shm, shm_size);
+
+		shm = (uint8_t *)p;
+		hdr = (lg1_shm_header_t *)shm;
+		fb = &shm[hdr -> fb_offset];
+
+		shm_name.clear();
+	}
+
+	// the locks may have been held by the render thread of the parent
+	pthread_mutex_init(&wake_lock, NULL);
+	pthread_cond_init(&wake_cond, NULL);
+
+	if (pthread_create(&th, NULL, lg1_render_thread, this))
+		error_exit("graphics_lg1: cannot start render thread");
+}
+
+void graphics_lg1::render_thread()
+{
+	for(;;)
+	{
+		pthread_mutex_lock(&wake_lock);
+		while(fifo.empty() && !stop_flag)
+			pthread_cond_wait(&wake_cond, &wake_lock);
+		pthread_mutex_unlock(&wake_lock);
+
+		if (fifo.empty())	// stop_flag
+			break;
+
+		double busy_start = get_ts();
+
+		// drain the FIFO completely before sleeping again
+		lg1_command_t *cmd = NULL;
+		while((cmd = fifo.peek()) != NULL)
+		{
+			set_register(cmd -> reg, cmd -> data);
+
+			if (cmd -> go)
+				execute();
+
+			fifo.consume();
+
+			// before the completion is visible so that a sync()
+			// also covers the shared memory header
+			if (fifo.empty())
+				publish();
+
+			n_completed.store(n_completed.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		if (done_cb)
+			done_cb(done_ctx);
+
+		busy_us += uint64_t((get_ts() - busy_start) * 1000000.0);
+	}
+}
+
+void graphics_lg1::mark_dirty(int x0, int y0, int x1, int y1)
+{
+	lg1_rect_t r = { uint16_t(x0), uint16_t(y0), uint16_t(x1), uint16_t(y1) };
+
+	add_dirty(pending, &n_pending, r);
+}
+
+// render thread: make what was drawn since the previous call visible in
+// the shared memory header
+void graphics_lg1::publish()
+{
+	if (n_pending == 0 && !palette_changed)
+		return;
+
+	// with another palette every pixel looks different
+	if (palette_changed)
+		n_pending = LG1_SHM_ALL_DIRTY;
+
+	uint64_t generation = hdr -> generation.load(std::memory_order_relaxed);
+	bool acked = hdr -> ack_generation.load(std::memory_order_acquire) == generation;
+
+	hdr -> generation.store(generation + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	// the reader has seen the current list: start a new one
+	if (acked)
+		hdr -> n_dirty = 0;
+
+	if (n_pending == LG1_SHM_ALL_DIRTY)
+		hdr -> n_dirty = LG1_SHM_ALL_DIRTY;
+	else
+	{
+		for(uint32_t index=0; index<n_pending; index++)
+			add_dirty(hdr -> dirty, &hdr -> n_dirty, pending[index]);
+	}
+
+	if (palette_changed)
+		memcpy(hdr -> palette, palette, sizeof palette);
+
+	hdr -> generation.store(generation + 2, std::memory_order_release);
+
+	n_pending = 0;
+	palette_changed = false;
+}
+
+void graphics_lg1::submit(uint32_t reg, uint32_t data, bool go)
+{
+	lg1_command_t cmd = { reg, data, go };
+
+	if (!fifo.push(cmd))
+	{
+		// the guest is drawing faster than the render thread can keep up:
+		// stall like a CPU waiting on a full graphics FIFO
+		n_fifo_stalls++;
+
+		while(!fifo.push(cmd))
+			sched_yield();
+	}
+
+	n_submitted++;
+
+	size_t depth = fifo.size();
+	if (depth > fifo_high_water)
+		fifo_high_water = depth;
+
+	// only an empty FIFO can have a sleeping render thread
+	if (depth <= 1)
+	{
+		pthread_mutex_lock(&wake_lock);
+		pthread_cond_signal(&wake_cond);
+		pthread_mutex_unlock(&wake_lock);
+	}
+}
+
+void graphics_lg1::sync()
+{
+	while(n_completed.load(std::memory_order_acquire) != n_submitted)
+		sched_yield();
+}
+
+double graphics_lg1::get_render_utilisation() const
+{
+	double took = get_ts() - start_ts;
+
+	return took > 0 ? busy_us / 1000000.0 / took : 0.0;
+}
+
+void graphics_lg1::to_rgb32(uint32_t *out) const
+{
+	lg1_to_rgb32(out, fb, LG1_WIDTH * LG1_HEIGHT, palette);
+}
+
+void graphics_lg1::draw_span(int yd, int x0, int x1)
+{
+	if (x0 > x1)
+	{
+		int dummy = x0;
+		x0 = x1;
+		x1 = dummy;
+	}
+
+	int phase_origin = x0 + xoffset;
+
+	yd += yoffset;
+	x0 += xoffset;
+	x1 += xoffset;
+
+	if (yd < 0 || yd >= LG1_HEIGHT)
+		return;
+
+	if (x0 < 0)
+		x0 = 0;
+	if (x1 >= LG1_WIDTH)
+		x1 = LG1_WIDTH - 1;
+	if (x0 > x1)
+		return;
+
+	size_t n = x1 - x0 + 1;
+	uint8_t *dst = &fb[yd * LG1_WIDTH + x0];
+	uint8_t logic_op = command >> LG1_CMD_LOGICOP_SHIFT;
+
+	if (command & LG1_CMD_ENZPATTERN)
+		lg1_pattern_fill(dst, n, zpattern, (x0 - phase_origin) & 31, colorredi, colorback, command & LG1_CMD_OPAQUE, wrmask, logic_op);
+	else
+		lg1_fill(dst, n, colorredi, wrmask, logic_op);
+
+	mark_dirty(x0, yd, x1, yd);
+
+	n_pixels += n;
+}
+
+void graphics_lg1::copy_block()
+{
+	int x0 = std::min(xstart, xend) + xoffset, x1 = std::max(xstart, xend) + xoffset;
+	int y0 = std::min(ystart, yend) + yoffset, y1 = std::max(ystart, yend) + yoffset;
+
+	// clip so that both source and destination are on screen
+	x0 = std::max(x0, std::max(0, -xmove));
+	x1 = std::min(x1, std::min(LG1_WIDTH - 1, LG1_WIDTH - 1 - xmove));
+	y0 = std::max(y0, std::max(0, -ymove));
+	y1 = std::min(y1, std::min(LG1_HEIGHT - 1, LG1_HEIGHT - 1 - ymove));
+
+	if (x0 > x1 || y0 > y1)
+		return;
+
+	size_t n = x1 - x0 + 1;
+	uint8_t logic_op = command >> LG1_CMD_LOGICOP_SHIFT;
+
+	// when moving down, start at the bottom so that no source line is
+	// overwritten before it is copied (within a line lg1_copy handles it)
+	int step = ymove > 0 ? -1 : 1;
+	int first = ymove > 0 ? y1 : y0, last = ymove > 0 ? y0 : y1;
+
+	for(int ys=first;; ys += step)
+	{
+		lg1_copy(&fb[(ys + ymove) * LG1_WIDTH + x0 + xmove], &fb[ys * LG1_WIDTH + x0], n, wrmask, logic_op);
+
+		if (ys == last)
+			break;
+	}
+
+	mark_dirty(x0 + xmove, y0 + ymove, x1 + xmove, y1 + ymove);
+
+	n_pixels += n * (y1 - y0 + 1);
+}
+
+void graphics_lg1::execute()
+{
+	uint32_t op = command & LG1_OP_MASK;
+
+	DEBUG(pdc -> dc_log("LG1 execute %08x (%d,%d)-(%d,%d)", command, xstart, ystart, xend, yend));
+
+	if (op == LG1_OP_DRAW)
+	{
+		if (command & LG1_CMD_BLOCK)
+		{
+			int y0 = std::min(ystart, yend), y1 = std::max(ystart, yend);
+
+			for(int yd=y0; yd<=y1; yd++)
+				draw_span(yd, xstart, xend);
+		}
+		else
+		{
+			draw_span(ystart, xstart, xend);
+
+			// a series of go's draws consecutive lines
+			ystart++;
+		}
+	}
+	else if (op == LG1_OP_SCR2SCR)
+	{
+		copy_block();
+	}
+
+	x = xstart;
+	y = ystart;
+}
+
+void graphics_lg1::host_write(uint32_t data)
+{
+	int n = command & LG1_CMD_QUADMODE ? 4 : 1;
+	uint8_t logic_op = command >> LG1_CMD_LOGICOP_SHIFT;
+
+	for(int index=0; index<n; index++)
+	{
+		uint8_t pixel = data >> ((n - 1 - index) * 8);
+		int xd = x + xoffset, yd = y + yoffset;
+
+		if (xd >= 0 && xd < LG1_WIDTH && yd >= 0 && yd < LG1_HEIGHT)
+		{
+			lg1_fill_scalar(&fb[yd * LG1_WIDTH + xd], 1, pixel, wrmask, logic_op);
+			mark_dirty(xd, yd, xd, yd);
+			n_pixels++;
+		}
+
+		if (++x > xend)
+		{
+			x = xstart;
+			y++;
+		}
+	}
+}
+
+uint32_t graphics_lg1::host_read()
+{
+	int n = command & LG1_CMD_QUADMODE ? 4 : 1;
+	uint32_t data = 0;
+
+	for(int index=0; index<n; index++)
+	{
+		int xd = x + xoffset, yd = y + yoffset;
+
+		data <<= 8;
+
+		if (xd >= 0 && xd < LG1_WIDTH && yd >= 0 && yd < LG1_HEIGHT)
+			data |= fb[yd * LG1_WIDTH + xd];
+
+		if (++x > xend)
+		{
+			x = xstart;
+			y++;
+		}
+	}
+
+	return data;
+}
+
+void graphics_lg1::set_register(uint32_t reg, uint32_t data)
+{
+	switch(reg)
+	{
+		case LG1_COMMAND:
+			command = data;
+			break;
+		case LG1_AUX1:
+			aux1 = data;
+			break;
+		case LG1_XSTART:
+			xstart = x = (int16_t)data;
+			break;
+		case LG1_YSTART:
+			ystart = y = (int16_t)data;
+			break;
+		case LG1_XYMOVE:
+			xmove = (int16_t)(data >> 16);
+			ymove = (int16_t)data;
+			break;
+		case LG1_COLORREDI:
+			colorredi = data & 0xff;
+			break;
+		case LG1_COLORBACK:
+			colorback = data & 0xff;
+			break;
+		case LG1_ZPATTERN:
+			zpattern = data;
+			break;
+		case LG1_XENDI:
+			xend = (int16_t)data;
+			break;
+		case LG1_YENDI:
+			yend = (int16_t)data;
+			break;
+		case LG1_WRMASK:
+			wrmask = data & 0xff;
+			break;
+		case LG1_HOSTRW:
+			if ((command & LG1_OP_MASK) == LG1_OP_DRAW)
+				host_write(data);
+			break;
+
+		case LG1_WCLOCKREV:
+			break;
+		case LG1_CFGSEL:
+			cfgsel = data;
+			break;
+		case LG1_CFGDATA:
+			if (cfgsel == LG1_CFG_DAC_ADDR)
+			{
+				dac_addr = data;
+				dac_component = 0;
+			}
+			else if (cfgsel == LG1_CFG_DAC_PALETTE)
+			{
+				dac_rgb[dac_component++] = data;
+
+				if (dac_component == 3)
+				{
+					palette[dac_addr++] = (dac_rgb[0] << 16) | (dac_rgb[1] << 8) | dac_rgb[2];
+					dac_component = 0;
+					palette_changed = true;
+				}
+			}
+			break;
+		case LG1_XYOFFSET:
+			xoffset = (int16_t)(data >> 16);
+			yoffset = (int16_t)data;
+			break;
+
+		default:
+			pdc -> dc_log("LG1 write to %04x (%08x) not implemented", reg, data);
+			break;
+	}
+}
+
+uint32_t graphics_lg1::get_register(uint32_t reg)
+{
+	switch(reg)
+	{
+		case LG1_COMMAND:	return command;
+		case LG1_AUX1:		return aux1;
+		case LG1_XSTART:	return xstart & 0xffff;
+		case LG1_YSTART:	return ystart & 0xffff;
+		case LG1_XYMOVE:	return ((xmove & 0xffff) << 16) | (ymove & 0xffff);
+		case LG1_COLORREDI:	return colorredi;
+		case LG1_COLORBACK:	return colorback;
+		case LG1_ZPATTERN:	return zpattern;
+		case LG1_XENDI:		return xend & 0xffff;
+		case LG1_YENDI:		return yend & 0xffff;
+		case LG1_WRMASK:	return wrmask;
+		case LG1_HOSTRW:
+			if ((command & LG1_OP_MASK) == LG1_OP_READ)
+				return host_read();
+			return 0;
+
+		case LG1_WCLOCKREV:	return 0x01;	// board revision
+		case LG1_CFGSEL:	return cfgsel;
+		case LG1_CFGDATA:
+			if (cfgsel == LG1_CFG_DAC_ADDR)
+				return dac_addr;
+			if (cfgsel == LG1_CFG_DAC_PALETTE)
+			{
+				uint8_t value = palette[dac_addr] >> (16 - dac_component * 8);
+
+				if (++dac_component == 3)
+				{
+					dac_addr++;
+					dac_component = 0;
+				}
+
+				return value;
+			}
+			return 0;
+		case LG1_XYOFFSET:	return ((xoffset & 0xffff) << 16) | (yoffset & 0xffff);
+	}
+
+	pdc -> dc_log("LG1 read from %04x not implemented", reg);
+
+	return 0;
+}
+
+void graphics_lg1::read_32b(uint64_t offset, uint32_t *data)
+{
+	offset &= get_mask();
+
+	// page 0 is mirrored at + LG1_GO, reading never starts a command
+	if (offset < 0x1000)
+		offset &= ~LG1_GO;
+
+	if (offset == LG1_CFGMODE)
+	{
+		// polled by drivers while waiting for the engine: report the
+		// state without waiting for the render thread
+		if (deterministic)
+			sync();
+
+		uint64_t depth = n_submitted - n_completed.load(std::memory_order_acquire);
+
+		*data = (depth ? LG1_CFGMODE_BUSY : 0) | (std::min(depth, uint64_t(0xffff)) << LG1_CFGMODE_DEPTH_SHIFT);
+	}
+	else
+	{
+		sync();
+
+		*data = get_register(offset);
+	}
+
+	DEBUG(pdc -> dc_log("LG1 read %04llx: %08x", offset, *data));
+}
+
+void graphics_lg1::write_32b(uint64_t offset, uint32_t data)
+{
+	offset &= get_mask();
+
+	DEBUG(pdc -> dc_log("LG1 write %04llx: %08x", offset, data));
+
+	bool go = offset < 0x1000 && (offset & LG1_GO);
+
+	if (offset < 0x1000)
+		offset &= ~LG1_GO;
+
+	submit(offset, data, go && offset != LG1_HOSTRW);
+}
+
+void graphics_lg1::read_64b(uint64_t offset, uint64_t *data)
+{
+	uint32_t hi = 0, lo = 0;
+
+	read_32b(offset, &hi);
+	read_32b(offset + 4, &lo);
+
+	*data = (uint64_t(hi) << 32) | lo;
+}
+
+void graphics_lg1::read_16b(uint64_t offset, uint16_t *data)
+{
+	uint32_t temp = 0;
+
+	read_32b(offset & ~3, &temp);
+
+	*data = temp >> ((2 - (offset & 2)) * 8);
+}
+
+void graphics_lg1::read_8b(uint64_t offset, uint8_t *data)
+{
+	uint32_t temp = 0;
+
+	read_32b(offset & ~3, &temp);
+
+	*data = temp >> ((3 - (offset & 3)) * 8);
+}
+
+void graphics_lg1::write_64b(uint64_t offset, uint64_t data)
+{
+	write_32b(offset, data >> 32);
+	write_32b(offset + 4, data);
+}
+
+// the drawing engine only has 32 bit registers, narrower writes are
+// taken as a write of the whole register
+void graphics_lg1::write_16b(uint64_t offset, uint16_t data)
+{
+	write_32b(offset & ~3, data);
+}
+
+void graphics_lg1::write_8b(uint64_t offset, uint8_t data)
+{
+	write_32b(offset & ~3, data);
 }
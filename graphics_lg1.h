@@ -1,8 +1,186 @@
+#ifndef __GRAPHICS_LG1__H__
+#define __GRAPHICS_LG1__H__
+
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+#include "debug_console.h"
+#include "lg1_shm.h"
 #include "memory.h"
+#include "ring_buffer.h"
+
+#define LG1_WIDTH	1024
+#define LG1_HEIGHT	768
+
+// the REX registers are mirrored: a write to the "go" copy (SET + 0x800)
+// also starts the command that is in COMMAND
+#define LG1_GO		0x0800
+
+// page 0: drawing engine
+#define LG1_COMMAND	0x0000
+#define LG1_AUX1	0x0004
+#define LG1_XSTART	0x000c
+#define LG1_YSTART	0x001c
+#define LG1_XYMOVE	0x0034	// x << 16 | y, signed, for screen to screen copies
+#define LG1_COLORREDI	0x0038
+#define LG1_COLORBACK	0x0058
+#define LG1_ZPATTERN	0x005c
+#define LG1_XENDI	0x0060
+#define LG1_YENDI	0x0064
+#define LG1_WRMASK	0x0068
+#define LG1_HOSTRW	0x0070	// 4 pixels per word, msb first
+
+// page 1: configuration
+#define LG1_WCLOCKREV	0x4790
+#define LG1_CFGSEL	0x47a0	// selects what CFGDATA accesses (LG1_CFG_*)
+#define LG1_CFGDATA	0x47a4
+#define LG1_CFGMODE	0x47a8	// status, see LG1_CFGMODE_*
+#define LG1_XYOFFSET	0x47ac
+
+#define LG1_CFGMODE_BUSY	0x01	// commands queued or executing
+#define LG1_CFGMODE_DEPTH_SHIFT	16	// bits 16-31: number of commands in the FIFO
+
+#define LG1_CFG_DAC_ADDR	0
+#define LG1_CFG_DAC_PALETTE	1	// r, g, b writes per entry, auto increment
+
+// COMMAND
+#define LG1_OP_MASK	0x03
+#define LG1_OP_NOP	0x00
+#define LG1_OP_DRAW	0x01
+#define LG1_OP_READ	0x02
+#define LG1_OP_SCR2SCR	0x03
+#define LG1_CMD_BLOCK		(1 << 3)	// rectangle instead of one span
+#define LG1_CMD_QUADMODE	(1 << 5)	// HOSTRW transfers 4 pixels
+#define LG1_CMD_ENZPATTERN	(1 << 7)
+#define LG1_CMD_OPAQUE		(1 << 8)	// draw clear pattern bits in COLORBACK
+#define LG1_CMD_LOGICOP_SHIFT	28
+
+#define LG1_FIFO_SIZE	1024	// commands, power of 2
 
+typedef struct
+{
+	uint32_t reg, data;
+	bool go;
+} lg1_command_t;
+
+// Register writes are queued in a FIFO and executed by a render thread so
+// that drawing does not stall the emulated CPU. The only read that does
+// not wait for the FIFO to drain is the CFGMODE status register.
 class graphics_lg1 : public memory
 {
+private:
+	debug_console *pdc;
+
+	ring_buffer<lg1_command_t> fifo;
+	pthread_t th;
+	std::atomic_bool stop_flag;
+
+	// called by the render thread when the FIFO is empty again, so that a
+	// guest that idles while polling the busy status continues
+	void (*done_cb)(void *ctx);
+	void *done_ctx;
+	bool deterministic;
+
+	pthread_mutex_t wake_lock;
+	pthread_cond_t wake_cond;
+
+	uint64_t n_submitted;	// CPU thread only
+	std::atomic<uint64_t> n_completed;
+
+	// metrics
+	size_t fifo_high_water;
+	uint64_t n_fifo_stalls;
+	std::atomic<uint64_t> busy_us;
+	double start_ts;
+
+	// the framebuffer lives in a (shared) mapping behind the header
+	std::string shm_name;
+	uint8_t *shm;
+	size_t shm_size;
+	lg1_shm_header_t *hdr;
+
+	uint8_t *fb;
+	uint32_t palette[256];
+
+	// drawn since the last publish()
+	lg1_rect_t pending[LG1_SHM_MAX_DIRTY];
+	uint32_t n_pending;
+	bool palette_changed;
+
+	uint32_t command, aux1, colorredi, colorback, zpattern, wrmask;
+	int xstart, ystart, xend, yend, xmove, ymove;
+	int xoffset, yoffset;
+	int x, y;	// current position for HOSTRW
+
+	uint32_t cfgsel;
+	uint8_t dac_addr, dac_component, dac_rgb[3];
+
+	std::atomic<uint64_t> n_pixels;
+
+	void submit(uint32_t reg, uint32_t data, bool go);
+
+	void mark_dirty(int x0, int y0, int x1, int y1);
+	void publish();
+
+	void set_register(uint32_t reg, uint32_t data);
+	uint32_t get_register(uint32_t reg);
+
+	void execute();
+	void draw_span(int y, int x0, int x1);
+	void copy_block();
+	void host_write(uint32_t data);
+	uint32_t host_read();
+
 public:
-	graphics_lg1();
+	// shm_name_in: name of the POSIX shared memory segment to draw in,
+	// empty for a private one
+	graphics_lg1(debug_console *pdc_in, std::string shm_name_in);
 	~graphics_lg1();
+
+	uint64_t get_size() const { return 0x8000; }
+	uint64_t get_mask() const { return 0x7fff; }
+
+	void render_thread();
+
+	// set before the first command is written
+	// the busy status then always reflects a drained FIFO, so that it
+	// does not depend on the speed of the render thread
+	void set_deterministic(bool state) { deterministic = state; }
+
+	void set_done_callback(void (*cb)(void *ctx), void *ctx) { done_cb = cb; done_ctx = ctx; }
+
+	// wait until all queued commands have been executed; the framebuffer
+	// and palette below are only consistent after this
+	void sync();
+
+	// in a forked child, after sync() in the parent: the render thread
+	// did not survive the fork, and a shared framebuffer becomes private
+	// so that the children do not draw into each other's
+	void after_fork();
+
+	const lg1_shm_header_t * get_shm_header() const { return hdr; }
+	const uint8_t * get_framebuffer() const { return fb; }
+	const uint32_t * get_palette() const { return palette; }
+	uint64_t get_n_pixels() const { return n_pixels; }
+
+	size_t get_fifo_high_water() const { return fifo_high_water; }
+	uint64_t get_n_fifo_stalls() const { return n_fifo_stalls; }
+	double get_render_utilisation() const;	// 0...1, since start
+	uint64_t get_busy_us() const { return busy_us; }	// render thread, since start
+
+	// framebuffer as 0x00RRGGBB, LG1_WIDTH * LG1_HEIGHT entries
+	void to_rgb32(uint32_t *out) const;
+
+	void read_64b(uint64_t offset, uint64_t *data);
+	void read_32b(uint64_t offset, uint32_t *data);
+	void read_16b(uint64_t offset, uint16_t *data);
+	void read_8b(uint64_t offset, uint8_t *data);
+	void write_64b(uint64_t offset, uint64_t data);
+	void write_32b(uint64_t offset, uint32_t data);
+	void write_16b(uint64_t offset, uint16_t data);
+	void write_8b(uint64_t offset, uint8_t data);
 };
+
+#endif
@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <string.h>
+
+#include "debug.h"
+#include "hal2.h"
+#include "processor.h"
+
+hal2::hal2(debug_console *pdc_in) : pdc(pdc_in), sink(NULL), isr(0), iar(0)
+{
+	memset(idr, 0x00, sizeof idr);
+}
+
+hal2::~hal2()
+{
+}
+
+uint32_t hal2::get_ireg(uint16_t reg) const
+{
+	std::map<uint16_t, uint32_t>::const_iterator it = iregs.find(reg);
+
+	return it == iregs.end() ? 0 : it -> second;
+}
+
+uint32_t hal2::rate(uint32_t c1) const
+{
+	// the clock id selects one of the three bresenham clock generators
+	int clock = (c1 >> 3) & 3;
+	uint16_t base = 0x2000 + (clock ? clock : 1) * 0x100;
+
+	uint32_t master = get_ireg(base + 4) & 1 ? 44100 : 48000;
+	uint32_t c2 = get_ireg(base + 8);
+
+	// written by drivers as ((inc - mod - 1) & 0xffff) << 16 | inc
+	int inc = c2 & 0xffff;
+	int mod = inc - 1 - int16_t(c2 >> 16);
+
+	if (inc <= 0 || mod <= 0 || inc > mod)
+		return master;
+
+	return uint64_t(master) * inc / mod;
+}
+
+uint32_t hal2::channels(uint32_t c1) const
+{
+	return ((c1 >> 8) & 3) == 1 ? 1 : 2;
+}
+
+void hal2::dma_to_device(int channel, const uint8_t *data, size_t n)
+{
+	audio_sink *target = dma_sink(channel, n);
+
+	if (target)
+		target -> put(data, n);
+}
+
+audio_sink *hal2::dma_sink(int channel, size_t n)
+{
+	uint32_t c1 = get_ireg(HAL2_I_DAC_C1);
+
+	if (!(get_ireg(HAL2_I_DMA_PORT_EN) & HAL2_DMA_PORT_EN_CODECTX) || int(c1 & 7) != channel)
+	{
+		DEBUG(pdc -> dc_log("HAL2: %zu bytes on PBUS DMA channel %d which does not go to the DAC", n, channel));
+		return NULL;
+	}
+
+	if (sink)
+		sink -> set_format(rate(c1), channels(c1));
+
+	return sink;
+}
+
+void hal2::dma_from_device(int channel, uint8_t *data, size_t n)
+{
+	// no audio input: silence
+	memset(data, 0x00, n);
+}
+
+uint64_t hal2::dma_cycles(int channel, size_t n) const
+{
+	uint32_t c1 = get_ireg(HAL2_I_DAC_C1);
+
+	if (int(get_ireg(HAL2_I_ADC_C1) & 7) == channel)
+		c1 = get_ireg(HAL2_I_ADC_C1);
+
+	uint64_t bytes_per_second = uint64_t(rate(c1)) * channels(c1) * 2;
+
+	return std::max(uint64_t(1), n * uint64_t(CPU_CLOCK_HZ) / bytes_per_second);
+}
+
+void hal2::read_32b(uint64_t offset, uint32_t *data)
+{
+	switch(offset & 0xff)
+	{
+		case HAL2_ISR:
+			*data = isr;	// indirect accesses complete at once, TSTATUS never set
+			break;
+		case HAL2_REV:
+			*data = 0x4010;	// bit 15 clear: audio present
+			break;
+		case HAL2_IAR:
+			*data = iar;
+			break;
+		case HAL2_IDR0:
+		case HAL2_IDR1:
+		case HAL2_IDR2:
+		case HAL2_IDR3:
+			*data = idr[((offset & 0xff) - HAL2_IDR0) >> 4];
+			break;
+		default:
+			pdc -> dc_log("HAL2 read %04llx not implemented", offset);
+			*data = 0;
+			break;
+	}
+}
+
+void hal2::write_32b(uint64_t offset, uint32_t data)
+{
+	switch(offset & 0xff)
+	{
+		case HAL2_ISR:
+			isr = data & ~HAL2_ISR_TSTATUS;
+
+			if (!(isr & HAL2_ISR_GLOBAL_RESET_N))
+				iregs.clear();
+			break;
+
+		case HAL2_IAR:
+			iar = data;
+
+			// 16 bit registers use IDR0, 32 bit ones IDR0 (low) and IDR1
+			if (iar & HAL2_IAR_READ)
+			{
+				uint32_t value = get_ireg(iar & ~HAL2_IAR_READ);
+
+				idr[0] = value & 0xffff;
+				idr[1] = value >> 16;
+			}
+			else
+			{
+				iregs[iar] = (idr[0] & 0xffff) | (idr[1] << 16);
+
+				DEBUG(pdc -> dc_log("HAL2 indirect write %04x: %08x", iar, iregs[iar]));
+			}
+			break;
+
+		case HAL2_IDR0:
+		case HAL2_IDR1:
+		case HAL2_IDR2:
+		case HAL2_IDR3:
+			idr[((offset & 0xff) - HAL2_IDR0) >> 4] = data & 0xffff;
+			break;
+
+		default:
+			pdc -> dc_log("HAL2 write %04llx: %08x not implemented", offset, data);
+			break;
+	}
+}
+
+void hal2::save_state(snapshot_writer & sw) const
+{
+	sw.put_u32(isr);
+	sw.put_u32(iar);
+	sw.put_bytes(idr, sizeof idr);
+
+	sw.put_u32(iregs.size());
+	for(std::map<uint16_t, uint32_t>::const_iterator it = iregs.begin(); it != iregs.end(); it++)
+	{
+		sw.put_u16(it -> first);
+		sw.put_u32(it -> second);
+	}
+}
+
+void hal2::load_state(snapshot_reader & sr)
+{
+	isr = sr.get_u32();
+	iar = sr.get_u32();
+	sr.get_bytes(idr, sizeof idr);
+
+	iregs.clear();
+
+	uint32_t n = sr.get_u32();
+	for(uint32_t index=0; index<n; index++)
+	{
+		uint16_t reg = sr.get_u16();
+		iregs[reg] = sr.get_u32();
+	}
+}
@@ -0,0 +1,79 @@
+#ifndef __HAL2__H__
+#define __HAL2__H__
+
+#include <map>
+#include <stdint.h>
+
+#include "audio_sink.h"
+#include "debug_console.h"
+#include "snapshot_state.h"
+
+// direct registers, relative to 0x1fbd8000
+#define HAL2_ISR	0x10
+#define HAL2_REV	0x20
+#define HAL2_IAR	0x30	// indirect address, see HAL2_IAR_*
+#define HAL2_IDR0	0x40	// indirect data
+#define HAL2_IDR1	0x50
+#define HAL2_IDR2	0x60
+#define HAL2_IDR3	0x70
+
+#define HAL2_ISR_TSTATUS	0x01	// indirect transaction busy
+#define HAL2_ISR_GLOBAL_RESET_N	0x08
+#define HAL2_ISR_CODEC_RESET_N	0x10
+
+#define HAL2_IAR_READ		0x0080	// else write
+
+// indirect registers
+#define HAL2_I_DMA_PORT_EN	0x9104
+#define HAL2_I_DMA_END		0x9108
+#define HAL2_I_DMA_DRV		0x910c
+#define HAL2_I_DAC_C1		0x1404	// bits 0-2: PBUS DMA channel, 3-4: clock, 8-9: 1 mono, 2 stereo
+#define HAL2_I_DAC_C2		0x1408
+#define HAL2_I_ADC_C1		0x1504
+#define HAL2_I_ADC_C2		0x1508
+#define HAL2_I_BRES1_C1		0x2104	// 0: 48kHz master clock, 1: 44.1kHz
+#define HAL2_I_BRES1_C2		0x2108	// rate = master * inc / mod, see rate()
+
+#define HAL2_DMA_PORT_EN_CODECTX	0x08
+#define HAL2_DMA_PORT_EN_CODECR		0x10
+
+// HAL2 audio: only the codec (DAC/ADC) is emulated. Its samples are moved
+// by the HPC3 PBUS DMA channels; the DAC sends them to an audio_sink.
+class hal2
+{
+private:
+	debug_console *pdc;
+	audio_sink *sink;
+
+	uint32_t isr, iar, idr[4];
+	std::map<uint16_t, uint32_t> iregs;
+
+	uint32_t get_ireg(uint16_t reg) const;
+
+	uint32_t rate(uint32_t c1) const;
+	uint32_t channels(uint32_t c1) const;
+
+public:
+	hal2(debug_console *pdc_in);
+	~hal2();
+
+	void set_sink(audio_sink *sink_in) { sink = sink_in; }
+
+	// PBUS DMA; the number of processor cycles the data lasts at the
+	// configured sample rate tells the DMA engine when to move the next
+	// descriptor
+	void dma_to_device(int channel, const uint8_t *data, size_t n);
+	// where the samples of a channel go (NULL: nowhere), for a transfer
+	// that puts them later on another thread; sets the format now
+	audio_sink *dma_sink(int channel, size_t n);
+	void dma_from_device(int channel, uint8_t *data, size_t n);
+	uint64_t dma_cycles(int channel, size_t n) const;
+
+	void save_state(snapshot_writer & sw) const;
+	void load_state(snapshot_reader & sr);
+
+	void read_32b(uint64_t offset, uint32_t *data);
+	void write_32b(uint64_t offset, uint32_t data);
+};
+
+#endif
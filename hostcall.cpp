@@ -0,0 +1,640 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "debug.h"
+#include "error.h"
+#include "exceptions.h"
+#include "hostcall.h"
+#include "log.h"
+
+hostcall::hostcall(debug_console *pdc_in, processor *pp_in, io_reactor *io_in, int2 *ioc_in, std::string dir_in) : pdc(pdc_in), pp(pp_in), pmb(pp_in -> get_memory_bus()), io(io_in), ioc(ioc_in), dir(dir_in), ring(0), entries(0), n_served(0), irq_enable(0), irq_pending(false), jobs_head(0), in_flight(false), doorbell_again(false), retry_event(SCHED_NONE), work_done(false), buffer(HC_CHUNK), console_out(NULL), console_in(NULL)
+{
+	dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+	if (dir_fd == -1)
+		error_exit("hostcall: cannot open directory %s", dir.c_str());
+
+	for(int nr=0; nr<HC_MAX_HANDLES; nr++)
+		handles[nr] = -1;
+
+	pthread_mutex_init(&work_lock, NULL);
+	pthread_cond_init(&work_cond, NULL);
+
+	pp -> add_sync_callback(sync_cb, this);
+}
+
+hostcall::~hostcall()
+{
+	// a batch that is in flight finishes here and its completion is
+	// dropped
+	if (io)
+		io -> run_requests();
+
+	pp -> get_scheduler() -> cancel(retry_event);
+	pp -> get_scheduler() -> cancel_posted(this);
+	pp -> remove_sync_callback(sync_cb, this);
+
+	if (irq_pending && ioc)
+		ioc -> set_local0(HC_INT2_LOCAL0, false);
+
+	for(int nr=0; nr<HC_MAX_HANDLES; nr++)
+	{
+		if (handles[nr] != -1)
+			close(handles[nr]);
+	}
+
+	close(dir_fd);
+
+	pthread_cond_destroy(&work_cond);
+	pthread_mutex_destroy(&work_lock);
+}
+
+uint32_t hostcall::get_u32(uint64_t addr)
+{
+	uint32_t v = 0;
+	pmb -> read_32b(addr, &v);
+
+	return v;
+}
+
+void hostcall::put_u32(uint64_t addr, uint32_t v)
+{
+	pmb -> write_32b(addr, v);
+}
+
+void hostcall::put_u64(uint64_t addr, uint64_t v)
+{
+	pmb -> write_32b(addr, v >> 32);
+	pmb -> write_32b(addr + 4, v);
+}
+
+void hostcall::read_32b(uint64_t offset, uint32_t *data)
+{
+	switch(offset & (HC_SIZE - 4))
+	{
+		case HC_REG_ID:
+			*data = HC_ID;
+			break;
+		case HC_REG_RING:
+			*data = ring;
+			break;
+		case HC_REG_ENTRIES:
+			*data = entries;
+			break;
+		case HC_REG_DOORBELL:
+			*data = n_served;
+			break;
+		case HC_REG_IRQ_ENABLE:
+			*data = irq_enable;
+			break;
+		case HC_REG_IRQ_STATUS:
+			*data = irq_pending;
+			break;
+		default:
+			*data = 0;
+			break;
+	}
+}
+
+void hostcall::write_32b(uint64_t offset, uint32_t data)
+{
+	switch(offset & (HC_SIZE - 4))
+	{
+		case HC_REG_RING:
+			ring = data & ~(HC_DESC_SIZE - 1);
+			break;
+		case HC_REG_ENTRIES:
+			if (data == 0 || data > HC_MAX_ENTRIES || (data & (data - 1)))
+				pdc -> dc_log("hostcall: %u ring entries is invalid", data);
+			else
+				entries = data;
+			break;
+		case HC_REG_DOORBELL:
+			serve();
+			break;
+		case HC_REG_IRQ_ENABLE:
+			irq_enable = data & 1;
+			update_irq();
+			break;
+		case HC_REG_IRQ_STATUS:
+			irq_pending = false;
+			update_irq();
+			break;
+		default:
+			DEBUG(pdc -> dc_log("hostcall: write %08x to %016llx ignored", data, offset));
+			break;
+	}
+}
+
+void hostcall::read_64b(uint64_t offset, uint64_t *data)
+{
+	uint32_t hi = 0, lo = 0;
+
+	read_32b(offset, &hi);
+	read_32b(offset + 4, &lo);
+
+	*data = (uint64_t(hi) << 32) | lo;
+}
+
+void hostcall::read_16b(uint64_t offset, uint16_t *data)
+{
+	uint32_t temp = 0;
+
+	read_32b(offset & ~3, &temp);
+
+	*data = temp >> ((2 - (offset & 2)) * 8);
+}
+
+void hostcall::read_8b(uint64_t offset, uint8_t *data)
+{
+	uint32_t temp = 0;
+
+	read_32b(offset & ~3, &temp);
+
+	*data = temp >> ((3 - (offset & 3)) * 8);
+}
+
+void hostcall::write_64b(uint64_t offset, uint64_t data)
+{
+	write_32b(offset, data >> 32);
+	write_32b(offset + 4, data);
+}
+
+// the registers are 32 bit, narrower writes are taken as a write of the
+// whole register
+void hostcall::write_16b(uint64_t offset, uint16_t data)
+{
+	write_32b(offset & ~3, data);
+}
+
+void hostcall::write_8b(uint64_t offset, uint8_t data)
+{
+	write_32b(offset & ~3, data);
+}
+
+void hostcall::update_irq()
+{
+	if (ioc)
+		ioc -> set_local0(HC_INT2_LOCAL0, irq_pending && irq_enable);
+}
+
+void hostcall::serve()
+{
+	if (entries == 0)
+	{
+		pdc -> dc_log("hostcall: doorbell without a ring");
+		return;
+	}
+
+	if (in_flight)
+	{
+		doorbell_again = true;
+		return;
+	}
+
+	bool any_pending = false;
+
+	try
+	{
+		uint32_t head = get_u32(ring + HC_RING_HEAD);
+		uint32_t tail = get_u32(ring + HC_RING_TAIL);
+
+		if (head - tail > entries)
+		{
+			pdc -> dc_log("hostcall: head %u and tail %u are more than %u apart", head, tail, entries);
+			return;
+		}
+
+		jobs.resize(head - tail);
+
+		for(size_t index=0; index<jobs.size(); index++)
+		{
+			hc_job_t *j = &jobs[index];
+
+			j -> desc = ring + HC_RING_DESC + ((tail + index) & (entries - 1)) * HC_DESC_SIZE;
+
+			prepare(j);
+
+			any_pending |= j -> pending;
+		}
+
+		jobs_head = head;
+	}
+	catch(processor_exception & pe)
+	{
+		pdc -> dc_log("hostcall: ring at %08x is not in RAM (%016llx)", ring, pe.get_BadVAddr());
+		return;
+	}
+
+	if (any_pending && io)
+	{
+		in_flight = true;
+		work_done = false;
+		hand_over();
+		return;
+	}
+
+	if (any_pending)
+		work();
+
+	complete();
+}
+
+// reads the descriptor and answers what needs no file system call
+void hostcall::prepare(hc_job_t *j)
+{
+	j -> op = get_u32(j -> desc + HC_DESC_OP);
+	j -> handle = get_u32(j -> desc + HC_DESC_HANDLE);
+	j -> len = get_u32(j -> desc + HC_DESC_LEN);
+	j -> offset = (uint64_t(get_u32(j -> desc + HC_DESC_OFFSET_HI)) << 32) | get_u32(j -> desc + HC_DESC_OFFSET_LO);
+	j -> buf = get_u32(j -> desc + HC_DESC_BUF);
+	j -> arg = get_u32(j -> desc + HC_DESC_ARG);
+	j -> path.clear();
+	j -> pending = false;
+	j -> result = 0;
+	j -> size = 0;
+
+	DEBUG(pdc -> dc_log("hostcall: op %u handle %u len %u offset %llu buf %08x arg %08x", j -> op, j -> handle, j -> len, j -> offset, j -> buf, j -> arg));
+
+	try
+	{
+		switch(j -> op)
+		{
+			case HC_OP_NOP:
+				return;
+
+			case HC_OP_OPEN:
+				j -> pending = read_path(j);
+				return;
+
+			case HC_OP_CLOSE:
+			case HC_OP_SIZE:
+				j -> pending = true;
+				return;
+
+			case HC_OP_READ:
+			case HC_OP_WRITE:
+				if (j -> len > 0x7fffffff)
+					j -> result = HC_EINVAL;
+				else if (!pmb -> is_plain(j -> buf, j -> len))
+					j -> result = HC_EFAULT;
+				else
+					j -> pending = true;
+				return;
+
+			case HC_OP_CONSOLE_WRITE:
+				j -> result = console_write(j -> buf, j -> len);
+				return;
+
+			case HC_OP_CONSOLE_READ:
+				j -> result = console_read(j -> buf, j -> len);
+				return;
+
+			case HC_OP_CLOCK:
+			{
+				struct timespec ts;
+				clock_gettime(CLOCK_MONOTONIC, &ts);
+
+				put_u64(j -> buf, uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec);
+				return;
+			}
+		}
+	}
+	catch(processor_exception & pe)
+	{
+		DEBUG(pdc -> dc_log("hostcall: op %u, %016llx is not in RAM", j -> op, pe.get_BadVAddr()));
+
+		j -> result = HC_EFAULT;
+		return;
+	}
+
+	j -> result = HC_ENOSYS;
+}
+
+// false: the result is set already
+bool hostcall::read_path(hc_job_t *j)
+{
+	if (j -> len == 0 || j -> len >= PATH_MAX)
+	{
+		j -> result = HC_EINVAL;
+		return false;
+	}
+
+	j -> path.assign(j -> len, ' ');
+	pmb -> read_block(j -> buf, (uint8_t *)&j -> path[0], j -> len);
+
+	if (j -> path.find('\0') != std::string::npos)
+	{
+		j -> result = HC_EINVAL;
+		return false;
+	}
+
+	// stay in the directory
+	if (j -> path[0] == '/')
+	{
+		j -> result = HC_EPERM;
+		return false;
+	}
+
+	for(size_t start=0; start<=j -> path.size();)
+	{
+		size_t end = j -> path.find('/', start);
+		if (end == std::string::npos)
+			end = j -> path.size();
+
+		if (j -> path.compare(start, end - start, "..") == 0)
+		{
+			j -> result = HC_EPERM;
+			return false;
+		}
+
+		start = end + 1;
+	}
+
+	return true;
+}
+
+// the results first, then the tail: a guest that sees the tail move
+// finds all of them
+void hostcall::complete()
+{
+	in_flight = false;
+
+	try
+	{
+		for(hc_job_t & j : jobs)
+		{
+			if (j.op == HC_OP_SIZE && j.result == 0)
+			{
+				try
+				{
+					put_u64(j.buf, j.size);
+				}
+				catch(processor_exception & pe)
+				{
+					j.result = HC_EFAULT;
+				}
+			}
+
+			put_u32(j.desc + HC_DESC_RESULT, j.result);
+		}
+
+		put_u32(ring + HC_RING_TAIL, jobs_head);
+	}
+	catch(processor_exception & pe)
+	{
+		pdc -> dc_log("hostcall: ring at %08x is not in RAM (%016llx)", ring, pe.get_BadVAddr());
+	}
+
+	n_served += jobs.size();
+
+	if (!jobs.empty())
+	{
+		irq_pending = true;
+		update_irq();
+	}
+
+	jobs.clear();
+
+	if (doorbell_again)
+	{
+		doorbell_again = false;
+		serve();
+	}
+}
+
+void hostcall::complete_cb(void *ctx, uint64_t now)
+{
+	((hostcall *)ctx) -> complete();
+}
+
+void hostcall::hand_over()
+{
+	retry_event = SCHED_NONE;
+
+	if (!io -> request(work_cb, this))
+		retry_event = pp -> get_scheduler() -> schedule(pp -> get_cycle_count() + HC_RETRY_CYCLES, retry_cb, this);
+}
+
+void hostcall::retry_cb(void *ctx, uint64_t now)
+{
+	((hostcall *)ctx) -> hand_over();
+}
+
+// the guest sees the results now instead of at the posted completion; a
+// doorbell that came in the meantime may start the next batch
+void hostcall::sync()
+{
+	while(in_flight)
+	{
+		// nobody else would do it
+		if (retry_event != SCHED_NONE)
+		{
+			pp -> get_scheduler() -> cancel(retry_event);
+			retry_event = SCHED_NONE;
+
+			work();
+			complete();
+			continue;
+		}
+
+		pthread_mutex_lock(&work_lock);
+		while(!work_done)
+			pthread_cond_wait(&work_cond, &work_lock);
+		pthread_mutex_unlock(&work_lock);
+
+		pp -> get_scheduler() -> cancel_posted(this);
+
+		complete();
+	}
+}
+
+void hostcall::sync_cb(void *ctx)
+{
+	((hostcall *)ctx) -> sync();
+}
+
+void hostcall::work_cb(void *ctx)
+{
+	hostcall *h = (hostcall *)ctx;
+
+	h -> work();
+
+	// posted first: sync() takes the completion back once it saw
+	// work_done
+	h -> pp -> get_scheduler() -> post(complete_cb, h);
+
+	pthread_mutex_lock(&h -> work_lock);
+	h -> work_done = true;
+	pthread_cond_signal(&h -> work_cond);
+	pthread_mutex_unlock(&h -> work_lock);
+
+	h -> pp -> wake();
+}
+
+// I/O thread: only the handles, the buffer and plain guest RAM are
+// touched here
+void hostcall::work()
+{
+	for(hc_job_t & j : jobs)
+	{
+		if (j.pending)
+			j.result = execute(&j);
+	}
+}
+
+int hostcall::get_fd(uint32_t handle) const
+{
+	return handle < HC_MAX_HANDLES ? handles[handle] : -1;
+}
+
+int32_t hostcall::execute(hc_job_t *j)
+{
+	if (j -> op == HC_OP_OPEN)
+		return open_file(j -> path, j -> arg);
+
+	int fd = get_fd(j -> handle);
+	if (fd == -1)
+		return HC_EBADF;
+
+	switch(j -> op)
+	{
+		case HC_OP_CLOSE:
+			close(fd);
+			handles[j -> handle] = -1;
+			return 0;
+
+		case HC_OP_READ:
+		case HC_OP_WRITE:
+			return transfer(fd, j -> buf, j -> len, j -> offset, j -> op == HC_OP_WRITE);
+
+		case HC_OP_SIZE:
+		{
+			struct stat st;
+
+			if (fstat(fd, &st) == -1)
+				return HC_EIO;
+
+			j -> size = st.st_size;
+			return 0;
+		}
+	}
+
+	return HC_ENOSYS;
+}
+
+int32_t hostcall::open_file(const std::string & path, uint32_t flags)
+{
+	int slot = -1;
+	for(int nr=0; nr<HC_MAX_HANDLES && slot == -1; nr++)
+	{
+		if (handles[nr] == -1)
+			slot = nr;
+	}
+
+	if (slot == -1)
+		return HC_EMFILE;
+
+	int mode = O_RDONLY;
+	if ((flags & HC_O_READ) && (flags & HC_O_WRITE))
+		mode = O_RDWR;
+	else if (flags & HC_O_WRITE)
+		mode = O_WRONLY;
+
+	if (flags & HC_O_CREATE)
+		mode |= O_CREAT;
+	if (flags & HC_O_TRUNCATE)
+		mode |= O_TRUNC;
+
+	int fd = openat(dir_fd, path.c_str(), mode | O_CLOEXEC, 0644);
+	if (fd == -1)
+	{
+		int e = errno;
+
+		dolog("hostcall: cannot open %s/%s: %s", dir.c_str(), path.c_str(), strerror(e));
+
+		return e == ENOENT ? HC_ENOENT : e == EACCES ? HC_EPERM : HC_EIO;
+	}
+
+	handles[slot] = fd;
+
+	return slot;
+}
+
+// in chunks through a bounce buffer; prepare() checked that the guest
+// range is plain RAM
+int32_t hostcall::transfer(int fd, uint32_t buf, uint32_t len, uint64_t offset, bool to_host)
+{
+	uint32_t done = 0;
+
+	while(done < len)
+	{
+		size_t chunk = std::min(len - done, uint32_t(HC_CHUNK));
+		ssize_t rc = 0;
+
+		if (to_host)
+		{
+			pmb -> read_block_plain(buf + done, buffer.data(), chunk);
+			rc = pwrite(fd, buffer.data(), chunk, offset + done);
+		}
+		else
+		{
+			rc = pread(fd, buffer.data(), chunk, offset + done);
+			if (rc > 0)
+				pmb -> write_block_plain(buf + done, buffer.data(), rc);
+		}
+
+		if (rc == -1)
+			return done ? int32_t(done) : HC_EIO;
+
+		done += rc;
+
+		if (size_t(rc) < chunk)	// end of file
+			break;
+	}
+
+	return done;
+}
+
+// no batch is in flight here: the buffer is free
+int32_t hostcall::console_write(uint32_t buf, uint32_t len)
+{
+	uint32_t done = 0;
+
+	while(done < len)
+	{
+		size_t chunk = std::min(len - done, uint32_t(HC_CHUNK));
+
+		pmb -> read_block(buf + done, buffer.data(), chunk);
+
+		if (console_out)
+		{
+			for(size_t index=0; index<chunk; index++)
+				console_out -> put(buffer[index]);
+		}
+
+		done += chunk;
+	}
+
+	return done;
+}
+
+int32_t hostcall::console_read(uint32_t buf, uint32_t len)
+{
+	uint32_t n = 0;
+
+	len = std::min(len, uint32_t(HC_CHUNK));
+
+	while(console_in && n < len && console_in -> get_input(&buffer[n]))
+		n++;
+
+	if (n)
+		pmb -> write_block(buf, buffer.data(), n);
+
+	return n;
+}
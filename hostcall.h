@@ -0,0 +1,144 @@
+#ifndef __HOSTCALL__H__
+#define __HOSTCALL__H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "debug_console.h"
+#include "hostcall_abi.h"
+#include "int2.h"
+#include "io_reactor.h"
+#include "memory.h"
+#include "memory_bus.h"
+#include "processor.h"
+#include "serial_host.h"
+#include "serial_output.h"
+
+#define HC_MAX_HANDLES	16
+#define HC_CHUNK	65536	// bytes copied per host call
+#define HC_INT2_LOCAL0	INT2_L0_FIFO	// GIO0, which the expansion slots share
+#define HC_RETRY_CYCLES	10000	// the I/O thread's queue was full: 100us
+
+typedef struct
+{
+	uint64_t desc;	// guest address of the descriptor
+	uint32_t op, handle, len, buf, arg;
+	uint64_t offset;
+	std::string path;	// HC_OP_OPEN
+
+	bool pending;	// still to be done on the I/O thread
+	int32_t result;
+	uint64_t size;	// HC_OP_SIZE
+} hc_job_t;
+
+// Lets guest software move data to and from the host at memcpy speed
+// instead of through a serial line: a page of registers in a free GIO
+// window and a ring of request descriptors in guest RAM (see
+// hostcall_abi.h).
+//
+// A write to the doorbell takes the requests that the guest queued. The
+// ones that need a file system call (open, close, read, write, size) are
+// handed to the I/O thread of the machine as one batch, so the processor
+// never waits for the disk; when the batch is done the results, the tail
+// and the completion interrupt are posted to the scheduler and become
+// visible between two instructions. Console I/O and the clock are
+// answered right away. Without an I/O thread all of it is done inline,
+// before the store completes. A doorbell while a batch is in flight is
+// served when that one completes.
+//
+// Reads and writes have to be in plain RAM: the I/O thread copies from
+// and to guest memory while the guest runs on, like DMA would. So that no
+// snapshot or RAM reclaim sees a half done batch, processor::sync_devices()
+// waits for it and completes it right away.
+//
+// Files are opened relative to one host directory; paths that are
+// absolute or contain ".." are refused (symbolic links in the directory
+// are followed). Open files and the ring registers are not part of a
+// snapshot: after a restore the guest has to set the ring up again.
+class hostcall : public memory
+{
+private:
+	debug_console *pdc;
+	processor *pp;
+	memory_bus *pmb;
+	io_reactor *io;
+	int2 *ioc;
+
+	std::string dir;
+	int dir_fd;
+
+	uint32_t ring, entries, n_served;
+	uint32_t irq_enable;
+	bool irq_pending;
+
+	// the batch of the last doorbell, and the tail once it is done
+	std::vector<hc_job_t> jobs;
+	uint32_t jobs_head;
+	bool in_flight, doorbell_again;
+	sched_id_t retry_event;	// the batch is not handed over yet
+
+	// set by the I/O thread when the batch in flight is done
+	pthread_mutex_t work_lock;
+	pthread_cond_t work_cond;
+	bool work_done;
+
+	// I/O thread while a batch is in flight
+	int handles[HC_MAX_HANDLES];
+	std::vector<uint8_t> buffer;
+
+	serial_output *console_out;
+	serial_host *console_in;
+
+	uint32_t get_u32(uint64_t addr);
+	void put_u32(uint64_t addr, uint32_t v);
+	void put_u64(uint64_t addr, uint64_t v);
+
+	// processor thread
+	void serve();
+	void prepare(hc_job_t *j);
+	void complete();
+	void update_irq();
+	void hand_over();
+	void sync();
+	bool read_path(hc_job_t *j);
+	int32_t console_write(uint32_t buf, uint32_t len);
+	int32_t console_read(uint32_t buf, uint32_t len);
+
+	// I/O thread
+	void work();
+	int32_t execute(hc_job_t *j);
+	int32_t open_file(const std::string & path, uint32_t flags);
+	int32_t transfer(int fd, uint32_t buf, uint32_t len, uint64_t offset, bool to_host);
+	int get_fd(uint32_t handle) const;
+
+	static void work_cb(void *ctx);
+	static void complete_cb(void *ctx, uint64_t now);
+	static void sync_cb(void *ctx);
+	static void retry_cb(void *ctx, uint64_t now);
+
+public:
+	// pp_in: its memory bus has the ring and the buffers, io_in: NULL to
+	// do the file I/O inline, ioc_in: may be NULL, dir_in: files
+	hostcall(debug_console *pdc_in, processor *pp_in, io_reactor *io_in, int2 *ioc_in, std::string dir_in);
+	~hostcall();
+
+	uint64_t get_size() const { return HC_SIZE; }
+
+	// out, in: may be NULL
+	void set_console(serial_output *out, serial_host *in) { console_out = out; console_in = in; }
+
+	uint32_t get_n_served() const { return n_served; }
+
+	void read_64b(uint64_t offset, uint64_t *data);
+	void read_32b(uint64_t offset, uint32_t *data);
+	void read_16b(uint64_t offset, uint16_t *data);
+	void read_8b(uint64_t offset, uint8_t *data);
+	void write_64b(uint64_t offset, uint64_t data);
+	void write_32b(uint64_t offset, uint32_t data);
+	void write_16b(uint64_t offset, uint16_t data);
+	void write_8b(uint64_t offset, uint8_t data);
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __HOSTCALL_ABI__H__
+#define __HOSTCALL_ABI__H__
+
+// The interface of the paravirtual host call device as the guest sees it.
+// Only #defines: included by the emulator, by guest C code and by the
+// MIPS client (hostcall_client.S). All words are big endian.
+
+#define HC_BASE			0x1f600000	// GIO expansion slot 1, physical
+#define HC_SIZE			0x1000
+
+// registers, 32 bit
+#define HC_REG_ID		0x00	// read: HC_ID
+#define HC_REG_RING		0x04	// physical address of the ring, 32 byte aligned
+#define HC_REG_ENTRIES		0x08	// slots in the ring, a power of 2 up to HC_MAX_ENTRIES
+#define HC_REG_DOORBELL		0x0c	// write: serve the ring up to its head; read: requests served
+#define HC_REG_IRQ_ENABLE	0x10	// 1: interrupt (GIO0) when the requests of a doorbell are done
+#define HC_REG_IRQ_STATUS	0x14	// read: 1 while the interrupt is pending; write: acknowledge
+
+#define HC_ID			0x48434c31	// "HCL1"
+#define HC_MAX_ENTRIES		256
+
+// the ring: a header, then HC_REG_ENTRIES descriptors. The guest fills
+// the descriptor at head % entries, increments head and writes the
+// doorbell. The host writes the results and then moves tail up to that
+// head, in one go: the guest polls tail or waits for the interrupt.
+#define HC_RING_HEAD		0x00	// guest: next slot to fill (free running)
+#define HC_RING_TAIL		0x04	// host: next slot to serve (free running)
+#define HC_RING_DESC		0x20
+
+// descriptor, HC_DESC_SIZE bytes
+#define HC_DESC_OP		0x00
+#define HC_DESC_RESULT		0x04	// host: >= 0 on success, HC_E* on failure
+#define HC_DESC_HANDLE		0x08
+#define HC_DESC_LEN		0x0c
+#define HC_DESC_OFFSET_HI	0x10	// file offset
+#define HC_DESC_OFFSET_LO	0x14
+#define HC_DESC_BUF		0x18	// physical address
+#define HC_DESC_ARG		0x1c
+#define HC_DESC_SIZE		0x20
+
+// operations
+#define HC_OP_NOP		0
+#define HC_OP_OPEN		1	// buf/len: path (relative to the host directory), arg: HC_O_*; result: handle
+#define HC_OP_CLOSE		2	// handle
+#define HC_OP_READ		3	// handle, buf, len, offset; result: bytes read, 0 at the end
+#define HC_OP_WRITE		4	// handle, buf, len, offset; result: bytes written
+#define HC_OP_SIZE		5	// handle; 8 bytes at buf: the size of the file
+#define HC_OP_CONSOLE_WRITE	6	// buf, len
+#define HC_OP_CONSOLE_READ	7	// buf, len; result: bytes read, 0 when nothing is waiting
+#define HC_OP_CLOCK		8	// 8 bytes at buf: host monotonic clock in ns
+
+// HC_OP_OPEN flags
+#define HC_O_READ		0x01
+#define HC_O_WRITE		0x02
+#define HC_O_CREATE		0x04
+#define HC_O_TRUNCATE		0x08
+
+// results
+#define HC_EINVAL		-1
+#define HC_ENOENT		-2
+#define HC_EBADF		-3
+#define HC_EFAULT		-4	// a guest address is not in RAM
+#define HC_EIO			-5
+#define HC_EPERM		-6	// the path leaves the host directory
+#define HC_EMFILE		-7
+#define HC_ENOSYS		-8	// unknown operation
+
+#endif
@@ -1,7 +1,12 @@
+#include <endian.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "debug.h"
+#include "device_thread.h"
+#include "exceptions.h"
 #include "hpc3.h"
+#include "processor.h"
 
 // 0x1fb80000 0x1fb8ffff PBUS DMA channel registers
 // 0x1fb90000 0x1fb9ffff HD0, HD1, ENET DMA channel registers
@@ -13,7 +18,33 @@
 // 0x1fbd8000 0x1fbdffff PBUS device registers
 // 0x1fbe0000 0x1fbfffff Battery backed sram address space
 
-hpc3::hpc3(debug_console *pdc_in, std::string sram) : pdc(pdc_in)
+static void pbus_dma_event(void *ctx, uint64_t now)
+{
+	pbus_dma_t *c = (pbus_dma_t *)ctx;
+
+	c -> owner -> pbus_dma_run(c -> nr, now);
+}
+
+static void pbus_dma_copy_job(void *ctx)
+{
+	pbus_dma_t *c = (pbus_dma_t *)ctx;
+
+	c -> owner -> pbus_dma_copy(c -> nr);
+}
+
+static void pbus_dma_done_job(void *ctx, uint64_t now)
+{
+	pbus_dma_t *c = (pbus_dma_t *)ctx;
+
+	c -> owner -> pbus_dma_done(c -> nr, now);
+}
+
+static void serial_irq_changed(void *ctx)
+{
+	((hpc3 *)ctx) -> serial_update_irq();
+}
+
+hpc3::hpc3(debug_console *pdc_in, processor *pp_in, std::string sram) : pdc(pdc_in), pp(pp_in)
 {
 	len = 512 * 1024;
 	pm = (unsigned char *)malloc(len);
@@ -37,19 +68,44 @@ hpc3::hpc3(debug_console *pdc_in, std::string sram) : pdc(pdc_in)
 
 	pep = new eprom(sram, 131072);
 
-	ser1 = new z85c30(pdc_in);
-	ser2 = new z85c30(pdc_in);
+	ioc = new int2(pdc_in, pp);
+
+	ser1 = new z85c30(pdc_in, pp);
+	ser2 = new z85c30(pdc_in, pp);
+	ser1 -> set_irq_callback(serial_irq_changed, this);
+	ser2 -> set_irq_callback(serial_irq_changed, this);
 
 	seeq = new seeq_8003_8020(pdc_in);
+
+	audio = new hal2(pdc_in);
+
+	for(int nr=0; nr<PBUS_DMA_CHANNELS; nr++)
+	{
+		pbus_dma[nr].owner = this;
+		pbus_dma[nr].nr = nr;
+		pbus_dma[nr].bp = pbus_dma[nr].dp = pbus_dma[nr].ctrl = 0;
+		pbus_dma[nr].event = SCHED_NONE;
+		pbus_dma[nr].job_pending = false;
+	}
 }
 
 hpc3::~hpc3()
 {
+	// the jobs refer to the channels
+	pp -> sync_devices();
+
+	for(int nr=0; nr<PBUS_DMA_CHANNELS; nr++)
+		pp -> get_scheduler() -> cancel(pbus_dma[nr].event);
+
+	delete audio;
+
 	delete seeq;
 
 	delete ser2;
 	delete ser1;
 
+	delete ioc;
+
 	delete pep;
 }
 
@@ -179,10 +235,184 @@ void hpc3::read_fake(ws_t ws, uint64_t offset, uint64_t *data)
 	}
 }
 
+void hpc3::serial_update_irq()
+{
+	ioc -> set_map(INT2_MAP_SERIAL, ser1 -> get_irq_state() || ser2 -> get_irq_state());
+}
+
+// the channels share the HPC DMA interrupt
+void hpc3::pbus_dma_update_irq()
+{
+	bool pending = false;
+
+	for(int nr=0; nr<PBUS_DMA_CHANNELS; nr++)
+		pending |= !!(pbus_dma[nr].ctrl & PBUS_DMA_CTRL_INT);
+
+	ioc -> set_local1(INT2_L1_HPC_DMA, pending);
+}
+
+// One scheduler event moves one complete descriptor; the next one is
+// scheduled when the device would have consumed the data (for audio: at
+// the sample rate), so DMA never holds up instruction execution. With a
+// device thread the copy of a buffer in plain memory is done there and
+// the descriptor completes (bp, INT, EOX) at the next quantum boundary;
+// the descriptor itself and device routing are handled here.
+void hpc3::pbus_dma_run(int nr, uint64_t now)
+{
+	pbus_dma_t & c = pbus_dma[nr];
+
+	c.event = SCHED_NONE;
+
+	// the previous descriptor of the channel must be done first
+	pbus_dma_sync(c);
+
+	if (!(c.ctrl & PBUS_DMA_CTRL_ACT))
+		return;
+
+	memory_bus *pmb = pp -> get_memory_bus();
+	uint8_t buffer[PBUS_DESC_BCNT + 1];
+	uint32_t desc[3];
+	uint32_t n = 0;
+
+	try
+	{
+		pmb -> read_block(c.dp, (uint8_t *)desc, sizeof desc);
+
+		uint32_t bp = be32toh(desc[0]);
+		uint32_t cntinfo = be32toh(desc[1]);
+		uint32_t next = be32toh(desc[2]);
+		n = cntinfo & PBUS_DESC_BCNT;
+
+		if (pp -> get_device_thread() && pmb -> is_plain(bp, n))
+			pbus_dma_post(c, bp, cntinfo, next);
+		else
+		{
+			c.bp = bp;
+
+			if (c.ctrl & PBUS_DMA_CTRL_RECEIVE)
+			{
+				audio -> dma_from_device(nr, buffer, n);
+				pmb -> write_block(c.bp, buffer, n);
+			}
+			else
+			{
+				pmb -> read_block(c.bp, buffer, n);
+				audio -> dma_to_device(nr, buffer, n);
+			}
+
+			pbus_dma_finish(c, bp + n, cntinfo, next);
+		}
+
+		if (cntinfo & PBUS_DESC_EOX)
+			return;
+	}
+	catch(processor_exception & pe)
+	{
+		pdc -> dc_log("HPC3 PBUS DMA %d: bus error at %016llx, channel stopped", nr, pe.get_BadVAddr());
+		c.ctrl &= ~PBUS_DMA_CTRL_ACT;
+		return;
+	}
+
+	c.event = pp -> get_scheduler() -> schedule(now + audio -> dma_cycles(nr, n), pbus_dma_event, &c);
+}
+
+void hpc3::pbus_dma_finish(pbus_dma_t & c, uint32_t bp, uint32_t cntinfo, uint32_t next)
+{
+	c.bp = bp;
+
+	if (cntinfo & PBUS_DESC_XIE)
+	{
+		c.ctrl |= PBUS_DMA_CTRL_INT;
+		pbus_dma_update_irq();
+	}
+
+	if (cntinfo & PBUS_DESC_EOX)
+		c.ctrl &= ~PBUS_DMA_CTRL_ACT;
+	else
+		c.dp = next;
+}
+
+// the samples are taken from and the routing is looked at in the HAL2
+// now, only the copy from/to guest memory and into the sink is left
+void hpc3::pbus_dma_post(pbus_dma_t & c, uint32_t bp, uint32_t cntinfo, uint32_t next)
+{
+	uint32_t n = cntinfo & PBUS_DESC_BCNT;
+
+	c.job_pending = true;
+	c.job_receive = !!(c.ctrl & PBUS_DMA_CTRL_RECEIVE);
+	c.job_bp = bp;
+	c.job_cntinfo = cntinfo;
+	c.job_next = next;
+	c.job_sink = NULL;
+
+	if (c.job_receive)
+		audio -> dma_from_device(c.nr, c.job_buffer, n);
+	else
+		c.job_sink = audio -> dma_sink(c.nr, n);
+
+	pp -> get_device_thread() -> post(pbus_dma_copy_job, pbus_dma_done_job, &c);
+}
+
+// the guest looks at the channel: the copy must be done by now
+void hpc3::pbus_dma_sync(const pbus_dma_t & c)
+{
+	if (c.job_pending)
+		pp -> sync_devices();
+}
+
+// device thread
+void hpc3::pbus_dma_copy(int nr)
+{
+	pbus_dma_t & c = pbus_dma[nr];
+	const memory_bus *pmb = pp -> get_memory_bus();
+	uint32_t n = c.job_cntinfo & PBUS_DESC_BCNT;
+
+	if (c.job_receive)
+		pmb -> write_block_plain(c.job_bp, c.job_buffer, n);
+	else if (c.job_sink)
+	{
+		pmb -> read_block_plain(c.job_bp, c.job_buffer, n);
+		c.job_sink -> put(c.job_buffer, n);
+	}
+}
+
+void hpc3::pbus_dma_done(int nr, uint64_t now)
+{
+	pbus_dma_t & c = pbus_dma[nr];
+
+	c.job_pending = false;
+
+	// for the idle detection
+	if (c.job_receive)
+		pp -> get_memory_bus() -> count_write();
+
+	pbus_dma_finish(c, c.job_bp + (c.job_cntinfo & PBUS_DESC_BCNT), c.job_cntinfo, c.job_next);
+}
+
 void hpc3::section_8_read_pbus_dma(ws_t ws, uint64_t offset, uint64_t *data)
 {
-	pdc -> dc_log("HPC3 PBUS read not implemented %016llx", offset);
-	read_fake(ws, offset, data);
+	pbus_dma_t & c = pbus_dma[(offset >> 13) & 7];
+
+	pbus_dma_sync(c);
+
+	switch(offset & 0x1ffc)
+	{
+		case PBUS_DMA_BP:
+			*data = c.bp;
+			break;
+		case PBUS_DMA_DP:
+			*data = c.dp;
+			break;
+		case PBUS_DMA_CTRL:
+			*data = c.ctrl;
+			c.ctrl &= ~PBUS_DMA_CTRL_INT;
+			pbus_dma_update_irq();
+			break;
+		default:
+			pdc -> dc_log("HPC3 PBUS read not implemented %016llx", offset);
+			read_fake(ws, offset, data);
+			break;
+	}
 }
 
 void hpc3::section_9_read_hd_enet_channel(ws_t ws, uint64_t offset, uint64_t *data)
@@ -222,7 +452,13 @@ void hpc3::section_d_read_enet_pbus_dev_regs(ws_t ws, uint64_t offset, uint64_t
 
 	if (offset >= 0x8000)
 	{
-		if ((offset & ~3) == 0x9830)
+		if (offset < 0x8100)	// HAL2
+		{
+			uint32_t temp = 0;
+			audio -> read_32b(offset & ~3, &temp);
+			*data = temp;
+		}
+		else if ((offset & ~3) == 0x9830)
 			*data = ser1 -> ser_command_read();
 		else if ((offset & ~3) == 0x9834)
 			*data = ser1 -> ser_data_read();
@@ -230,6 +466,8 @@ void hpc3::section_d_read_enet_pbus_dev_regs(ws_t ws, uint64_t offset, uint64_t
 			*data = ser2 -> ser_command_read();
 		else if ((offset & ~3) == 0x983c)
 			*data = ser2 -> ser_data_read();
+		else if (offset >= 0x9880 && offset < 0x98c0)
+			*data = ioc -> read(offset & 0x3f);
 		else
 			pdc -> dc_log("HPC3 PBUS read %016llx not implemented", offset);
 	}
@@ -250,8 +488,34 @@ void hpc3::section_e_read_sram(ws_t ws, uint64_t offset, uint64_t *data)
 
 void hpc3::section_8_write_pbus_dma(ws_t ws, uint64_t offset, uint64_t data)
 {
-	pdc -> dc_log("HPC3 PBUS write not implemented %016llx", offset);
-	write_fake(ws, offset, data);
+	pbus_dma_t & c = pbus_dma[(offset >> 13) & 7];
+
+	pbus_dma_sync(c);
+
+	switch(offset & 0x1ffc)
+	{
+		case PBUS_DMA_DP:
+			c.dp = data;
+			break;
+		case PBUS_DMA_CTRL:
+			c.ctrl = (c.ctrl & PBUS_DMA_CTRL_INT) | (data & ~PBUS_DMA_CTRL_INT);
+
+			DEBUG(pdc -> dc_log("HPC3 PBUS DMA %d ctrl %08x, descriptor at %08x", c.nr, c.ctrl, c.dp));
+
+			if ((c.ctrl & PBUS_DMA_CTRL_ACT) && c.event == SCHED_NONE)
+				c.event = pp -> get_scheduler() -> schedule(pp -> get_cycle_count(), pbus_dma_event, &c);
+			else if (!(c.ctrl & PBUS_DMA_CTRL_ACT) && c.event != SCHED_NONE)
+			{
+				// stopped by the driver: drop the pending descriptor
+				pp -> get_scheduler() -> cancel(c.event);
+				c.event = SCHED_NONE;
+			}
+			break;
+		default:
+			pdc -> dc_log("HPC3 PBUS write not implemented %016llx", offset);
+			write_fake(ws, offset, data);
+			break;
+	}
 }
 
 void hpc3::section_9_write_hd_enet_channel(ws_t ws, uint64_t offset, uint64_t data)
@@ -288,7 +552,9 @@ void hpc3::section_d_write_enet_pbus_dev_regs(ws_t ws, uint64_t offset, uint64_t
 {
 	if (offset >= 0x8000)
 	{
-		if ((offset & ~3) == 0x9830)
+		if (offset < 0x8100)	// HAL2
+			audio -> write_32b(offset & ~3, data);
+		else if ((offset & ~3) == 0x9830)
 			ser1 -> ser_command_write(uint8_t(data));
 		else if ((offset & ~3) == 0x9834)
 			ser1 -> ser_data_write(uint8_t(data));
@@ -296,6 +562,8 @@ void hpc3::section_d_write_enet_pbus_dev_regs(ws_t ws, uint64_t offset, uint64_t
 			ser2 -> ser_command_write(uint8_t(data));
 		else if ((offset & ~3) == 0x983c)
 			ser2 -> ser_data_write(uint8_t(data));
+		else if (offset >= 0x9880 && offset < 0x98c0)
+			ioc -> write(offset & 0x3f, uint8_t(data));
 		else
 		{
 			pdc -> dc_log("HPC3 PBUS write %016llx: %016llx not implemented", offset, data);
@@ -315,3 +583,50 @@ void hpc3::section_e_write_sram(ws_t ws, uint64_t offset, uint64_t data)
 
 	pep -> write_32b(offset, data);
 }
+
+void hpc3::save_state(snapshot_writer & sw) const
+{
+	sw.put_bytes(pm, len);	// the registers that are only stored
+	sw.put_u8(gio_misc);
+
+	for(int nr=0; nr<PBUS_DMA_CHANNELS; nr++)
+	{
+		sw.put_u32(pbus_dma[nr].bp);
+		sw.put_u32(pbus_dma[nr].dp);
+		sw.put_u32(pbus_dma[nr].ctrl);
+	}
+
+	ioc -> save_state(sw);
+	ser1 -> save_state(sw);
+	ser2 -> save_state(sw);
+	audio -> save_state(sw);
+}
+
+void hpc3::load_state(snapshot_reader & sr)
+{
+	scheduler *s = pp -> get_scheduler();
+
+	sr.get_bytes(pm, len);
+	gio_misc = sr.get_u8();
+
+	// an active channel continues with its next descriptor at once
+	for(int nr=0; nr<PBUS_DMA_CHANNELS; nr++)
+	{
+		pbus_dma_t & c = pbus_dma[nr];
+
+		c.bp = sr.get_u32();
+		c.dp = sr.get_u32();
+		c.ctrl = sr.get_u32();
+
+		s -> cancel(c.event);
+		c.event = c.ctrl & PBUS_DMA_CTRL_ACT ? s -> schedule(pp -> get_cycle_count(), pbus_dma_event, &c) : SCHED_NONE;
+	}
+
+	ioc -> load_state(sr);
+	ser1 -> load_state(sr);
+	ser2 -> load_state(sr);
+	audio -> load_state(sr);
+
+	pbus_dma_update_irq();
+	serial_update_irq();
+}
@@ -1,11 +1,55 @@
+#ifndef __HPC3__H__
+#define __HPC3__H__
+
 #include "memory.h"
 #include "eprom.h"
 #include "z85c30.h"
 #include "seeq_8003_8020.h"
+#include "hal2.h"
+#include "int2.h"
+#include "scheduler.h"
+#include "snapshot_state.h"
 #include "debug_console.h"
 
+class processor;
+class hpc3;
+
 typedef enum { S_BYTE, S_SHORT, S_WORD, S_DWORD } ws_t;
 
+#define PBUS_DMA_CHANNELS	8
+
+// PBUS DMA channel registers, channel n at n * 0x2000
+#define PBUS_DMA_BP		0x0000	// buffer pointer (read only)
+#define PBUS_DMA_DP		0x0004	// descriptor pointer
+#define PBUS_DMA_CTRL		0x1000
+
+#define PBUS_DMA_CTRL_INT	0x01	// interrupt pending, cleared by reading
+#define PBUS_DMA_CTRL_LITTLE	0x02
+#define PBUS_DMA_CTRL_RECEIVE	0x04	// device to memory
+#define PBUS_DMA_CTRL_FLUSH	0x08
+#define PBUS_DMA_CTRL_ACT	0x10
+#define PBUS_DMA_CTRL_ACT_LD	0x20
+
+// descriptor: buffer pointer, cntinfo, next descriptor pointer
+#define PBUS_DESC_EOX		0x80000000	// last descriptor of the chain
+#define PBUS_DESC_XIE		0x20000000	// interrupt when done
+#define PBUS_DESC_BCNT		0x00003fff
+
+typedef struct
+{
+	hpc3 *owner;
+	int nr;
+
+	uint32_t bp, dp, ctrl;
+	sched_id_t event;	// SCHED_NONE when idle
+
+	// the descriptor that is copied on the device thread
+	bool job_pending, job_receive;
+	uint32_t job_bp, job_cntinfo, job_next;
+	audio_sink *job_sink;	// transmit, NULL: the samples go nowhere
+	uint8_t job_buffer[PBUS_DESC_BCNT + 1];
+} pbus_dma_t;
+
 class hpc3 : public memory
 {
 private:
@@ -17,6 +61,13 @@ private:
 
 	seeq_8003_8020 *seeq;
 
+	hal2 *audio;
+
+	int2 *ioc;
+
+	processor *pp;
+	pbus_dma_t pbus_dma[PBUS_DMA_CHANNELS];
+
 	uint8_t gio_misc;
 
 	void section_8_read_pbus_dma(ws_t ws, uint64_t offset, uint64_t *data);
@@ -37,16 +88,42 @@ private:
 	void section_e_write_sram(ws_t ws, uint64_t offset, uint64_t data);
 	void (hpc3::*sections_write[8])(ws_t ws, uint64_t offset, uint64_t data);
 
+	void pbus_dma_update_irq();
+	void pbus_dma_finish(pbus_dma_t & c, uint32_t bp, uint32_t cntinfo, uint32_t next);
+	void pbus_dma_post(pbus_dma_t & c, uint32_t bp, uint32_t cntinfo, uint32_t next);
+	void pbus_dma_sync(const pbus_dma_t & c);
+
 	void write_fake(ws_t ws, uint64_t offset, uint64_t data);
 	void read_fake(ws_t ws, uint64_t offset, uint64_t *data);
 
 public:
-	hpc3(debug_console *pdc_in, std::string sram_file);
+	hpc3(debug_console *pdc_in, processor *pp_in, std::string sram_file);
 	~hpc3();
 
 	uint64_t get_size() const { return 0x100000; }
 	uint64_t get_mask() const { return 0xfffff; }
 
+	seeq_8003_8020 * get_seeq() const { return seeq; }
+	z85c30 * get_serial(int nr) const { return nr == 0 ? ser1 : ser2; }
+	hal2 * get_hal2() const { return audio; }
+	int2 * get_int2() const { return ioc; }
+
+	// the serial chips, the IOC and HAL2 too; the Seeq has no state and
+	// the NVRAM is kept in its own file
+	void save_state(snapshot_writer & sw) const;
+	void load_state(snapshot_reader & sr);
+
+	// both serial channels share one interrupt
+	void serial_update_irq();
+
+	// scheduler callback: moves the next descriptor of the channel
+	void pbus_dma_run(int nr, uint64_t now);
+
+	// device thread jobs: the copy, then (processor thread) what the guest
+	// sees of it
+	void pbus_dma_copy(int nr);
+	void pbus_dma_done(int nr, uint64_t now);
+
 	void read_64b(uint64_t offset, uint64_t *data);
 	void read_32b(uint64_t offset, uint32_t *data);
 	void read_16b(uint64_t offset, uint16_t *data);
@@ -56,3 +133,5 @@ public:
 	void write_16b(uint64_t offset, uint16_t data);
 	void write_8b(uint64_t offset, uint8_t data);
 };
+
+#endif
@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "input_log.h"
+#include "log.h"
+
+input_log::input_log(std::string file_in, bool replay) : file(file_in), replaying(replay), last_cycle(0), n_records(0), have_next(false), end_reported(false), next_cycle(0), next_type(0)
+{
+	char magic[8];
+
+	if (replaying)
+	{
+		fh = fopen(file.c_str(), "rb");
+		if (!fh)
+			error_exit("cannot open input log %s", file.c_str());
+
+		if (fread(magic, sizeof magic, 1, fh) != 1 || memcmp(magic, INPUT_LOG_MAGIC, sizeof magic) != 0)
+			error_exit("%s is not an input log", file.c_str());
+
+		read_next();
+	}
+	else
+	{
+		fh = fopen(file.c_str(), "wb");
+		if (!fh)
+			error_exit("cannot create input log %s", file.c_str());
+
+		memcpy(magic, INPUT_LOG_MAGIC, sizeof magic);
+
+		if (fwrite(magic, sizeof magic, 1, fh) != 1)
+			error_exit("failed writing to input log %s", file.c_str());
+	}
+}
+
+input_log::~input_log()
+{
+	dolog("input log %s: %llu records %s", file.c_str(), n_records, replaying ? "replayed" : "recorded");
+
+	fclose(fh);
+}
+
+void input_log::put_varint(uint64_t v)
+{
+	while(v >= 0x80)
+	{
+		fputc(0x80 | (v & 0x7f), fh);
+		v >>= 7;
+	}
+
+	if (fputc(v, fh) == EOF)
+		error_exit("failed writing to input log %s", file.c_str());
+}
+
+bool input_log::get_varint(uint64_t *v)
+{
+	*v = 0;
+
+	for(int shift=0; shift<64; shift += 7)
+	{
+		int c = fgetc(fh);
+		if (c == EOF)
+			return false;
+
+		*v |= uint64_t(c & 0x7f) << shift;
+
+		if (!(c & 0x80))
+			return true;
+	}
+
+	error_exit("input log %s is corrupt", file.c_str());
+
+	return false;
+}
+
+void input_log::put_record(uint64_t now, uint8_t type)
+{
+	put_varint(now - last_cycle);
+	fputc(type, fh);
+
+	last_cycle = now;
+	n_records++;
+}
+
+void input_log::read_next()
+{
+	uint64_t delta = 0;
+	int type = EOF;
+
+	have_next = get_varint(&delta) && (type = fgetc(fh)) != EOF;
+
+	if (have_next)
+	{
+		next_cycle = last_cycle + delta;
+		next_type = type;
+		last_cycle = next_cycle;
+	}
+	else if (!end_reported)
+	{
+		dolog("input log %s: end of replay after %llu records", file.c_str(), n_records);
+		end_reported = true;
+	}
+
+	for(const il_reader_t & r : readers)
+		r.cb(r.ctx);
+}
+
+bool input_log::peek(uint64_t *cycle, uint8_t *type) const
+{
+	if (!have_next)
+		return false;
+
+	*cycle = next_cycle;
+	*type = next_type;
+
+	return true;
+}
+
+void input_log::add_reader(void (*cb)(void *ctx), void *ctx)
+{
+	il_reader_t r = { cb, ctx };
+
+	readers.push_back(r);
+}
+
+void input_log::remove_reader(void (*cb)(void *ctx), void *ctx)
+{
+	for(size_t index=0; index<readers.size(); index++)
+	{
+		if (readers[index].cb == cb && readers[index].ctx == ctx)
+		{
+			readers.erase(readers.begin() + index);
+			break;
+		}
+	}
+}
+
+// the payload follows when true is returned
+bool input_log::match(uint64_t now, uint8_t type)
+{
+	if (!have_next)
+		return false;
+
+	if (next_cycle < now)
+		error_exit("replay diverged: record of type %02x for cycle %llu still pending at cycle %llu", next_type, next_cycle, now);
+
+	if (next_cycle != now || next_type != type)
+		return false;
+
+	n_records++;
+
+	return true;
+}
+
+void input_log::record_serial(int channel, uint64_t now, uint8_t c)
+{
+	put_record(now, (IL_SERIAL_RX << 4) | channel);
+	fputc(c, fh);
+}
+
+bool input_log::replay_serial(int channel, uint64_t now, uint8_t *c)
+{
+	if (!match(now, (IL_SERIAL_RX << 4) | channel))
+		return false;
+
+	int v = fgetc(fh);
+	if (v == EOF)
+		error_exit("input log %s is truncated", file.c_str());
+
+	*c = v;
+
+	read_next();
+
+	return true;
+}
+
+uint32_t input_log::get_random(uint64_t now)
+{
+	uint64_t v = 0;
+
+	if (!replaying)
+	{
+		v = uint32_t(rand());
+
+		put_record(now, IL_RANDOM << 4);
+		put_varint(v);
+	}
+	else if (match(now, IL_RANDOM << 4))
+	{
+		if (!get_varint(&v))
+			error_exit("input log %s is truncated", file.c_str());
+
+		read_next();
+	}
+	else if (have_next)
+	{
+		error_exit("replay diverged: random number requested at cycle %llu, next record of type %02x at %llu", now, next_type, next_cycle);
+	}
+	else
+	{
+		v = uint32_t(rand());	// past the end of the log
+	}
+
+	return v;
+}
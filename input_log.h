@@ -0,0 +1,84 @@
+#ifndef __INPUT_LOG__H__
+#define __INPUT_LOG__H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#define INPUT_LOG_MAGIC	"MIEPIL01"
+
+// record types, in the high nibble of the type byte; the low nibble is
+// the device channel
+#define IL_SERIAL_RX	0x1	// payload: the character
+#define IL_RANDOM	0x2	// payload: varint
+
+// Records every value that enters the emulated machine from outside,
+// together with the cycle count at which the guest took it, so that a
+// replay of the log reproduces a run exactly. This only holds when guest
+// time depends on nothing but the executed instructions, so both modes
+// switch the processor and the devices to deterministic timing.
+//
+// The file is a magic followed by records of a varint cycle delta to the
+// previous record, a type byte and the payload. Devices ask the log for
+// input at points that are themselves deterministic (a register read, a
+// scheduler event); when replaying, a record is handed out only when the
+// device, channel and cycle all match, and a record for a cycle that has
+// already passed means the replay diverged. Devices that take input
+// from a scheduler event rather than from a register read look at the
+// next record with peek() and are told when it changes, so that they
+// can schedule that event for the recorded cycle.
+class input_log
+{
+private:
+	FILE *fh;
+	std::string file;
+	bool replaying;
+
+	uint64_t last_cycle;
+	uint64_t n_records;
+
+	// next record when replaying
+	bool have_next, end_reported;
+	uint64_t next_cycle;
+	uint8_t next_type;
+
+	typedef struct
+	{
+		void (*cb)(void *ctx);
+		void *ctx;
+	} il_reader_t;
+
+	std::vector<il_reader_t> readers;
+
+	void put_varint(uint64_t v);
+	bool get_varint(uint64_t *v);
+	void put_record(uint64_t now, uint8_t type);
+	void read_next();
+	bool match(uint64_t now, uint8_t type);
+
+public:
+	input_log(std::string file_in, bool replay);
+	~input_log();
+
+	bool is_replaying() const { return replaying; }
+
+	// serial input: `c' is written when recording, filled in when
+	// replaying (returns false if the guest received nothing now)
+	void record_serial(int channel, uint64_t now, uint8_t c);
+	bool replay_serial(int channel, uint64_t now, uint8_t *c);
+
+	// a random number, recorded or replayed
+	uint32_t get_random(uint64_t now);
+
+	// replaying: the cycle and type of the next record, false at the end
+	bool peek(uint64_t *cycle, uint8_t *type) const;
+
+	// replaying: cb(ctx) is called whenever the next record changes
+	void add_reader(void (*cb)(void *ctx), void *ctx);
+	void remove_reader(void (*cb)(void *ctx), void *ctx);
+
+	uint64_t get_n_records() const { return n_records; }
+};
+
+#endif
@@ -0,0 +1,210 @@
+#include "debug.h"
+#include "int2.h"
+#include "processor.h"
+
+int2::int2(debug_console *pdc_in, processor *pp_in) : pdc(pdc_in), pp(pp_in)
+{
+	local0_status = local0_mask = 0;
+	local1_status = local1_mask = 0;
+	map_status = map_mask0 = map_mask1 = map_pol = 0;
+	error_status = 0;
+	timers = 0;
+
+	pit = new pit8254(pdc, pp, this);
+
+	ip_lines = 0;
+}
+
+int2::~int2()
+{
+	delete pit;
+}
+
+// the only place where the masks are evaluated: the processor just gets
+// the resulting lines
+void int2::update()
+{
+	if (map_status & map_mask0)
+		local0_status |= 1 << INT2_L0_MAP0;
+	else
+		local0_status &= ~(1 << INT2_L0_MAP0);
+
+	if (map_status & map_mask1)
+		local1_status |= 1 << INT2_L1_MAP1;
+	else
+		local1_status &= ~(1 << INT2_L1_MAP1);
+
+	uint32_t lines = timers;
+
+	if (local0_status & local0_mask)
+		lines |= INT2_IP_LOCAL0;
+
+	if (local1_status & local1_mask)
+		lines |= INT2_IP_LOCAL1;
+
+	if (lines != ip_lines)
+	{
+		DEBUG(pdc -> dc_log("INT2: interrupt lines %04x -> %04x", ip_lines, lines));
+
+		ip_lines = lines;
+
+		pp -> set_ip_lines(ip_lines);
+	}
+}
+
+void int2::set_local0(int bit, bool state)
+{
+	uint8_t new_status = state ? local0_status | (1 << bit) : local0_status & ~(1 << bit);
+
+	if (new_status != local0_status)
+	{
+		local0_status = new_status;
+		update();
+	}
+}
+
+void int2::set_local1(int bit, bool state)
+{
+	uint8_t new_status = state ? local1_status | (1 << bit) : local1_status & ~(1 << bit);
+
+	if (new_status != local1_status)
+	{
+		local1_status = new_status;
+		update();
+	}
+}
+
+void int2::set_map(int bit, bool state)
+{
+	uint8_t new_status = state ? map_status | (1 << bit) : map_status & ~(1 << bit);
+
+	if (new_status != map_status)
+	{
+		map_status = new_status;
+		update();
+	}
+}
+
+// latched until cleared through INT2_TIMER_CLEAR
+void int2::set_timer(int nr)
+{
+	timers |= nr ? INT2_IP_TIMER1 : INT2_IP_TIMER0;
+
+	update();
+}
+
+uint8_t int2::read(uint64_t offset)
+{
+	switch(offset & 0x3c)
+	{
+		case INT2_LOCAL0_STATUS:
+			return local0_status;
+		case INT2_LOCAL0_MASK:
+			return local0_mask;
+		case INT2_LOCAL1_STATUS:
+			return local1_status;
+		case INT2_LOCAL1_MASK:
+			return local1_mask;
+		case INT2_MAP_STATUS:
+			return map_status;
+		case INT2_MAP_MASK0:
+			return map_mask0;
+		case INT2_MAP_MASK1:
+			return map_mask1;
+		case INT2_MAP_POL:
+			return map_pol;
+		case INT2_ERROR_STATUS:
+			return error_status;
+		case INT2_TCNT0:
+		case INT2_TCNT1:
+		case INT2_TCNT2:
+			return pit -> read(((offset & 0x3c) - INT2_TCNT0) >> 2);
+	}
+
+	pdc -> dc_log("INT2 read %02llx not implemented", offset);
+
+	return 0;
+}
+
+void int2::write(uint64_t offset, uint8_t data)
+{
+	DEBUG(pdc -> dc_log("INT2 write %02llx: %02x", offset, data));
+
+	switch(offset & 0x3c)
+	{
+		case INT2_LOCAL0_MASK:
+			local0_mask = data;
+			break;
+		case INT2_LOCAL1_MASK:
+			local1_mask = data;
+			break;
+		case INT2_MAP_MASK0:
+			map_mask0 = data;
+			break;
+		case INT2_MAP_MASK1:
+			map_mask1 = data;
+			break;
+		case INT2_MAP_POL:
+			map_pol = data;
+			return;
+		case INT2_TIMER_CLEAR:
+			if (data & 1)
+				timers &= ~INT2_IP_TIMER0;
+			if (data & 2)
+				timers &= ~INT2_IP_TIMER1;
+			break;
+		case INT2_ERROR_STATUS:
+			error_status = 0;
+			return;
+		case INT2_TCNT0:
+		case INT2_TCNT1:
+		case INT2_TCNT2:
+			pit -> write(((offset & 0x3c) - INT2_TCNT0) >> 2, data);
+			return;
+		case INT2_TCWORD:
+			pit -> write_control(data);
+			return;
+		default:
+			pdc -> dc_log("INT2 write %02llx: %02x not implemented", offset, data);
+			return;
+	}
+
+	update();
+}
+
+void int2::save_state(snapshot_writer & sw) const
+{
+	sw.put_u8(local0_status);
+	sw.put_u8(local0_mask);
+	sw.put_u8(local1_status);
+	sw.put_u8(local1_mask);
+	sw.put_u8(map_status);
+	sw.put_u8(map_mask0);
+	sw.put_u8(map_mask1);
+	sw.put_u8(map_pol);
+	sw.put_u8(error_status);
+	sw.put_u32(timers);
+
+	pit -> save_state(sw);
+}
+
+void int2::load_state(snapshot_reader & sr)
+{
+	local0_status = sr.get_u8();
+	local0_mask = sr.get_u8();
+	local1_status = sr.get_u8();
+	local1_mask = sr.get_u8();
+	map_status = sr.get_u8();
+	map_mask0 = sr.get_u8();
+	map_mask1 = sr.get_u8();
+	map_pol = sr.get_u8();
+	error_status = sr.get_u8();
+	timers = sr.get_u32();
+
+	pit -> load_state(sr);
+
+	// the processor lines follow from the restored state
+	ip_lines = 0;
+	pp -> set_ip_lines(0);
+	update();
+}
@@ -0,0 +1,98 @@
+#ifndef __INT2__H__
+#define __INT2__H__
+
+#include <stdint.h>
+
+#include "debug_console.h"
+#include "pit8254.h"
+#include "snapshot_state.h"
+
+class processor;
+
+// registers, relative to 0x1fbd9880; each one is the low byte of a 32 bit
+// word
+#define INT2_LOCAL0_STATUS	0x00
+#define INT2_LOCAL0_MASK	0x04
+#define INT2_LOCAL1_STATUS	0x08
+#define INT2_LOCAL1_MASK	0x0c
+#define INT2_MAP_STATUS		0x10
+#define INT2_MAP_MASK0		0x14
+#define INT2_MAP_MASK1		0x18
+#define INT2_MAP_POL		0x1c
+#define INT2_TIMER_CLEAR	0x20	// write: bit 0 clears timer 0, bit 1 timer 1
+#define INT2_ERROR_STATUS	0x24
+#define INT2_TCNT0		0x30
+#define INT2_TCNT1		0x34
+#define INT2_TCNT2		0x38
+#define INT2_TCWORD		0x3c
+
+// local0 sources
+#define INT2_L0_FIFO		0
+#define INT2_L0_SCSI0		1
+#define INT2_L0_SCSI1		2
+#define INT2_L0_ENET		3
+#define INT2_L0_GFX_DMA		4
+#define INT2_L0_PARALLEL	5
+#define INT2_L0_GRAPHICS	6
+#define INT2_L0_MAP0		7	// map status & map mask 0
+
+// local1 sources
+#define INT2_L1_ISDN_ISAC	0
+#define INT2_L1_POWER		1
+#define INT2_L1_ISDN_HSCX	2
+#define INT2_L1_MAP1		3	// map status & map mask 1
+#define INT2_L1_HPC_DMA		4
+#define INT2_L1_AC_FAIL		5
+#define INT2_L1_VIDEO		6
+#define INT2_L1_RETRACE		7
+
+// mappable sources
+#define INT2_MAP_SERIAL		5
+
+// processor interrupt lines, as IP bits of the Cause register
+#define INT2_IP_LOCAL0		(1 << 10)
+#define INT2_IP_LOCAL1		(1 << 11)
+#define INT2_IP_TIMER0		(1 << 12)
+#define INT2_IP_TIMER1		(1 << 13)
+
+// The INT2/INT3 interrupt controller in the IOC. Devices set and clear
+// their status bits when their interrupt condition changes; the
+// controller then recomputes which processor lines are raised and hands
+// them to the processor, which keeps a single "pending and enabled" word.
+class int2
+{
+private:
+	debug_console *pdc;
+	processor *pp;
+
+	uint8_t local0_status, local0_mask;
+	uint8_t local1_status, local1_mask;
+	uint8_t map_status, map_mask0, map_mask1, map_pol;
+	uint8_t error_status;
+	uint32_t timers;	// INT2_IP_TIMER* latched by the interval timer
+
+	pit8254 *pit;
+
+	uint32_t ip_lines;
+
+	void update();
+
+public:
+	int2(debug_console *pdc_in, processor *pp_in);
+	~int2();
+
+	void set_local0(int bit, bool state);
+	void set_local1(int bit, bool state);
+	void set_map(int bit, bool state);
+	void set_timer(int nr);
+
+	uint32_t get_ip_lines() const { return ip_lines; }
+
+	uint8_t read(uint64_t offset);
+	void write(uint64_t offset, uint8_t data);
+
+	void save_state(snapshot_writer & sw) const;
+	void load_state(snapshot_reader & sr);
+};
+
+#endif
@@ -0,0 +1,456 @@
+#include <algorithm>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "error.h"
+#include "io_reactor.h"
+#include "placement.h"
+#include "utils.h"
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<io_reactor *> registry;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+
+static void *io_reactor_thread(void *arg)
+{
+	place_thread(PLACE_IO, "io reactor");
+
+	((io_reactor *)arg) -> run();
+
+	return NULL;
+}
+
+static void flush_log_timer(void *ctx)
+{
+	((io_reactor *)ctx) -> flush_log();
+}
+
+static void flush_at_exit()
+{
+	io_reactor::flush_all_logs(true);
+}
+
+// a failed ASSERT: the last lines before it matter most. The locks are
+// only tried, whoever holds them may never continue.
+static void flush_at_abort()
+{
+	io_reactor::flush_all_logs(false);
+}
+
+// the child of a fork must not find the registry locked by a thread
+// that does not exist there
+static void atfork_prepare()
+{
+	pthread_mutex_lock(&registry_lock);
+}
+
+static void atfork_release()
+{
+	pthread_mutex_unlock(&registry_lock);
+}
+
+static void registry_init()
+{
+	atexit(flush_at_exit);
+	set_abort_hook(flush_at_abort);
+
+	pthread_atfork(atfork_prepare, atfork_release, atfork_release);
+}
+
+static uint64_t get_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+io_reactor::io_reactor(std::string name_in) : name(name_in), epoll_fd(-1), wake_fd(-1), requests(REACTOR_REQUESTS), wake_pending(false), n_requests_dropped(0), log_lines(REACTOR_LOG_LINES), log_dropped(0), n_log_dropped(0), log_fh(NULL), stop_flag(false)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	pthread_mutex_init(&log_lock, NULL);
+
+	pthread_once(&registry_once, registry_init);
+
+	pthread_mutex_lock(&registry_lock);
+	registry.push_back(this);
+	pthread_mutex_unlock(&registry_lock);
+
+	setup();
+
+	add_timer(REACTOR_LOG_FLUSH_US, flush_log_timer, this);
+
+	start();
+}
+
+io_reactor::~io_reactor()
+{
+	stop_flag = true;
+	wake();
+
+	pthread_join(th, NULL);
+
+	pthread_mutex_lock(&registry_lock);
+	for(size_t index=0; index<registry.size(); index++)
+	{
+		if (registry[index] == this)
+		{
+			registry.erase(registry.begin() + index);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&registry_lock);
+
+	// what the devices asked for after the thread stopped
+	run_requests();
+
+	flush_log();
+
+	if (log_fh)
+		fclose(log_fh);
+
+	close(wake_fd);
+	close(epoll_fd);
+
+	pthread_mutex_destroy(&log_lock);
+	pthread_mutex_destroy(&lock);
+}
+
+void io_reactor::setup()
+{
+	epoll_fd = epoll_create1(0);
+	if (epoll_fd == -1)
+		error_exit("io_reactor: epoll_create1 failed");
+
+	wake_fd = eventfd(0, EFD_NONBLOCK);
+	if (wake_fd == -1)
+		error_exit("io_reactor: cannot create eventfd");
+
+	struct epoll_event ev = { 0 };
+	ev.events = EPOLLIN;
+	ev.data.fd = wake_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == -1)
+		error_exit("io_reactor: epoll_ctl failed");
+}
+
+void io_reactor::start()
+{
+	if (pthread_create(&th, NULL, io_reactor_thread, this))
+		error_exit("io_reactor: cannot start thread");
+}
+
+void io_reactor::after_fork()
+{
+	close(epoll_fd);
+	close(wake_fd);
+
+	// the thread may have held them at the fork: start with new ones
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	pthread_mutex_init(&log_lock, NULL);
+
+	handlers.clear();
+	timers.clear();
+
+	// for devices of the parent
+	reactor_request_t r;
+	while(requests.pop(&r))
+	{
+	}
+
+	wake_pending = false;
+	stop_flag = false;
+
+	setup();
+
+	add_timer(REACTOR_LOG_FLUSH_US, flush_log_timer, this);
+
+	start();
+}
+
+void io_reactor::add(int fd, uint32_t events, reactor_fd_callback_t cb, void *ctx)
+{
+	pthread_mutex_lock(&lock);
+
+	reactor_handler_t h = { cb, ctx };
+	handlers[fd] = h;
+
+	struct epoll_event ev = { 0 };
+	ev.events = events;
+	ev.data.fd = fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+		error_exit("io_reactor %s: cannot add fd %d", name.c_str(), fd);
+
+	pthread_mutex_unlock(&lock);
+}
+
+void io_reactor::modify(int fd, uint32_t events)
+{
+	struct epoll_event ev = { 0 };
+	ev.events = events;
+	ev.data.fd = fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void io_reactor::remove(int fd)
+{
+	pthread_mutex_lock(&lock);
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	handlers.erase(fd);
+
+	pthread_mutex_unlock(&lock);
+}
+
+void io_reactor::add_timer(uint64_t period_us, reactor_callback_t cb, void *ctx)
+{
+	pthread_mutex_lock(&lock);
+
+	reactor_timer_t t = { period_us, get_us() + period_us, cb, ctx };
+	timers.push_back(t);
+
+	pthread_mutex_unlock(&lock);
+
+	wake();
+}
+
+void io_reactor::remove_timer(reactor_callback_t cb, void *ctx)
+{
+	pthread_mutex_lock(&lock);
+
+	for(size_t index=0; index<timers.size(); index++)
+	{
+		if (timers[index].cb == cb && timers[index].ctx == ctx)
+		{
+			timers.erase(timers.begin() + index);
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&lock);
+}
+
+void io_reactor::wake()
+{
+	uint64_t one = 1;
+	(void)write(wake_fd, &one, sizeof one);
+}
+
+bool io_reactor::request(reactor_callback_t cb, void *ctx)
+{
+	reactor_request_t r = { cb, ctx };
+
+	// not run here nor waited for: the callbacks do I/O
+	if (!requests.push(r))
+	{
+		n_requests_dropped++;
+
+		if (!wake_pending.exchange(true))
+			wake();
+
+		return false;
+	}
+
+	// the thread clears the flag before it takes the requests
+	if (!wake_pending.exchange(true))
+		wake();
+
+	return true;
+}
+
+void io_reactor::run_requests()
+{
+	pthread_mutex_lock(&lock);
+
+	wake_pending = false;
+
+	reactor_request_t r;
+	while(requests.pop(&r))
+		r.cb(r.ctx);
+
+	pthread_mutex_unlock(&lock);
+}
+
+// runs the timers that are due, returns the epoll_wait() timeout
+int io_reactor::run_timers()
+{
+	std::vector<reactor_timer_t> due;
+	uint64_t now = get_us();
+
+	pthread_mutex_lock(&lock);
+
+	for(reactor_timer_t & t : timers)
+	{
+		if (t.next_us > now)
+			continue;
+
+		due.push_back(t);
+
+		// no catching up after a stall
+		t.next_us += t.period_us;
+		if (t.next_us <= now)
+			t.next_us = now + t.period_us;
+	}
+
+	for(const reactor_timer_t & d : due)
+	{
+		// a timer that ran earlier in this round may have removed it
+		for(const reactor_timer_t & t : timers)
+		{
+			if (t.cb == d.cb && t.ctx == d.ctx)
+			{
+				d.cb(d.ctx);
+				break;
+			}
+		}
+	}
+
+	uint64_t next = UINT64_MAX;
+	for(const reactor_timer_t & t : timers)
+		next = std::min(next, t.next_us);
+
+	pthread_mutex_unlock(&lock);
+
+	if (next == UINT64_MAX)
+		return -1;
+
+	now = get_us();
+
+	return next <= now ? 0 : int((next - now + 999) / 1000);
+}
+
+void io_reactor::run()
+{
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+
+	while(!stop_flag)
+	{
+		int timeout = run_timers();
+
+		int n = epoll_wait(epoll_fd, events, REACTOR_MAX_EVENTS, timeout);
+
+		for(int index=0; index<n; index++)
+		{
+			int fd = events[index].data.fd;
+
+			if (fd == wake_fd)
+			{
+				uint64_t dummy;
+				(void)read(wake_fd, &dummy, sizeof dummy);
+				continue;
+			}
+
+			pthread_mutex_lock(&lock);
+
+			// may have been removed by a handler that ran before
+			std::map<int, reactor_handler_t>::iterator it = handlers.find(fd);
+			if (it != handlers.end())
+				it -> second.cb(it -> second.ctx, fd, events[index].events);
+
+			pthread_mutex_unlock(&lock);
+		}
+
+		run_requests();
+	}
+}
+
+void io_reactor::log(const char *file, const std::string & line)
+{
+	// once there is room again the reader learns how many are missing
+	if (log_dropped && queue_log(file, format("io_reactor: %llu log lines dropped, the I/O thread did not keep up", log_dropped)))
+		log_dropped = 0;
+
+	if (!queue_log(file, line))
+	{
+		log_dropped++;
+		n_log_dropped++;
+	}
+}
+
+bool io_reactor::queue_log(const char *file, const std::string & line)
+{
+	reactor_log_line_t *slot = log_lines.reserve();
+
+	if (!slot)
+		return false;
+
+	slot -> file = file;
+	slot -> text = new std::string(line);
+	log_lines.commit();
+
+	return true;
+}
+
+void io_reactor::flush_log()
+{
+	pthread_mutex_lock(&log_lock);
+
+	write_log();
+
+	pthread_mutex_unlock(&log_lock);
+}
+
+// with log_lock held
+void io_reactor::write_log()
+{
+	reactor_log_line_t l;
+	bool written = false;
+
+	while(log_lines.pop(&l))
+	{
+		if (!log_fh || log_fh_name != l.file)
+		{
+			if (log_fh)
+				fclose(log_fh);
+
+			log_fh_name = l.file;
+
+			log_fh = fopen(l.file, "a+");
+			if (!log_fh)
+				error_exit("error accessing logfile");
+		}
+
+		fprintf(log_fh, "%s\n", l.text -> c_str());
+		delete l.text;
+
+		written = true;
+	}
+
+	if (written)
+		fflush(log_fh);
+}
+
+void io_reactor::flush_all_logs(bool wait)
+{
+	if (wait)
+		pthread_mutex_lock(&registry_lock);
+	else if (pthread_mutex_trylock(&registry_lock))
+		return;
+
+	for(io_reactor *r : registry)
+	{
+		if (wait)
+			pthread_mutex_lock(&r -> log_lock);
+		else if (pthread_mutex_trylock(&r -> log_lock))
+			continue;
+
+		r -> write_log();
+
+		pthread_mutex_unlock(&r -> log_lock);
+	}
+
+	pthread_mutex_unlock(&registry_lock);
+}
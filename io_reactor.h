@@ -0,0 +1,134 @@
+#ifndef __IO_REACTOR__H__
+#define __IO_REACTOR__H__
+
+#include <atomic>
+#include <map>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "ring_buffer.h"
+
+#define REACTOR_MAX_EVENTS	16
+#define REACTOR_REQUESTS	1024	// entries, must be a power of 2
+#define REACTOR_LOG_LINES	4096	// entries, must be a power of 2
+#define REACTOR_LOG_FLUSH_US	10000
+
+typedef void (*reactor_fd_callback_t)(void *ctx, int fd, uint32_t events);
+typedef void (*reactor_callback_t)(void *ctx);
+
+typedef struct
+{
+	reactor_fd_callback_t cb;
+	void *ctx;
+} reactor_handler_t;
+
+typedef struct
+{
+	uint64_t period_us, next_us;
+	reactor_callback_t cb;
+	void *ctx;
+} reactor_timer_t;
+
+typedef struct
+{
+	reactor_callback_t cb;
+	void *ctx;
+} reactor_request_t;
+
+typedef struct
+{
+	const char *file;
+	std::string *text;
+} reactor_log_line_t;
+
+// The I/O thread of one machine. It owns the host file descriptors of
+// the serial lines and the network port, waits for them with epoll and
+// runs the periodic work of the devices (flushing console output, the
+// log file). The emulation thread never makes a blocking call for I/O:
+// it exchanges data with the devices through their lock-free queues,
+// which the device models poll from their scheduler events, and it
+// hands work to this thread with request(). The log lines of the machine
+// go through a queue too and are written here.
+//
+// Handlers and timers run with a (recursive) lock held, so once remove()
+// or remove_timer() returned, the callback is not running and will not
+// be called again; a callback may itself (un)register.
+class io_reactor
+{
+private:
+	std::string name;
+	int epoll_fd, wake_fd;
+
+	pthread_mutex_t lock;
+	std::map<int, reactor_handler_t> handlers;
+	std::vector<reactor_timer_t> timers;
+
+	// single producer: the thread that runs the machine
+	ring_buffer<reactor_request_t> requests;
+	std::atomic_bool wake_pending;
+	uint64_t n_requests_dropped;
+
+	ring_buffer<reactor_log_line_t> log_lines;
+	uint64_t log_dropped;	// since the last note in the log
+	uint64_t n_log_dropped;
+	pthread_mutex_t log_lock;	// consumer side: the thread, flush_log()
+	FILE *log_fh;
+	std::string log_fh_name;
+
+	pthread_t th;
+	std::atomic_bool stop_flag;
+
+	void setup();
+	void start();
+	void wake();
+	int run_timers();
+	void write_log();
+	bool queue_log(const char *file, const std::string & line);
+
+public:
+	io_reactor(std::string name);
+	~io_reactor();
+
+	void run();
+
+	// in the child of a fork: the thread is gone and the epoll instance
+	// is shared with the parent. Starts over without handlers and timers.
+	void after_fork();
+
+	void add(int fd, uint32_t events, reactor_fd_callback_t cb, void *ctx);
+	void modify(int fd, uint32_t events);
+	void remove(int fd);
+
+	void add_timer(uint64_t period_us, reactor_callback_t cb, void *ctx);
+	void remove_timer(reactor_callback_t cb, void *ctx);
+
+	// emulation thread: cb(ctx) runs on the I/O thread soon. Requests of
+	// one burst share one wakeup. Never waits: when the queue is full the
+	// request is dropped and counted and false is returned. A device keeps
+	// at most one request queued (a pending flag), so this only happens
+	// with more devices than REACTOR_REQUESTS.
+	bool request(reactor_callback_t cb, void *ctx);
+	uint64_t get_n_requests_dropped() const { return n_requests_dropped; }
+
+	// runs the queued requests now; a device calls it when it goes away
+	// so that none is left for it
+	void run_requests();
+
+	// emulation thread: the line (without newline) is appended to file
+	// later; never waits: when the queue is full the line is dropped and
+	// counted, a note with the count follows once there is room
+	void log(const char *file, const std::string & line);
+	uint64_t get_n_log_dropped() const { return n_log_dropped; }
+
+	// writes the queued log lines, from any thread; also at exit() and
+	// when an ASSERT fails
+	void flush_log();
+
+	// wait: false when no lock may be waited for (in a signal handler)
+	static void flush_all_logs(bool wait);
+};
+
+#endif
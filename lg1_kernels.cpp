@@ -0,0 +1,293 @@
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "lg1_kernels.h"
+
+static inline uint8_t rop(uint8_t s, uint8_t d, uint8_t op)
+{
+	switch(op)
+	{
+		case REX_LO_ZERO:	return 0x00;
+		case REX_LO_AND:	return s & d;
+		case REX_LO_ANDR:	return s & ~d;
+		case REX_LO_SRC:	return s;
+		case REX_LO_ANDI:	return ~s & d;
+		case REX_LO_DST:	return d;
+		case REX_LO_XOR:	return s ^ d;
+		case REX_LO_OR:		return s | d;
+		case REX_LO_NOR:	return ~(s | d);
+		case REX_LO_XNOR:	return ~(s ^ d);
+		case REX_LO_NDST:	return ~d;
+		case REX_LO_ORR:	return s | ~d;
+		case REX_LO_NSRC:	return ~s;
+		case REX_LO_ORI:	return ~s | d;
+		case REX_LO_NAND:	return ~(s & d);
+	}
+
+	return 0xff;	// REX_LO_ONE
+}
+
+static inline uint8_t apply(uint8_t s, uint8_t d, uint8_t op, uint8_t wrmask)
+{
+	return (d & ~wrmask) | (rop(s, d, op) & wrmask);
+}
+
+static inline bool pattern_bit(uint32_t pattern, unsigned nr)
+{
+	return (pattern >> (31 - (nr & 31))) & 1;
+}
+
+void lg1_fill_scalar(uint8_t *dst, size_t n, uint8_t color, uint8_t wrmask, uint8_t logic_op)
+{
+	for(size_t index=0; index<n; index++)
+		dst[index] = apply(color, dst[index], logic_op, wrmask);
+}
+
+void lg1_pattern_fill_scalar(uint8_t *dst, size_t n, uint32_t pattern, unsigned phase, uint8_t fg, uint8_t bg, bool opaque, uint8_t wrmask, uint8_t logic_op)
+{
+	for(size_t index=0; index<n; index++)
+	{
+		bool set = pattern_bit(pattern, phase + index);
+
+		if (set || opaque)
+			dst[index] = apply(set ? fg : bg, dst[index], logic_op, wrmask);
+	}
+}
+
+void lg1_copy_scalar(uint8_t *dst, const uint8_t *src, size_t n, uint8_t wrmask, uint8_t logic_op)
+{
+	if (dst <= src || dst >= src + n)
+	{
+		for(size_t index=0; index<n; index++)
+			dst[index] = apply(src[index], dst[index], logic_op, wrmask);
+	}
+	else
+	{
+		for(size_t index=n; index>0; index--)
+			dst[index - 1] = apply(src[index - 1], dst[index - 1], logic_op, wrmask);
+	}
+}
+
+void lg1_to_rgb32_scalar(uint32_t *dst, const uint8_t *src, size_t n, const uint32_t *palette)
+{
+	for(size_t index=0; index<n; index++)
+		dst[index] = palette[src[index]];
+}
+
+#ifdef __SSE2__
+// the logic operation is a template parameter so that the switch is
+// resolved at compile time and each loop body is a handful of
+// instructions
+template <int op>
+static inline __m128i rop_sse2(__m128i s, __m128i d)
+{
+	const __m128i ones = _mm_set1_epi8(-1);
+
+	switch(op)
+	{
+		case REX_LO_ZERO:	return _mm_setzero_si128();
+		case REX_LO_AND:	return _mm_and_si128(s, d);
+		case REX_LO_ANDR:	return _mm_andnot_si128(d, s);
+		case REX_LO_SRC:	return s;
+		case REX_LO_ANDI:	return _mm_andnot_si128(s, d);
+		case REX_LO_DST:	return d;
+		case REX_LO_XOR:	return _mm_xor_si128(s, d);
+		case REX_LO_OR:		return _mm_or_si128(s, d);
+		case REX_LO_NOR:	return _mm_xor_si128(_mm_or_si128(s, d), ones);
+		case REX_LO_XNOR:	return _mm_xor_si128(_mm_xor_si128(s, d), ones);
+		case REX_LO_NDST:	return _mm_xor_si128(d, ones);
+		case REX_LO_ORR:	return _mm_or_si128(s, _mm_xor_si128(d, ones));
+		case REX_LO_NSRC:	return _mm_xor_si128(s, ones);
+		case REX_LO_ORI:	return _mm_or_si128(_mm_xor_si128(s, ones), d);
+		case REX_LO_NAND:	return _mm_xor_si128(_mm_and_si128(s, d), ones);
+	}
+
+	return ones;
+}
+
+template <int op>
+static inline __m128i apply_sse2(__m128i s, __m128i d, __m128i wrmask)
+{
+	return _mm_or_si128(_mm_andnot_si128(wrmask, d), _mm_and_si128(rop_sse2<op>(s, d), wrmask));
+}
+
+template <int op>
+static void fill_sse2(uint8_t *dst, size_t n, uint8_t color, uint8_t wrmask)
+{
+	const __m128i s = _mm_set1_epi8(color), m = _mm_set1_epi8(wrmask);
+
+	size_t index = 0;
+	for(; index + 16 <= n; index += 16)
+	{
+		__m128i d = _mm_loadu_si128((const __m128i *)&dst[index]);
+
+		_mm_storeu_si128((__m128i *)&dst[index], apply_sse2<op>(s, d, m));
+	}
+
+	lg1_fill_scalar(&dst[index], n - index, color, wrmask, op);
+}
+
+template <int op>
+static void pattern_fill_sse2(uint8_t *dst, size_t n, uint32_t pattern, unsigned phase, uint8_t fg, uint8_t bg, bool opaque, uint8_t wrmask)
+{
+	// lane i tests bit 7 - (i & 7) of its byte: the 16 pattern bits for
+	// a chunk become a 16 byte mask with one compare
+	const __m128i bit_select = _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+	const __m128i vfg = _mm_set1_epi8(fg), vbg = _mm_set1_epi8(bg), vmask = _mm_set1_epi8(wrmask);
+
+	size_t index = 0;
+	for(; index + 16 <= n; index += 16)
+	{
+		unsigned p = (phase + index) & 31;
+		uint32_t rotated = p ? (pattern << p) | (pattern >> (32 - p)) : pattern;
+
+		__m128i bits = _mm_unpacklo_epi64(_mm_set1_epi8(rotated >> 24), _mm_set1_epi8(rotated >> 16));
+		__m128i set = _mm_cmpeq_epi8(_mm_and_si128(bits, bit_select), bit_select);
+
+		__m128i s = _mm_or_si128(_mm_and_si128(set, vfg), _mm_andnot_si128(set, vbg));
+		__m128i m = opaque ? vmask : _mm_and_si128(vmask, set);
+
+		__m128i d = _mm_loadu_si128((const __m128i *)&dst[index]);
+		_mm_storeu_si128((__m128i *)&dst[index], apply_sse2<op>(s, d, m));
+	}
+
+	lg1_pattern_fill_scalar(&dst[index], n - index, pattern, phase + index, fg, bg, opaque, wrmask, op);
+}
+
+template <int op>
+static void copy_sse2(uint8_t *dst, const uint8_t *src, size_t n, uint8_t wrmask)
+{
+	const __m128i m = _mm_set1_epi8(wrmask);
+
+	// every chunk is loaded before it is stored and chunks are processed
+	// away from the overlap, so no chunk reads pixels that were written
+	if (dst <= src || dst >= src + n)
+	{
+		size_t index = 0;
+		for(; index + 16 <= n; index += 16)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i *)&src[index]);
+			__m128i d = _mm_loadu_si128((const __m128i *)&dst[index]);
+
+			_mm_storeu_si128((__m128i *)&dst[index], apply_sse2<op>(s, d, m));
+		}
+
+		lg1_copy_scalar(&dst[index], &src[index], n - index, wrmask, op);
+	}
+	else
+	{
+		size_t index = n;
+		for(; index >= 16; index -= 16)
+		{
+			__m128i s = _mm_loadu_si128((const __m128i *)&src[index - 16]);
+			__m128i d = _mm_loadu_si128((const __m128i *)&dst[index - 16]);
+
+			_mm_storeu_si128((__m128i *)&dst[index - 16], apply_sse2<op>(s, d, m));
+		}
+
+		lg1_copy_scalar(dst, src, index, wrmask, op);
+	}
+}
+
+#define LG1_INSTANTIATE(f) { f<0x0>, f<0x1>, f<0x2>, f<0x3>, f<0x4>, f<0x5>, f<0x6>, f<0x7>, f<0x8>, f<0x9>, f<0xa>, f<0xb>, f<0xc>, f<0xd>, f<0xe>, f<0xf> }
+
+typedef void (*fill_fn_t)(uint8_t *, size_t, uint8_t, uint8_t);
+typedef void (*pattern_fill_fn_t)(uint8_t *, size_t, uint32_t, unsigned, uint8_t, uint8_t, bool, uint8_t);
+typedef void (*copy_fn_t)(uint8_t *, const uint8_t *, size_t, uint8_t);
+
+static const fill_fn_t fill_fns[16] = LG1_INSTANTIATE(fill_sse2);
+static const pattern_fill_fn_t pattern_fill_fns[16] = LG1_INSTANTIATE(pattern_fill_sse2);
+static const copy_fn_t copy_fns[16] = LG1_INSTANTIATE(copy_sse2);
+#endif
+
+void lg1_fill(uint8_t *dst, size_t n, uint8_t color, uint8_t wrmask, uint8_t logic_op)
+{
+	logic_op &= 15;
+
+	// the common case, libc has the fastest memset for this cpu
+	if (wrmask == 0xff && (logic_op == REX_LO_SRC || logic_op == REX_LO_ZERO || logic_op == REX_LO_ONE))
+	{
+		memset(dst, logic_op == REX_LO_SRC ? color : (logic_op == REX_LO_ZERO ? 0x00 : 0xff), n);
+		return;
+	}
+
+#ifdef __SSE2__
+	fill_fns[logic_op](dst, n, color, wrmask);
+#else
+	lg1_fill_scalar(dst, n, color, wrmask, logic_op);
+#endif
+}
+
+void lg1_pattern_fill(uint8_t *dst, size_t n, uint32_t pattern, unsigned phase, uint8_t fg, uint8_t bg, bool opaque, uint8_t wrmask, uint8_t logic_op)
+{
+	logic_op &= 15;
+
+	if (pattern == 0xffffffff || (pattern == 0 && opaque))
+	{
+		lg1_fill(dst, n, pattern ? fg : bg, wrmask, logic_op);
+		return;
+	}
+
+#ifdef __SSE2__
+	pattern_fill_fns[logic_op](dst, n, pattern, phase, fg, bg, opaque, wrmask);
+#else
+	lg1_pattern_fill_scalar(dst, n, pattern, phase, fg, bg, opaque, wrmask, logic_op);
+#endif
+}
+
+void lg1_copy(uint8_t *dst, const uint8_t *src, size_t n, uint8_t wrmask, uint8_t logic_op)
+{
+	logic_op &= 15;
+
+	if (wrmask == 0xff && logic_op == REX_LO_SRC)
+	{
+		memmove(dst, src, n);
+		return;
+	}
+
+#ifdef __SSE2__
+	copy_fns[logic_op](dst, src, n, wrmask);
+#else
+	lg1_copy_scalar(dst, src, n, wrmask, logic_op);
+#endif
+}
+
+void lg1_to_rgb32(uint32_t *dst, const uint8_t *src, size_t n, const uint32_t *palette)
+{
+	size_t index = 0;
+
+#ifdef __AVX2__
+	for(; index + 8 <= n; index += 8)
+	{
+		__m128i idx8 = _mm_loadl_epi64((const __m128i *)&src[index]);
+		__m256i idx32 = _mm256_cvtepu8_epi32(idx8);
+
+		_mm256_storeu_si256((__m256i *)&dst[index], _mm256_i32gather_epi32((const int *)palette, idx32, 4));
+	}
+#else
+	// SSE2 has no gather: unroll so that the loads are independent
+	for(; index + 8 <= n; index += 8)
+	{
+		uint64_t pixels;
+		memcpy(&pixels, &src[index], 8);
+
+		dst[index + 0] = palette[(pixels >>  0) & 0xff];
+		dst[index + 1] = palette[(pixels >>  8) & 0xff];
+		dst[index + 2] = palette[(pixels >> 16) & 0xff];
+		dst[index + 3] = palette[(pixels >> 24) & 0xff];
+		dst[index + 4] = palette[(pixels >> 32) & 0xff];
+		dst[index + 5] = palette[(pixels >> 40) & 0xff];
+		dst[index + 6] = palette[(pixels >> 48) & 0xff];
+		dst[index + 7] = palette[(pixels >> 56) & 0xff];
+	}
+#endif
+
+	lg1_to_rgb32_scalar(&dst[index], &src[index], n - index, palette);
+}
@@ -0,0 +1,49 @@
+#ifndef __LG1_KERNELS__H__
+#define __LG1_KERNELS__H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Pixel kernels for the LG1 (REX) drawing engine. The framebuffer has one
+// byte (a color index) per pixel. Every kernel applies one of the 16 X11
+// style logic operations (REX_LO_*) on source and destination and only
+// touches the bits that are set in the write mask.
+//
+// The plain versions use SSE2 when available, the _scalar versions are
+// the reference implementation (also used for the tails of spans).
+
+#define REX_LO_ZERO	0x0
+#define REX_LO_AND	0x1
+#define REX_LO_ANDR	0x2	// src & ~dst
+#define REX_LO_SRC	0x3
+#define REX_LO_ANDI	0x4	// ~src & dst
+#define REX_LO_DST	0x5
+#define REX_LO_XOR	0x6
+#define REX_LO_OR	0x7
+#define REX_LO_NOR	0x8
+#define REX_LO_XNOR	0x9
+#define REX_LO_NDST	0xa
+#define REX_LO_ORR	0xb	// src | ~dst
+#define REX_LO_NSRC	0xc
+#define REX_LO_ORI	0xd	// ~src | dst
+#define REX_LO_NAND	0xe
+#define REX_LO_ONE	0xf
+
+// n pixels of one color
+void lg1_fill(uint8_t *dst, size_t n, uint8_t color, uint8_t wrmask, uint8_t logic_op);
+void lg1_fill_scalar(uint8_t *dst, size_t n, uint8_t color, uint8_t wrmask, uint8_t logic_op);
+
+// n pixels from a 32 bit (msb first) pattern starting at bit `phase':
+// set bits are drawn in fg, clear bits in bg when opaque, else not at all
+void lg1_pattern_fill(uint8_t *dst, size_t n, uint32_t pattern, unsigned phase, uint8_t fg, uint8_t bg, bool opaque, uint8_t wrmask, uint8_t logic_op);
+void lg1_pattern_fill_scalar(uint8_t *dst, size_t n, uint32_t pattern, unsigned phase, uint8_t fg, uint8_t bg, bool opaque, uint8_t wrmask, uint8_t logic_op);
+
+// n pixels from src to dst, src and dst may overlap (memmove semantics)
+void lg1_copy(uint8_t *dst, const uint8_t *src, size_t n, uint8_t wrmask, uint8_t logic_op);
+void lg1_copy_scalar(uint8_t *dst, const uint8_t *src, size_t n, uint8_t wrmask, uint8_t logic_op);
+
+// color indexes to 0x00RRGGBB through the palette
+void lg1_to_rgb32(uint32_t *dst, const uint8_t *src, size_t n, const uint32_t *palette);
+void lg1_to_rgb32_scalar(uint32_t *dst, const uint8_t *src, size_t n, const uint32_t *palette);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __LG1_SHM__H__
+#define __LG1_SHM__H__
+
+#include <atomic>
+#include <stdint.h>
+
+// Layout of the POSIX shared memory segment in which the LG1 framebuffer
+// lives (miep -F name, /dev/shm/name). The emulator draws directly into
+// it; a viewer maps it read/write (it only writes ack_generation).
+//
+// The header is a sequence lock: the emulator makes `generation' odd,
+// updates dirty[] and palette[] and makes it even again. A reader copies
+// what it needs while the generation is even and unchanged and then
+// stores that generation in ack_generation. The dirty list holds the
+// rectangles drawn since the last acknowledged generation (when nobody
+// acknowledges it grows until it overflows into "everything").
+//
+// The pixels themselves are not covered by the lock: a region may be
+// read while being drawn, it will then be in the next dirty list.
+
+#define LG1_SHM_MAGIC		0x4c473146	// "LG1F"
+#define LG1_SHM_VERSION		1
+#define LG1_SHM_MAX_DIRTY	64
+#define LG1_SHM_ALL_DIRTY	(LG1_SHM_MAX_DIRTY + 1)	// value of n_dirty
+
+typedef struct
+{
+	uint16_t x0, y0, x1, y1;	// inclusive
+} lg1_rect_t;
+
+typedef struct
+{
+	uint32_t magic, version;
+	uint32_t width, height, stride;	// stride in bytes, 1 byte per pixel
+	uint32_t fb_offset;		// from the start of the segment
+
+	std::atomic<uint64_t> generation;
+	std::atomic<uint64_t> ack_generation;
+
+	uint32_t n_dirty;
+	lg1_rect_t dirty[LG1_SHM_MAX_DIRTY];
+
+	uint32_t palette[256];		// 0x00RRGGBB
+} lg1_shm_header_t;
+
+#endif
@@ -2,25 +2,59 @@
 #include <stdio.h>
 
 #include "error.h"
+#include "io_reactor.h"
+#include "log.h"
+#include "machine_context.h"
 
 extern const char *logfile;
 
+static const char * current_logfile(const machine_context *ctx)
+{
+	return ctx -> logfile.empty() ? logfile : ctx -> logfile.c_str();
+}
+
+bool log_enabled()
+{
+	return current_logfile(get_machine_context()) != NULL;
+}
+
 void dolog(const char *fmt, ...)
 {
-	if (logfile)
-	{
-		FILE *fh = fopen(logfile, "a+");
-		if (!fh)
-			error_exit("error accessing logfile");
+	const machine_context *ctx = get_machine_context();
+	const char *file = current_logfile(ctx);
+
+	if (!file)
+		return;
 
+	// the thread that runs a machine does not write files
+	if (ctx -> reactor)
+	{
+		char buffer[4096];
 		va_list ap;
 
 		va_start(ap, fmt);
-		(void)vfprintf(fh, fmt, ap);
+		(void)vsnprintf(buffer, sizeof buffer, fmt, ap);
 		va_end(ap);
 
-		fprintf(fh, "\n");
+		ctx -> reactor -> log(file, ctx -> name.empty() ? buffer : "[" + ctx -> name + "] " + buffer);
 
-		fclose(fh);
+		return;
 	}
+
+	FILE *fh = fopen(file, "a+");
+	if (!fh)
+		error_exit("error accessing logfile");
+
+	if (!ctx -> name.empty())
+		fprintf(fh, "[%s] ", ctx -> name.c_str());
+
+	va_list ap;
+
+	va_start(ap, fmt);
+	(void)vfprintf(fh, fmt, ap);
+	va_end(ap);
+
+	fprintf(fh, "\n");
+
+	fclose(fh);
 }
@@ -1 +1,4 @@
 void dolog(const char *fmt, ...);
+
+// false when dolog() would not write anything
+bool log_enabled();
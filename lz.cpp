@@ -0,0 +1,166 @@
+#include <string.h>
+
+#include "lz.h"
+
+static inline uint32_t load32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof v);
+
+	return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static bool put_length(uint8_t *out, size_t *op, size_t max_out, size_t len)
+{
+	for(; len >= 255; len -= 255)
+	{
+		if (*op >= max_out)
+			return false;
+
+		out[(*op)++] = 255;
+	}
+
+	if (*op >= max_out)
+		return false;
+
+	out[(*op)++] = len;
+
+	return true;
+}
+
+// match_len 0: the final sequence, without offset
+static bool put_sequence(uint8_t *out, size_t *op, size_t max_out, const uint8_t *literals, size_t n_literals, size_t offset, size_t match_len)
+{
+	size_t m = match_len ? match_len - LZ_MIN_MATCH : 0;
+
+	if (*op >= max_out)
+		return false;
+
+	out[(*op)++] = ((n_literals < 15 ? n_literals : 15) << 4) | (m < 15 ? m : 15);
+
+	if (n_literals >= 15 && !put_length(out, op, max_out, n_literals - 15))
+		return false;
+
+	if (*op + n_literals > max_out)
+		return false;
+
+	memcpy(&out[*op], literals, n_literals);
+	*op += n_literals;
+
+	if (!match_len)
+		return true;
+
+	if (*op + 2 > max_out)
+		return false;
+
+	out[(*op)++] = offset;
+	out[(*op)++] = offset >> 8;
+
+	return m < 15 || put_length(out, op, max_out, m - 15);
+}
+
+size_t lz_compress(const uint8_t *in, size_t n, uint8_t *out, size_t max_out)
+{
+	uint32_t table[1 << LZ_HASH_BITS];	// position + 1, 0: empty
+	memset(table, 0x00, sizeof table);
+
+	size_t ip = 0, anchor = 0, op = 0;
+
+	while(ip + LZ_MIN_MATCH <= n)
+	{
+		uint32_t v = load32(&in[ip]);
+		uint32_t h = lz_hash(v);
+		size_t candidate = table[h];
+
+		table[h] = ip + 1;
+
+		if (candidate == 0 || ip - (candidate - 1) > LZ_MAX_OFFSET || load32(&in[candidate - 1]) != v)
+		{
+			ip++;
+			continue;
+		}
+
+		size_t ref = candidate - 1, len = LZ_MIN_MATCH;
+
+		while(ip + len < n && in[ref + len] == in[ip + len])
+			len++;
+
+		if (!put_sequence(out, &op, max_out, &in[anchor], ip - anchor, ip - ref, len))
+			return 0;
+
+		ip += len;
+		anchor = ip;
+	}
+
+	if (!put_sequence(out, &op, max_out, &in[anchor], n - anchor, 0, 0))
+		return 0;
+
+	return op;
+}
+
+static bool get_length(const uint8_t *in, size_t in_len, size_t *ip, size_t *len)
+{
+	for(;;)
+	{
+		if (*ip >= in_len)
+			return false;
+
+		uint8_t b = in[(*ip)++];
+		*len += b;
+
+		if (b != 255)
+			return true;
+	}
+}
+
+bool lz_decompress(const uint8_t *in, size_t in_len, uint8_t *out, size_t n)
+{
+	size_t ip = 0, op = 0;
+
+	while(ip < in_len)
+	{
+		uint8_t token = in[ip++];
+		size_t n_literals = token >> 4;
+
+		if (n_literals == 15 && !get_length(in, in_len, &ip, &n_literals))
+			return false;
+
+		if (ip + n_literals > in_len || op + n_literals > n)
+			return false;
+
+		memcpy(&out[op], &in[ip], n_literals);
+		ip += n_literals;
+		op += n_literals;
+
+		if (ip == in_len)	// the final sequence
+			break;
+
+		if (ip + 2 > in_len)
+			return false;
+
+		size_t offset = in[ip] | (in[ip + 1] << 8);
+		ip += 2;
+
+		size_t len = token & 15;
+		if (len == 15 && !get_length(in, in_len, &ip, &len))
+			return false;
+		len += LZ_MIN_MATCH;
+
+		if (offset == 0 || offset > op || op + len > n)
+			return false;
+
+		// may overlap: byte by byte
+		const uint8_t *src = &out[op - offset];
+		for(size_t index=0; index<len; index++)
+			out[op + index] = src[index];
+
+		op += len;
+	}
+
+	return op == n;
+}
@@ -0,0 +1,24 @@
+#ifndef __LZ__H__
+#define __LZ__H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZ_MIN_MATCH	4
+#define LZ_MAX_OFFSET	65535
+#define LZ_HASH_BITS	12
+
+// A small LZ77 compressor in the style of LZ4: a sequence is a token (4
+// bits literal length, 4 bits match length), the literals, a 16 bit
+// little endian offset and the match. Lengths of 15 and up continue in
+// extra bytes of 255. The last sequence only has literals. It is fast
+// rather than tight: one hash probe per position, no lazy matching.
+
+// returns the compressed size, 0 when it does not fit in max_out bytes
+size_t lz_compress(const uint8_t *in, size_t n, uint8_t *out, size_t max_out);
+
+// returns false when the input is corrupt or does not expand to exactly
+// n bytes
+bool lz_decompress(const uint8_t *in, size_t in_len, uint8_t *out, size_t n);
+
+#endif
@@ -0,0 +1,129 @@
+#include "log.h"
+#include "machine.h"
+#include "placement.h"
+#include "utils.h"
+
+machine::machine(debug_console *pdc, const machine_config_t & cfg) : ctx(cfg.name, cfg.logfile)
+{
+	io = new io_reactor(cfg.name);
+	ctx.reactor = io;
+
+	mb = new memory_bus(pdc);
+
+	p = new processor(pdc, mb);
+
+	mem1 = new memory(MACHINE_RAM_BANK, true);
+	mb -> register_memory(0x08000000, mem1 -> get_size(), mem1);
+	mb -> register_memory(0xffffffff88000000, mem1 -> get_size(), mem1); // KSEG0
+	mb -> register_memory(0xffffffffa8000000, mem1 -> get_size(), mem1); // KSEG1
+	mb -> register_memory(0, 512 * 1024, mem1); // needed for exception vectors
+	mem2 = new memory(MACHINE_RAM_BANK, true);
+	mb -> register_memory(0x20000000, mem2 -> get_size(), mem2);
+
+	// before the guest touches it: pages are allocated on the bound node
+	int node = get_ram_node();
+	if (node != PLACE_NODE_NONE)
+		bind_ram(node);
+
+	m_prom = new rom(cfg.prom_file);
+	mb -> register_memory(0xffffffff1fc00000, m_prom -> get_size(), m_prom);
+	mb -> register_memory(0xffffffff9fc00000, m_prom -> get_size(), m_prom); // KSEG0
+	mb -> register_memory(0xffffffffbfc00000, m_prom -> get_size(), m_prom); // KSEG1
+
+	pmc = new mc(p, pdc);
+	mb -> register_memory(0xffffffff1fa00000, pmc -> get_size(), pmc);
+	mb -> register_memory(0xffffffff9fa00000, pmc -> get_size(), pmc); // KSEG0
+	mb -> register_memory(0xffffffffbfa00000, pmc -> get_size(), pmc); // KSEG1
+
+	lg1 = new graphics_lg1(pdc, cfg.fb_shm);
+	mb -> register_memory(0xffffffff1f3f0000, lg1 -> get_size(), lg1);
+	mb -> register_memory(0xffffffff9f3f0000, lg1 -> get_size(), lg1); // KSEG0
+	mb -> register_memory(0xffffffffbf3f0000, lg1 -> get_size(), lg1); // KSEG1
+	lg1 -> set_done_callback(processor::wake_callback, p);
+
+	hpc = new hpc3(pdc, p, cfg.sram_file);
+	mb -> register_memory(0xffffffff1fb00000, hpc -> get_size(), hpc);
+	mb -> register_memory(0xffffffff9fb00000, hpc -> get_size(), hpc); // KSEG0
+	mb -> register_memory(0xffffffffbfb00000, hpc -> get_size(), hpc); // KSEG1
+
+	hc = NULL;
+	if (!cfg.hostcall_dir.empty())
+	{
+		hc = new hostcall(pdc, p, io, hpc -> get_int2(), cfg.hostcall_dir);
+		mb -> register_memory(0xffffffff00000000 | HC_BASE, hc -> get_size(), hc);
+		mb -> register_memory(0xffffffff80000000 | HC_BASE, hc -> get_size(), hc); // KSEG0
+		mb -> register_memory(0xffffffffa0000000 | HC_BASE, hc -> get_size(), hc); // KSEG1
+	}
+
+	report_cycle = report_idle = 0;
+	report_stalls = report_busy_us = 0;
+	report_ts = get_ts();
+	schedule_report(0);
+}
+
+void machine::schedule_report(uint64_t now)
+{
+	report_event = p -> get_scheduler() -> schedule(now + uint64_t(MACHINE_REPORT_S) * CPU_CLOCK_HZ, report_cb, this);
+}
+
+void machine::report_cb(void *ctx, uint64_t now)
+{
+	((machine *)ctx) -> report(now);
+}
+
+// emulation thread: the line goes through the log queue
+void machine::report(uint64_t now)
+{
+	uint64_t idle = p -> get_idle_cycles();
+
+	// not across a restored snapshot
+	if (now > report_cycle && idle >= report_idle)
+		dolog("idle: %.1f%% of the cycles in the last %ds", (idle - report_idle) * 100.0 / (now - report_cycle), MACHINE_REPORT_S);
+
+	// only while the guest draws
+	uint64_t stalls = lg1 -> get_n_fifo_stalls(), busy_us = lg1 -> get_busy_us();
+	double ts = get_ts();
+
+	if (busy_us != report_busy_us && ts > report_ts)
+		dolog("LG1: render thread busy %.1f%% since the last report, %llu FIFO stalls, FIFO high water %zu/%d", (busy_us - report_busy_us) / 10000.0 / (ts - report_ts), stalls - report_stalls, lg1 -> get_fifo_high_water(), LG1_FIFO_SIZE);
+
+	report_cycle = now;
+	report_idle = idle;
+	report_stalls = stalls;
+	report_busy_us = busy_us;
+	report_ts = ts;
+
+	schedule_report(now);
+}
+
+void machine::log_statistics()
+{
+	dolog("LG1: FIFO high water %zu/%d, %llu stalls, render thread busy %.1f%%", lg1 -> get_fifo_high_water(), LG1_FIFO_SIZE, lg1 -> get_n_fifo_stalls(), lg1 -> get_render_utilisation() * 100.0);
+	dolog("idle: %.1f%% of the cycles", p -> get_idle_percentage());
+}
+
+void machine::bind_ram(int node)
+{
+	mem1 -> set_node(node);
+	mem2 -> set_node(node);
+}
+
+machine::~machine()
+{
+	// the render thread wakes the processor, so it goes first
+	delete lg1;
+
+	// the devices cancel their events at the processor's scheduler
+	p -> get_scheduler() -> cancel(report_event);
+	delete hpc;
+	delete hc;
+	delete p;
+	delete mb;
+	delete pmc;
+	delete mem1;
+	delete mem2;
+	delete m_prom;
+
+	// writes what is left of the log
+	delete io;
+}
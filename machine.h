@@ -0,0 +1,90 @@
+#ifndef __MACHINE__H__
+#define __MACHINE__H__
+
+#include <string>
+
+#include "debug_console.h"
+#include "graphics_lg1.h"
+#include "hostcall.h"
+#include "hpc3.h"
+#include "io_reactor.h"
+#include "machine_context.h"
+#include "mc.h"
+#include "memory.h"
+#include "memory_bus.h"
+#include "processor.h"
+#include "rom.h"
+
+#define MACHINE_RAM_BANK	(256 * 1024 * 1024)
+#define MACHINE_REPORT_S	10	// guest seconds between two reports in the log
+
+typedef struct
+{
+	std::string name;	// of the context, prefixes the log lines
+	std::string logfile;	// empty: the log file of the process
+	std::string prom_file;
+	std::string sram_file;
+	std::string fb_shm;	// empty: a private framebuffer
+	std::string hostcall_dir;	// empty: no host call device
+} machine_config_t;
+
+// One Indy: the processor, two banks of RAM, the PROM, the MC, the LG1
+// and the HPC3 with its devices, all registered at a memory bus of their
+// own. Nothing is shared with other machines but the PROM pages, which
+// are a read-only mapping of the file. Serial lines, network, audio,
+// snapshots etc. are attached by the owner; the host side of the serial
+// lines and the network goes on the I/O thread of the machine. With a
+// host directory in the configuration it gets a host call device too.
+//
+// Every MACHINE_REPORT_S of guest time a scheduler event logs how the
+// last period went (idle share, the LG1 FIFO and render thread while the
+// guest draws); log_statistics() gives the totals.
+class machine
+{
+private:
+	machine_context ctx;
+	io_reactor *io;
+
+	memory_bus *mb;
+	processor *p;
+	memory *mem1, *mem2;
+	rom *m_prom;
+	mc *pmc;
+	graphics_lg1 *lg1;
+	hpc3 *hpc;
+	hostcall *hc;
+
+	sched_id_t report_event;
+	uint64_t report_cycle, report_idle;	// at the last report
+	uint64_t report_stalls, report_busy_us;
+	double report_ts;
+
+	static void report_cb(void *ctx, uint64_t now);
+	void report(uint64_t now);
+	void schedule_report(uint64_t now);
+
+public:
+	machine(debug_console *pdc, const machine_config_t & cfg);
+	~machine();
+
+	machine_context * get_context() { return &ctx; }
+	io_reactor * get_reactor() { return io; }
+
+	memory_bus * get_memory_bus() { return mb; }
+	processor * get_processor() { return p; }
+	memory * get_mem1() { return mem1; }
+	memory * get_mem2() { return mem2; }
+
+	// moves the guest RAM to a NUMA node, pages already touched too
+	void bind_ram(int node);
+	rom * get_prom() { return m_prom; }
+	mc * get_mc() { return pmc; }
+	graphics_lg1 * get_lg1() { return lg1; }
+	hpc3 * get_hpc() { return hpc; }
+	hostcall * get_hostcall() { return hc; }	// may be NULL
+
+	// since the start, e.g. when the machine stops
+	void log_statistics();
+};
+
+#endif
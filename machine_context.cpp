@@ -0,0 +1,22 @@
+#include "machine_context.h"
+
+static machine_context default_context;
+static thread_local machine_context *current_context = NULL;
+
+machine_context::machine_context() : single_step(false), terminate(false), reactor(NULL)
+{
+}
+
+machine_context::machine_context(std::string name_in, std::string logfile_in) : name(name_in), logfile(logfile_in), single_step(false), terminate(false), reactor(NULL)
+{
+}
+
+machine_context * get_machine_context()
+{
+	return current_context ? current_context : &default_context;
+}
+
+void set_machine_context(machine_context *ctx)
+{
+	current_context = ctx;
+}
@@ -0,0 +1,35 @@
+#ifndef __MACHINE_CONTEXT__H__
+#define __MACHINE_CONTEXT__H__
+
+#include <atomic>
+#include <string>
+
+class io_reactor;
+
+// What used to be process wide (the log file, single stepping, the stop
+// flag) but belongs to one emulated machine. The thread that runs a
+// machine makes its context current; code that has no pointer to a
+// machine (dolog(), the debug console) asks get_machine_context().
+// Threads without a current context share the default one, which logs
+// to the log file of the process.
+class machine_context
+{
+public:
+	std::string name;	// prefixes the log lines, may be empty
+	std::string logfile;	// empty: the log file of the process
+	bool single_step;
+	std::atomic_bool terminate;	// this machine only, see fleet::stop_machine()
+
+	// the log lines go through its queue, NULL: dolog() writes them itself
+	io_reactor *reactor;
+
+	machine_context();
+	machine_context(std::string name_in, std::string logfile_in);
+};
+
+machine_context * get_machine_context();
+
+// NULL: back to the default context
+void set_machine_context(machine_context *ctx);
+
+#endif
@@ -1,7 +1,12 @@
 #include <atomic>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <vector>
+#include <sys/time.h>
 
 #include "error.h"
 #include "processor.h"
@@ -12,18 +17,60 @@
 #include "rom.h"
 #include "hpc3.h"
 #include "mc.h"
+#include "graphics_lg1.h"
 #include "log.h"
+#include "pcap_writer.h"
+#include "vswitch.h"
+#include "serial_output.h"
+#include "serial_host.h"
+#include "audio_sink.h"
+#include "throttle.h"
+#include "snapshot.h"
+#include "fork_server.h"
+#include "ram_compactor.h"
+#include "zero_reclaimer.h"
+#include "machine.h"
+#include "machine_context.h"
+#include "placement.h"
+#include "fleet.h"
+#include "device_thread.h"
+#include "arcs.h"
 
-bool single_step = false;
 const char *logfile = NULL;
 
-std::atomic_bool sig_terminate(false), sig_interrupt(false);
+std::atomic_bool sig_terminate(false), sig_interrupt(false), sig_snapshot(false), sig_checkpoint(false);
 
 void help()
 {
 	fprintf(stderr, "-d     debug (console) mode\n");
 	fprintf(stderr, "-S     enable single step mode\n");
 	fprintf(stderr, "-l x   logfile to write to\n");
+	fprintf(stderr, "-s x   write serial console output to file x (- for stdout) instead of the terminal\n");
+	fprintf(stderr, "-c x   attach serial channel 1 to the host: \"pty\" or \"unix:<path>\"\n");
+	fprintf(stderr, "-C x   same for serial channel 2\n");
+	fprintf(stderr, "-n x   connect the ethernet interface to the vswitch at unix socket x\n");
+	fprintf(stderr, "-N x   run a vswitch in-process on unix socket x and connect to it\n");
+	fprintf(stderr, "-P x   write the frames of the ethernet interface to pcap file x\n");
+	fprintf(stderr, "-A x   write the audio output as WAV to file or pipe x (- for stdout)\n");
+	fprintf(stderr, "-F x   put the framebuffer in POSIX shared memory x (see miep-fbdump)\n");
+	fprintf(stderr, "-i     do not sleep when the guest is idle\n");
+	fprintf(stderr, "-R x   deterministic run, record all input to file x\n");
+	fprintf(stderr, "-r x   deterministic run, replay the input recorded in file x\n");
+	fprintf(stderr, "-W x   write a snapshot to file x on SIGUSR1 (in the background) and when exiting\n");
+	fprintf(stderr, "-K x   with -W: write an incremental checkpoint every x seconds\n");
+	fprintf(stderr, "-L x   restore the snapshot in file x\n");
+	fprintf(stderr, "-X x   fork server: boot, then start a job per request on unix socket x\n");
+	fprintf(stderr, "-B x   boot condition of the fork server: cycles:<n>, pc:<hex> or serial:<text>\n");
+	fprintf(stderr, "-z     do not give pages the guest zeroed back to the host\n");
+	fprintf(stderr, "-Z x   compress guest RAM that was not touched for x seconds\n");
+	fprintf(stderr, "-J x   run x machines in this process, console of machine n in <-s file>.n\n");
+	fprintf(stderr, "-j x   number of threads for -J (default: one per core)\n");
+	fprintf(stderr, "-a x   pin the threads to cores, e.g. cpu=0-3,io=4,render=5 (roles: cpu, io, render)\n");
+	fprintf(stderr, "-m x   bind the guest RAM to NUMA node x, \"none\" for no binding (default: the node of -a cpu)\n");
+	fprintf(stderr, "-H x   host call device: the guest can read and write the files in directory x (not with -R/-r)\n");
+	fprintf(stderr, "-k x   boot the ELF kernel in x directly, without the PROM: \"file arg...\" (not with -L/-X/-J/-R/-r)\n");
+	fprintf(stderr, "-Q x   copy PBUS DMA buffers on a device thread, synchronised every x cycles (not with -R/-r)\n");
+	fprintf(stderr, "-M x   limit the emulated processor to x MHz (not in debug mode)\n");
 	fprintf(stderr, "-V     show version & exit\n");
 	fprintf(stderr, "-h     this help & exit\n");
 }
@@ -33,6 +80,104 @@ void version()
 	printf("miep v" VERSION ", (C) 2013-2016 by folkert@vanheusden.com\n\n");
 }
 
+// a fork server job: only the emulation thread survived the fork, the
+// job gets its own console and no audio, network or second serial port
+void run_job(machine *mach, int console_fd, uint64_t max_cycles)
+{
+	processor *p = mach -> get_processor();
+	hpc3 *hpc = mach -> get_hpc();
+	io_reactor *io = mach -> get_reactor();
+
+	mach -> get_lg1() -> after_fork();
+	io -> after_fork();
+
+	if (p -> get_device_thread())
+		p -> get_device_thread() -> after_fork();
+
+	hpc -> get_hal2() -> set_sink(NULL);
+	hpc -> get_seeq() -> attach(NULL);
+
+	serial_host *sh = new serial_host(io, "job console", format("fd:%d", console_fd));
+	serial_output *so = new serial_output(io, sh);
+
+	hpc -> get_serial(0) -> set_input(sh);
+	hpc -> get_serial(0) -> set_output(so);
+	hpc -> get_serial(1) -> set_input(NULL);
+	hpc -> get_serial(1) -> set_output(NULL);
+
+	if (mach -> get_hostcall())
+		mach -> get_hostcall() -> set_console(so, sh);
+
+	uint64_t end = max_cycles ? p -> get_cycle_count() + max_cycles : UINT64_MAX;
+
+	while(!sig_terminate && uint64_t(p -> get_cycle_count()) < end)
+		p -> tick();
+
+	dolog("fork server job %d: ended at cycle %llu", getpid(), p -> get_cycle_count());
+	mach -> log_statistics();
+
+	delete so;
+	delete sh;
+
+	// the objects of the server refer to threads that only exist there
+	_exit(0);
+}
+
+// -J: machines without terminal, network, audio or snapshots
+void run_fleet(debug_console *dc, int n_machines, int n_workers, const char *serial_file, bool sleep_when_idle)
+{
+	fleet *f = new fleet(n_workers);
+
+	std::vector<machine *> machines;
+	std::vector<serial_output *> consoles;
+
+	for(int nr=0; nr<n_machines; nr++)
+	{
+		machine_config_t cfg;
+		cfg.name = format("m%d", nr);
+		cfg.prom_file = "ip24prom.070-9101-007.bin";
+		cfg.sram_file = format("sram-%d.dat", nr);
+
+		machine *m = new machine(dc, cfg);
+		m -> get_processor() -> set_idle_enabled(sleep_when_idle);
+
+		std::string console = format("%s.%d", serial_file ? serial_file : "console", nr);
+		int fd = open(console.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (fd == -1)
+			error_exit("cannot open %s", console.c_str());
+
+		serial_output *so = new serial_output(m -> get_reactor(), fd);
+
+		for(int ch=0; ch<2; ch++)
+			m -> get_hpc() -> get_serial(ch) -> set_output(so);
+
+		f -> add(m, 0);
+
+		machines.push_back(m);
+		consoles.push_back(so);
+	}
+
+	dolog("fleet: %d machines on %d threads", n_machines, n_workers);
+
+	f -> run(sig_terminate);
+
+	delete f;
+
+	// the consoles are on the I/O threads of the machines
+	for(int nr=0; nr<n_machines; nr++)
+	{
+		delete consoles[nr];
+		delete machines[nr];
+	}
+}
+
+// the kernel called Halt, Reboot etc.
+void arcs_halt(void *ctx)
+{
+	sig_terminate = true;
+	sig_interrupt = true;
+}
+
 void sig_handler(int sig)
 {
 	sig_interrupt = true;
@@ -40,16 +185,31 @@ void sig_handler(int sig)
 	if (sig == SIGTERM || sig == SIGINT || sig == SIGQUIT)
 		sig_terminate = true;
 
-	// if (sig == SIGALRM)
-		// sig_alarm = true;
+	if (sig == SIGUSR1)
+		sig_snapshot = true;
+
+	if (sig == SIGALRM)
+		sig_checkpoint = true;
 }
 
 int main(int argc, char *argv[])
 {
 	int c = -1;
-	bool debug = false;
-
-	while((c = getopt(argc, argv, "dSl:")) != -1)
+	bool debug = false, single_step = false;
+	const char *switch_path = NULL, *pcap_file = NULL, *serial_file = NULL, *fb_shm = "", *audio_file = NULL;
+	const char *serial_host_spec[2] = { NULL, NULL };
+	bool local_switch = false, sleep_when_idle = true, reclaim_zero = true;
+	double target_mhz = 0.0;
+	const char *input_log_file = NULL, *snapshot_file = NULL, *restore_file = NULL;
+	double checkpoint_interval = 0.0, compact_interval = 0.0;
+	int n_machines = 0, n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	const char *fork_server_path = NULL, *boot_condition = "";
+	bool replay = false;
+	uint64_t device_quantum = 0;
+	const char *hostcall_dir = NULL;
+	const char *kernel_cmd = NULL;
+
+	while((c = getopt(argc, argv, "dSl:s:c:C:n:N:P:F:A:iM:R:r:W:K:L:X:B:zZ:J:j:a:m:Q:H:k:")) != -1)
 	{
 		switch(c)
 		{
@@ -65,6 +225,116 @@ int main(int argc, char *argv[])
 				logfile = optarg;
 				break;
 
+			case 's':
+				serial_file = optarg;
+				break;
+
+			case 'c':
+				serial_host_spec[0] = optarg;
+				break;
+
+			case 'C':
+				serial_host_spec[1] = optarg;
+				break;
+
+			case 'n':
+				switch_path = optarg;
+				break;
+
+			case 'N':
+				switch_path = optarg;
+				local_switch = true;
+				break;
+
+			case 'P':
+				pcap_file = optarg;
+				break;
+
+			case 'F':
+				fb_shm = optarg;
+				break;
+
+			case 'A':
+				audio_file = optarg;
+				break;
+
+			case 'i':
+				sleep_when_idle = false;
+				break;
+
+			case 'M':
+				target_mhz = atof(optarg);
+				break;
+
+			case 'R':
+				input_log_file = optarg;
+				replay = false;
+				break;
+
+			case 'r':
+				input_log_file = optarg;
+				replay = true;
+				break;
+
+			case 'W':
+				snapshot_file = optarg;
+				break;
+
+			case 'K':
+				checkpoint_interval = atof(optarg);
+				break;
+
+			case 'L':
+				restore_file = optarg;
+				break;
+
+			case 'X':
+				fork_server_path = optarg;
+				break;
+
+			case 'B':
+				boot_condition = optarg;
+				break;
+
+			case 'J':
+				n_machines = atoi(optarg);
+				break;
+
+			case 'j':
+				n_workers = atoi(optarg);
+				break;
+
+			case 'a':
+				if (!set_placement(optarg))
+					error_exit("-a: invalid placement \"%s\", e.g. cpu=0-3,io=4,render=5", optarg);
+				break;
+
+			case 'm':
+				set_ram_node(strcmp(optarg, "none") == 0 ? PLACE_NODE_NONE : atoi(optarg));
+				break;
+
+			case 'z':
+				reclaim_zero = false;
+				break;
+
+			case 'H':
+				hostcall_dir = optarg;
+				break;
+
+			case 'k':
+				kernel_cmd = optarg;
+				break;
+
+			case 'Q':
+				device_quantum = strtoull(optarg, NULL, 10);
+				if (device_quantum == 0)
+					error_exit("-Q: the quantum must be at least 1 cycle");
+				break;
+
+			case 'Z':
+				compact_interval = atof(optarg);
+				break;
+
 			case 'V':
 				version();
 				return 0;
@@ -87,6 +357,8 @@ int main(int argc, char *argv[])
 	signal(SIGTERM, sig_handler);
 	signal(SIGINT , sig_handler);
 	signal(SIGQUIT, sig_handler);
+	signal(SIGUSR1, sig_handler);
+	signal(SIGALRM, sig_handler);
 	signal(SIGPIPE, SIG_IGN);
 
 #ifdef _PROFILING
@@ -97,32 +369,247 @@ int main(int argc, char *argv[])
 
 	dc -> init();
 
-	memory_bus *mb = new memory_bus(dc);
+	for(std::string line : placement_report())
+		dolog("placement: %s", line.c_str());
 
-	processor *p = new processor(dc, mb);
+	// the firmware answers GetTime from the host clock
+	if (kernel_cmd && (restore_file || fork_server_path || n_machines > 0 || input_log_file))
+		error_exit("-k cannot be combined with -L, -X, -J, -R or -r");
 
-	memory *mem1 = new memory(256 * 1024 * 1024, true);
-	mb -> register_memory(0x08000000, mem1 -> get_size(), mem1);
-	mb -> register_memory(0xffffffff88000000, mem1 -> get_size(), mem1); // KSEG0
-	mb -> register_memory(0xffffffffa8000000, mem1 -> get_size(), mem1); // KSEG1
-	mb -> register_memory(0, 512 * 1024, mem1); // needed for exception vectors
-	memory *mem2 = new memory(256 * 1024 * 1024, true);
-	mb -> register_memory(0x20000000, mem2 -> get_size(), mem2);
+	if (n_machines > 0)
+	{
+		run_fleet(dc, n_machines, n_workers, serial_file, sleep_when_idle);
+
+		delete dc;
 
-	rom *m_prom = new rom("ip24prom.070-9101-007.bin");
-	mb -> register_memory(0xffffffff1fc00000, m_prom -> get_size(), m_prom);
-	mb -> register_memory(0xffffffff9fc00000, m_prom -> get_size(), m_prom); // KSEG0
-	mb -> register_memory(0xffffffffbfc00000, m_prom -> get_size(), m_prom); // KSEG1
+		dolog("--- END ---");
 
-	memory *pmc = new mc(p, dc);
-	mb -> register_memory(0xffffffff1fa00000, pmc -> get_size(), pmc);
-	mb -> register_memory(0xffffffff9fa00000, pmc -> get_size(), pmc); // KSEG0
-	mb -> register_memory(0xffffffffbfa00000, pmc -> get_size(), pmc); // KSEG1
+		return 0;
+	}
 
-	memory *hpc = new hpc3(dc, "sram.dat");
-	mb -> register_memory(0xffffffff1fb00000, hpc -> get_size(), hpc);
-	mb -> register_memory(0xffffffff9fb00000, hpc -> get_size(), hpc); // KSEG0
-	mb -> register_memory(0xffffffffbfb00000, hpc -> get_size(), hpc); // KSEG1
+	machine_config_t cfg;
+	cfg.prom_file = "ip24prom.070-9101-007.bin";
+	cfg.sram_file = "sram.dat";
+	cfg.fb_shm = fb_shm;
+
+	// host files and the host clock cannot be replayed
+	if (hostcall_dir && input_log_file)
+		error_exit("-H cannot be combined with -R or -r");
+	if (hostcall_dir)
+		cfg.hostcall_dir = hostcall_dir;
+
+	machine *mach = new machine(dc, cfg);
+
+	set_machine_context(mach -> get_context());
+	get_machine_context() -> single_step = single_step;
+
+	processor *p = mach -> get_processor();
+	memory *mem1 = mach -> get_mem1(), *mem2 = mach -> get_mem2();
+	rom *m_prom = mach -> get_prom();
+	mc *pmc = mach -> get_mc();
+	graphics_lg1 *lg1 = mach -> get_lg1();
+	hpc3 *hpc = mach -> get_hpc();
+
+	p -> set_idle_enabled(sleep_when_idle);
+
+	input_log *il = input_log_file ? new input_log(input_log_file, replay) : NULL;
+	if (il)
+		p -> set_deterministic(true);
+
+	pmc -> set_input_log(il);
+	lg1 -> set_deterministic(il != NULL);
+
+	// when a copy completes depends on the host: not for a recording
+	device_thread *dt = NULL;
+	if (device_quantum && !il)
+	{
+		dt = new device_thread(p, device_quantum);
+		p -> set_device_thread(dt);
+	}
+
+	audio_sink *as = NULL;
+	if (audio_file)
+	{
+		as = new audio_sink(audio_file);
+		hpc -> get_hal2() -> set_sink(as);
+	}
+
+	serial_output *so = NULL;
+	if (serial_file == NULL)
+		so = new serial_output(mach -> get_reactor(), dc);
+	else if (strcmp(serial_file, "-") == 0)
+		so = new serial_output(mach -> get_reactor(), 1);
+	else
+	{
+		int fd = open(serial_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (fd == -1)
+			error_exit("cannot open %s", serial_file);
+
+		so = new serial_output(mach -> get_reactor(), fd);
+	}
+
+	serial_host *sh[2] = { NULL, NULL };
+	serial_output *sho[2] = { NULL, NULL };
+
+	for(int nr=0; nr<2; nr++)
+	{
+		z85c30 *ser = hpc -> get_serial(nr);
+
+		if (il)
+			ser -> set_input_log(il, nr);
+
+		if (serial_host_spec[nr])
+		{
+			sh[nr] = new serial_host(mach -> get_reactor(), format("serial channel %d", nr + 1), serial_host_spec[nr]);
+			sho[nr] = new serial_output(mach -> get_reactor(), sh[nr]);
+
+			ser -> set_input(sh[nr]);
+			ser -> set_output(sho[nr]);
+		}
+		else
+		{
+			ser -> set_output(so);
+		}
+	}
+
+	// the console of the host call device is that of serial channel 1
+	hostcall *hc = mach -> get_hostcall();
+	if (hc)
+		hc -> set_console(sho[0] ? sho[0] : so, sh[0]);
+
+	// instead of the PROM
+	arcs *fw = NULL;
+	if (kernel_cmd)
+	{
+		std::vector<std::string> args;
+		std::string cur;
+
+		for(const char *c=kernel_cmd;; c++)
+		{
+			if (*c == ' ' || *c == 0)
+			{
+				if (!cur.empty())
+					args.push_back(cur);
+				cur.clear();
+
+				if (*c == 0)
+					break;
+			}
+			else
+			{
+				cur += *c;
+			}
+		}
+
+		if (args.empty())
+			error_exit("-k: no kernel given");
+
+		std::string kernel = args.at(0);
+		args.erase(args.begin());
+
+		fw = new arcs(dc, p, mem1, 0x08000000);
+		fw -> add_ram(0x08000000, mem1 -> get_size());
+		fw -> add_ram(0x20000000, mem2 -> get_size());
+		fw -> set_console(sho[0] ? sho[0] : so, sh[0]);
+		fw -> set_halt_callback(arcs_halt, NULL);
+		fw -> boot(kernel, args);
+	}
+
+	vswitch *vs = NULL;
+	if (local_switch)
+	{
+		vs = new vswitch(switch_path, NULL);
+		vs -> start();
+	}
+
+	pcap_writer *pcap = pcap_file ? new pcap_writer(pcap_file) : NULL;
+
+	vswitch_port *vp = NULL;
+	if (switch_path)
+	{
+		vp = new vswitch_port(mach -> get_reactor(), switch_path, pcap);
+		hpc -> get_seeq() -> attach(vp);
+	}
+
+	snapshot *snap = new snapshot(p, pmc, hpc);
+	snap -> add_ram("mem1", mem1);
+	snap -> add_ram("mem2", mem2);
+	snap -> add_rom("prom", m_prom);
+
+	if (restore_file)
+		snap -> load(restore_file);
+
+	// after a restore: that replaces the memory
+	ram_compactor *rc = NULL;
+	if (compact_interval > 0.0)
+	{
+		rc = new ram_compactor(compact_interval);
+		rc -> add(mem1);
+		rc -> add(mem2);
+		rc -> set_release_callback(snapshot::release_callback, snap);
+		rc -> start();
+	}
+
+	zero_reclaimer *zr = NULL;
+	if (reclaim_zero)
+	{
+		zr = new zero_reclaimer(p, rc);
+		zr -> add(mem1);
+		zr -> add(mem2);
+		zr -> set_release_callback(snapshot::release_callback, snap);
+		zr -> start();
+	}
+
+	if (checkpoint_interval > 0.0)
+	{
+		if (!snapshot_file)
+			error_exit("-K requires -W");
+
+		snap -> enable_checkpoints();
+
+		// hashing every page at each checkpoint would fault all the
+		// compressed chunks back in
+		if (rc && !snap -> has_soft_dirty())
+			error_exit("-Z with -K needs soft-dirty page tracking in the kernel");
+
+		struct itimerval it;
+		it.it_interval.tv_sec = time_t(checkpoint_interval);
+		it.it_interval.tv_usec = suseconds_t((checkpoint_interval - it.it_interval.tv_sec) * 1000000);
+		it.it_value = it.it_interval;
+
+		if (setitimer(ITIMER_REAL, &it, NULL) == -1)
+			error_exit("setitimer failed");
+	}
+
+	// the device threads exist by now and placed themselves
+	place_thread(PLACE_CPU, "processor");
+
+	if (fork_server_path)
+	{
+		fork_server *fs = new fork_server(fork_server_path, boot_condition);
+
+		hpc -> get_serial(0) -> set_tx_callback(fork_server::serial_tx, fs);
+
+		while(!sig_terminate && !fs -> reached(p))
+			p -> tick();
+
+		hpc -> get_serial(0) -> set_tx_callback(NULL, NULL);
+
+		dolog("fork server: booted at cycle %llu, PC %016llx", p -> get_cycle_count(), p -> get_PC());
+
+		// nothing in the FIFO of the render thread when forking, no copy
+		// on the device thread
+		lg1 -> sync();
+		p -> sync_devices();
+
+		int console_fd = -1;
+		uint64_t max_cycles = 0;
+
+		if (fs -> serve(sig_terminate, &console_fd, &max_cycles))
+			run_job(mach, console_fd, max_cycles);
+
+		delete fs;
+	}
 
 #if _PROFILING == 1 || _PROFILING == 2
 	double start_ts = get_ts();
@@ -154,33 +641,134 @@ int main(int argc, char *argv[])
 	}
         printf("i/s: %f\n", double(cnt) / (get_ts() - start_ts));
 #else
-	if (single_step || debug)
+	throttle *t = target_mhz > 0.0 && !(single_step || debug) ? new throttle(target_mhz, p -> get_cycle_count()) : NULL;
+
+	// every signal ends the inner loops: snapshots are taken between two
+	// instructions
+	for(;!sig_terminate;)
 	{
-		for(;!sig_terminate;)
+		if (single_step || debug)
 		{
-			dc -> tick(p);
-			p -> tick();
+			for(;!sig_interrupt;)
+			{
+				dc -> tick(p);
+				p -> tick();
+
+				if (single_step)
+					getch();
+			}
+		}
+		else if (t)
+		{
+			for(;!sig_interrupt;)
+			{
+				uint64_t slice_end = t -> get_slice_end(p -> get_cycle_count());
+
+				while(p -> get_cycle_count() < slice_end && !sig_interrupt)
+					p -> tick();
 
-			if (single_step)
-				getch();
+				t -> account(p -> get_cycle_count());
+			}
+		}
+		else
+		{
+			for(;!sig_interrupt;)
+				p -> tick();
+		}
+
+		sig_interrupt = false;
+
+		if (sig_snapshot)
+		{
+			sig_snapshot = false;
+
+			if (snapshot_file)
+				snap -> save(snapshot_file, true);
+		}
+
+		// the first checkpoint is a complete snapshot
+		if (sig_checkpoint)
+		{
+			sig_checkpoint = false;
+
+			if (snap -> have_chain())
+				snap -> checkpoint(snapshot_file);
+			else
+				snap -> save(snapshot_file, true);
 		}
 	}
-	else
+
+	if (t)
 	{
-		for(;!sig_terminate;)
-			p -> tick();
+		dolog("throttle: %.1f MHz effective, %.1fms behind real time, %llu sleeps", t -> get_effective_mhz(p -> get_cycle_count()), t -> get_behind_ns() / 1000000.0, t -> get_n_sleeps());
+		delete t;
 	}
 #endif
 
+	if (snapshot_file)
+		snap -> save(snapshot_file, false);
+
+	// its thread reports to the snapshot
+	if (rc)
+	{
+		dolog("ram_compactor: %llu chunks compressed into %llu bytes at exit, %llu faults", rc -> get_n_compressed(), rc -> get_pool_bytes(), rc -> get_n_faults());
+		delete rc;
+	}
+
+	delete snap;
+
+	if (hc)
+	{
+		dolog("hostcall: %u requests served", hc -> get_n_served());
+		hc -> set_console(NULL, NULL);
+	}
+
+	if (fw)
+	{
+		dolog("arcs: %llu firmware calls", fw -> get_n_calls());
+		fw -> set_console(NULL, NULL);
+	}
+
+	delete so;
+
+	for(int nr=0; nr<2; nr++)
+	{
+		delete sho[nr];
+		delete sh[nr];
+	}
+
+	mach -> log_statistics();
+
+	if (zr)
+	{
+		dolog("zero_reclaimer: %llu pages reclaimed", zr -> get_n_reclaimed());
+		delete zr;
+	}
+
+	// its socket is on the I/O thread of the machine
+	delete vp;
+
+	// finishes the last copies: before the HPC3 and the audio sink go
+	if (dt)
+	{
+		dolog("device thread: %llu jobs in %llu quanta of %llu cycles, %llu syncs, %llu waits, busy %.1fms", dt -> get_n_jobs(), dt -> get_n_quanta(), dt -> get_quantum(), dt -> get_n_syncs(), dt -> get_n_waits(), dt -> get_busy_us() / 1000.0);
+		delete dt;
+		p -> set_device_thread(NULL);
+	}
+
+	set_machine_context(NULL);
+	delete fw;
+	delete mach;
+	delete il;
+
 	delete dc;
 
-	delete p;
-	delete mb;
-	delete pmc;
-	delete mem1;
-	delete mem2;
-	delete m_prom;
-	delete hpc;
+	if (as)
+		dolog("audio: %llu bytes dropped", as -> get_n_dropped());
+	delete as;
+
+	delete vs;
+	delete pcap;
 
 	dolog("--- END ---");
 
@@ -11,7 +11,13 @@ mc::mc(processor *const ppIn, debug_console *pdc_in) : pp(ppIn), pdc(pdc_in)
 	pm = NULL;
 	len = 0;
 
-	refresh_counter = 0;
+	ilog = NULL;
+
+	regs[0x40 / REGS_DIV] = MC_REFCNT_PRELOAD_DEFAULT;
+	refresh_cycle = pp -> get_cycle_count();
+
+	rpss_base = 0;
+	rpss_cycle = pp -> get_cycle_count();
 
 	sys_semaphore = 0;
 	memset(user_semaphores, 0x00, sizeof user_semaphores);
@@ -78,6 +84,24 @@ mc::~mc()
 {
 }
 
+uint32_t mc::get_refresh_counter() const
+{
+	uint64_t preload = regs[0x40 / REGS_DIV] & 0xffff;
+	uint64_t ticks = (pp -> get_cycle_count() - refresh_cycle) / (CPU_CLOCK_HZ / MC_CLOCK_HZ);
+
+	return preload - ticks % (preload + 1);
+}
+
+// increments by (bits 8-15 + 1) every (bits 0-7 + 1) MC clocks
+uint32_t mc::get_rpss_counter() const
+{
+	uint64_t div = (RPSS_DIVIDER & 0xff) + 1;
+	uint64_t mul = ((RPSS_DIVIDER >> 8) & 0xff) + 1;
+	uint64_t ticks = (pp -> get_cycle_count() - rpss_cycle) / (CPU_CLOCK_HZ / MC_CLOCK_HZ);
+
+	return rpss_base + uint32_t(ticks / div * mul);
+}
+
 void mc::read_32b(uint64_t offset, uint32_t *data)
 {
 	uint32_t index = offset / REGS_DIV;
@@ -102,13 +126,13 @@ void mc::read_32b(uint64_t offset, uint32_t *data)
 		// bit 2: register size (32/64)
 		// *data = 0x0f;
 
-		(*data) ^= rand();
+		(*data) ^= ilog ? ilog -> get_random(pp -> get_cycle_count()) : rand();
 		(*data) &= 0x1e;
 	}
 	else if (offset == 0x48)	// REF_CTR - refresh counter
 	{
-		*data = refresh_counter--;
-		pdc -> dc_log("MC REF_CTR read (%08x)", *data);
+		*data = get_refresh_counter();
+		DEBUG(pdc -> dc_log("MC REF_CTR read (%08x)", *data));
 	}
 	else if (offset == 0xc0)	// MEMCFG0
 	{
@@ -149,13 +173,9 @@ void mc::read_32b(uint64_t offset, uint32_t *data)
 	}
 	else if (offset == 0x1000)	// RPSS_CTR
 	{
-		int div = (RPSS_DIVIDER & 0xff) + 1;
-		int mul = ((RPSS_DIVIDER >> 8) & 0xff) + 1;
-
-		unsigned long long int cycles = pp -> get_cycle_count();
-		*data = (cycles / div) * mul;
+		*data = get_rpss_counter();
 
-		pdc -> dc_log("MC RPSS_CTR read: %08x (%llx)", *data, cycles);
+		DEBUG(pdc -> dc_log("MC RPSS_CTR read: %08x", *data));
 	}
 	else if (offset == 0x2000 || offset == 0x2008)	// DMA_MEMADRD, like DMA_MEMADR but also sets defaults
 		*data = DMA_MEMADDR;
@@ -223,12 +243,22 @@ void mc::write_32b(uint64_t offset, uint32_t data)
 	else if (offset == 0x28)	// RPSS_DIVIDER 
 	{
 		pdc -> dc_log("MC RPSS_DIVIDER write: %08x", data);
+
+		// the new rate applies from now on
+		rpss_base = get_rpss_counter();
+		rpss_cycle = pp -> get_cycle_count();
+
 		RPSS_DIVIDER = data;
 	}
 	else if (offset == 0x30)	// EEROM
 	{
 		pdc -> dc_log("MC EEROM write @ %016llx: %016llx %c%c%c%c", offset, data, data & 8?'1':'0', data&4?'1':'0', data&2?'1':'0', data&1?'1':'0');
 	}
+	else if (offset == 0x40)	// REFCNT_PRELOAD, stored below
+	{
+		pdc -> dc_log("MC REFCNT_PRELOAD write: %08x", data);
+		refresh_cycle = pp -> get_cycle_count();
+	}
 	else if (offset == 0x80)	// GIO64_ARB
 	{
 		pdc -> dc_log("MC GIO64_ARB write: %08x", data);
@@ -350,3 +380,41 @@ void mc::write_32b(uint64_t offset, uint32_t data)
 	if (index < 128)
 		regs[index] = data;
 }
+
+void mc::save_state(snapshot_writer & sw) const
+{
+	sw.put_bytes(regs, sizeof regs);
+	sw.put_u64(refresh_cycle);
+	sw.put_u32(rpss_base);
+	sw.put_u64(rpss_cycle);
+	sw.put_bytes(user_semaphores, sizeof user_semaphores);
+	sw.put_u8(sys_semaphore);
+	sw.put_u32(RPSS_DIVIDER);
+	sw.put_u32(DMA_MEMADDR);
+	sw.put_u32(DMA_SIZE);
+	sw.put_u32(DMA_STRIDE);
+	sw.put_u32(DMA_MODE);
+	sw.put_u32(DMA_COUNT);
+	sw.put_u32(DMA_GIO_ADR);
+	sw.put_u32(DMA_STDMA);
+	sw.put_u8(vdma_state);
+}
+
+void mc::load_state(snapshot_reader & sr)
+{
+	sr.get_bytes(regs, sizeof regs);
+	refresh_cycle = sr.get_u64();
+	rpss_base = sr.get_u32();
+	rpss_cycle = sr.get_u64();
+	sr.get_bytes(user_semaphores, sizeof user_semaphores);
+	sys_semaphore = sr.get_u8();
+	RPSS_DIVIDER = sr.get_u32();
+	DMA_MEMADDR = sr.get_u32();
+	DMA_SIZE = sr.get_u32();
+	DMA_STRIDE = sr.get_u32();
+	DMA_MODE = sr.get_u32();
+	DMA_COUNT = sr.get_u32();
+	DMA_GIO_ADR = sr.get_u32();
+	DMA_STDMA = sr.get_u32();
+	vdma_state = vdma_state_t(sr.get_u8());
+}
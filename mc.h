@@ -1,20 +1,36 @@
+#ifndef __MC__H__
+#define __MC__H__
+
 #include <pthread.h>
 
 #include "debug_console.h"
+#include "input_log.h"
 #include "memory.h"
+#include "snapshot_state.h"
 
 #define REGS_DIV 8
 
+#define MC_CLOCK_HZ	50000000	// REF_CTR and RPSS_CTR count in these
+#define MC_REFCNT_PRELOAD_DEFAULT	0x0c30
+
 typedef enum { vdma_stopped, vdma_running } vdma_state_t;
 
 class mc : public memory
 {
 private:
 	processor *const pp;
-	uint32_t refresh_counter;
 	debug_console *pdc;
 	uint32_t regs[128];
-	uint32_t RPSS_CTR;
+
+	// the counters are derived from the processor cycle count when read:
+	// REF_CTR counts down from the preload value, RPSS_CTR continues from
+	// rpss_base at the rate set by RPSS_DIVIDER
+	uint64_t refresh_cycle;
+	uint32_t rpss_base;
+	uint64_t rpss_cycle;
+
+	uint32_t get_refresh_counter() const;
+	uint32_t get_rpss_counter() const;
 
 	pthread_mutex_t semaphore_lock;
 	uint8_t user_semaphores[16];
@@ -31,6 +47,8 @@ private:
 	uint32_t DMA_GIO_ADR;
 	uint32_t DMA_STDMA;
 	vdma_state_t vdma_state;
+
+	input_log *ilog;
 	void set_dma_default();
 
 public:
@@ -40,6 +58,14 @@ public:
 	uint64_t get_size() const { return 0x100000; }
 	uint64_t get_mask() const { return  0xfffff; }
 
+	// random values come from this log when set
+	void set_input_log(input_log *ilog_in) { ilog = ilog_in; }
+
+	void save_state(snapshot_writer & sw) const;
+	void load_state(snapshot_reader & sr);
+
 	void read_32b(uint64_t offset, uint32_t *data);
 	void write_32b(uint64_t offset, uint32_t data);
 };
+
+#endif
@@ -1,26 +1,31 @@
 #include <endian.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "error.h"
 #include "debug.h"
 #include "memory.h"
+#include "log.h"
+#include "placement.h"
 
-memory::memory() : pm(NULL), len(0)
+memory::memory() : pm(NULL), len(0), direct(false), mapped(false), from_file(false), n_remaps(0), node(-1)
 {
 }
 
-memory::memory(uint64_t size, bool init) : len(size)
+// anonymous pages: page aligned (see ram_compactor) and already zero
+memory::memory(uint64_t size, bool init) : len(size), direct(true), mapped(true), from_file(false), n_remaps(0), node(-1)
 {
 	if (size == 0)
 		error_exit("memory::memory invalid size");
 
-	pm = new unsigned char[size];
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		error_exit("memory::memory: cannot allocate %llu bytes", size);
 
-	if (init)
-		memset(pm, 0x00, size);
+	pm = (unsigned char *)p;
 }
 
-memory::memory(unsigned char *p, uint64_t size) : pm(p), len(size)
+memory::memory(unsigned char *p, uint64_t size) : pm(p), len(size), direct(true), mapped(false), from_file(false), n_remaps(0), node(-1)
 {
 	if (size == 0)
 		error_exit("memory::memory invalid size");
@@ -28,7 +33,80 @@ memory::memory(unsigned char *p, uint64_t size) : pm(p), len(size)
 
 memory::~memory()
 {
-	delete [] pm;
+	if (mapped)
+		munmap(pm, len);
+	else
+		delete [] pm;
+}
+
+// pages are read from the file when first touched, writes stay private
+void memory::map_file(int fd, uint64_t offset)
+{
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, offset);
+	if (p == MAP_FAILED)
+		error_exit("memory::map_file: mmap failed");
+
+	if (mapped)
+		munmap(pm, len);
+	else
+		delete [] pm;
+
+	pm = (unsigned char *)p;
+	mapped = true;
+	from_file = true;
+	n_remaps = 0;
+
+	// the policy belongs to the old mapping
+	if (node != -1)
+		bind_memory(pm, len, node);
+}
+
+// MADV_DONTNEED on a private file mapping would bring back the contents
+// of the file: there the range is replaced by anonymous memory instead.
+// Each replacement can be a mapping of its own and the kernel limits the
+// number of those (vm.max_map_count): after MEMORY_MAX_REMAPS of them, or
+// when the kernel refuses, the pages are simply kept. They are zero
+// already, so that only costs host memory.
+bool memory::release(uint64_t offset, uint64_t n)
+{
+	ASSERT(mapped && offset + n <= len);
+
+	if (from_file)
+	{
+		if (n_remaps >= MEMORY_MAX_REMAPS)
+			return false;
+
+		if (mmap(&pm[offset], n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+		{
+			dolog("memory: cannot replace %llu bytes of a file mapping, no more pages are released", n);
+			n_remaps = MEMORY_MAX_REMAPS;
+			return false;
+		}
+
+		n_remaps++;
+
+		if (node != -1)
+			bind_memory(&pm[offset], n, node);
+	}
+	else if (madvise(&pm[offset], n, MADV_DONTNEED) == -1)
+	{
+		error_exit("memory::release: madvise failed");
+	}
+
+	return true;
+}
+
+void memory::set_node(int node_in)
+{
+	ASSERT(mapped);
+
+	if (!bind_memory(pm, len, node_in))
+	{
+		dolog("memory: cannot bind %llu bytes to node %d", len, node_in);
+		return;
+	}
+
+	node = node_in;
 }
 
 void memory::read_64b(uint64_t offset, uint64_t *data)
@@ -88,3 +166,33 @@ void memory::write_8b(uint64_t offset, uint8_t data)
 
 	pm[offset] = data;
 }
+
+void memory::read_block(uint64_t offset, uint8_t *data, uint64_t n)
+{
+	if (direct)
+	{
+		ASSERT(offset + n <= len);
+
+		memcpy(data, &pm[offset], n);
+	}
+	else
+	{
+		for(uint64_t index=0; index<n; index++)
+			read_8b(offset + index, &data[index]);
+	}
+}
+
+void memory::write_block(uint64_t offset, const uint8_t *data, uint64_t n)
+{
+	if (direct)
+	{
+		ASSERT(offset + n <= len);
+
+		memcpy(&pm[offset], data, n);
+	}
+	else
+	{
+		for(uint64_t index=0; index<n; index++)
+			write_8b(offset + index, data[index]);
+	}
+}
@@ -3,12 +3,30 @@
 
 #include <stdint.h>
 
+#define MEMORY_MAX_REMAPS	8192	// each splits a file mapping, see release()
+
+class memory;
+
+// called when pages were handed back to the kernel behind the guest's back,
+// e.g. so that the next checkpoint includes them
+typedef void (*memory_release_callback_t)(void *ctx, memory *m, uint64_t offset, uint64_t n);
+
 class memory
 {
 protected:
 	unsigned char *pm;
 	uint64_t len;
 
+	// plain memory: blocks are copied directly from/to pm, other (device)
+	// subclasses are accessed through their 8 bit methods
+	bool direct;
+
+	bool mapped;	// pm is from mmap(), see map_file()
+	bool from_file;
+	uint64_t n_remaps;	// anonymous ranges in a file mapping, see release()
+
+	int node;	// NUMA node the pages are bound to, -1: none
+
 	memory();
 
 public:
@@ -18,6 +36,8 @@ public:
 
 	virtual uint64_t get_size() const { return len; }
 
+	bool is_direct() const { return direct; }
+
 	virtual void read_64b(uint64_t offset, uint64_t *data);
 	virtual void read_32b(uint64_t offset, uint32_t *data);
 	virtual void read_16b(uint64_t offset, uint16_t *data);
@@ -26,6 +46,24 @@ public:
 	virtual void write_32b(uint64_t offset, uint32_t data);
 	virtual void write_16b(uint64_t offset, uint16_t data);
 	virtual void write_8b(uint64_t offset, uint8_t data);
+
+	// snapshots: the contents of plain memory, and replacing them by a
+	// private (copy-on-write) mapping of `size()' bytes of a file
+	const unsigned char * get_data() const { return pm; }
+	void map_file(int fd, uint64_t offset);
+
+	// gives whole host pages of plain memory back to the kernel: they
+	// read as zero afterwards; false when they were kept (see the .cpp)
+	bool release(uint64_t offset, uint64_t n);
+
+	// binds plain memory to a NUMA node (see placement.h), also after
+	// map_file() and release()
+	void set_node(int node_in);
+	int get_node() const { return node; }
+
+	// for DMA
+	virtual void read_block(uint64_t offset, uint8_t *data, uint64_t n);
+	virtual void write_block(uint64_t offset, const uint8_t *data, uint64_t n);
 };
 
 #endif
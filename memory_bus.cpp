@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,7 +13,7 @@
 uint64_t index_dist = 0, index_cnt = 0;
 #endif
 
-memory_bus::memory_bus(debug_console *pdc_in) : list(NULL), n_elements(0), pdc(pdc_in)
+memory_bus::memory_bus(debug_console *pdc_in) : list(NULL), n_elements(0), pdc(pdc_in), n_writes(0)
 {
 }
 
@@ -62,6 +63,9 @@ const memory_segment_t * memory_bus::find_segment(uint64_t offset)
 		last_psegment = &list[last_index];
 	}
 
+	// back in step with the index, else the next search skips a segment
+	last_psegment = &list[last_index];
+
 	pdc -> dc_log("%016llx is not mapped", offset);
 
 	throw processor_exception(offset, -1, -1, PEE_MEM, -1);
@@ -87,6 +91,9 @@ const memory_segment_t * memory_bus::find_segment_i(uint64_t offset)
 		last_psegment_i = &list[last_index_i];
 	}
 
+	// back in step with the index, else the next search skips a segment
+	last_psegment_i = &list[last_index_i];
+
 	pdc -> dc_log("%016llx is not mapped", offset);
 
 	throw processor_exception(offset, -1, -1, PEE_MEM, -1);
@@ -105,6 +112,8 @@ void memory_bus::write_64b(uint64_t offset, uint64_t data)
 {
 	const memory_segment_t * segment = find_segment(offset);
 
+	n_writes++;
+
 	segment -> target -> write_64b(offset - segment -> offset_start, data);
 }
 
@@ -126,6 +135,8 @@ void memory_bus::write_32b(uint64_t offset, uint32_t data)
 {
 	const memory_segment_t * segment = find_segment(offset);
 
+	n_writes++;
+
 	segment -> target -> write_32b(offset - segment -> offset_start, data);
 }
 
@@ -140,6 +151,8 @@ void memory_bus::write_16b(uint64_t offset, uint16_t data)
 {
 	const memory_segment_t * segment = find_segment(offset);
 
+	n_writes++;
+
 	segment -> target -> write_16b(offset - segment -> offset_start, data);
 }
 
@@ -154,5 +167,103 @@ void memory_bus::write_8b(uint64_t offset, uint8_t data)
 {
 	const memory_segment_t * segment = find_segment(offset);
 
+	n_writes++;
+
 	segment -> target -> write_8b(offset - segment -> offset_start, data);
 }
+
+void memory_bus::read_block(uint64_t offset, uint8_t *data, uint64_t n)
+{
+	while(n > 0)
+	{
+		const memory_segment_t * segment = find_segment(offset);
+
+		uint64_t chunk = std::min(n, segment -> offset_end - offset);
+
+		segment -> target -> read_block(offset - segment -> offset_start, data, chunk);
+
+		offset += chunk;
+		data += chunk;
+		n -= chunk;
+	}
+}
+
+void memory_bus::write_block(uint64_t offset, const uint8_t *data, uint64_t n)
+{
+	n_writes++;
+
+	while(n > 0)
+	{
+		const memory_segment_t * segment = find_segment(offset);
+
+		uint64_t chunk = std::min(n, segment -> offset_end - offset);
+
+		segment -> target -> write_block(offset - segment -> offset_start, data, chunk);
+
+		offset += chunk;
+		data += chunk;
+		n -= chunk;
+	}
+}
+
+// for is_plain() and the *_plain methods: NULL when not mapped
+const memory_segment_t * memory_bus::lookup(uint64_t offset) const
+{
+	for(int index=0; index<n_elements; index++)
+	{
+		if (offset >= list[index].offset_start && offset < list[index].offset_end)
+			return &list[index];
+	}
+
+	return NULL;
+}
+
+bool memory_bus::is_plain(uint64_t offset, uint64_t n) const
+{
+	while(n > 0)
+	{
+		const memory_segment_t * segment = lookup(offset);
+
+		if (!segment || !segment -> target -> is_direct())
+			return false;
+
+		uint64_t chunk = std::min(n, segment -> offset_end - offset);
+
+		offset += chunk;
+		n -= chunk;
+	}
+
+	return true;
+}
+
+void memory_bus::read_block_plain(uint64_t offset, uint8_t *data, uint64_t n) const
+{
+	while(n > 0)
+	{
+		const memory_segment_t * segment = lookup(offset);
+
+		uint64_t chunk = std::min(n, segment -> offset_end - offset);
+
+		segment -> target -> read_block(offset - segment -> offset_start, data, chunk);
+
+		offset += chunk;
+		data += chunk;
+		n -= chunk;
+	}
+}
+
+void memory_bus::write_block_plain(uint64_t offset, const uint8_t *data, uint64_t n) const
+{
+	while(n > 0)
+	{
+		const memory_segment_t * segment = lookup(offset);
+
+		uint64_t chunk = std::min(n, segment -> offset_end - offset);
+
+		segment -> target -> write_block(offset - segment -> offset_start, data, chunk);
+
+		offset += chunk;
+		data += chunk;
+		n -= chunk;
+	}
+}
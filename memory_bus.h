@@ -21,8 +21,11 @@ private:
 
 	debug_console *pdc;
 
+	uint64_t n_writes;	// lets the idle detection see stores and DMA
+
 	const memory_segment_t * find_segment(uint64_t offset);
 	const memory_segment_t * find_segment_i(uint64_t offset);
+	const memory_segment_t * lookup(uint64_t offset) const;
 
 public:
 	memory_bus(debug_console *pdc_in);
@@ -33,6 +36,8 @@ public:
 
 	void register_memory(uint64_t offset, uint64_t size, memory *target);
 
+	uint64_t get_n_writes() const { return n_writes; }
+
 	void read_32b_i(uint64_t offset, uint32_t *data);
 
 	void read_64b(uint64_t offset, uint64_t *data);
@@ -43,5 +48,18 @@ public:
 	void write_16b(uint64_t offset, uint16_t data);
 	void read_8b(uint64_t offset, uint8_t *data);
 	void write_8b(uint64_t offset, uint8_t data);
+
+	// bulk transfers (DMA), may span segments
+	void read_block(uint64_t offset, uint8_t *data, uint64_t n);
+	void write_block(uint64_t offset, const uint8_t *data, uint64_t n);
+
+	// DMA on the device thread: only for ranges that is_plain() accepted
+	// (plain memory, no device registers), does not touch the segment
+	// cache of the processor and does not count the write; the processor
+	// thread calls count_write() when it makes the result visible
+	bool is_plain(uint64_t offset, uint64_t n) const;
+	void read_block_plain(uint64_t offset, uint8_t *data, uint64_t n) const;
+	void write_block_plain(uint64_t offset, const uint8_t *data, uint64_t n) const;
+	void count_write() { n_writes++; }
 };
 #endif
@@ -0,0 +1,62 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <sys/time.h>
+
+#include "error.h"
+#include "pcap_writer.h"
+
+#define PCAP_MAGIC	0xa1b2c3d4
+#define PCAP_SNAPLEN	65535
+#define LINKTYPE_ETHERNET	1
+
+typedef struct
+{
+	uint32_t magic_number;
+	uint16_t version_major, version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t network;
+} pcap_hdr_t;
+
+typedef struct
+{
+	uint32_t ts_sec, ts_usec;
+	uint32_t incl_len, orig_len;
+} pcaprec_hdr_t;
+
+pcap_writer::pcap_writer(std::string file) : n_frames(0)
+{
+	fh = fopen(file.c_str(), "wb");
+	if (!fh)
+		error_exit("cannot create pcap file %s", file.c_str());
+
+	pcap_hdr_t hdr = { PCAP_MAGIC, 2, 4, 0, 0, PCAP_SNAPLEN, LINKTYPE_ETHERNET };
+
+	if (fwrite(&hdr, sizeof hdr, 1, fh) != 1)
+		error_exit("failed writing to pcap file %s", file.c_str());
+}
+
+pcap_writer::~pcap_writer()
+{
+	fclose(fh);
+}
+
+void pcap_writer::add_frame(const uint8_t *data, uint32_t len)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+
+	pcaprec_hdr_t rec = { uint32_t(tv.tv_sec), uint32_t(tv.tv_usec), len, len };
+
+	if (fwrite(&rec, sizeof rec, 1, fh) != 1 || fwrite(data, 1, len, fh) != len)
+		error_exit("failed writing to pcap file");
+
+	n_frames++;
+}
+
+void pcap_writer::flush()
+{
+	fflush(fh);
+}
@@ -0,0 +1,24 @@
+#ifndef __PCAP_WRITER__H__
+#define __PCAP_WRITER__H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+class pcap_writer
+{
+private:
+	FILE *fh;
+	uint64_t n_frames;
+
+public:
+	pcap_writer(std::string file);
+	~pcap_writer();
+
+	void add_frame(const uint8_t *data, uint32_t len);
+	void flush();
+
+	uint64_t get_n_frames() const { return n_frames; }
+};
+
+#endif
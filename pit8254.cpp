@@ -0,0 +1,351 @@
+#include "debug.h"
+#include "int2.h"
+#include "pit8254.h"
+#include "processor.h"
+
+#define PIT_CYCLES_PER_CLOCK	(CPU_CLOCK_HZ / PIT_CLOCK_HZ)
+
+static void pit_event(void *ctx, uint64_t now)
+{
+	pit_counter_t *c = (pit_counter_t *)ctx;
+
+	c -> owner -> terminal_count(c -> nr, now);
+}
+
+static inline uint64_t reload_value(const pit_counter_t & c)
+{
+	return c.n ? c.n : 65536;
+}
+
+static inline bool is_periodic(const pit_counter_t & c)
+{
+	return c.mode == 2 || c.mode == 3;
+}
+
+pit8254::pit8254(debug_console *pdc_in, processor *pp_in, int2 *ic_in) : pdc(pdc_in), pp(pp_in), ic(ic_in)
+{
+	for(int nr=0; nr<3; nr++)
+	{
+		pit_counter_t & c = counters[nr];
+
+		c.owner = this;
+		c.nr = nr;
+		c.mode = 0;
+		c.rw = 3;
+		c.bcd = 0;
+		c.n = 0;
+		c.loaded = c.write_msb_next = c.read_msb_next = false;
+		c.lsb = 0;
+		c.count_latched = c.status_latched = false;
+		c.latch = 0;
+		c.status = 0;
+		c.base_cycle = c.base_ticks = c.period = 0;
+		c.event = SCHED_NONE;
+	}
+}
+
+pit8254::~pit8254()
+{
+	for(int nr=0; nr<3; nr++)
+		pp -> get_scheduler() -> cancel(counters[nr].event);
+}
+
+// number of input clocks since the count was loaded
+uint64_t pit8254::elapsed(const pit_counter_t & c, uint64_t now) const
+{
+	if (!c.loaded)
+		return 0;
+
+	if (c.period == 0)
+		return c.base_ticks;
+
+	return c.base_ticks + (now - c.base_cycle) / c.period;
+}
+
+uint16_t pit8254::get_count(const pit_counter_t & c, uint64_t now) const
+{
+	if (!c.loaded)
+		return c.n;
+
+	uint64_t e = elapsed(c, now), n = reload_value(c);
+
+	if (c.mode == 2)
+		return n - e % n;
+
+	if (c.mode == 3)	// counts down by two, twice per period
+		return n - (e * 2) % n;
+
+	return (n - e) & 0xffff;
+}
+
+bool pit8254::get_out(const pit_counter_t & c, uint64_t now) const
+{
+	if (!c.loaded)
+		return c.mode != 0;
+
+	uint64_t e = elapsed(c, now), n = reload_value(c);
+
+	switch(c.mode)
+	{
+		case 0:
+		case 1:
+			return e >= n;
+		case 2:
+			return e % n != n - 1;
+		case 3:
+			return e % n < (n + 1) / 2;
+	}
+
+	return e != n;	// 4, 5: low for one clock
+}
+
+// the input clock of counters 0 and 1 changed
+void pit8254::rebase(pit_counter_t & c, uint64_t now, uint64_t period)
+{
+	c.base_ticks = elapsed(c, now);
+	c.base_cycle = now;
+	c.period = period;
+
+	schedule_tc(c, now);
+}
+
+void pit8254::update_prescaler(uint64_t now)
+{
+	const pit_counter_t & c2 = counters[2];
+	uint64_t period = c2.loaded && is_periodic(c2) ? PIT_CYCLES_PER_CLOCK * reload_value(c2) : 0;
+
+	for(int nr=0; nr<2; nr++)
+	{
+		if (counters[nr].period != period)
+			rebase(counters[nr], now, period);
+	}
+}
+
+// a new count takes effect at once, also in the periodic modes
+void pit8254::start(pit_counter_t & c, uint64_t now)
+{
+	DEBUG(pdc -> dc_log("PIT: counter %d, mode %d, count %u", c.nr, c.mode, c.n));
+
+	c.loaded = true;
+	c.base_cycle = now;
+	c.base_ticks = 0;
+
+	if (c.nr == 2)
+	{
+		c.period = PIT_CYCLES_PER_CLOCK;
+		update_prescaler(now);
+	}
+	else
+	{
+		schedule_tc(c, now);
+	}
+}
+
+// counter 2 only clocks the others, it has no interrupt
+void pit8254::schedule_tc(pit_counter_t & c, uint64_t now)
+{
+	scheduler *s = pp -> get_scheduler();
+
+	s -> cancel(c.event);
+	c.event = SCHED_NONE;
+
+	if (c.nr == 2 || !c.loaded || c.period == 0)
+		return;
+
+	uint64_t e = elapsed(c, now), n = reload_value(c), tc = n;
+
+	if (is_periodic(c))
+		tc = (e / n + 1) * n;
+	else if (e >= n)
+		return;
+
+	c.event = s -> schedule(c.base_cycle + (tc - c.base_ticks) * c.period, pit_event, &c);
+}
+
+void pit8254::terminal_count(int nr, uint64_t now)
+{
+	pit_counter_t & c = counters[nr];
+
+	c.event = SCHED_NONE;
+
+	ic -> set_timer(nr);
+
+	schedule_tc(c, now);
+}
+
+void pit8254::latch_count(pit_counter_t & c, uint64_t now)
+{
+	if (!c.count_latched)
+	{
+		c.latch = get_count(c, now);
+		c.count_latched = true;
+	}
+}
+
+void pit8254::latch_status(pit_counter_t & c, uint64_t now)
+{
+	if (!c.status_latched)
+	{
+		c.status = (get_out(c, now) ? 0x80 : 0) | (c.loaded ? 0 : 0x40) | (c.rw << PIT_CW_RW_SHIFT) | (c.mode << PIT_CW_MODE_SHIFT) | c.bcd;
+		c.status_latched = true;
+	}
+}
+
+uint8_t pit8254::read(int nr)
+{
+	pit_counter_t & c = counters[nr];
+
+	if (c.status_latched)
+	{
+		c.status_latched = false;
+		return c.status;
+	}
+
+	uint16_t value = c.count_latched ? c.latch : get_count(c, pp -> get_cycle_count());
+
+	if (c.rw == 1 || (c.rw == 3 && !c.read_msb_next))
+	{
+		if (c.rw == 3)
+			c.read_msb_next = true;
+		else
+			c.count_latched = false;
+
+		return value;
+	}
+
+	c.read_msb_next = false;
+	c.count_latched = false;
+
+	return value >> 8;
+}
+
+void pit8254::write(int nr, uint8_t data)
+{
+	pit_counter_t & c = counters[nr];
+	uint64_t now = pp -> get_cycle_count();
+
+	if (c.rw == 1)
+		c.n = data;
+	else if (c.rw == 2)
+		c.n = data << 8;
+	else if (!c.write_msb_next)
+	{
+		c.lsb = data;
+		c.write_msb_next = true;
+
+		// in mode 0 the first byte stops the counter
+		if (c.mode == 0 && c.loaded)
+		{
+			c.base_ticks = elapsed(c, now);
+			c.n = get_count(c, now);
+			c.loaded = false;
+			schedule_tc(c, now);
+		}
+
+		return;
+	}
+	else
+	{
+		c.n = c.lsb | (data << 8);
+		c.write_msb_next = false;
+	}
+
+	start(c, now);
+}
+
+void pit8254::write_control(uint8_t data)
+{
+	uint64_t now = pp -> get_cycle_count();
+	int sc = data >> PIT_CW_SC_SHIFT;
+
+	if (sc == 3)	// read-back
+	{
+		for(int nr=0; nr<3; nr++)
+		{
+			if (!(data & (2 << nr)))
+				continue;
+
+			if (!(data & PIT_RB_NO_COUNT))
+				latch_count(counters[nr], now);
+
+			if (!(data & PIT_RB_NO_STATUS))
+				latch_status(counters[nr], now);
+		}
+
+		return;
+	}
+
+	pit_counter_t & c = counters[sc];
+	int rw = (data >> PIT_CW_RW_SHIFT) & 3;
+
+	if (rw == 0)
+	{
+		latch_count(c, now);
+		return;
+	}
+
+	c.rw = rw;
+	c.mode = (data >> PIT_CW_MODE_SHIFT) & 7;
+	if (c.mode >= 6)	// 6 and 7 are aliases of 2 and 3
+		c.mode -= 4;
+	c.bcd = data & PIT_CW_BCD;	// stored for the status only, counting is binary
+
+	c.loaded = c.write_msb_next = c.read_msb_next = c.count_latched = false;
+
+	schedule_tc(c, now);
+
+	if (sc == 2)
+		update_prescaler(now);
+}
+
+void pit8254::save_state(snapshot_writer & sw) const
+{
+	for(int nr=0; nr<3; nr++)
+	{
+		const pit_counter_t & c = counters[nr];
+
+		sw.put_u8(c.mode);
+		sw.put_u8(c.rw);
+		sw.put_u8(c.bcd);
+		sw.put_u32(c.n);
+		sw.put_bool(c.loaded);
+		sw.put_bool(c.write_msb_next);
+		sw.put_bool(c.read_msb_next);
+		sw.put_u8(c.lsb);
+		sw.put_bool(c.count_latched);
+		sw.put_bool(c.status_latched);
+		sw.put_u16(c.latch);
+		sw.put_u8(c.status);
+		sw.put_u64(c.base_cycle);
+		sw.put_u64(c.base_ticks);
+		sw.put_u64(c.period);
+	}
+}
+
+void pit8254::load_state(snapshot_reader & sr)
+{
+	uint64_t now = pp -> get_cycle_count();
+
+	for(int nr=0; nr<3; nr++)
+	{
+		pit_counter_t & c = counters[nr];
+
+		c.mode = sr.get_u8();
+		c.rw = sr.get_u8();
+		c.bcd = sr.get_u8();
+		c.n = sr.get_u32();
+		c.loaded = sr.get_bool();
+		c.write_msb_next = sr.get_bool();
+		c.read_msb_next = sr.get_bool();
+		c.lsb = sr.get_u8();
+		c.count_latched = sr.get_bool();
+		c.status_latched = sr.get_bool();
+		c.latch = sr.get_u16();
+		c.status = sr.get_u8();
+		c.base_cycle = sr.get_u64();
+		c.base_ticks = sr.get_u64();
+		c.period = sr.get_u64();
+
+		schedule_tc(c, now);
+	}
+}
@@ -0,0 +1,88 @@
+#ifndef __PIT8254__H__
+#define __PIT8254__H__
+
+#include <stdint.h>
+
+#include "debug_console.h"
+#include "scheduler.h"
+#include "snapshot_state.h"
+
+class int2;
+class pit8254;
+class processor;
+
+#define PIT_CLOCK_HZ	1000000	// input of counter 2
+
+// control word
+#define PIT_CW_SC_SHIFT		6	// counter select, 3: read-back
+#define PIT_CW_RW_SHIFT		4	// 0: latch, 1: LSB, 2: MSB, 3: LSB then MSB
+#define PIT_CW_MODE_SHIFT	1
+#define PIT_CW_BCD		0x01
+
+#define PIT_RB_NO_COUNT		0x20	// read-back: do not latch the count
+#define PIT_RB_NO_STATUS	0x10	// read-back: do not latch the status
+
+typedef struct
+{
+	pit8254 *owner;
+	int nr;
+
+	uint8_t mode, rw, bcd;
+	uint32_t n;	// reload value, 0 is 65536
+	bool loaded;	// counting: a complete count was written
+	bool write_msb_next, read_msb_next;
+	uint8_t lsb;
+
+	bool count_latched, status_latched;
+	uint16_t latch;
+	uint8_t status;
+
+	// the count is never decremented: elapsed() derives the number of
+	// input clocks since loading from the processor cycle counter
+	uint64_t base_cycle, base_ticks;
+	uint64_t period;	// cycles per input clock, 0: no clock
+
+	sched_id_t event;	// next terminal count
+} pit_counter_t;
+
+// The 8254 interval timer in the INT2. Counter 2 runs at 1MHz and its
+// output clocks counters 0 and 1, whose terminal counts raise the timer
+// 0 and timer 1 interrupts. Counter values are computed when read and
+// each terminal count is one scheduler event, so a running timer costs
+// nothing between its interrupts.
+class pit8254
+{
+private:
+	debug_console *pdc;
+	processor *pp;
+	int2 *ic;
+
+	pit_counter_t counters[3];
+
+	uint64_t elapsed(const pit_counter_t & c, uint64_t now) const;
+	uint16_t get_count(const pit_counter_t & c, uint64_t now) const;
+	bool get_out(const pit_counter_t & c, uint64_t now) const;
+
+	void rebase(pit_counter_t & c, uint64_t now, uint64_t period);
+	void start(pit_counter_t & c, uint64_t now);
+	void schedule_tc(pit_counter_t & c, uint64_t now);
+	void update_prescaler(uint64_t now);
+	void latch_count(pit_counter_t & c, uint64_t now);
+	void latch_status(pit_counter_t & c, uint64_t now);
+
+public:
+	pit8254(debug_console *pdc_in, processor *pp_in, int2 *ic_in);
+	~pit8254();
+
+	// scheduler callback
+	void terminal_count(int nr, uint64_t now);
+
+	uint8_t read(int nr);
+	void write(int nr, uint8_t data);
+	void write_control(uint8_t data);
+
+	void save_state(snapshot_writer & sw) const;
+	void load_state(snapshot_reader & sr);
+};
+
+#endif
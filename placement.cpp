@@ -0,0 +1,247 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+
+#include "log.h"
+#include "placement.h"
+#include "utils.h"
+
+#define PLACE_MAX_NODES	1024
+
+static const char *const role_names[PLACE_N_ROLES] = { "cpu", "io", "render" };
+
+static pthread_mutex_t placement_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<int> role_cpus[PLACE_N_ROLES];
+static int ram_node = PLACE_NODE_AUTO;
+
+static std::string cpu_list_str(const std::vector<int> & cpus)
+{
+	std::string out;
+
+	for(size_t i=0; i<cpus.size();)
+	{
+		size_t j = i;
+		while(j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+			j++;
+
+		if (!out.empty())
+			out += ",";
+
+		out += j == i ? format("%d", cpus[i]) : format("%d-%d", cpus[i], cpus[j]);
+
+		i = j + 1;
+	}
+
+	return out;
+}
+
+// "0-3,8,10-11", as in /sys/devices/system/node/node*/cpulist
+bool parse_cpu_list(const char *s, std::vector<int> *cpus)
+{
+	cpus -> clear();
+
+	while(*s && *s != '\n')
+	{
+		char *end = NULL;
+		long first = strtol(s, &end, 10), last = first;
+
+		if (end == s || first < 0 || first >= CPU_SETSIZE)
+			return false;
+
+		if (*end == '-')
+		{
+			s = end + 1;
+			last = strtol(s, &end, 10);
+
+			if (end == s || last < first || last >= CPU_SETSIZE)
+				return false;
+		}
+
+		for(long cpu=first; cpu<=last; cpu++)
+			cpus -> push_back(cpu);
+
+		s = end;
+
+		if (*s == ',')
+			s++;
+		else if (*s && *s != '\n')
+			return false;
+	}
+
+	return !cpus -> empty();
+}
+
+bool set_placement(const char *spec)
+{
+	std::string s = spec;
+	size_t pos = 0;
+
+	while(pos <= s.size())
+	{
+		// the lists contain commas too: a role ends where the next "x=" starts
+		size_t eq = s.find('=', pos);
+		if (eq == std::string::npos)
+			return false;
+
+		size_t next = s.find('=', eq + 1), end = s.size();
+		if (next != std::string::npos)
+		{
+			end = s.rfind(',', next);
+			if (end == std::string::npos || end < eq)
+				return false;
+		}
+
+		std::string name = s.substr(pos, eq - pos);
+		std::string list = s.substr(eq + 1, end - eq - 1);
+
+		int role = -1;
+		for(int nr=0; nr<PLACE_N_ROLES; nr++)
+		{
+			if (name == role_names[nr])
+				role = nr;
+		}
+
+		if (role == -1 || !parse_cpu_list(list.c_str(), &role_cpus[role]))
+			return false;
+
+		pos = end + 1;
+	}
+
+	return true;
+}
+
+void set_ram_node(int node)
+{
+	ram_node = node;
+}
+
+int get_ram_node(int index)
+{
+	if (ram_node != PLACE_NODE_AUTO)
+		return ram_node;
+
+	int node = get_thread_node(PLACE_CPU, index >= 0 ? index : 0);
+
+	return node == -1 ? PLACE_NODE_NONE : node;
+}
+
+int get_thread_node(int role, int index)
+{
+	if (role_cpus[role].empty())
+		return -1;
+
+	return cpu_to_node(role_cpus[role][index % role_cpus[role].size()]);
+}
+
+int cpu_to_node(int cpu)
+{
+	DIR *dir = opendir("/sys/devices/system/node");
+	if (!dir)
+		return -1;
+
+	int found = -1;
+	struct dirent *de = NULL;
+
+	while(found == -1 && (de = readdir(dir)) != NULL)
+	{
+		int node = -1;
+		if (sscanf(de -> d_name, "node%d", &node) != 1)
+			continue;
+
+		FILE *fh = fopen(format("/sys/devices/system/node/%s/cpulist", de -> d_name).c_str(), "r");
+		if (!fh)
+			continue;
+
+		char buffer[4096];
+		std::vector<int> cpus;
+
+		if (fgets(buffer, sizeof buffer, fh) && parse_cpu_list(buffer, &cpus))
+		{
+			for(int c : cpus)
+			{
+				if (c == cpu)
+					found = node;
+			}
+		}
+
+		fclose(fh);
+	}
+
+	closedir(dir);
+
+	return found;
+}
+
+void place_thread(int role, const char *name, int index)
+{
+	pthread_mutex_lock(&placement_lock);
+	std::vector<int> cpus = role_cpus[role];
+	pthread_mutex_unlock(&placement_lock);
+
+	if (cpus.empty())
+		return;
+
+	if (index >= 0)
+		cpus = std::vector<int>(1, cpus[index % cpus.size()]);
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(int cpu : cpus)
+		CPU_SET(cpu, &set);
+
+	int err = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+
+	std::string line = format("%s thread %s (%ld): cores %s", role_names[role], name, long(syscall(SYS_gettid)), cpu_list_str(cpus).c_str());
+
+	if (err)
+		line += format(" failed: %s", strerror(err));
+	else
+		line += format(", node %d", cpu_to_node(cpus[0]));
+
+	dolog("placement: %s", line.c_str());
+}
+
+// MPOL_MF_MOVE: pages that were touched already move too
+bool bind_memory(void *p, uint64_t n, int node)
+{
+	unsigned long mask[PLACE_MAX_NODES / (8 * sizeof(unsigned long))] = { 0 };
+
+	if (node < 0 || node >= PLACE_MAX_NODES)
+		return false;
+
+	mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+
+	// the kernel counts one node less than maxnode
+	return syscall(SYS_mbind, p, n, MPOL_BIND, mask, PLACE_MAX_NODES + 1, MPOL_MF_MOVE) == 0;
+}
+
+std::vector<std::string> placement_report()
+{
+	std::vector<std::string> out;
+
+	pthread_mutex_lock(&placement_lock);
+
+	for(int role=0; role<PLACE_N_ROLES; role++)
+	{
+		if (role_cpus[role].empty())
+			out.push_back(format("%s threads: not pinned", role_names[role]));
+		else
+			out.push_back(format("%s threads: cores %s, node %d", role_names[role], cpu_list_str(role_cpus[role]).c_str(), cpu_to_node(role_cpus[role][0])));
+	}
+
+	int node = get_ram_node();
+	if (node == PLACE_NODE_NONE)
+		out.push_back("guest RAM: not bound");
+	else
+		out.push_back(format("guest RAM: node %d", node));
+
+	pthread_mutex_unlock(&placement_lock);
+
+	return out;
+}
@@ -0,0 +1,51 @@
+#ifndef __PLACEMENT__H__
+#define __PLACEMENT__H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// thread roles
+#define PLACE_CPU	0	// the emulated processor(s), the fleet workers
+#define PLACE_IO	1	// serial, network, audio, RAM compaction, device thread
+#define PLACE_RENDER	2	// the LG1 render thread
+#define PLACE_N_ROLES	3
+
+#define PLACE_NODE_AUTO	-2	// guest RAM on the node of the processor core that runs it
+#define PLACE_NODE_NONE	-1	// guest RAM wherever the kernel puts it
+
+// Where the threads and the guest RAM of the process run. The cores of
+// each role are given once at startup (-a); each thread then places
+// itself with place_thread() when it starts, so that devices need no
+// pointer to a configuration. Threads of a role without cores keep the
+// affinity they inherited. Guest RAM is bound with mbind() before it is
+// first touched: see memory::set_node().
+bool parse_cpu_list(const char *s, std::vector<int> *cpus);
+
+// e.g. "cpu=0-3,io=4,render=5"; false on a syntax error
+bool set_placement(const char *spec);
+
+// node of the guest RAM, or one of PLACE_NODE_*; index >= 0: of a
+// machine that runs on the index-th core of the cpu role (a fleet
+// worker), else on the first one
+void set_ram_node(int node);
+int get_ram_node(int index = -1);
+
+// node of the index-th core of the role (round-robin, as in
+// place_thread()), -1: not pinned or unknown
+int get_thread_node(int role, int index);
+
+// logs where the thread went; index >= 0: only the index-th core of the
+// role (round-robin), so that the fleet workers get a core each
+void place_thread(int role, const char *name, int index = -1);
+
+// -1: unknown
+int cpu_to_node(int cpu);
+
+bool bind_memory(void *p, uint64_t n, int node);
+
+// the cores of each role and the node of the guest RAM, for the startup
+// log; the threads log themselves when they start
+std::vector<std::string> placement_report();
+
+#endif
@@ -1,17 +1,41 @@
+#include <algorithm>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "debug.h"
 #include "debug_console.h"
+#include "device_thread.h"
 #include "processor.h"
 #include "processor_utils.h"
 #include "exceptions.h"
 #include "utils.h"
 
+static void compare_event_cb(void *ctx, uint64_t now)
+{
+	((processor *)ctx) -> compare_match(now);
+}
+
 processor::processor(debug_console *pdc_in, memory_bus *pmb_in) : pdc(pdc_in), pmb(pmb_in)
 {
 	cycles = 0;
 
+	compare_event = SCHED_NONE;
+
+	dt = NULL;
+
+	hle_cb = NULL;
+	hle_ctx = NULL;
+
+	idle_enabled = true;
+	deterministic = false;
+	idle_yield = false;
+	yield_us = 0;
+	idle_cycles = 0;
+	wake_pending = false;
+	pthread_mutex_init(&idle_lock, NULL);
+	pthread_cond_init(&idle_cond, NULL);
+
 	init_i_type();
 	init_r_type();
 
@@ -20,6 +44,37 @@ processor::processor(debug_console *pdc_in, memory_bus *pmb_in) : pdc(pdc_in), p
 
 processor::~processor()
 {
+	sched.cancel(compare_event);
+
+	pthread_cond_destroy(&idle_cond);
+	pthread_mutex_destroy(&idle_lock);
+}
+
+void processor::sync_devices()
+{
+	if (dt)
+		dt -> sync(cycles);
+
+	for(sync_handler_t & h : sync_handlers)
+		h.cb(h.ctx);
+}
+
+void processor::add_sync_callback(sync_callback_t cb, void *ctx)
+{
+	sync_handler_t h = { cb, ctx };
+	sync_handlers.push_back(h);
+}
+
+void processor::remove_sync_callback(sync_callback_t cb, void *ctx)
+{
+	for(size_t index=0; index<sync_handlers.size(); index++)
+	{
+		if (sync_handlers[index].cb == cb && sync_handlers[index].ctx == ctx)
+		{
+			sync_handlers.erase(sync_handlers.begin() + index);
+			break;
+		}
+	}
 }
 
 void processor::reset()
@@ -32,12 +87,23 @@ void processor::reset()
 	memset(C1_registers, 0x00, sizeof C1_registers);
 	memset(C2_registers, 0x00, sizeof C2_registers);
 
+	ip_lines = 0;
+	update_irq_pending();
+
+	sched.cancel(compare_event);
+	compare_event = SCHED_NONE;
+	compare_armed = false;
+	set_count(0);
+
 	set_PC(0xffffffffbfc00000);
 
 	nullify_instruction = have_delay_slot = false;
 	delay_slot_PC = -1;
 
 	RMW_sequence = false;
+
+	loop_target = -1;
+	loop_iterations = 0;
 }
 
 void processor::tick()
@@ -101,10 +167,19 @@ void processor::tick()
 			EPC = pe.get_EPC();
 			PC = 0x80000080;
 
+			update_irq_pending();
+
 			// FIXME: at return, shift >> 2, do not change old state
 			// ALSO INCREASE PC WITH 4
 		}
 	}
+
+	if (unlikely(uint64_t(cycles) >= sched.get_next_event()))
+		sched.run(cycles);
+
+	// not between a branch and its delay slot: EPC then is simply the PC
+	if (unlikely(irq_pending) && !have_delay_slot)
+		interrupt();
 }
 
 void processor::set_delay_slot(uint64_t offset)
@@ -140,6 +215,18 @@ uint64_t processor::get_C0_register(uint8_t nr, uint8_t sel)
 	if (sel)
 		pdc -> dc_log("get_C0_register: handling of sel %d not implemented", sel);
 
+	if (nr == 9)
+		return get_count(cycles);
+
+	if (nr == 12)
+		return status_register;
+
+	if (nr == 13)
+		return C0_registers[13] | ip_lines;
+
+	if (nr == 14)
+		return EPC;
+
 	return C0_registers[nr];
 }
 
@@ -153,26 +240,245 @@ void processor::set_C0_register(uint8_t nr, uint8_t sel, uint64_t value)
 	if (sel)
 		pdc -> dc_log("set_C0_register: handling of sel %d not implemented", sel);
 
-	C0_registers[nr] = value;
+	if (nr == 9)
+		set_count(value);
+	else if (nr == 11)	// also acknowledges the timer interrupt
+	{
+		C0_registers[11] = value;
+		C0_registers[13] &= ~CAUSE_IP_TIMER;
+		compare_armed = true;
+		schedule_compare(cycles);
+	}
+	else if (nr == 12)
+		status_register = value;
+	else if (nr == 13)	// only the software interrupt bits are writable
+		C0_registers[13] = (C0_registers[13] & ~CAUSE_IP_SW) | (value & CAUSE_IP_SW);
+	else if (nr == 14)
+		EPC = int32_t(value);
+	else
+		C0_registers[nr] = value;
+
+	update_irq_pending();
+}
+
+uint32_t processor::get_count(uint64_t now) const
+{
+	return count_base + uint32_t((now - count_cycle) / COUNT_DIVIDER);
+}
+
+void processor::set_count(uint32_t value)
+{
+	count_base = value;
+	count_cycle = cycles;
+
+	schedule_compare(cycles);
+}
+
+// the first cycle at which Count equals Compare
+void processor::schedule_compare(uint64_t now)
+{
+	sched.cancel(compare_event);
+	compare_event = SCHED_NONE;
+
+	if (!compare_armed)
+		return;
+
+	uint64_t count_cycles = now - count_cycle;
+	uint32_t delta = C0_registers[11] - get_count(now);
+
+	// already equal: the next match is after a complete wrap
+	uint64_t counts = delta ? delta : 1ll << 32;
+
+	uint64_t when = count_cycle + (count_cycles / COUNT_DIVIDER + counts) * COUNT_DIVIDER;
+
+	compare_event = sched.schedule(when, compare_event_cb, this);
 }
 
-void processor::interrupt(int nr)
+void processor::compare_match(uint64_t now)
 {
-	// 00 0 external interrupt
-	// 01 1 instruction bus error (invalid instruction)
-	// 10 2 arithmetic error
-	// 11 3 system call
+	compare_event = SCHED_NONE;
 
-	// bits 8...15 of status register are the interrupt mask
-	if (IS_BIT_OFF0_SET(8 + nr, status_register))
+	DEBUG(pdc -> dc_log("Count reached Compare (%08x)", C0_registers[11]));
+
+	C0_registers[13] |= CAUSE_IP_TIMER;
+
+	update_irq_pending();
+
+	schedule_compare(now);
+}
+
+// called at the branch of a loop that ran IDLE_LOOP_CHECK times: takes
+// a snapshot, and one iteration later compares with it
+void processor::inspect_idle_loop()
+{
+	if (loop_iterations == IDLE_LOOP_CHECK)
 	{
-		set_C0_register(14, 0, PC);	// EPC (FIXME: sel 0?)
-		PC = 0x80000080;	// interrupt service routine
-		// cause = (?)
-		status_register <<= 4;
+		memcpy(loop_registers, registers, sizeof registers);
+		loop_HI = HI;
+		loop_LO = LO;
+		loop_writes = pmb -> get_n_writes();
+		return;
+	}
 
-		// FIXME
+	loop_iterations = 0;
+
+	if (idle_enabled && loop_writes == pmb -> get_n_writes() && loop_HI == HI && loop_LO == LO && memcmp(loop_registers, registers, sizeof registers) == 0)
+		idle();
+}
+
+void processor::idle()
+{
+	uint64_t now = cycles;
+	uint64_t until = std::min(sched.get_next_event(), now + uint64_t(IDLE_MAX_SLEEP_US) * (CPU_CLOCK_HZ / 1000000));
+
+	if (until <= now)
+		return;
+
+	uint64_t sleep_us = (until - now) / (CPU_CLOCK_HZ / 1000000);
+
+	if (sleep_us >= IDLE_MIN_SLEEP_US && !wake_pending && idle_yield)
+	{
+		yield_us = sleep_us;
+	}
+	else if (sleep_us >= IDLE_MIN_SLEEP_US && !wake_pending)
+	{
+		double start_ts = get_ts();
+
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		uint64_t ns = deadline.tv_nsec + sleep_us * 1000;
+		deadline.tv_sec += ns / 1000000000;
+		deadline.tv_nsec = ns % 1000000000;
+
+		pthread_mutex_lock(&idle_lock);
+		while(!wake_pending && pthread_cond_timedwait(&idle_cond, &idle_lock, &deadline) == 0)
+		{
+		}
+		pthread_mutex_unlock(&idle_lock);
+
+		// woken early: guest time advances by what has really passed
+		uint64_t slept = uint64_t((get_ts() - start_ts) * CPU_CLOCK_HZ);
+		if (slept < until - now && !deterministic)
+			until = now + slept;
 	}
+
+	wake_pending = false;
+
+	DEBUG(pdc -> dc_log("idle at %016llx: %llu cycles", PC, until - now));
+
+	idle_cycles += until - now;
+	cycles = until;
+}
+
+void processor::hle_wait()
+{
+	PC -= 4;
+
+	uint64_t before = cycles;
+
+	if (idle_enabled)
+		idle();
+
+	// no event to skip to: still advances, so that loops that run until a
+	// cycle count or a signal get there
+	if (uint64_t(cycles) == before)
+		cycles += HLE_WAIT_CYCLES;
+}
+
+void processor::wake()
+{
+	pthread_mutex_lock(&idle_lock);
+	wake_pending = true;
+	pthread_cond_signal(&idle_cond);
+	pthread_mutex_unlock(&idle_lock);
+}
+
+void processor::save_state(snapshot_writer & sw) const
+{
+	sw.put_bytes(registers, sizeof registers);
+	sw.put_u64(PC);
+	sw.put_u64(HI);
+	sw.put_u64(LO);
+	sw.put_u64(EPC);
+	sw.put_u32(status_register);
+	sw.put_bytes(C0_registers, sizeof C0_registers);
+	sw.put_u32(ip_lines);
+	sw.put_bytes(C1_registers, sizeof C1_registers);
+	sw.put_bytes(C2_registers, sizeof C2_registers);
+	sw.put_bool(RMW_sequence);
+	sw.put_bool(have_delay_slot);
+	sw.put_bool(nullify_instruction);
+	sw.put_u64(delay_slot_PC);
+	sw.put_u64(cycles);
+	sw.put_u32(count_base);
+	sw.put_u64(count_cycle);
+	sw.put_bool(compare_armed);
+	sw.put_u64(idle_cycles);
+}
+
+void processor::load_state(snapshot_reader & sr)
+{
+	sr.get_bytes(registers, sizeof registers);
+	PC = sr.get_u64();
+	HI = sr.get_u64();
+	LO = sr.get_u64();
+	EPC = sr.get_u64();
+	status_register = sr.get_u32();
+	sr.get_bytes(C0_registers, sizeof C0_registers);
+	ip_lines = sr.get_u32();
+	sr.get_bytes(C1_registers, sizeof C1_registers);
+	sr.get_bytes(C2_registers, sizeof C2_registers);
+	RMW_sequence = sr.get_bool();
+	have_delay_slot = sr.get_bool();
+	nullify_instruction = sr.get_bool();
+	delay_slot_PC = sr.get_u64();
+	cycles = sr.get_u64();
+	count_base = sr.get_u32();
+	count_cycle = sr.get_u64();
+	compare_armed = sr.get_bool();
+	idle_cycles = sr.get_u64();
+
+	loop_target = -1;
+	loop_iterations = 0;
+
+	update_irq_pending();
+
+	schedule_compare(cycles);
+}
+
+void processor::interrupt()
+{
+	DEBUG(pdc -> dc_log("interrupt, IP %04x, SR %08x, PC %016llx", ip_lines | C0_registers[13], status_register, PC));
+
+	EPC = PC;
+
+	C0_registers[13] &= ~CAUSE_EXCCODE;	// 0: interrupt
+
+	status_register |= SR_EXL;
+
+	PC = status_register & SR_BEV ? 0xffffffffbfc00380ll : 0xffffffff80000180ll;
+
+	RMW_sequence = false;
+
+	update_irq_pending();
+}
+
+void processor::ERET()
+{
+	if (status_register & SR_ERL)
+	{
+		PC = C0_registers[30];	// ErrorEPC
+		status_register &= ~SR_ERL;
+	}
+	else
+	{
+		PC = EPC;
+		status_register &= ~SR_EXL;
+	}
+
+	RMW_sequence = false;
+
+	update_irq_pending();
 }
 
 void processor::start_RMW_sequence()
@@ -189,8 +495,13 @@ void processor::conditional_jump(bool do_jump, uint32_t instruction, bool skip_d
 
 	if (do_jump)
 	{
+		int32_t offset = get_SB18(instruction);
+
 		set_delay_slot(PC);
-		PC += get_SB18(instruction);
+		PC += offset;
+
+		if (offset <= 0 && offset >= -IDLE_LOOP_BYTES)
+			check_idle_loop(PC);
 	}
 	else if (skip_delay_slot_if_not)
 	{
@@ -1,18 +1,66 @@
 #ifndef __PROCESSOR__H__
 #define __PROCESSOR__H__
 
+#include <atomic>
+#include <pthread.h>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "debug.h"
 #include "optimize.h"
 #include "debug_console.h"
 #include "processor_utils.h"
 #include "memory_bus.h"
+#include "scheduler.h"
+#include "snapshot_state.h"
 
 #define SR_EI 0			// status register "EI" bit
 #define SR_KERNEL_USER	1	// kernel/user mode
 
+#define SR_IE		(1 << 0)
+#define SR_EXL		(1 << 1)
+#define SR_ERL		(1 << 2)
+#define SR_IM		0x0000ff00
+#define SR_BEV		(1 << 22)
+
+#define CAUSE_IP	0x0000ff00
+#define CAUSE_IP_SW	0x00000300	// IP0/IP1, set by software
+#define CAUSE_EXCCODE	0x0000007c
+
+#define CPU_CLOCK_HZ	100000000	// R4600PC, used to convert cycles to time
+#define COUNT_DIVIDER	2	// COP0 Count runs at half the pipeline clock
+
+#define CAUSE_IP_TIMER	(1 << 15)	// IP7: Count reached Compare
+
+#define IDLE_LOOP_BYTES		64	// longest backward branch considered a wait loop
+#define IDLE_LOOP_CHECK		64	// iterations before a loop is inspected
+#define IDLE_MAX_SLEEP_US	100000	// without pending events
+#define IDLE_MIN_SLEEP_US	50	// shorter waits are skipped without sleeping
+
+// SPECIAL2 function 0x3e is not used by MIPS (nor by MIPS32 later on):
+// miep uses it to call native code from guest code, e.g. firmware stubs.
+// The 20 bits above the function field are the code of the call.
+#define HLE_TRAP_FUNCT	0x3e
+#define HLE_TRAP(code)	((0x1c << 26) | (((code) & 0xfffff) << 6) | HLE_TRAP_FUNCT)
+#define HLE_WAIT_CYCLES	100	// guest time of a trap that waits, at least
+
+class device_thread;
+class processor;
+
+// runs instead of the instruction; may change registers and the PC
+typedef void (*hle_handler_t)(void *ctx, processor *p, uint32_t code);
+
+// a device with work in flight on another thread: waits for it and makes
+// the results visible
+typedef void (*sync_callback_t)(void *ctx);
+
+typedef struct
+{
+	sync_callback_t cb;
+	void *ctx;
+} sync_handler_t;
+
 class processor
 {
 private:
@@ -34,6 +82,13 @@ private:
 	uint64_t registers[32], PC, HI, LO, EPC;
 	uint32_t status_register;
 	uint32_t C0_registers[32]; // COP0
+
+	// IP2...IP7 of Cause, driven by the interrupt controller; irq_pending
+	// is non-zero when one of them (or IP0/IP1) is raised, unmasked and
+	// interrupts are enabled. It is recomputed whenever one of those
+	// changes so that the instruction loop only tests this one word.
+	uint32_t ip_lines;
+	uint32_t irq_pending;
 	uint64_t C1_registers[32]; // FP, COP1
 	uint64_t C2_registers[32]; // COP2
 
@@ -44,6 +99,60 @@ private:
 
 	long long int cycles;
 
+	scheduler sched;
+
+	device_thread *dt;	// NULL: devices do all their work inline
+	std::vector<sync_handler_t> sync_handlers;
+
+	hle_handler_t hle_cb;
+	void *hle_ctx;
+
+	// Count is never stepped: it is count_base plus the cycles since
+	// count_cycle. A Compare match is a single scheduler event, armed by
+	// the first write to Compare.
+	uint32_t count_base;
+	uint64_t count_cycle;
+	bool compare_armed;
+	sched_id_t compare_event;
+
+	// Idle detection: a short backward loop of which a complete
+	// iteration changes no register and writes no memory can only be left
+	// through an interrupt, a device event or host input. Instead of
+	// spinning, the thread then sleeps until the next event (or until
+	// wake()) and the cycle counter jumps ahead by the time slept.
+	bool idle_enabled, deterministic;
+	bool idle_yield;	// leave the sleeping to the caller, see take_yield_us()
+	uint64_t yield_us;
+	uint64_t loop_target;
+	int loop_iterations;
+	uint64_t loop_registers[32], loop_HI, loop_LO, loop_writes;
+	uint64_t idle_cycles;
+
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle_cond;
+	std::atomic_bool wake_pending;
+
+	inline void check_idle_loop(uint64_t target)
+	{
+		if (likely(target != loop_target))
+		{
+			loop_target = target;
+			loop_iterations = 0;
+		}
+		else if (unlikely(++loop_iterations >= IDLE_LOOP_CHECK))
+		{
+			inspect_idle_loop();
+		}
+	}
+
+	void inspect_idle_loop();
+	void idle();
+
+	uint32_t get_count(uint64_t now) const;
+	void set_count(uint32_t value);
+	void schedule_compare(uint64_t now);
+
+	void ERET();
 	void j_type(uint8_t opcode, uint32_t instruction);
 	void special2(uint32_t instruction);
 	void special3(uint32_t instruction);
@@ -53,7 +162,11 @@ private:
 	// not in a group? FIXME
 	void SLTI(uint32_t instruction);
 	void regimm(uint32_t instruction);
-	void interrupt(int nr);
+	void interrupt();
+	inline void update_irq_pending()
+	{
+		irq_pending = (status_register & (SR_IE | SR_EXL | SR_ERL)) == SR_IE ? (C0_registers[13] | ip_lines) & status_register & SR_IM : 0;
+	}
 
 	void init_r_type();
 	void r_type_00(uint32_t instruction);
@@ -194,6 +307,24 @@ public:
 	~processor();
 
 	memory_bus *get_memory_bus() const { return pmb; }
+	scheduler *get_scheduler() { return &sched; }
+
+	void set_device_thread(device_thread *dt_in) { dt = dt_in; }
+	device_thread *get_device_thread() const { return dt; }
+
+	// NULL: HLE_TRAP is an unknown instruction
+	void set_hle_handler(hle_handler_t cb, void *ctx) { hle_cb = cb; hle_ctx = ctx; }
+	// from a handler that cannot complete yet: the trap runs again after
+	// the next event or wake(), guest time goes on in the meantime
+	void hle_wait();
+	// all device work done and visible to the guest: before the state is
+	// saved, memory is inspected behind the guest's back or the process
+	// forks
+	void sync_devices();
+	// for devices that hand work to a thread of their own (not the device
+	// thread), called by sync_devices()
+	void add_sync_callback(sync_callback_t cb, void *ctx);
+	void remove_sync_callback(sync_callback_t cb, void *ctx);
 
 	inline bool is_delay_slot() { return have_delay_slot; }
 	void set_delay_slot(uint64_t offset);
@@ -210,7 +341,11 @@ public:
 
 	uint64_t get_C0_register(uint8_t nr, uint8_t sel);
 
-	inline void set_status_register(uint32_t value) { status_register = value; }
+	inline void set_status_register(uint32_t value) { status_register = value; update_irq_pending(); }
+
+	// called by the interrupt controller when its output changes
+	inline void set_ip_lines(uint32_t lines) { ip_lines = lines; update_irq_pending(); }
+	inline uint32_t get_irq_pending() const { return irq_pending; }
 
 	inline void set_PC(uint64_t value) { PC = value; }
 	inline void set_HI(uint64_t value) { HI = value; }
@@ -221,6 +356,28 @@ public:
 	void reset();
 	void tick();
 
+	// scheduler callback
+	void compare_match(uint64_t now);
+
+	void set_idle_enabled(bool state) { idle_enabled = state; }
+	// guest time then depends on the executed instructions only: an idle
+	// wait always lasts until the next event, even when woken earlier
+	void set_deterministic(bool state) { deterministic = state; }
+	// thread safe, ends an idle sleep because host input arrived
+	void wake();
+	static void wake_callback(void *ctx) { ((processor *)ctx) -> wake(); }
+	// for a thread that runs several machines: instead of sleeping, idle
+	// only records for how long, the guest time still jumps ahead
+	void set_idle_yield(bool state) { idle_yield = state; }
+	bool yield_pending() const { return yield_us != 0; }
+	uint64_t take_yield_us() { uint64_t us = yield_us; yield_us = 0; return us; }
+	uint64_t get_idle_cycles() const { return idle_cycles; }
+	double get_idle_percentage() const { return cycles ? idle_cycles * 100.0 / cycles : 0.0; }
+
+	// snapshots: the pending Compare match is rescheduled when loading
+	void save_state(snapshot_writer & sw) const;
+	void load_state(snapshot_reader & sr);
+
 	static inline uint8_t get_RS(uint32_t instruction) { return (instruction >> 21) & MASK_5B; }
 	static inline uint8_t get_RT(uint32_t instruction) { return (instruction >> 16) & MASK_5B; }
 	static inline uint8_t get_RD(uint32_t instruction) { return (instruction >> 11) & MASK_5B; }
@@ -9,13 +9,9 @@ void processor::COP0(uint32_t instruction)
 
 		switch(function)
 		{
-#if 0
 			case 0x18:	// ERET
-				PC = get_C0_register(14, 0);	// EPC (FIXME: sel 0?)
-				status_register >>= 4;
-				// FIXME
+				ERET();
 				break;
-#endif
 
 			default:
 				pdc -> dc_log("COP0: function %02x not implemented (1)", function);
@@ -11,5 +11,10 @@ void processor::j_type(uint8_t opcode, uint32_t instruction)
 
 	set_delay_slot(PC);
 
-	PC = ((instruction & MASK_26B) << 2) | (PC & 0xfffffffff0000000);
+	uint64_t target = ((instruction & MASK_26B) << 2) | (PC & 0xfffffffff0000000);
+
+	if (target <= PC && PC - target <= IDLE_LOOP_BYTES)
+		check_idle_loop(target);
+
+	PC = target;
 }
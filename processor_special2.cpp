@@ -28,6 +28,16 @@ void processor::special2(uint32_t instruction)
 			// FIXME also in rt?
 			break;
 
+		case HLE_TRAP_FUNCT:
+			if (hle_cb)
+			{
+				hle_cb(hle_ctx, this, (instruction >> 6) & 0xfffff);
+				break;
+			}
+
+			pdc -> dc_log("HLE trap %05x without a handler", (instruction >> 6) & 0xfffff);
+			break;
+
 		default:
 			pdc -> dc_log("special2 clo %02x not implemented", clo);
 			break;
@@ -0,0 +1,337 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "error.h"
+#include "log.h"
+#include "lz.h"
+#include "placement.h"
+#include "ram_compactor.h"
+
+static ram_compactor *instances[COMPACT_MAX_INSTANCES];
+static int n_instances = 0;
+static struct sigaction old_action;
+static bool atfork_registered = false;
+
+static void *ram_compactor_thread(void *arg)
+{
+	place_thread(PLACE_IO, "ram compactor");
+
+	((ram_compactor *)arg) -> run();
+
+	return NULL;
+}
+
+ram_compactor::ram_compactor(double interval_in) : interval(interval_in), running(false), stop(false), n_compressed(0), pool_bytes(0), n_faults(0), n_decompressed(0), buffer(COMPACT_CHUNK), cb(NULL), cb_ctx(NULL)
+{
+	if (n_instances == COMPACT_MAX_INSTANCES)
+		error_exit("ram_compactor: too many instances");
+
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&stop_cond, NULL);
+
+	if (n_instances == 0)
+	{
+		struct sigaction sa;
+		memset(&sa, 0x00, sizeof sa);
+		sa.sa_sigaction = fault_handler;
+		sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+		sigemptyset(&sa.sa_mask);
+
+		if (sigaction(SIGSEGV, &sa, &old_action) == -1)
+			error_exit("ram_compactor: cannot install the SIGSEGV handler");
+	}
+
+	if (!atfork_registered)
+	{
+		if (pthread_atfork(fork_prepare, fork_parent, fork_child))
+			error_exit("ram_compactor: pthread_atfork failed");
+
+		atfork_registered = true;
+	}
+
+	instances[n_instances++] = this;
+}
+
+ram_compactor::~ram_compactor()
+{
+	if (running)
+	{
+		pthread_mutex_lock(&lock);
+		stop = true;
+		pthread_cond_signal(&stop_cond);
+		pthread_mutex_unlock(&lock);
+
+		pthread_join(th, NULL);
+	}
+
+	// everything accessible again, the handler is not needed after this
+	for(size_t index=0; index<regions.size(); index++)
+	{
+		region_t & r = regions[index];
+
+		for(size_t nr=0; nr<r.state.size(); nr++)
+		{
+			if (r.state[nr] != CS_RESIDENT)
+				fault(r.base + nr * COMPACT_CHUNK);
+		}
+	}
+
+	for(int index=0; index<n_instances; index++)
+	{
+		if (instances[index] == this)
+		{
+			instances[index] = instances[--n_instances];
+			break;
+		}
+	}
+
+	if (n_instances == 0)
+		sigaction(SIGSEGV, &old_action, NULL);
+
+	pthread_cond_destroy(&stop_cond);
+	pthread_mutex_destroy(&lock);
+}
+
+void ram_compactor::add(memory *m)
+{
+	if (running)
+		error_exit("ram_compactor: memory added while running");
+
+	region_t r;
+	r.m = m;
+	r.base = (uint8_t *)m -> get_data();
+	r.len = m -> get_size();
+
+	if (uintptr_t(r.base) % sysconf(_SC_PAGESIZE))
+		error_exit("ram_compactor: memory is not page aligned");
+
+	// a partial chunk at the end stays resident
+	r.state.resize(r.len / COMPACT_CHUNK, CS_RESIDENT);
+	r.pool.resize(r.state.size());
+
+	regions.push_back(r);
+}
+
+void ram_compactor::start()
+{
+	if (pthread_create(&th, NULL, ram_compactor_thread, this))
+		error_exit("ram_compactor: cannot start thread");
+
+	running = true;
+}
+
+// the chunk is armed and the lock is held
+void ram_compactor::compress_chunk(region_t & r, size_t nr)
+{
+	uint8_t *p = r.base + nr * COMPACT_CHUNK;
+
+	// guest reads can go on meanwhile, writes fault and wait for the lock
+	if (mprotect(p, COMPACT_CHUNK, PROT_READ) == -1)
+		error_exit("ram_compactor: mprotect failed");
+
+	bool zero = p[0] == 0 && memcmp(p, p + 1, COMPACT_CHUNK - 1) == 0;
+	size_t size = 0;
+
+	if (!zero)
+	{
+		size = lz_compress(p, COMPACT_CHUNK, buffer.data(), size_t(COMPACT_CHUNK * COMPACT_MAX_RATIO));
+
+		if (size == 0)
+		{
+			if (mprotect(p, COMPACT_CHUNK, PROT_READ | PROT_WRITE) == -1)
+				error_exit("ram_compactor: mprotect failed");
+
+			r.state[nr] = CS_RESIDENT;
+			return;
+		}
+
+		r.pool[nr].assign(buffer.begin(), buffer.begin() + size);
+	}
+
+	if (madvise(p, COMPACT_CHUNK, MADV_DONTNEED) == -1 || mprotect(p, COMPACT_CHUNK, PROT_NONE) == -1)
+		error_exit("ram_compactor: cannot release chunk");
+
+	r.state[nr] = CS_COMPRESSED;
+
+	n_compressed++;
+	pool_bytes += size;
+
+	if (cb)
+		cb(cb_ctx, r.m, nr * COMPACT_CHUNK, COMPACT_CHUNK);
+}
+
+void ram_compactor::scan()
+{
+	for(size_t index=0; index<regions.size(); index++)
+	{
+		region_t & r = regions[index];
+
+		for(size_t nr=0; nr<r.state.size(); nr++)
+		{
+			pthread_mutex_lock(&lock);
+
+			if (r.state[nr] == CS_RESIDENT)
+			{
+				if (mprotect(r.base + nr * COMPACT_CHUNK, COMPACT_CHUNK, PROT_NONE) == -1)
+					error_exit("ram_compactor: mprotect failed");
+
+				r.state[nr] = CS_ARMED;
+			}
+			else if (r.state[nr] == CS_ARMED)	// not touched since the previous scan
+			{
+				compress_chunk(r, nr);
+			}
+
+			pthread_mutex_unlock(&lock);
+		}
+	}
+}
+
+// without the lock: at worst the caller touches a chunk that just got
+// armed, which then counts as an access
+bool ram_compactor::is_resident(const uint8_t *p) const
+{
+	for(size_t index=0; index<regions.size(); index++)
+	{
+		const region_t & r = regions[index];
+
+		if (p >= r.base && p < r.base + r.state.size() * COMPACT_CHUNK)
+			return r.state[(p - r.base) / COMPACT_CHUNK] == CS_RESIDENT;
+	}
+
+	return true;
+}
+
+void ram_compactor::run()
+{
+	uint64_t reported = 0;
+
+	for(;;)
+	{
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		uint64_t ns = deadline.tv_nsec + uint64_t(interval * 1000000000.0);
+		deadline.tv_sec += ns / 1000000000;
+		deadline.tv_nsec = ns % 1000000000;
+
+		pthread_mutex_lock(&lock);
+		while(!stop && pthread_cond_timedwait(&stop_cond, &lock, &deadline) == 0)
+		{
+		}
+		bool stop_now = stop;
+		pthread_mutex_unlock(&lock);
+
+		if (stop_now)
+			break;
+
+		scan();
+
+		if (n_compressed != reported)
+		{
+			dolog("ram_compactor: %llu chunks compressed into %llu bytes, %llu faults, %llu decompressed", n_compressed, pool_bytes, n_faults, n_decompressed);
+			reported = n_compressed;
+		}
+	}
+}
+
+// false: not in a chunk of this compactor
+bool ram_compactor::fault(uint8_t *addr)
+{
+	for(size_t index=0; index<regions.size(); index++)
+	{
+		region_t & r = regions[index];
+
+		if (addr < r.base || addr >= r.base + r.state.size() * COMPACT_CHUNK)
+			continue;
+
+		size_t nr = (addr - r.base) / COMPACT_CHUNK;
+		uint8_t *p = r.base + nr * COMPACT_CHUNK;
+
+		pthread_mutex_lock(&lock);
+
+		// resident: another thread was first, the access is simply retried
+		if (r.state[nr] != CS_RESIDENT)
+		{
+			if (mprotect(p, COMPACT_CHUNK, PROT_READ | PROT_WRITE) == -1)
+				error_exit("ram_compactor: mprotect failed");
+
+			if (r.state[nr] == CS_COMPRESSED)
+			{
+				std::vector<uint8_t> & data = r.pool[nr];
+
+				if (data.empty())
+					memset(p, 0x00, COMPACT_CHUNK);
+				else if (!lz_decompress(data.data(), data.size(), p, COMPACT_CHUNK))
+					error_exit("ram_compactor: chunk %zu does not decompress", nr);
+
+				pool_bytes -= data.size();
+
+				// guest memory is never touched from within malloc, so
+				// freeing here cannot re-enter it
+				std::vector<uint8_t>().swap(data);
+
+				n_compressed--;
+				n_decompressed++;
+			}
+
+			r.state[nr] = CS_RESIDENT;
+			n_faults++;
+		}
+
+		pthread_mutex_unlock(&lock);
+
+		return true;
+	}
+
+	return false;
+}
+
+void ram_compactor::fault_handler(int sig, siginfo_t *si, void *ctx)
+{
+	int e = errno;
+
+	for(int index=0; index<n_instances; index++)
+	{
+		if (instances[index] -> fault((uint8_t *)si -> si_addr))
+		{
+			errno = e;
+			return;
+		}
+	}
+
+	// a real fault
+	if (old_action.sa_flags & SA_SIGINFO)
+		old_action.sa_sigaction(sig, si, ctx);
+	else if (old_action.sa_handler != SIG_DFL && old_action.sa_handler != SIG_IGN)
+		old_action.sa_handler(sig);
+	else
+		signal(SIGSEGV, SIG_DFL);	// the access is retried and kills us
+}
+
+void ram_compactor::fork_prepare()
+{
+	for(int index=0; index<n_instances; index++)
+		pthread_mutex_lock(&instances[index] -> lock);
+}
+
+void ram_compactor::fork_parent()
+{
+	for(int index=n_instances - 1; index>=0; index--)
+		pthread_mutex_unlock(&instances[index] -> lock);
+}
+
+void ram_compactor::fork_child()
+{
+	for(int index=n_instances - 1; index>=0; index--)
+	{
+		ram_compactor *rc = instances[index];
+
+		pthread_mutex_unlock(&rc -> lock);
+
+		// the thread is not in the child; the chunks still fault in
+		rc -> running = false;
+	}
+}
@@ -0,0 +1,100 @@
+#ifndef __RAM_COMPACTOR__H__
+#define __RAM_COMPACTOR__H__
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <vector>
+
+#include "memory.h"
+
+#define COMPACT_CHUNK		65536	// unit of tracking and compression
+#define COMPACT_MAX_RATIO	0.75	// chunks that compress worse stay resident
+#define COMPACT_MAX_INSTANCES	8
+
+// Compresses guest RAM that the guest does not use into an in-process
+// pool and gives the host pages back to the kernel.
+//
+// Accesses are tracked with page protection, so the memory methods on
+// the hot path stay as they are: a scan makes each resident chunk
+// inaccessible (armed); the first access faults and the SIGSEGV handler
+// makes it accessible again. A chunk that is still armed at the next scan
+// was not touched for a whole interval: it is compressed, its pages are
+// released with MADV_DONTNEED and it stays inaccessible. The first access
+// to it then faults and the handler decompresses it in place.
+//
+// Faults are synchronous, so the handler may take the lock: the scanner
+// holds it while it handles one chunk. It is also held across fork() so
+// that a child (background snapshot writer, fork server job) inherits it
+// free and can still fault in compressed chunks.
+class ram_compactor
+{
+private:
+	enum chunk_state { CS_RESIDENT, CS_ARMED, CS_COMPRESSED };
+
+	typedef struct
+	{
+		memory *m;
+		uint8_t *base;
+		uint64_t len;
+
+		std::vector<uint8_t> state;
+		std::vector<std::vector<uint8_t> > pool;	// per compressed chunk, empty: all zero
+	} region_t;
+
+	std::vector<region_t> regions;
+
+	pthread_mutex_t lock;
+
+	double interval;
+	pthread_t th;
+	bool running, stop;
+	pthread_cond_t stop_cond;
+
+	uint64_t n_compressed, pool_bytes;
+	uint64_t n_faults, n_decompressed;
+
+	std::vector<uint8_t> buffer;
+
+	memory_release_callback_t cb;
+	void *cb_ctx;
+
+	void compress_chunk(region_t & r, size_t nr);
+	bool fault(uint8_t *addr);
+
+	static void fault_handler(int sig, siginfo_t *si, void *ctx);
+	static void fork_prepare();
+	static void fork_parent();
+	static void fork_child();
+
+public:
+	// interval 0: no thread, call scan() yourself
+	ram_compactor(double interval_in);
+	// decompresses everything: delete before the memory objects
+	~ram_compactor();
+
+	// page aligned memory only; after a snapshot restore, map_file()
+	// replaces the memory
+	void add(memory *m);
+	void start();
+
+	// called from the thread of the compactor
+	void set_release_callback(memory_release_callback_t cb_in, void *ctx) { cb = cb_in; cb_ctx = ctx; }
+
+	// one pass over all chunks
+	void scan();
+
+	// false for a chunk that is compressed or being watched: touching it
+	// would fault
+	bool is_resident(const uint8_t *p) const;
+
+	// the thread
+	void run();
+
+	uint64_t get_n_compressed() const { return n_compressed; }
+	uint64_t get_pool_bytes() const { return pool_bytes; }
+	uint64_t get_n_faults() const { return n_faults; }
+	uint64_t get_n_decompressed() const { return n_decompressed; }
+};
+
+#endif
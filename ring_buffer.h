@@ -0,0 +1,109 @@
+#ifndef __RING_BUFFER__H__
+#define __RING_BUFFER__H__
+
+#include <atomic>
+#include <stddef.h>
+
+#include "error.h"
+
+// single producer / single consumer queue without locks
+// one thread may call push(), one other thread may call pop()/peek()
+template <typename T>
+class ring_buffer
+{
+private:
+	T *slots;
+	size_t mask;
+
+	// producer and consumer indexes on their own cache line to prevent
+	// the two threads from bouncing the same line between cores
+	char pad0[64];
+	std::atomic<size_t> head;	// written by producer
+	char pad1[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> tail;	// written by consumer
+	char pad2[64 - sizeof(std::atomic<size_t>)];
+
+public:
+	ring_buffer(size_t n_slots) : head(0), tail(0)
+	{
+		if (n_slots == 0 || (n_slots & (n_slots - 1)))
+			error_exit("ring_buffer: size %zu is not a power of 2", n_slots);
+
+		slots = new T[n_slots];
+		mask = n_slots - 1;
+	}
+
+	~ring_buffer()
+	{
+		delete [] slots;
+	}
+
+	bool push(const T & item)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+
+		if (h - tail.load(std::memory_order_acquire) > mask)
+			return false;	// full
+
+		slots[h & mask] = item;
+		head.store(h + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	// reserve()/commit() let the producer fill a slot in place (for large T)
+	T * reserve()
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+
+		if (h - tail.load(std::memory_order_acquire) > mask)
+			return NULL;
+
+		return &slots[h & mask];
+	}
+
+	void commit()
+	{
+		head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	bool pop(T *item)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+
+		if (t == head.load(std::memory_order_acquire))
+			return false;	// empty
+
+		*item = slots[t & mask];
+		tail.store(t + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	// peek()/consume() let the consumer use a slot in place
+	T * peek()
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+
+		if (t == head.load(std::memory_order_acquire))
+			return NULL;
+
+		return &slots[t & mask];
+	}
+
+	void consume()
+	{
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	size_t size() const
+	{
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const { return mask + 1; }
+
+	bool empty() const { return size() == 0; }
+};
+
+#endif
@@ -1,12 +1,36 @@
+#include <fcntl.h>
 #include <string>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include "error.h"
 #include "rom.h"
 #include "exceptions.h"
 #include "utils.h"
 
+// a read-only mapping: all machines (also in other processes) share the
+// pages of the file
 rom::rom(std::string file)
 {
-	load_file(file, &pm, &len);
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd == -1)
+		error_exit("Problem opening file %s", file.c_str());
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size == 0)
+		error_exit("Stat on file %s failed", file.c_str());
+
+	len = st.st_size;
+
+	void *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+		error_exit("rom: cannot map %s", file.c_str());
+
+	close(fd);
+
+	pm = (unsigned char *)p;
+	mapped = true;
 }
 
 rom::~rom()
@@ -1,3 +1,6 @@
+#ifndef __ROM__H__
+#define __ROM__H__
+
 #include "memory.h"
 
 class rom : public memory
@@ -11,3 +14,5 @@ public:
 	void write_16b(uint64_t offset, uint16_t data);
 	void write_8b(uint64_t offset, uint8_t data);
 };
+
+#endif
@@ -0,0 +1,193 @@
+#include "scheduler.h"
+
+scheduler::scheduler() : post_pending(false), next_seq(0), next_event(UINT64_MAX), n_dispatched(0)
+{
+	pthread_mutex_init(&post_lock, NULL);
+}
+
+scheduler::~scheduler()
+{
+	pthread_mutex_destroy(&post_lock);
+}
+
+void scheduler::heap_set(int pos, uint32_t slot)
+{
+	heap[pos] = slot;
+	slots[slot].heap_pos = pos;
+}
+
+void scheduler::sift_up(int pos)
+{
+	uint32_t slot = heap[pos];
+
+	while(pos > 0)
+	{
+		int parent = (pos - 1) / 2;
+
+		if (!later(heap[parent], slot))
+			break;
+
+		heap_set(pos, heap[parent]);
+		pos = parent;
+	}
+
+	heap_set(pos, slot);
+}
+
+void scheduler::sift_down(int pos)
+{
+	int n = heap.size();
+	uint32_t slot = heap[pos];
+
+	for(;;)
+	{
+		int child = pos * 2 + 1;
+		if (child >= n)
+			break;
+
+		if (child + 1 < n && later(heap[child], heap[child + 1]))
+			child++;
+
+		if (!later(slot, heap[child]))
+			break;
+
+		heap_set(pos, heap[child]);
+		pos = child;
+	}
+
+	heap_set(pos, slot);
+}
+
+void scheduler::heap_remove(int pos)
+{
+	uint32_t slot = heap[pos];
+	uint32_t last = heap.back();
+
+	heap.pop_back();
+
+	if (pos < int(heap.size()))
+	{
+		heap_set(pos, last);
+
+		// the moved event can belong either higher or lower
+		sift_up(pos);
+		sift_down(slots[last].heap_pos);
+	}
+
+	slots[slot].heap_pos = -1;
+	slots[slot].generation++;
+	free_slots.push_back(slot);
+}
+
+sched_id_t scheduler::schedule(uint64_t when, sched_callback_t cb, void *ctx)
+{
+	uint32_t slot;
+
+	if (free_slots.empty())
+	{
+		sched_event_t e = { 0, 0, NULL, NULL, 1, -1 };
+
+		slot = slots.size();
+		slots.push_back(e);
+	}
+	else
+	{
+		slot = free_slots.back();
+		free_slots.pop_back();
+	}
+
+	sched_event_t & e = slots[slot];
+	e.when = when;
+	e.seq = next_seq++;
+	e.cb = cb;
+	e.ctx = ctx;
+
+	heap.push_back(slot);
+	sift_up(heap.size() - 1);
+
+	update_next_event();
+
+	return (uint64_t(e.generation) << 32) | slot;
+}
+
+bool scheduler::cancel(sched_id_t id)
+{
+	uint32_t slot = id & 0xffffffff;
+
+	if (slot >= slots.size() || slots[slot].generation != uint32_t(id >> 32) || slots[slot].heap_pos == -1)
+		return false;
+
+	heap_remove(slots[slot].heap_pos);
+
+	update_next_event();
+
+	return true;
+}
+
+void scheduler::run(uint64_t now)
+{
+	if (post_pending.exchange(false))
+		run_posted(now);
+
+	while(!heap.empty() && slots[heap[0]].when <= now)
+	{
+		sched_event_t & e = slots[heap[0]];
+		sched_callback_t cb = e.cb;
+		void *ctx = e.ctx;
+
+		// free the slot first: the callback may schedule into it
+		heap_remove(0);
+
+		n_dispatched++;
+
+		cb(ctx, now);
+	}
+
+	update_next_event();
+}
+
+void scheduler::run_posted(uint64_t now)
+{
+	std::vector<sched_post_t> todo;
+
+	pthread_mutex_lock(&post_lock);
+	todo.swap(posted);
+	pthread_mutex_unlock(&post_lock);
+
+	for(const sched_post_t & p : todo)
+	{
+		n_dispatched++;
+
+		p.cb(p.ctx, now);
+	}
+}
+
+void scheduler::post(sched_callback_t cb, void *ctx)
+{
+	sched_post_t p = { cb, ctx };
+
+	pthread_mutex_lock(&post_lock);
+	posted.push_back(p);
+	pthread_mutex_unlock(&post_lock);
+
+	post_pending.store(true, std::memory_order_relaxed);
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	next_event.store(0, std::memory_order_relaxed);
+}
+
+void scheduler::cancel_posted(void *ctx)
+{
+	pthread_mutex_lock(&post_lock);
+
+	for(size_t index=0; index<posted.size();)
+	{
+		if (posted[index].ctx == ctx)
+			posted.erase(posted.begin() + index);
+		else
+			index++;
+	}
+
+	pthread_mutex_unlock(&post_lock);
+}
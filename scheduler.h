@@ -0,0 +1,113 @@
+#ifndef __SCHEDULER__H__
+#define __SCHEDULER__H__
+
+#include <atomic>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+typedef void (*sched_callback_t)(void *ctx, uint64_t now);
+
+// identifies a scheduled event for cancel(); 0 is never returned
+typedef uint64_t sched_id_t;
+
+#define SCHED_NONE	0
+
+// Calls devices back at a given processor cycle count. The events are
+// kept in a min-heap on their cycle; the processor only compares its
+// cycle counter with get_next_event() after each instruction.
+//
+// Events live in slots that are reused; the heap holds slot numbers and
+// each slot knows its heap position so that cancel() is O(log n) too. A
+// sched_id_t is the slot number plus a generation count of that slot, so
+// an id of an event that already fired (and whose slot got reused) is
+// recognized as stale.
+//
+// The heap belongs to the processor thread. Other threads (I/O
+// completions) use post(): the callback goes into an inbox and the next
+// event is set to 0, so that the processor runs it at the next
+// instruction.
+class scheduler
+{
+private:
+	typedef struct
+	{
+		uint64_t when, seq;	// seq keeps events for the same cycle in order
+		sched_callback_t cb;
+		void *ctx;
+
+		uint32_t generation;
+		int heap_pos;	// -1: free
+	} sched_event_t;
+
+	std::vector<sched_event_t> slots;
+	std::vector<uint32_t> free_slots;
+	std::vector<uint32_t> heap;
+
+	typedef struct
+	{
+		sched_callback_t cb;
+		void *ctx;
+	} sched_post_t;
+
+	pthread_mutex_t post_lock;
+	std::vector<sched_post_t> posted;
+	std::atomic_bool post_pending;
+
+	uint64_t next_seq;
+	std::atomic<uint64_t> next_event;
+	uint64_t n_dispatched;
+
+	inline bool later(uint32_t a, uint32_t b) const
+	{
+		const sched_event_t & ea = slots[a], & eb = slots[b];
+
+		return ea.when > eb.when || (ea.when == eb.when && ea.seq > eb.seq);
+	}
+
+	void heap_set(int pos, uint32_t slot);
+	void sift_up(int pos);
+	void sift_down(int pos);
+	void heap_remove(int pos);
+
+	void run_posted(uint64_t now);
+
+	inline void update_next_event()
+	{
+		next_event.store(heap.empty() ? UINT64_MAX : slots[heap[0]].when, std::memory_order_relaxed);
+
+		// pairs with the fence in post(): either post() sees the value
+		// stored above and overwrites it, or this sees post_pending
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (post_pending.load(std::memory_order_relaxed))
+			next_event.store(0, std::memory_order_relaxed);
+	}
+
+public:
+	scheduler();
+	~scheduler();
+
+	sched_id_t schedule(uint64_t when, sched_callback_t cb, void *ctx);
+
+	// returns false when the event already fired or was cancelled
+	bool cancel(sched_id_t id);
+
+	inline uint64_t get_next_event() const { return next_event.load(std::memory_order_relaxed); }
+
+	// calls all callbacks that are due at cycle `now'; they may schedule
+	// new events and cancel pending ones
+	void run(uint64_t now);
+
+	// any thread: cb runs on the processor thread at the next run(); the
+	// caller wakes the processor if it may be idle
+	void post(sched_callback_t cb, void *ctx);
+	// drops the posted callbacks for ctx, for a device that goes away
+	void cancel_posted(void *ctx);
+
+	size_t get_n_pending() const { return heap.size(); }
+	uint64_t get_n_dispatched() const { return n_dispatched; }
+};
+
+#endif
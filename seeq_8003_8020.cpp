@@ -1,7 +1,7 @@
 #include "debug_console.h"
 #include "seeq_8003_8020.h"
 
-seeq_8003_8020::seeq_8003_8020(debug_console *pdc_in)
+seeq_8003_8020::seeq_8003_8020(debug_console *pdc_in) : pdc(pdc_in), port(NULL), reg(0)
 {
 }
 
@@ -9,14 +9,36 @@ seeq_8003_8020::~seeq_8003_8020()
 {
 }
 
-static uint32_t bla;
-
 void seeq_8003_8020::read_32b(uint64_t offset, uint32_t *data)
 {
-	*data = bla;
+	*data = reg;
 }
 
 void seeq_8003_8020::write_32b(uint64_t offset, uint32_t data)
 {
-	bla = data;
+	reg = data;
+}
+
+// frames without a cable go nowhere, like on the real thing
+bool seeq_8003_8020::transmit(const uint8_t *data, uint16_t len)
+{
+	if (!port)
+		return false;
+
+	if (!port -> send_frame(data, len))
+	{
+		pdc -> dc_log("SEEQ: transmit queue full, frame dropped");
+
+		return false;
+	}
+
+	return true;
+}
+
+bool seeq_8003_8020::receive(net_frame_t *frame)
+{
+	if (!port)
+		return false;
+
+	return port -> receive_frame(frame);
 }
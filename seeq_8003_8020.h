@@ -1,15 +1,31 @@
+#ifndef __SEEQ_8003_8020__H__
+#define __SEEQ_8003_8020__H__
+
 #include <stdint.h>
 
 #include "debug_console.h"
+#include "vswitch.h"
 
 class seeq_8003_8020
 {
 private:
+	debug_console *pdc;
+
+	vswitch_port *port;
+
+	uint32_t reg;	// registers are not emulated: reads return the last write
 
 public:
 	seeq_8003_8020(debug_console *pdc_in);
 	~seeq_8003_8020();
 
+	void attach(vswitch_port *port_in) { port = port_in; }
+
+	bool transmit(const uint8_t *data, uint16_t len);
+	bool receive(net_frame_t *frame);
+
         void read_32b(uint64_t offset, uint32_t *data);
         void write_32b(uint64_t offset, uint32_t data);
 };
+
+#endif
@@ -0,0 +1,240 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "error.h"
+#include "log.h"
+#include "serial_host.h"
+
+#define SERIAL_RX_QUEUE_SIZE	65536	// bytes, must be a power of 2
+
+static void serial_host_listen_event(void *ctx, int fd, uint32_t events)
+{
+	((serial_host *)ctx) -> accept_client();
+}
+
+static void serial_host_conn_event(void *ctx, int fd, uint32_t events)
+{
+	((serial_host *)ctx) -> read_input();
+}
+
+static void serial_host_resume(void *ctx)
+{
+	((serial_host *)ctx) -> resume_input();
+}
+
+serial_host::serial_host(io_reactor *io_in, std::string name_in, std::string spec) : name(name_in), io(io_in), listen_fd(-1), pty_slave_fd(-1), is_pty(false), conn_fd(-1), rx(SERIAL_RX_QUEUE_SIZE), rx_blocked(false), input_cb(NULL), input_ctx(NULL)
+{
+	if (spec == "pty")
+		open_pty();
+	else if (spec.substr(0, 5) == "unix:")
+		open_unix_socket(spec.substr(5));
+	else if (spec.substr(0, 3) == "fd:")	// already connected, e.g. passed by a fork server client
+		open_fd(atoi(spec.substr(3).c_str()));
+	else
+		error_exit("serial_host: \"%s\" is not understood, use pty, unix:<path> or fd:<n>", spec.c_str());
+}
+
+serial_host::~serial_host()
+{
+	io -> run_requests();
+	io -> remove_timer(serial_host_resume, this);
+
+	set_connection(-1);
+
+	if (pty_slave_fd != -1)
+		close(pty_slave_fd);
+
+	if (listen_fd != -1)
+	{
+		io -> remove(listen_fd);
+		close(listen_fd);
+	}
+}
+
+void serial_host::open_pty()
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd == -1 || grantpt(fd) == -1 || unlockpt(fd) == -1)
+		error_exit("serial_host: cannot create pty");
+
+	const char *slave = ptsname(fd);
+
+	pty_slave_fd = open(slave, O_RDWR | O_NOCTTY);
+	if (pty_slave_fd == -1)
+		error_exit("serial_host: cannot open %s", slave);
+
+	struct termios tio;
+	tcgetattr(pty_slave_fd, &tio);
+	cfmakeraw(&tio);
+	tcsetattr(pty_slave_fd, TCSANOW, &tio);
+
+	fprintf(stderr, "%s: %s\n", name.c_str(), slave);
+	dolog("%s: %s", name.c_str(), slave);
+
+	is_pty = true;
+
+	set_connection(fd);
+}
+
+void serial_host::open_fd(int fd)
+{
+	// a client that stops reading must not block the I/O thread
+	int flags = fcntl(fd, F_GETFL);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		error_exit("serial_host: fd %d is not usable", fd);
+
+	set_connection(fd);
+}
+
+void serial_host::open_unix_socket(std::string path)
+{
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (listen_fd == -1)
+		error_exit("serial_host: cannot create socket");
+
+	struct sockaddr_un addr;
+	memset(&addr, 0x00, sizeof addr);
+	addr.sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof addr.sun_path)
+		error_exit("serial_host: path %s too long", path.c_str());
+	memcpy(addr.sun_path, path.c_str(), path.size());
+
+	unlink(path.c_str());
+
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof addr) == -1 || listen(listen_fd, 1) == -1)
+		error_exit("serial_host: cannot listen on %s", path.c_str());
+
+	io -> add(listen_fd, EPOLLIN, serial_host_listen_event, this);
+
+	dolog("%s: listening on %s", name.c_str(), path.c_str());
+}
+
+void serial_host::set_connection(int fd)
+{
+	int old_fd = conn_fd.exchange(fd);
+
+	if (old_fd != -1)
+	{
+		io -> remove(old_fd);
+		close(old_fd);
+	}
+
+	if (fd != -1)
+		io -> add(fd, EPOLLIN, serial_host_conn_event, this);
+}
+
+bool serial_host::get_input(uint8_t *c)
+{
+	if (!rx.pop(c))
+		return false;
+
+	// the I/O thread stopped reading when the queue was full
+	if (rx_blocked && rx.size() < rx.capacity() / 2)
+	{
+		rx_blocked = false;
+
+		// the next character asks again
+		if (!io -> request(serial_host_resume, this))
+			rx_blocked = true;
+	}
+
+	return true;
+}
+
+void serial_host::resume_input()
+{
+	// also a retry of a pty nobody had opened
+	io -> remove_timer(serial_host_resume, this);
+
+	int fd = conn_fd;
+	if (fd != -1 && !rx_blocked)
+		io -> modify(fd, EPOLLIN);
+}
+
+void serial_host::read_input()
+{
+	int fd = conn_fd;
+	uint8_t buffer[4096];
+
+	size_t room = rx.capacity() - rx.size();
+	if (room == 0)
+	{
+		// leave the data in the kernel: the sender is throttled and
+		// nothing is lost
+		rx_blocked = true;
+
+		io -> modify(fd, 0);
+
+		return;
+	}
+
+	ssize_t n = read(fd, buffer, room < sizeof buffer ? room : sizeof buffer);
+
+	if (n > 0)
+	{
+		for(ssize_t index=0; index<n; index++)
+			rx.push(buffer[index]);
+
+		if (input_cb)
+			input_cb(input_ctx);
+	}
+	else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+	{
+		if (is_pty)	// nobody has the slave open, EIO until someone does
+		{
+			io -> modify(fd, 0);
+			io -> add_timer(SERIAL_PTY_RETRY_US, serial_host_resume, this);
+		}
+		else	// client went away
+		{
+			dolog("%s: client disconnected", name.c_str());
+
+			set_connection(-1);
+		}
+	}
+}
+
+size_t serial_host::write_output(const char *data, size_t len)
+{
+	size_t done = 0;
+
+	while(done < len)
+	{
+		int fd = conn_fd;
+		if (fd == -1)	// nobody is listening
+			return len;
+
+		ssize_t rc = write(fd, data + done, len - done);
+
+		if (rc > 0)
+			done += rc;
+		else if (rc == -1 && errno == EAGAIN)	// the other end is slower than the emulator
+			break;
+		else if (rc == -1 && errno != EINTR)
+			return len;
+	}
+
+	return done;
+}
+
+void serial_host::accept_client()
+{
+	int cfd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+
+	if (cfd != -1)
+	{
+		dolog("%s: client connected", name.c_str());
+
+		// a new client replaces the previous one
+		set_connection(cfd);
+	}
+}
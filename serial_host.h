@@ -0,0 +1,62 @@
+#ifndef __SERIAL_HOST__H__
+#define __SERIAL_HOST__H__
+
+#include <atomic>
+#include <string>
+
+#include "io_reactor.h"
+#include "ring_buffer.h"
+
+#define SERIAL_PTY_RETRY_US	100000
+
+// Connects a serial channel to the host: either a pseudo terminal
+// ("pty"), a listening unix stream socket ("unix:/some/path", one
+// client at a time) or a descriptor that is connected already ("fd:<n>",
+// dropped when the other end closes it). The I/O thread of the machine reads host input into
+// a lock-free RX queue which the emulated UART drains; nothing on the
+// host side is polled from the emulation thread.
+class serial_host
+{
+private:
+	std::string name;
+	io_reactor *io;
+	int listen_fd;			// unix socket mode
+	int pty_slave_fd;		// pty mode, kept open so that the master does not see EIO
+	bool is_pty;			// EOF means nobody opened the slave, not a client that left
+	std::atomic_int conn_fd;	// where data is read from/written to, -1 if none
+
+	ring_buffer<uint8_t> rx;
+	std::atomic_bool rx_blocked;	// queue was full, stopped reading from the host
+
+	// called by the io thread when input was queued
+	void (*input_cb)(void *ctx);
+	void *input_ctx;
+
+	void open_pty();
+	void open_unix_socket(std::string path);
+	void open_fd(int fd);
+	void set_connection(int fd);
+
+public:
+	serial_host(io_reactor *io_in, std::string name, std::string spec);
+	~serial_host();
+
+	// I/O thread
+	void accept_client();
+	void read_input();
+	void resume_input();
+
+	// set before input can arrive, e.g. to wake an idle processor
+	void set_input_callback(void (*cb)(void *ctx), void *ctx) { input_cb = cb; input_ctx = ctx; }
+
+	// called from the emulation thread
+	bool has_input() const { return !rx.empty(); }
+	bool is_connected() const { return conn_fd != -1; }
+	bool get_input(uint8_t *c);
+
+	// called from the I/O thread, returns how much was written: the rest
+	// waits for the next try rather than for a slow other end
+	size_t write_output(const char *data, size_t len);
+};
+
+#endif
@@ -0,0 +1,104 @@
+#include <unistd.h>
+
+#include "error.h"
+#include "log.h"
+#include "serial_output.h"
+
+#define SERIAL_BUFFER_SIZE	65536	// must be a power of 2
+
+static void serial_output_timer(void *ctx)
+{
+	((serial_output *)ctx) -> drain();
+}
+
+serial_output::serial_output(io_reactor *io_in, debug_console *pdc_in) : io(io_in), pdc(pdc_in), fd(-1), host(NULL), buffer(SERIAL_BUFFER_SIZE), n_dropped(0)
+{
+	start();
+}
+
+serial_output::serial_output(io_reactor *io_in, int fd_in) : io(io_in), pdc(NULL), fd(fd_in), host(NULL), buffer(SERIAL_BUFFER_SIZE), n_dropped(0)
+{
+	start();
+}
+
+serial_output::serial_output(io_reactor *io_in, serial_host *host_in) : io(io_in), pdc(NULL), fd(-1), host(host_in), buffer(SERIAL_BUFFER_SIZE), n_dropped(0)
+{
+	start();
+}
+
+serial_output::~serial_output()
+{
+	io -> remove_timer(serial_output_timer, this);
+
+	// whatever was produced after the last run of the timer
+	drain();
+
+	if (n_dropped)
+		dolog("serial_output: %llu bytes dropped, the host did not keep up", n_dropped);
+}
+
+void serial_output::start()
+{
+	io -> add_timer(1000000 / SERIAL_REFRESH_HZ, serial_output_timer, this);
+}
+
+void serial_output::put(char c)
+{
+	if (!buffer.push(c))
+		n_dropped++;
+}
+
+// false: the host did not take all of it, the rest is in `pending'
+bool serial_output::send(const char *data, size_t n)
+{
+	if (pdc)
+		pdc -> dc_term_write(data, n);
+	else if (host)
+	{
+		size_t done = host -> write_output(data, n);
+
+		if (done < n)
+		{
+			pending.assign(data + done, n - done);
+			return false;
+		}
+	}
+	else if (write(fd, data, n) != ssize_t(n))
+		error_exit("serial_output: write failed");
+
+	return true;
+}
+
+void serial_output::drain()
+{
+	if (!pending.empty())
+	{
+		std::string rest;
+		rest.swap(pending);
+
+		if (!send(rest.data(), rest.size()))
+			return;
+	}
+
+	char chunk[4096];
+	size_t n = 0;
+
+	for(;;)
+	{
+		bool more = buffer.pop(&chunk[n]);
+
+		if (more)
+			n++;
+
+		if ((!more || n == sizeof chunk) && n)
+		{
+			if (!send(chunk, n))
+				break;
+
+			n = 0;
+		}
+
+		if (!more)
+			break;
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef __SERIAL_OUTPUT__H__
+#define __SERIAL_OUTPUT__H__
+
+#include <stdint.h>
+#include <string>
+
+#include "debug_console.h"
+#include "io_reactor.h"
+#include "ring_buffer.h"
+#include "serial_host.h"
+
+#define SERIAL_REFRESH_HZ	50	// max. number of host writes per second
+
+// Serial TX bytes go into a lock-free queue from the emulation thread. A
+// timer on the I/O thread of the machine sends them to the host (terminal
+// window of the debug console, a file descriptor or a pty/socket) in
+// chunks, at most SERIAL_REFRESH_HZ times per second. The emulation
+// thread never waits for it: when the host does not keep up and the
+// queue is full, bytes are dropped (and counted).
+class serial_output
+{
+private:
+	io_reactor *io;
+	debug_console *pdc;
+	int fd;
+	serial_host *host;
+
+	ring_buffer<char> buffer;
+	std::string pending;	// what the serial_host could not take yet
+
+	uint64_t n_dropped;
+
+	void start();
+	bool send(const char *data, size_t n);
+
+public:
+	serial_output(io_reactor *io_in, debug_console *pdc_in);
+	serial_output(io_reactor *io_in, int fd_in);
+	serial_output(io_reactor *io_in, serial_host *host_in);
+	~serial_output();
+
+	// I/O thread
+	void drain();
+
+	void put(char c);
+
+	uint64_t get_n_dropped() const { return n_dropped; }
+};
+
+#endif
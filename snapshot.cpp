@@ -0,0 +1,776 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "error.h"
+#include "log.h"
+#include "snapshot.h"
+#include "utils.h"
+
+snapshot::snapshot(processor *pp_in, mc *pmc_in, hpc3 *hpc_in) : pp(pp_in), pmc(pmc_in), hpc(hpc_in), writer(-1), tracking(false), soft_dirty(false), chain_id(0), chain_seq(0)
+{
+	pthread_mutex_init(&released_lock, NULL);
+}
+
+snapshot::~snapshot()
+{
+	if (writer != -1)
+	{
+		int status = 0;
+
+		if (waitpid(writer, &status, 0) == writer)
+			finished(status);
+	}
+
+	pthread_mutex_destroy(&released_lock);
+}
+
+void snapshot::add_ram(std::string name, memory *m)
+{
+	if (name.size() >= SNAPSHOT_NAME_LEN)
+		error_exit("snapshot: region name %s too long", name.c_str());
+
+	region_t r = { name, m, false };
+	regions.push_back(r);
+}
+
+void snapshot::add_rom(std::string name, memory *m)
+{
+	if (name.size() >= SNAPSHOT_NAME_LEN)
+		error_exit("snapshot: region name %s too long", name.c_str());
+
+	region_t r = { name, m, true };
+	regions.push_back(r);
+}
+
+// FNV-1a
+uint64_t snapshot::hash(const unsigned char *p, uint64_t n)
+{
+	uint64_t h = 0xcbf29ce484222325ll;
+
+	for(uint64_t index=0; index<n; index++)
+	{
+		h ^= p[index];
+		h *= 0x100000001b3ll;
+	}
+
+	return h;
+}
+
+bool snapshot::is_zero(const unsigned char *p, uint64_t n)
+{
+	const uint64_t *p64 = (const uint64_t *)p;
+
+	for(uint64_t index=0; index<n / 8; index++)
+	{
+		if (p64[index])
+			return false;
+	}
+
+	return true;
+}
+
+// also runs in the forked writer: no allocations, only system calls
+bool snapshot::write_file(const std::string & file, const std::string & tmp_file, const snapshot_writer & sw, uint64_t id) const
+{
+	int fd = open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		return false;
+
+	snapshot_header_t hdr;
+	memset(&hdr, 0x00, sizeof hdr);
+	memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof hdr.magic);
+	hdr.version = SNAPSHOT_VERSION;
+	hdr.n_regions = regions.size();
+	hdr.state_offset = sizeof hdr + regions.size() * sizeof(snapshot_region_t);
+	hdr.state_len = sw.get_size();
+	hdr.chain_id = id;
+
+	bool ok = pwrite(fd, &hdr, sizeof hdr, 0) == sizeof hdr && pwrite(fd, sw.get_data(), sw.get_size(), hdr.state_offset) == ssize_t(sw.get_size());
+
+	uint64_t offset = (hdr.state_offset + hdr.state_len + SNAPSHOT_ALIGN - 1) & ~uint64_t(SNAPSHOT_ALIGN - 1);
+
+	// like in checkpoint(): pwrite() from a chunk that the ram_compactor
+	// keeps inaccessible fails with EFAULT, a copy faults it back in
+	unsigned char bounce[SNAPSHOT_BOUNCE];
+
+	for(size_t nr=0; ok && nr<regions.size(); nr++)
+	{
+		const region_t & r = regions[nr];
+		const unsigned char *data = r.m -> get_data();
+		uint64_t size = r.m -> get_size();
+
+		snapshot_region_t entry;
+		memset(&entry, 0x00, sizeof entry);
+		strncpy(entry.name, r.name.c_str(), sizeof entry.name - 1);
+		entry.is_rom = r.rom;
+		entry.size = size;
+
+		if (r.rom)
+			entry.hash = hash(data, size);
+		else
+		{
+			entry.offset = offset;
+
+			// runs of non-zero pages in one write each
+			for(uint64_t page=0; ok && page<size;)
+			{
+				uint64_t n = std::min(uint64_t(SNAPSHOT_PAGE), size - page);
+
+				if (is_zero(&data[page], n))
+				{
+					page += n;
+					continue;
+				}
+
+				uint64_t end = page + n;
+				while(end < size && !is_zero(&data[end], std::min(uint64_t(SNAPSHOT_PAGE), size - end)))
+					end += std::min(uint64_t(SNAPSHOT_PAGE), size - end);
+
+				entry.n_pages += (end - page + SNAPSHOT_PAGE - 1) / SNAPSHOT_PAGE;
+
+				for(uint64_t pos=page; ok && pos<end;)
+				{
+					uint64_t n_copy = std::min(uint64_t(SNAPSHOT_BOUNCE), end - pos);
+					memcpy(bounce, &data[pos], n_copy);
+
+					for(uint64_t done=0; ok && done<n_copy;)
+					{
+						ssize_t rc = pwrite(fd, &bounce[done], n_copy - done, offset + pos + done);
+
+						if (rc == -1 && errno == EINTR)
+							continue;
+
+						ok = rc > 0;
+						done += rc;
+					}
+
+					pos += n_copy;
+				}
+
+				page = end;
+			}
+
+			offset = (offset + size + SNAPSHOT_ALIGN - 1) & ~uint64_t(SNAPSHOT_ALIGN - 1);
+		}
+
+		ok = ok && pwrite(fd, &entry, sizeof entry, sizeof hdr + nr * sizeof entry) == sizeof entry;
+	}
+
+	// the zero pages at the end of the last image
+	ok = ok && ftruncate(fd, offset) == 0;
+	ok = ok && fsync(fd) == 0;
+	ok = close(fd) == 0 && ok;
+
+	return ok && rename(tmp_file.c_str(), file.c_str()) == 0;
+}
+
+void snapshot::save(std::string file, bool background)
+{
+	if (!background && writer != -1)
+	{
+		int status = 0;
+
+		if (waitpid(writer, &status, 0) == writer)
+			finished(status);
+	}
+
+	if (poll())
+	{
+		dolog("snapshot: still writing %s, %s skipped", writer_file.c_str(), file.c_str());
+		return;
+	}
+
+	// no copy may be in flight on the device thread
+	pp -> sync_devices();
+
+	// the device state is small: collected here so that the writer only
+	// has to copy memory
+	snapshot_writer sw;
+	pp -> save_state(sw);
+	pmc -> save_state(sw);
+	hpc -> save_state(sw);
+
+	// a new chain of checkpoints starts here
+	uint64_t id = 0;
+
+	if (tracking)
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+
+		id = ((uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec) ^ (uint64_t(getpid()) << 48)) | 1;
+
+		chain_id = id;
+		chain_seq = 0;
+
+		reset_tracking();
+
+		pthread_mutex_lock(&released_lock);
+		released.clear();
+		pthread_mutex_unlock(&released_lock);
+	}
+
+	std::string tmp_file = file + ".tmp";
+
+	dolog("snapshot: writing %s at cycle %llu", file.c_str(), pp -> get_cycle_count());
+
+	if (!background)
+	{
+		if (!write_file(file, tmp_file, sw, id))
+			error_exit("snapshot: failed writing %s", file.c_str());
+
+		dolog("snapshot: %s written", file.c_str());
+
+		writer_file = file;
+		drop_old_checkpoints();
+		return;
+	}
+
+	pid_t pid = fork();
+
+	if (pid == -1)
+		error_exit("snapshot: fork failed");
+
+	if (pid == 0)
+		_exit(write_file(file, tmp_file, sw, id) ? 0 : 1);
+
+	writer = pid;
+	writer_file = file;
+}
+
+void snapshot::finished(int status)
+{
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+	{
+		dolog("snapshot: %s written", writer_file.c_str());
+
+		drop_old_checkpoints();
+	}
+	else
+		dolog("snapshot: failed writing %s", writer_file.c_str());
+
+	writer = -1;
+}
+
+bool snapshot::poll()
+{
+	if (writer == -1)
+		return false;
+
+	int status = 0;
+	pid_t rc = waitpid(writer, &status, WNOHANG);
+
+	if (rc == 0)
+		return true;
+
+	if (rc == writer)
+		finished(status);
+	else
+		writer = -1;
+
+	return false;
+}
+
+void snapshot::load(std::string file)
+{
+	// the memory is replaced
+	pp -> sync_devices();
+
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd == -1)
+		error_exit("snapshot: cannot open %s", file.c_str());
+
+	snapshot_header_t hdr;
+	if (pread(fd, &hdr, sizeof hdr, 0) != sizeof hdr || memcmp(hdr.magic, SNAPSHOT_MAGIC, sizeof hdr.magic) != 0)
+		error_exit("snapshot: %s is not a snapshot", file.c_str());
+
+	if (hdr.version != SNAPSHOT_VERSION || hdr.n_regions != regions.size())
+		error_exit("snapshot: %s is of a different version or machine", file.c_str());
+
+	for(size_t nr=0; nr<regions.size(); nr++)
+	{
+		const region_t & r = regions[nr];
+
+		snapshot_region_t entry;
+		if (pread(fd, &entry, sizeof entry, sizeof hdr + nr * sizeof entry) != sizeof entry)
+			error_exit("snapshot: %s is truncated", file.c_str());
+
+		if (r.name != entry.name || r.rom != bool(entry.is_rom) || r.m -> get_size() != entry.size)
+			error_exit("snapshot: region %s of %s does not match %s", entry.name, file.c_str(), r.name.c_str());
+
+		if (r.rom)
+		{
+			if (hash(r.m -> get_data(), entry.size) != entry.hash)
+				error_exit("snapshot: %s was made with a different %s", file.c_str(), r.name.c_str());
+		}
+		else
+		{
+			r.m -> map_file(fd, entry.offset);
+
+			dolog("snapshot: %s, %llu of %llu pages stored", r.name.c_str(), entry.n_pages, (entry.size + SNAPSHOT_PAGE - 1) / SNAPSHOT_PAGE);
+		}
+	}
+
+	std::vector<uint8_t> state(hdr.state_len);
+	if (pread(fd, state.data(), hdr.state_len, hdr.state_offset) != ssize_t(hdr.state_len))
+		error_exit("snapshot: %s is truncated", file.c_str());
+
+	// the mappings stay valid without the descriptor
+	close(fd);
+
+	apply_checkpoints(file, hdr.chain_id, &state);
+
+	snapshot_reader sr(state.data(), state.size());
+	pp -> load_state(sr);
+	pmc -> load_state(sr);
+	hpc -> load_state(sr);
+
+	if (sr.get_left())
+		error_exit("snapshot: %s is of a different version", file.c_str());
+
+	dolog("snapshot: %s restored, cycle %llu", file.c_str(), pp -> get_cycle_count());
+}
+
+void snapshot::enable_checkpoints()
+{
+	tracking = true;
+	soft_dirty = probe_soft_dirty();
+
+	dolog("snapshot: checkpoints find changed pages through %s", soft_dirty ? "soft-dirty bits" : "page hashes");
+}
+
+static bool clear_soft_dirty()
+{
+	int fd = open("/proc/self/clear_refs", O_WRONLY);
+	if (fd == -1)
+		return false;
+
+	bool ok = write(fd, "4", 1) == 1;
+
+	close(fd);
+
+	return ok;
+}
+
+// the kernel may have been built without soft-dirty tracking: then the
+// bits are never set
+bool snapshot::probe_soft_dirty()
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	volatile uint8_t *p = (uint8_t *)mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return false;
+
+	p[0] = 1;
+
+	bool ok = false;
+	int fd = open("/proc/self/pagemap", O_RDONLY);
+
+	if (fd != -1 && clear_soft_dirty())
+	{
+		uint64_t before = 0, after = 0;
+		off_t offset = uintptr_t(p) / page_size * sizeof(uint64_t);
+
+		ok = pread(fd, &before, sizeof before, offset) == sizeof before;
+
+		p[0] = 2;
+
+		ok = ok && pread(fd, &after, sizeof after, offset) == sizeof after;
+		ok = ok && !(before & PAGEMAP_SOFT_DIRTY) && (after & PAGEMAP_SOFT_DIRTY);
+	}
+
+	if (fd != -1)
+		close(fd);
+
+	munmap((void *)p, page_size);
+
+	return ok;
+}
+
+static uint64_t page_hash(const unsigned char *p, uint64_t n)
+{
+	const uint64_t *p64 = (const uint64_t *)p;
+	uint64_t h = n;
+
+	for(uint64_t index=0; index<n / 8; index++)
+		h = (h ^ p64[index]) * 0x9e3779b97f4a7c15ll;
+
+	return h;
+}
+
+void snapshot::reset_tracking()
+{
+	if (soft_dirty)
+	{
+		if (!clear_soft_dirty())
+			error_exit("snapshot: cannot clear the soft-dirty bits");
+
+		return;
+	}
+
+	page_hashes.resize(regions.size());
+
+	for(size_t nr=0; nr<regions.size(); nr++)
+	{
+		if (regions[nr].rom)
+			continue;
+
+		const unsigned char *data = regions[nr].m -> get_data();
+		uint64_t size = regions[nr].m -> get_size();
+
+		page_hashes[nr].resize((size + SNAPSHOT_PAGE - 1) / SNAPSHOT_PAGE);
+
+		for(uint64_t page=0; page<size; page += SNAPSHOT_PAGE)
+			page_hashes[nr][page / SNAPSHOT_PAGE] = page_hash(&data[page], std::min(uint64_t(SNAPSHOT_PAGE), size - page));
+	}
+}
+
+bool snapshot::range_before(const range_t & a, const range_t & b)
+{
+	return a.region < b.region || (a.region == b.region && a.offset < b.offset);
+}
+
+void snapshot::add_range(std::vector<range_t> *ranges, uint32_t region, uint64_t offset, uint64_t len)
+{
+	if (!ranges -> empty())
+	{
+		range_t & last = ranges -> back();
+
+		if (last.region == region && last.offset + last.len == offset && last.len + len <= CHECKPOINT_MAX_RANGE)
+		{
+			last.len += len;
+			return;
+		}
+	}
+
+	range_t r = { region, offset, len };
+	ranges -> push_back(r);
+}
+
+void snapshot::changed_ranges(std::vector<range_t> *ranges)
+{
+	int fd = soft_dirty ? open("/proc/self/pagemap", O_RDONLY) : -1;
+	if (soft_dirty && fd == -1)
+		error_exit("snapshot: cannot open /proc/self/pagemap");
+
+	uint64_t page_size = sysconf(_SC_PAGESIZE);
+	std::vector<uint64_t> entries(CHECKPOINT_PAGEMAP_BATCH);
+
+	for(size_t nr=0; nr<regions.size(); nr++)
+	{
+		if (regions[nr].rom)
+			continue;
+
+		const unsigned char *data = regions[nr].m -> get_data();
+		uint64_t size = regions[nr].m -> get_size();
+
+		if (!soft_dirty)
+		{
+			for(uint64_t page=0; page<size; page += SNAPSHOT_PAGE)
+			{
+				uint64_t n = std::min(uint64_t(SNAPSHOT_PAGE), size - page);
+
+				if (page_hash(&data[page], n) != page_hashes[nr][page / SNAPSHOT_PAGE])
+					add_range(ranges, nr, page, n);
+			}
+
+			continue;
+		}
+
+		// host pages, the region need not be page aligned
+		uint64_t start = uintptr_t(data), end = start + size;
+
+		for(uint64_t host_page = start / page_size; host_page * page_size < end;)
+		{
+			uint64_t n = std::min(uint64_t(CHECKPOINT_PAGEMAP_BATCH), (end - 1) / page_size + 1 - host_page);
+			ssize_t bytes = n * sizeof(uint64_t);
+
+			if (pread(fd, entries.data(), bytes, host_page * sizeof(uint64_t)) != bytes)
+				error_exit("snapshot: cannot read /proc/self/pagemap");
+
+			for(uint64_t index=0; index<n; index++)
+			{
+				if (!(entries[index] & PAGEMAP_SOFT_DIRTY))
+					continue;
+
+				uint64_t from = std::max((host_page + index) * page_size, start);
+				uint64_t to = std::min((host_page + index + 1) * page_size, end);
+
+				add_range(ranges, nr, from - start, to - from);
+			}
+
+			host_page += n;
+		}
+	}
+
+	if (fd != -1)
+		close(fd);
+
+	// only after reading the pagemap: a page released in between is then
+	// in either one
+	std::vector<range_t> extra;
+
+	pthread_mutex_lock(&released_lock);
+	extra.swap(released);
+	pthread_mutex_unlock(&released_lock);
+
+	if (!soft_dirty || extra.empty())
+		return;
+
+	extra.insert(extra.end(), ranges -> begin(), ranges -> end());
+	std::sort(extra.begin(), extra.end(), range_before);
+
+	ranges -> clear();
+
+	for(size_t index=0; index<extra.size(); index++)
+	{
+		const range_t & r = extra[index];
+		uint64_t end = r.offset + r.len;
+
+		if (!ranges -> empty() && ranges -> back().region == r.region && r.offset <= ranges -> back().offset + ranges -> back().len)
+		{
+			range_t & last = ranges -> back();
+			uint64_t last_end = last.offset + last.len;
+
+			if (end <= last_end)
+				continue;
+
+			if (end - last.offset <= CHECKPOINT_MAX_RANGE)
+			{
+				last.len = end - last.offset;
+				continue;
+			}
+
+			range_t rest = { r.region, last_end, end - last_end };
+			ranges -> push_back(rest);
+		}
+		else
+		{
+			ranges -> push_back(r);
+		}
+	}
+}
+
+void snapshot::mark_released(const memory *m, uint64_t offset, uint64_t n)
+{
+	if (!tracking || !soft_dirty)
+		return;
+
+	for(size_t nr=0; nr<regions.size(); nr++)
+	{
+		if (regions[nr].m != m)
+			continue;
+
+		// in pieces that fit a checkpoint range
+		pthread_mutex_lock(&released_lock);
+
+		for(uint64_t pos=0; pos<n; pos += CHECKPOINT_MAX_RANGE)
+		{
+			range_t r = { uint32_t(nr), offset + pos, std::min(uint64_t(CHECKPOINT_MAX_RANGE), n - pos) };
+			released.push_back(r);
+		}
+
+		pthread_mutex_unlock(&released_lock);
+		break;
+	}
+}
+
+void snapshot::release_callback(void *ctx, memory *m, uint64_t offset, uint64_t n)
+{
+	((snapshot *)ctx) -> mark_released(m, offset, n);
+}
+
+static bool write_all(int fd, const void *p, uint64_t n)
+{
+	const uint8_t *p8 = (const uint8_t *)p;
+
+	while(n)
+	{
+		ssize_t rc = write(fd, p8, n);
+
+		if (rc == -1 && errno == EINTR)
+			continue;
+
+		if (rc <= 0)
+			return false;
+
+		p8 += rc;
+		n -= rc;
+	}
+
+	return true;
+}
+
+void snapshot::checkpoint(std::string file)
+{
+	if (!tracking || !chain_id)
+		error_exit("snapshot: checkpoint without a snapshot to start from");
+
+	pp -> sync_devices();
+
+	snapshot_writer sw;
+	pp -> save_state(sw);
+	pmc -> save_state(sw);
+	hpc -> save_state(sw);
+
+	std::vector<range_t> ranges;
+	changed_ranges(&ranges);
+
+	// the guest is paused: nothing can change between finding the pages
+	// and copying them
+	reset_tracking();
+
+	checkpoint_header_t hdr;
+	memset(&hdr, 0x00, sizeof hdr);
+	memcpy(hdr.magic, CHECKPOINT_MAGIC, sizeof hdr.magic);
+	hdr.chain_id = chain_id;
+	hdr.seq = chain_seq;
+	hdr.cycle = pp -> get_cycle_count();
+	hdr.state_len = sw.get_size();
+	hdr.n_ranges = ranges.size();
+
+	std::string delta_file = file + ".delta";
+
+	int fd = open(delta_file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (fd == -1)
+		error_exit("snapshot: cannot open %s", delta_file.c_str());
+
+	bool ok = write_all(fd, &hdr, sizeof hdr) && write_all(fd, sw.get_data(), sw.get_size());
+	uint64_t n_bytes = 0;
+
+	// through a copy: the ram_compactor keeps chunks it watches or
+	// compressed inaccessible, write() would fail on them with EFAULT
+	// instead of faulting them in
+	std::vector<uint8_t> bounce;
+
+	for(size_t index=0; ok && index<ranges.size(); index++)
+	{
+		const range_t & r = ranges[index];
+		checkpoint_range_t entry = { r.region, uint32_t(r.len), r.offset };
+
+		bounce.resize(r.len);
+		memcpy(bounce.data(), &regions[r.region].m -> get_data()[r.offset], r.len);
+
+		ok = write_all(fd, &entry, sizeof entry) && write_all(fd, bounce.data(), r.len);
+
+		n_bytes += r.len;
+	}
+
+	ok = ok && fdatasync(fd) == 0;
+	ok = close(fd) == 0 && ok;
+
+	if (!ok)
+		error_exit("snapshot: failed writing %s", delta_file.c_str());
+
+	dolog("snapshot: checkpoint %llu at cycle %llu, %llu bytes of RAM in %zu ranges", chain_seq, hdr.cycle, n_bytes, ranges.size());
+
+	chain_seq++;
+}
+
+// once a new snapshot is on disk the checkpoints of the previous one are
+// useless; checkpoints of the new one may already follow them though
+void snapshot::drop_old_checkpoints()
+{
+	if (tracking && chain_seq == 0)
+		truncate((writer_file + ".delta").c_str(), 0);
+}
+
+void snapshot::apply_checkpoints(const std::string & file, uint64_t id, std::vector<uint8_t> *state)
+{
+	std::string delta_file = file + ".delta";
+
+	FILE *fh = fopen(delta_file.c_str(), "rb");
+	if (!fh)
+		return;
+
+	uint64_t n_applied = 0, next_seq = 0;
+	std::vector<uint8_t> data;
+
+	for(;;)
+	{
+		checkpoint_header_t hdr;
+		if (fread(&hdr, sizeof hdr, 1, fh) != 1)
+			break;
+
+		if (memcmp(hdr.magic, CHECKPOINT_MAGIC, sizeof hdr.magic) != 0)
+			error_exit("snapshot: %s is corrupt", delta_file.c_str());
+
+		bool apply = hdr.chain_id == id && id != 0;
+
+		if (apply && hdr.seq != next_seq)
+			error_exit("snapshot: checkpoint %llu of %s is missing", next_seq, delta_file.c_str());
+
+		data.resize(hdr.state_len);
+		if (hdr.state_len && fread(data.data(), hdr.state_len, 1, fh) != 1)
+			break;	// interrupted while writing: the previous one is complete
+
+		std::vector<std::pair<checkpoint_range_t, long> > ranges;
+		bool complete = true;
+
+		for(uint64_t index=0; index<hdr.n_ranges; index++)
+		{
+			checkpoint_range_t entry;
+			if (fread(&entry, sizeof entry, 1, fh) != 1)
+			{
+				complete = false;
+				break;
+			}
+
+			if (apply && (entry.region >= regions.size() || regions[entry.region].rom || entry.offset + entry.len > regions[entry.region].m -> get_size()))
+				error_exit("snapshot: %s does not match the machine", delta_file.c_str());
+
+			ranges.push_back(std::pair<checkpoint_range_t, long>(entry, ftell(fh)));
+
+			if (fseek(fh, entry.len, SEEK_CUR) == -1)
+			{
+				complete = false;
+				break;
+			}
+		}
+
+		long end = ftell(fh);
+
+		// only checkpoints that were completely written
+		fseek(fh, 0, SEEK_END);
+		if (!complete || ftell(fh) < end)
+			break;
+
+		if (apply)
+		{
+			std::vector<uint8_t> buffer;
+
+			for(size_t index=0; index<ranges.size(); index++)
+			{
+				const checkpoint_range_t & r = ranges[index].first;
+
+				buffer.resize(r.len);
+				fseek(fh, ranges[index].second, SEEK_SET);
+				if (fread(buffer.data(), r.len, 1, fh) != 1)
+					error_exit("snapshot: cannot read %s", delta_file.c_str());
+
+				regions[r.region].m -> write_block(r.offset, buffer.data(), r.len);
+			}
+
+			state -> swap(data);
+
+			next_seq++;
+			n_applied++;
+		}
+
+		fseek(fh, end, SEEK_SET);
+	}
+
+	fclose(fh);
+
+	if (n_applied)
+		dolog("snapshot: %llu checkpoints of %s applied", n_applied, delta_file.c_str());
+}
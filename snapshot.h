@@ -0,0 +1,161 @@
+#ifndef __SNAPSHOT__H__
+#define __SNAPSHOT__H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+#include "hpc3.h"
+#include "mc.h"
+#include "memory.h"
+#include "processor.h"
+#include "snapshot_state.h"
+
+#define SNAPSHOT_MAGIC		"MIEPSNAP"
+#define SNAPSHOT_VERSION	2
+#define SNAPSHOT_PAGE		4096	// unit of the zero page check
+#define SNAPSHOT_ALIGN		65536	// RAM images can be mapped with any host page size
+#define SNAPSHOT_NAME_LEN	32
+#define SNAPSHOT_BOUNCE		65536	// RAM is written through a copy of this size
+
+#define CHECKPOINT_MAGIC	"MIEPDLTA"
+#define CHECKPOINT_MAX_RANGE	(1 << 24)	// changed pages are coalesced up to this length
+#define CHECKPOINT_PAGEMAP_BATCH	4096	// pagemap entries per read
+
+#define PAGEMAP_SOFT_DIRTY	(1ull << 55)
+
+typedef struct
+{
+	char magic[8];
+	uint32_t version, n_regions;
+	uint64_t state_offset, state_len;
+	uint64_t chain_id;	// checkpoints of this snapshot carry the same id
+} snapshot_header_t;
+
+typedef struct
+{
+	char name[SNAPSHOT_NAME_LEN];
+	uint32_t is_rom, pad;
+	uint64_t size;
+	uint64_t offset;	// RAM: start of the image in the file
+	uint64_t hash;		// ROM: contents are not stored, only checked
+	uint64_t n_pages;	// RAM: pages that are not zero
+} snapshot_region_t;
+
+// an incremental checkpoint: followed by the device state and n_ranges
+// times a checkpoint_range_t with its data
+typedef struct
+{
+	char magic[8];
+	uint64_t chain_id, seq;
+	uint64_t cycle;
+	uint64_t state_len;
+	uint64_t n_ranges;
+} checkpoint_header_t;
+
+typedef struct
+{
+	uint32_t region, len;
+	uint64_t offset;
+} checkpoint_range_t;
+
+// Saves and restores the machine: the processor, the MC, the HPC3 and its
+// devices, and all RAM.
+//
+// A snapshot file is a header, a table of the memory regions, the device
+// state and then one image per RAM region at an aligned offset. Pages
+// that are zero are not written, so they are holes in a sparse file.
+// Restoring maps these images copy-on-write instead of reading them, so a
+// restore is fast and only the pages the guest touches are ever read.
+// ROMs are identified by a hash and must match on restore.
+//
+// Saving in the background forks: the child writes the file from its
+// copy-on-write view of the process while the emulation continues.
+//
+// Incremental checkpoints are appended to <file>.delta, chained to the
+// last snapshot in <file>: only the RAM that changed since the snapshot
+// or the previous checkpoint is written, with the device state. Changed
+// pages are found through the soft-dirty bits of the kernel (cleared
+// through /proc/self/clear_refs, read from /proc/self/pagemap), so that
+// nothing is tracked while the guest runs. Without soft-dirty support a
+// hash per page is kept and compared when checkpointing instead.
+class snapshot
+{
+private:
+	processor *pp;
+	mc *pmc;
+	hpc3 *hpc;
+
+	typedef struct
+	{
+		std::string name;
+		memory *m;
+		bool rom;
+	} region_t;
+
+	std::vector<region_t> regions;
+
+	pid_t writer;	// background writer, -1: none
+	std::string writer_file;
+
+	// checkpoints
+	bool tracking, soft_dirty;
+	uint64_t chain_id, chain_seq;
+	std::vector<std::vector<uint64_t> > page_hashes;	// without soft-dirty
+
+	pthread_mutex_t released_lock;
+
+	typedef struct
+	{
+		uint32_t region;
+		uint64_t offset, len;
+	} range_t;
+
+	std::vector<range_t> released;	// soft-dirty bits the kernel forgot
+
+	static bool probe_soft_dirty();
+	static bool range_before(const range_t & a, const range_t & b);
+	static void add_range(std::vector<range_t> *ranges, uint32_t region, uint64_t offset, uint64_t len);
+	void reset_tracking();
+	void changed_ranges(std::vector<range_t> *ranges);
+	void drop_old_checkpoints();
+	void apply_checkpoints(const std::string & file, uint64_t id, std::vector<uint8_t> *state);
+
+	bool write_file(const std::string & file, const std::string & tmp_file, const snapshot_writer & sw, uint64_t id) const;
+	void finished(int status);
+
+	static uint64_t hash(const unsigned char *p, uint64_t n);
+	static bool is_zero(const unsigned char *p, uint64_t n);
+
+public:
+	snapshot(processor *pp_in, mc *pmc_in, hpc3 *hpc_in);
+	~snapshot();
+
+	// before save() or load(), in the same order for both
+	void add_ram(std::string name, memory *m);
+	void add_rom(std::string name, memory *m);
+
+	// between two instructions
+	void save(std::string file, bool background);
+	void load(std::string file);
+
+	// reaps a background writer that has finished, returns true while
+	// one is running
+	bool poll();
+
+	// checkpoint() needs a save() after this first
+	void enable_checkpoints();
+	bool have_chain() const { return chain_id != 0; }
+	// false: changed pages are found by hashing all of them
+	bool has_soft_dirty() const { return soft_dirty; }
+	void checkpoint(std::string file);
+
+	// pages given back to the kernel lose their soft-dirty bit: this
+	// puts them in the next checkpoint; from any thread
+	void mark_released(const memory *m, uint64_t offset, uint64_t n);
+	static void release_callback(void *ctx, memory *m, uint64_t offset, uint64_t n);
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef __SNAPSHOT_STATE__H__
+#define __SNAPSHOT_STATE__H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "error.h"
+
+// Device state in a snapshot: the fields are appended in host byte order,
+// a snapshot is only restored by the same build on the same kind of host.
+// Each device reads back exactly what it wrote, in the same order.
+class snapshot_writer
+{
+private:
+	std::vector<uint8_t> data;
+
+public:
+	void put_bytes(const void *p, size_t n) { data.insert(data.end(), (const uint8_t *)p, (const uint8_t *)p + n); }
+
+	void put_u8(uint8_t v) { data.push_back(v); }
+	void put_bool(bool v) { data.push_back(v); }
+	void put_u16(uint16_t v) { put_bytes(&v, sizeof v); }
+	void put_u32(uint32_t v) { put_bytes(&v, sizeof v); }
+	void put_u64(uint64_t v) { put_bytes(&v, sizeof v); }
+
+	const uint8_t * get_data() const { return data.data(); }
+	size_t get_size() const { return data.size(); }
+};
+
+class snapshot_reader
+{
+private:
+	const uint8_t *data;
+	size_t len, pos;
+
+public:
+	snapshot_reader(const uint8_t *data_in, size_t len_in) : data(data_in), len(len_in), pos(0)
+	{
+	}
+
+	void get_bytes(void *p, size_t n)
+	{
+		if (n > len - pos)
+			error_exit("snapshot: device state is truncated");
+
+		memcpy(p, &data[pos], n);
+		pos += n;
+	}
+
+	uint8_t get_u8() { uint8_t v; get_bytes(&v, sizeof v); return v; }
+	bool get_bool() { return get_u8() != 0; }
+	uint16_t get_u16() { uint16_t v; get_bytes(&v, sizeof v); return v; }
+	uint32_t get_u32() { uint32_t v; get_bytes(&v, sizeof v); return v; }
+	uint64_t get_u64() { uint64_t v; get_bytes(&v, sizeof v); return v; }
+
+	size_t get_left() const { return len - pos; }
+};
+
+#endif
@@ -1,6 +1,20 @@
+#include <elf.h>
+#include <endian.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
 #define __STDC_LIMIT_MACROS // for INT32_MIN
 #include <stdint.h>
 
@@ -10,11 +24,31 @@
 #include "processor.h"
 #include "processor_utils.h"
 #include "exceptions.h"
+#include "z85c30.h"
+#include "graphics_lg1.h"
+#include "lg1_kernels.h"
+#include "hpc3.h"
+#include "mc.h"
+#include "audio_sink.h"
+#include "utils.h"
+#include "throttle.h"
+#include "input_log.h"
+#include "snapshot.h"
+#include "fork_server.h"
+#include "lz.h"
+#include "ram_compactor.h"
+#include "zero_reclaimer.h"
+#include "machine.h"
+#include "fleet.h"
+#include "placement.h"
+#include "io_reactor.h"
+#include "device_thread.h"
+#include "hostcall.h"
+#include "arcs.h"
 
 #define TEST_VAL_1 0x12345678abcdefff
 #define TEST_VAL_2 0x87654321beefdead
 
-bool single_step = false; // not applicable
 debug_console *dc = new debug_console_testcases();
 
 const char *logfile = "testcases.log";
@@ -34,6 +68,24 @@ void error_exit(const char *format, ...)
 	exit(1);
 }
 
+static void (*abort_hook)() = NULL;
+
+void set_abort_hook(void (*hook)())
+{
+	abort_hook = hook;
+}
+
+void assert_failed(const char *what, const char *file, int line)
+{
+	fprintf(stderr, "%s:%d: assertion \"%s\" failed\n", file, line, what);
+	dc -> dc_log("%s:%d: assertion \"%s\" failed", file, line, what);
+
+	if (abort_hook)
+		abort_hook();
+
+	abort();
+}
+
 void tick(processor *p)
 {
 	dc -> tick(p);
@@ -1042,7 +1094,8 @@ void test_NOP()
 		if (p -> get_register_32b_unsigned(nr) != reg_copy -> registers[nr])
 			error_exit("NOP: register %s (%d) mismatch", processor::reg_to_name(nr), nr);
 
-		if (p -> get_C0_register(nr, 0) != reg_copy -> C0_registers[nr])
+		// Count (9) follows the cycle counter
+		if (nr != 9 && p -> get_C0_register(nr, 0) != reg_copy -> C0_registers[nr])
 			error_exit("NOP: C0 register %d mismatch", nr);
 	}
 
@@ -1482,19 +1535,2670 @@ void test_J_JAL(bool is_JAL)
 	free_system(mb, m1, m2, m3, p);
 }
 
-int main(int argc, char *argv[])
+void test_z85c30()
 {
-	test_untows_complement();
-	test_twos_complement();
-	test_sign_extend();
-	test_count_leading();
-	test_rotate_right();
-	test_make_instruction();
-	test_test_tc_overflow_32b();
+	dolog(" + test_z85c30");
+	memory_bus *mb = NULL;
+	memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+	processor *p = NULL;
+	create_system(&mb, &m1, &m2, &m3, &p);
 
-	test_memory();
-	test_memory_bus();
-	test_processor();
+	z85c30 *ser = new z85c30(dc, p);
+
+	// 9600 baud (default), 2 characters: the first moves to the shift
+	// register at once, the second has to wait for it
+	ser -> ser_data_write('a');
+	if ((ser -> ser_command_read() & 4) == 0)
+		error_exit("z85c30: TX buffer not empty after 1 character");
+
+	ser -> ser_data_write('b');
+	if (ser -> ser_command_read() & 4)
+		error_exit("z85c30: TX buffer empty directly after 2 characters");
+
+	// a guest polling for it idles until the buffer empties, not beyond
+	if (p -> get_scheduler() -> get_next_event() > p -> get_cycle_count() + uint64_t(CPU_CLOCK_HZ) * 10 / 9600)
+		error_exit("z85c30: no event when the TX buffer empties");
+
+	// memory is filled with NOPs
+	while((ser -> ser_command_read() & 4) == 0)
+		tick(p);
+
+	uint64_t cycles = p -> get_cycle_count();
+	uint64_t expected = uint64_t(CPU_CLOCK_HZ) * 10 / 9600;
+	if (cycles < expected || cycles > expected + 16)
+		error_exit("z85c30: TX buffer empty after %llu cycles, expected %llu", cycles, expected);
+
+	// input from a host socket ends up in the receive buffer
+	std::string path = format("/tmp/testcases-serial.%d", getpid());
+	io_reactor *io = new io_reactor("test");
+	serial_host *sh = new serial_host(io, "test", "unix:" + path);
+	ser -> set_input(sh);
+
+	if (ser -> ser_command_read() & 1)
+		error_exit("z85c30: RX available without input");
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0x00, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+	if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == -1)
+		error_exit("z85c30: cannot connect to %s", path.c_str());
+
+	if (write(fd, "xy", 2) != 2)
+		error_exit("z85c30: cannot write to %s", path.c_str());
+
+	double start_ts = get_ts();
+	while((ser -> ser_command_read() & 1) == 0)
+	{
+		if (get_ts() - start_ts > 5.0)
+			error_exit("z85c30: input did not arrive");
+
+		usleep(1000);
+	}
+
+	uint8_t c1 = ser -> ser_data_read();
+	while((ser -> ser_command_read() & 1) == 0)
+		usleep(1000);
+	uint8_t c2 = ser -> ser_data_read();
+
+	if (c1 != 'x' || c2 != 'y')
+		error_exit("z85c30: expected \"xy\", got %02x %02x", c1, c2);
+
+	// with rx interrupts on, input raises the interrupt by itself at the
+	// next scheduler run, no polling event is waiting for it
+	p -> get_scheduler() -> run(p -> get_cycle_count());	// the one posted for "xy"
+
+	ser -> ser_command_write(9);
+	ser -> ser_command_write(0x08);	// master interrupt enable
+	ser -> ser_command_write(1);
+	ser -> ser_command_write(0x10);	// rx interrupt on all characters
+
+	if (ser -> get_irq_state() || p -> get_scheduler() -> get_next_event() <= p -> get_cycle_count() + 100000)
+		error_exit("z85c30: rx interrupt or an event without input");
+
+	if (write(fd, "z", 1) != 1)
+		error_exit("z85c30: cannot write to %s", path.c_str());
+
+	start_ts = get_ts();
+	while(!ser -> get_irq_state())
+	{
+		if (get_ts() - start_ts > 5.0)
+			error_exit("z85c30: no rx interrupt for input");
+
+		if (p -> get_scheduler() -> get_next_event() <= p -> get_cycle_count())
+			p -> get_scheduler() -> run(p -> get_cycle_count());
+		else
+			usleep(1000);
+	}
+
+	if (ser -> ser_data_read() != 'z')
+		error_exit("z85c30: rx interrupt without the character");
+
+	close(fd);
+	delete sh;
+
+	// a descriptor handed over by a fork server client: non-blocking, and
+	// let go of when the client goes away
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+		error_exit("z85c30: socketpair failed");
+
+	sh = new serial_host(io, "test", format("fd:%d", sv[0]));
+	if ((fcntl(sv[0], F_GETFL) & O_NONBLOCK) == 0 || !sh -> is_connected())
+		error_exit("z85c30: fd connection is blocking or not connected");
+
+	close(sv[1]);
+
+	start_ts = get_ts();
+	while(sh -> is_connected())
+	{
+		if (get_ts() - start_ts > 5.0)
+			error_exit("z85c30: fd connection kept after the client left");
+
+		usleep(1000);
+	}
+
+	delete sh;
+	delete io;
+	unlink(path.c_str());
+
+	delete ser;
+
+	free_system(mb, m1, m2, m3, p);
+}
+
+// the vectorized kernels must give the same result as the reference for
+// all logic operations, write masks, lengths (tails) and overlaps
+void test_lg1_kernels()
+{
+	dolog(" + test_lg1_kernels");
+
+	const size_t size = 256;
+	uint8_t src[size], a[size], b[size];
+
+	for(size_t index=0; index<size; index++)
+		src[index] = rand();
+
+	for(int op=0; op<16; op++)
+	{
+		for(size_t n=0; n<70; n += 3)
+		{
+			uint8_t wrmask = op & 1 ? 0xff : rand();
+			uint32_t pattern = rand();
+			unsigned phase = rand() & 31;
+			bool opaque = n & 1;
+
+			memcpy(a, src, size);
+			memcpy(b, src, size);
+			lg1_fill(&a[1], n, 0x5a, wrmask, op);
+			lg1_fill_scalar(&b[1], n, 0x5a, wrmask, op);
+			if (memcmp(a, b, size))
+				error_exit("lg1_fill: op %d, n %zu, wrmask %02x differs", op, n, wrmask);
+
+			memcpy(a, src, size);
+			memcpy(b, src, size);
+			lg1_pattern_fill(&a[3], n, pattern, phase, 0x11, 0xee, opaque, wrmask, op);
+			lg1_pattern_fill_scalar(&b[3], n, pattern, phase, 0x11, 0xee, opaque, wrmask, op);
+			if (memcmp(a, b, size))
+				error_exit("lg1_pattern_fill: op %d, n %zu, pattern %08x, phase %u differs", op, n, pattern, phase);
+
+			// overlapping in both directions
+			for(int shift=-20; shift<=20; shift += 5)
+			{
+				memcpy(a, src, size);
+				memcpy(b, src, size);
+				lg1_copy(&a[100 + shift], &a[100], n, wrmask, op);
+				lg1_copy_scalar(&b[100 + shift], &b[100], n, wrmask, op);
+				if (memcmp(a, b, size))
+					error_exit("lg1_copy: op %d, n %zu, shift %d differs", op, n, shift);
+			}
+		}
+	}
+
+	// a plain overlapping copy must behave like memmove
+	memcpy(a, src, size);
+	memcpy(b, src, size);
+	lg1_copy_scalar(&a[7], &a[0], 200, 0xff, REX_LO_SRC);
+	memmove(&b[7], &b[0], 200);
+	if (memcmp(a, b, size))
+		error_exit("lg1_copy_scalar: overlapping copy differs from memmove");
+
+	uint32_t palette[256], rgb_a[size], rgb_b[size];
+	for(int index=0; index<256; index++)
+		palette[index] = rand() & 0xffffff;
+
+	lg1_to_rgb32(rgb_a, src, size - 5, palette);
+	lg1_to_rgb32_scalar(rgb_b, src, size - 5, palette);
+	if (memcmp(rgb_a, rgb_b, (size - 5) * sizeof(uint32_t)))
+		error_exit("lg1_to_rgb32: differs");
+}
+
+void test_graphics_lg1()
+{
+	dolog(" + test_graphics_lg1");
+
+	graphics_lg1 *lg1 = new graphics_lg1(dc, "");
+	const uint8_t *fb = lg1 -> get_framebuffer();
+
+	// rectangle (10,20)-(13,21) in color 7
+	lg1 -> write_32b(LG1_XSTART, 10);
+	lg1 -> write_32b(LG1_XENDI, 13);
+	lg1 -> write_32b(LG1_YSTART, 20);
+	lg1 -> write_32b(LG1_YENDI, 21);
+	lg1 -> write_32b(LG1_COLORREDI, 7);
+	lg1 -> write_32b(LG1_COMMAND | LG1_GO, LG1_OP_DRAW | LG1_CMD_BLOCK | (REX_LO_SRC << LG1_CMD_LOGICOP_SHIFT));
+
+	// drawing is asynchronous, the status register tells when it is done
+	uint32_t temp_32b = 0;
+	double start_ts = get_ts();
+	do
+	{
+		lg1 -> read_32b(LG1_CFGMODE, &temp_32b);
+
+		if (get_ts() - start_ts > 5.0)
+			error_exit("graphics_lg1: engine stays busy (%08x)", temp_32b);
+	}
+	while(temp_32b & LG1_CFGMODE_BUSY);
+
+	if (fb[20 * LG1_WIDTH + 10] != 7 || fb[21 * LG1_WIDTH + 13] != 7)
+		error_exit("graphics_lg1: rectangle not drawn");
+	if (fb[20 * LG1_WIDTH + 9] != 0 || fb[20 * LG1_WIDTH + 14] != 0 || fb[22 * LG1_WIDTH + 10] != 0)
+		error_exit("graphics_lg1: rectangle too large");
+	if (lg1 -> get_n_pixels() != 8)
+		error_exit("graphics_lg1: %llu pixels counted, expected 8", lg1 -> get_n_pixels());
+
+	// move it 100 pixels to the right
+	lg1 -> write_32b(LG1_XYMOVE, 100 << 16);
+	lg1 -> write_32b(LG1_COMMAND | LG1_GO, LG1_OP_SCR2SCR | LG1_CMD_BLOCK | (REX_LO_SRC << LG1_CMD_LOGICOP_SHIFT));
+	lg1 -> sync();
+
+	if (fb[20 * LG1_WIDTH + 110] != 7 || fb[21 * LG1_WIDTH + 113] != 7)
+		error_exit("graphics_lg1: rectangle not copied");
+
+	// read it back through HOSTRW, 4 pixels at a time
+	lg1 -> write_32b(LG1_COMMAND, LG1_OP_READ | LG1_CMD_QUADMODE);
+	lg1 -> write_32b(LG1_XSTART, 109);
+	lg1 -> write_32b(LG1_XENDI, 112);
+	lg1 -> write_32b(LG1_YSTART, 20);
+
+	// reads other than the status wait for the queued writes
+	lg1 -> read_32b(LG1_HOSTRW, &temp_32b);
+	if (temp_32b != 0x00070707)
+		error_exit("graphics_lg1: HOSTRW read %08x, expected 00070707", temp_32b);
+
+	// DAC: entry 5 = 0x102030
+	lg1 -> write_32b(LG1_CFGSEL, LG1_CFG_DAC_ADDR);
+	lg1 -> write_32b(LG1_CFGDATA, 5);
+	lg1 -> write_32b(LG1_CFGSEL, LG1_CFG_DAC_PALETTE);
+	lg1 -> write_32b(LG1_CFGDATA, 0x10);
+	lg1 -> write_32b(LG1_CFGDATA, 0x20);
+	lg1 -> write_32b(LG1_CFGDATA, 0x30);
+	lg1 -> sync();
+
+	if (lg1 -> get_palette()[5] != 0x102030)
+		error_exit("graphics_lg1: palette entry 5 is %06x, expected 102030", lg1 -> get_palette()[5]);
+
+	delete lg1;
+}
+
+void test_lg1_shm()
+{
+	dolog(" + test_lg1_shm");
+
+	std::string name = format("/miep-testcases.%d", getpid());
+	graphics_lg1 *lg1 = new graphics_lg1(dc, name);
+
+	int fd = shm_open(name.c_str(), O_RDWR, 0);
+	if (fd == -1)
+		error_exit("lg1_shm: %s not created", name.c_str());
+
+	struct stat st;
+	fstat(fd, &st);
+	uint8_t *shm = (uint8_t *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	lg1_shm_header_t *hdr = (lg1_shm_header_t *)shm;
+	if (hdr -> magic != LG1_SHM_MAGIC || hdr -> width != LG1_WIDTH || hdr -> height != LG1_HEIGHT)
+		error_exit("lg1_shm: invalid header");
+
+	// two spans below each other become one rectangle
+	lg1 -> write_32b(LG1_XSTART, 100);
+	lg1 -> write_32b(LG1_XENDI, 199);
+	lg1 -> write_32b(LG1_YSTART, 50);
+	lg1 -> write_32b(LG1_COLORREDI, 9);
+	lg1 -> write_32b(LG1_COMMAND, LG1_OP_DRAW | (REX_LO_SRC << LG1_CMD_LOGICOP_SHIFT));
+	lg1 -> write_32b(LG1_COLORREDI | LG1_GO, 9);
+	lg1 -> write_32b(LG1_COLORREDI | LG1_GO, 9);
+	lg1 -> sync();
+
+	uint64_t generation = hdr -> generation;
+	if (generation == 0 || (generation & 1))
+		error_exit("lg1_shm: generation %llu after drawing", generation);
+
+	if (hdr -> n_dirty != 1 || hdr -> dirty[0].x0 != 100 || hdr -> dirty[0].y0 != 50 || hdr -> dirty[0].x1 != 199 || hdr -> dirty[0].y1 != 51)
+		error_exit("lg1_shm: unexpected dirty list (%u entries)", hdr -> n_dirty);
+
+	if (shm[hdr -> fb_offset + 51 * hdr -> stride + 150] != 9)
+		error_exit("lg1_shm: pixel not in shared memory");
+
+	// not acknowledged: the list grows
+	lg1 -> write_32b(LG1_YSTART, 300);
+	lg1 -> write_32b(LG1_COLORREDI | LG1_GO, 9);
+	lg1 -> sync();
+
+	if (hdr -> n_dirty != 2)
+		error_exit("lg1_shm: %u dirty entries, expected 2", hdr -> n_dirty);
+
+	// acknowledged: a new list is started
+	hdr -> ack_generation = hdr -> generation.load();
+	lg1 -> write_32b(LG1_YSTART, 400);
+	lg1 -> write_32b(LG1_COLORREDI | LG1_GO, 9);
+	lg1 -> sync();
+
+	if (hdr -> n_dirty != 1 || hdr -> dirty[0].y0 != 400)
+		error_exit("lg1_shm: %u dirty entries after acknowledge, expected 1", hdr -> n_dirty);
+
+	// a new palette changes everything
+	lg1 -> write_32b(LG1_CFGSEL, LG1_CFG_DAC_PALETTE);
+	lg1 -> write_32b(LG1_CFGDATA, 1);
+	lg1 -> write_32b(LG1_CFGDATA, 2);
+	lg1 -> write_32b(LG1_CFGDATA, 3);
+	lg1 -> sync();
+
+	if (hdr -> n_dirty != LG1_SHM_ALL_DIRTY || hdr -> palette[0] != 0x010203)
+		error_exit("lg1_shm: palette change not published");
+
+	munmap(shm, st.st_size);
+
+	delete lg1;
+
+	if (shm_open(name.c_str(), O_RDWR, 0) != -1)
+		error_exit("lg1_shm: %s not removed", name.c_str());
+}
+
+void test_scheduler_order(void *ctx, uint64_t now)
+{
+	std::vector<int> *order = (std::vector<int> *)ctx;
+
+	order -> push_back(int(now));
+}
+
+scheduler *test_sched = NULL;
+sched_id_t test_sched_victim = SCHED_NONE;
+int test_sched_n = 0;
+
+void test_scheduler_rearm(void *ctx, uint64_t now)
+{
+	test_sched_n++;
+
+	if (test_sched_n < 3)
+		test_sched -> schedule(now + 10, test_scheduler_rearm, ctx);
+
+	// an event may cancel another one that is due at the same cycle
+	test_sched -> cancel(test_sched_victim);
+}
+
+void test_scheduler_count(void *ctx, uint64_t now)
+{
+	(*(int *)ctx)++;
+}
+
+void test_scheduler()
+{
+	dolog(" + test_scheduler");
+
+	scheduler *s = new scheduler();
+
+	if (s -> get_next_event() != UINT64_MAX)
+		error_exit("scheduler: next event %llu when empty", s -> get_next_event());
+
+	// fires in cycle order, same cycle in the order of scheduling
+	std::vector<int> order, order_same;
+	const int when[] = { 50, 10, 40, 20, 30 };
+	for(size_t index=0; index<sizeof when / sizeof when[0]; index++)
+		s -> schedule(when[index], test_scheduler_order, &order);
+
+	if (s -> get_next_event() != 10)
+		error_exit("scheduler: next event %llu, expected 10", s -> get_next_event());
+
+	s -> run(35);
+
+	if (order.size() != 3 || order[0] != 35 || s -> get_next_event() != 40)
+		error_exit("scheduler: %zu events fired before cycle 35, next at %llu", order.size(), s -> get_next_event());
+
+	s -> run(100);
+
+	if (order.size() != 5 || s -> get_next_event() != UINT64_MAX)
+		error_exit("scheduler: %zu events fired in total", order.size());
+
+	int counts[3] = { 0 };
+	s -> schedule(200, test_scheduler_count, &counts[0]);
+	s -> schedule(200, test_scheduler_count, &counts[1]);
+	s -> schedule(200, test_scheduler_count, &counts[2]);
+
+	// cancel a pending event; ids of fired/cancelled events are stale
+	sched_id_t id = s -> schedule(150, test_scheduler_count, &counts[0]);
+	if (!s -> cancel(id) || s -> cancel(id))
+		error_exit("scheduler: cancel of a pending event");
+
+	if (s -> get_next_event() != 200)
+		error_exit("scheduler: next event %llu after cancel, expected 200", s -> get_next_event());
+
+	// the freed slot gets reused: the old id must not cancel the new event
+	sched_id_t id2 = s -> schedule(300, test_scheduler_count, &counts[1]);
+	if (s -> cancel(id) || id2 == id)
+		error_exit("scheduler: stale id cancelled a reused slot");
+
+	s -> run(300);
+
+	if (counts[0] != 1 || counts[1] != 2 || counts[2] != 1 || s -> get_n_pending() != 0)
+		error_exit("scheduler: counts %d %d %d after run", counts[0], counts[1], counts[2]);
+
+	// callbacks that reschedule themselves and cancel other events
+	test_sched = s;
+	int victim_count = 0;
+	s -> schedule(400, test_scheduler_rearm, NULL);
+	test_sched_victim = s -> schedule(400, test_scheduler_count, &victim_count);
+
+	s -> run(400);
+
+	if (test_sched_n != 1 || victim_count != 0)
+		error_exit("scheduler: %d rearmed callbacks, victim fired %d times", test_sched_n, victim_count);
+
+	if (s -> get_next_event() != 410)
+		error_exit("scheduler: rescheduled for %llu, expected 410", s -> get_next_event());
+
+	s -> run(410);
+	s -> run(420);
+
+	if (test_sched_n != 3 || s -> get_next_event() != UINT64_MAX)
+		error_exit("scheduler: %d rearmed callbacks", test_sched_n);
+
+	// many events in random order come out sorted
+	for(int index=0; index<1000; index++)
+		s -> schedule(random() % 10000, test_scheduler_order, &order_same);
+
+	uint64_t prev = 0;
+	while(s -> get_next_event() != UINT64_MAX)
+	{
+		uint64_t next = s -> get_next_event();
+
+		if (next < prev)
+			error_exit("scheduler: event for %llu after %llu", next, prev);
+
+		s -> run(next);
+		prev = next;
+	}
+
+	if (order_same.size() != 1000)
+		error_exit("scheduler: %zu of 1000 events fired", order_same.size());
+
+	delete s;
+}
+
+void test_int2()
+{
+	dolog(" + test_int2");
+	memory_bus *mb = NULL;
+	memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+	processor *p = NULL;
+	create_system(&mb, &m1, &m2, &m3, &p);
+
+	std::string sram = format("/tmp/testcases-sram.%d", getpid());
+	hpc3 *h = new hpc3(dc, p, sram);
+	int2 *ic = h -> get_int2();
+
+	const uint64_t int2_base = 0xd9880;
+
+	// memory is filled with NOPs
+	p -> set_PC(0);
+	p -> set_status_register(SR_IE | SR_IM);
+
+	// masked: nothing reaches the processor
+	ic -> set_local1(INT2_L1_HPC_DMA, true);
+	if (ic -> get_ip_lines() || p -> get_irq_pending())
+		error_exit("int2: masked interrupt raised line %04x", ic -> get_ip_lines());
+
+	uint8_t temp_8b = 0;
+	h -> read_8b(int2_base + INT2_LOCAL1_STATUS + 3, &temp_8b);
+	if (temp_8b != (1 << INT2_L1_HPC_DMA))
+		error_exit("int2: local1 status %02x", temp_8b);
+
+	h -> write_8b(int2_base + INT2_LOCAL1_MASK + 3, 1 << INT2_L1_HPC_DMA);
+	if (ic -> get_ip_lines() != INT2_IP_LOCAL1 || p -> get_irq_pending() == 0)
+		error_exit("int2: local1 not raised (%04x)", ic -> get_ip_lines());
+
+	if ((p -> get_C0_register(13, 0) & CAUSE_IP) != INT2_IP_LOCAL1)
+		error_exit("int2: cause %08x", p -> get_C0_register(13, 0));
+
+	// taken after the next instruction
+	tick(p);
+
+	if (p -> get_PC() != 0xffffffff80000180ll || p -> get_C0_register(14, 0) != 4)
+		error_exit("int2: PC %016llx, EPC %016llx after interrupt", p -> get_PC(), p -> get_C0_register(14, 0));
+
+	if (!(p -> get_SR() & SR_EXL) || p -> get_irq_pending())
+		error_exit("int2: SR %08x after interrupt", p -> get_SR());
+
+	// the handler masks the source and returns
+	h -> write_8b(int2_base + INT2_LOCAL1_MASK + 3, 0);
+	m1 -> write_32b(0x100, 0x42000018);	// ERET
+	p -> set_PC(0x100);
+	tick(p);
+
+	if (p -> get_PC() != 4 || (p -> get_SR() & SR_EXL) || p -> get_irq_pending())
+		error_exit("int2: PC %016llx, SR %08x after ERET", p -> get_PC(), p -> get_SR());
+
+	// mappable sources end up at local0/local1 through the map masks
+	ic -> set_local1(INT2_L1_HPC_DMA, false);
+	h -> write_8b(int2_base + INT2_LOCAL0_MASK + 3, 1 << INT2_L0_MAP0);
+	h -> write_8b(int2_base + INT2_MAP_MASK0 + 3, 1 << INT2_MAP_SERIAL);
+
+	// serial: tx interrupt once the character left the transmit buffer
+	z85c30 *ser = h -> get_serial(0);
+	ser -> ser_command_write(1);	// WR1: tx interrupt enable
+	ser -> ser_command_write(2);
+	ser -> ser_command_write(9);	// WR9: master interrupt enable
+	ser -> ser_command_write(8);
+	ser -> ser_data_write('a');
+	ser -> ser_data_write('b');
+
+	if (ic -> get_ip_lines())
+		error_exit("int2: serial interrupt while transmitting");
+
+	scheduler *s = p -> get_scheduler();
+	if (s -> get_next_event() == UINT64_MAX)
+		error_exit("int2: no event for the serial transmitter");
+
+	s -> run(s -> get_next_event());
+
+	if (ic -> get_ip_lines() != INT2_IP_LOCAL0)
+		error_exit("int2: serial interrupt not routed to local0 (%04x)", ic -> get_ip_lines());
+
+	h -> read_8b(int2_base + INT2_LOCAL0_STATUS + 3, &temp_8b);
+	if (temp_8b != (1 << INT2_L0_MAP0))
+		error_exit("int2: local0 status %02x", temp_8b);
+
+	ser -> ser_command_write(0x28);	// reset tx int pending
+	if (ic -> get_ip_lines())
+		error_exit("int2: serial interrupt not cleared");
+
+	delete h;
+	unlink(sram.c_str());
+
+	free_system(mb, m1, m2, m3, p);
+}
+
+void test_pit8254()
+{
+	dolog(" + test_pit8254");
+	memory_bus *mb = NULL;
+	memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+	processor *p = NULL;
+	create_system(&mb, &m1, &m2, &m3, &p);
+
+	std::string sram = format("/tmp/testcases-sram.%d", getpid());
+	hpc3 *h = new hpc3(dc, p, sram);
+	int2 *ic = h -> get_int2();
+	scheduler *s = p -> get_scheduler();
+
+	const uint64_t int2_base = 0xd9880 + 3;
+
+	// counter 2: 10us, clocks counter 0 which interrupts every 100 of those
+	h -> write_8b(int2_base + INT2_TCWORD, (2 << PIT_CW_SC_SHIFT) | (3 << PIT_CW_RW_SHIFT) | (2 << PIT_CW_MODE_SHIFT));
+	h -> write_8b(int2_base + INT2_TCNT2, 10);
+	h -> write_8b(int2_base + INT2_TCNT2, 0);
+
+	if (s -> get_next_event() != UINT64_MAX)
+		error_exit("pit8254: event for the prescaler");
+
+	h -> write_8b(int2_base + INT2_TCWORD, (0 << PIT_CW_SC_SHIFT) | (3 << PIT_CW_RW_SHIFT) | (2 << PIT_CW_MODE_SHIFT));
+	h -> write_8b(int2_base + INT2_TCNT0, 100);
+	h -> write_8b(int2_base + INT2_TCNT0, 0);
+
+	const uint64_t period = uint64_t(CPU_CLOCK_HZ) / 1000000 * 10 * 100;
+	uint64_t start = p -> get_cycle_count();
+	if (s -> get_next_event() != start + period)
+		error_exit("pit8254: terminal count at %llu, expected %llu", s -> get_next_event(), start + period);
+
+	// memory is filled with NOPs; 10 clocks of counter 0
+	p -> set_PC(0);
+	while(p -> get_cycle_count() < start + period / 10)
+		tick(p);
+
+	uint8_t lsb = 0, msb = 0;
+	h -> write_8b(int2_base + INT2_TCWORD, 0 << PIT_CW_SC_SHIFT);	// latch
+	for(int loop=0; loop<100; loop++)	// latched: does not change
+		tick(p);
+	h -> read_8b(int2_base + INT2_TCNT0, &lsb);
+	h -> read_8b(int2_base + INT2_TCNT0, &msb);
+
+	if (lsb != 90 || msb != 0)
+		error_exit("pit8254: count %d, expected 90", (msb << 8) | lsb);
+
+	// read-back of the status
+	uint8_t status = 0;
+	h -> write_8b(int2_base + INT2_TCWORD, (3 << PIT_CW_SC_SHIFT) | PIT_RB_NO_COUNT | (2 << 0));
+	h -> read_8b(int2_base + INT2_TCNT0, &status);
+	if (status != (0x80 | (3 << PIT_CW_RW_SHIFT) | (2 << PIT_CW_MODE_SHIFT)))
+		error_exit("pit8254: status %02x", status);
+
+	s -> run(start + period);
+
+	if (ic -> get_ip_lines() != INT2_IP_TIMER0)
+		error_exit("pit8254: timer 0 not raised (%04x)", ic -> get_ip_lines());
+
+	if (s -> get_next_event() != start + 2 * period)
+		error_exit("pit8254: next terminal count at %llu", s -> get_next_event());
+
+	h -> write_8b(int2_base + INT2_TIMER_CLEAR, 1);
+	if (ic -> get_ip_lines())
+		error_exit("pit8254: timer 0 not cleared");
+
+	// counter 1, mode 0: a single interrupt
+	h -> write_8b(int2_base + INT2_TCWORD, (1 << PIT_CW_SC_SHIFT) | (1 << PIT_CW_RW_SHIFT) | (0 << PIT_CW_MODE_SHIFT));
+	h -> write_8b(int2_base + INT2_TCNT1, 5);
+
+	uint64_t now = p -> get_cycle_count();
+	uint64_t expected = now + uint64_t(CPU_CLOCK_HZ) / 1000000 * 10 * 5;
+	if (s -> get_next_event() != expected)
+		error_exit("pit8254: counter 1 terminal count at %llu, expected %llu", s -> get_next_event(), expected);
+
+	s -> run(expected);
+
+	if (ic -> get_ip_lines() != INT2_IP_TIMER1)
+		error_exit("pit8254: timer 1 not raised (%04x)", ic -> get_ip_lines());
+
+	// only counter 0 is left
+	s -> run(start + 2 * period);
+	if (s -> get_next_event() != start + 3 * period)
+		error_exit("pit8254: counter 1 fired again or counter 0 stopped");
+
+	// stopping counter 2 stops the others
+	h -> write_8b(int2_base + INT2_TCWORD, (2 << PIT_CW_SC_SHIFT) | (3 << PIT_CW_RW_SHIFT) | (2 << PIT_CW_MODE_SHIFT));
+	if (s -> get_next_event() != UINT64_MAX)
+		error_exit("pit8254: counter 0 runs without input clock");
+
+	delete h;
+	unlink(sram.c_str());
+
+	free_system(mb, m1, m2, m3, p);
+}
+
+void test_count_compare()
+{
+	dolog(" + test_count_compare");
+	memory_bus *mb = NULL;
+	memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+	processor *p = NULL;
+	create_system(&mb, &m1, &m2, &m3, &p);
+
+	scheduler *s = p -> get_scheduler();
+
+	// memory is filled with NOPs
+	p -> set_PC(0);
+	p -> set_C0_register(9, 0, 0xfffffff0);	// Count, wraps during the test
+
+	uint64_t start = p -> get_cycle_count();
+	for(int loop=0; loop<100; loop++)
+		tick(p);
+
+	uint64_t cycles = p -> get_cycle_count() - start;
+	uint32_t count = p -> get_C0_register(9, 0);
+	if (count != uint32_t(0xfffffff0 + cycles / COUNT_DIVIDER))
+		error_exit("count/compare: Count %08x after %llu cycles", count, cycles);
+
+	if (s -> get_next_event() != UINT64_MAX)
+		error_exit("count/compare: event before Compare was written");
+
+	// Compare 1000 counts ahead
+	p -> set_status_register(SR_IE | CAUSE_IP_TIMER);
+	p -> set_C0_register(11, 0, count + 1000);
+
+	uint64_t now = p -> get_cycle_count();
+	uint64_t expected = now - (now - start) % COUNT_DIVIDER + 1000 * COUNT_DIVIDER;
+	if (s -> get_next_event() != expected)
+		error_exit("count/compare: match at %llu, expected %llu", s -> get_next_event(), expected);
+
+	while(p -> get_cycle_count() < expected)
+	{
+		if (p -> get_C0_register(13, 0) & CAUSE_IP_TIMER)
+			error_exit("count/compare: timer interrupt at Count %08x", p -> get_C0_register(9, 0));
+
+		tick(p);
+	}
+
+	// taken by the processor
+	if (!(p -> get_C0_register(13, 0) & CAUSE_IP_TIMER) || p -> get_PC() != 0xffffffff80000180ll)
+		error_exit("count/compare: no timer interrupt, PC %016llx", p -> get_PC());
+
+	// the next match is a full Count wrap later
+	if (s -> get_next_event() != expected + (1ll << 32) * COUNT_DIVIDER)
+		error_exit("count/compare: next match at %llu", s -> get_next_event());
+
+	// writing Compare acknowledges
+	p -> set_C0_register(11, 0, 0);
+	if (p -> get_C0_register(13, 0) & CAUSE_IP_TIMER)
+		error_exit("count/compare: interrupt not acknowledged");
+
+	// MC counters follow the cycle count
+	memory *pmc = new mc(p, dc);
+	p -> set_PC(0);
+
+	uint32_t rpss1 = 0, rpss2 = 0, ref1 = 0, ref2 = 0;
+	pmc -> write_32b(0x28, 0x0104);	// RPSS_DIVIDER: +2 every 5 MC clocks
+	pmc -> read_32b(0x1000, &rpss1);
+	pmc -> read_32b(0x48, &ref1);
+
+	now = p -> get_cycle_count();
+	for(int loop=0; loop<250; loop++)
+		tick(p);
+	cycles = p -> get_cycle_count() - now;
+
+	pmc -> read_32b(0x1000, &rpss2);
+	pmc -> read_32b(0x48, &ref2);
+
+	uint64_t mc_clocks = cycles / (CPU_CLOCK_HZ / MC_CLOCK_HZ);
+	if (rpss2 - rpss1 < (mc_clocks / 5 - 1) * 2 || rpss2 - rpss1 > (mc_clocks / 5 + 1) * 2)
+		error_exit("mc: RPSS_CTR advanced by %u in %llu MC clocks", rpss2 - rpss1, mc_clocks);
+
+	if (ref1 - ref2 < mc_clocks - 1 || ref1 - ref2 > mc_clocks + 1 || ref1 > MC_REFCNT_PRELOAD_DEFAULT)
+		error_exit("mc: REF_CTR from %u to %u in %llu MC clocks", ref1, ref2, mc_clocks);
+
+	delete pmc;
+
+	free_system(mb, m1, m2, m3, p);
+}
+
+static void idle_set_flag(void *ctx, uint64_t now)
+{
+	((memory_bus *)ctx) -> write_32b(0x100, 1);
+}
+
+typedef struct
+{
+	memory_bus *mb;
+	processor *p;
+} idle_wake_t;
+
+static void * idle_wake_thread(void *arg)
+{
+	idle_wake_t *iw = (idle_wake_t *)arg;
+
+	usleep(10000);
+
+	iw -> mb -> write_32b(0x100, 1);
+	iw -> p -> wake();
+
+	return NULL;
+}
+
+// runs until the polling loop at 0 sees the flag at 0x100
+static void idle_poll(processor *p, const char *what)
+{
+	p -> set_PC(0);
+
+	for(int loop=0; loop<10000 && p -> get_PC() != 0x0c; loop++)
+		tick(p);
+
+	if (p -> get_PC() != 0x0c)
+		error_exit("idle (%s): loop not left, PC %016llx", what, p -> get_PC());
+}
+
+void test_idle()
+{
+	dolog(" + test_idle");
+	memory_bus *mb = NULL;
+	memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+	processor *p = NULL;
+	create_system(&mb, &m1, &m2, &m3, &p);
+
+	// 0: lw t0,0x100(zero); beq t0,zero,0; nop
+	mb -> write_32b(0x00, make_cmd_I_TYPE(0, 8, 0x23, 0x100));
+	mb -> write_32b(0x04, make_cmd_I_TYPE(0, 8, 0x04, 0xfffe));
+	mb -> write_32b(0x08, 0);
+	mb -> write_32b(0x100, 0);
+
+	// a device event ends the wait: guest time jumps to it
+	uint64_t when = p -> get_cycle_count() + CPU_CLOCK_HZ / 200;	// 5ms
+	p -> get_scheduler() -> schedule(when, idle_set_flag, mb);
+
+	idle_poll(p, "event");
+
+	if (p -> get_idle_cycles() == 0 || p -> get_cycle_count() < when)
+		error_exit("idle: %llu idle cycles, at %llu, event at %llu", p -> get_idle_cycles(), p -> get_cycle_count(), when);
+
+	// a loop that counts down is busy
+	uint64_t idle_before = p -> get_idle_cycles();
+
+	// 0x20: addiu t1,t1,-1; bne t1,zero,0x20; nop
+	mb -> write_32b(0x20, make_cmd_I_TYPE(9, 9, 0x09, 0xffff));
+	mb -> write_32b(0x24, make_cmd_I_TYPE(9, 0, 0x05, 0xfffe));
+	mb -> write_32b(0x28, 0);
+
+	p -> set_PC(0x20);
+	p -> set_register_64b(9, 1000);
+
+	while(p -> get_PC() != 0x2c)
+		tick(p);
+
+	if (p -> get_idle_cycles() != idle_before)
+		error_exit("idle: countdown loop considered idle");
+
+	// host input (without a pending event the sleep would be 100ms)
+	mb -> write_32b(0x100, 0);
+
+	idle_wake_t iw = { mb, p };
+	pthread_t th;
+	double start_ts = get_ts();
+	pthread_create(&th, NULL, idle_wake_thread, &iw);
+
+	idle_poll(p, "wake");
+
+	double took = get_ts() - start_ts;
+	pthread_join(th, NULL);
+
+	if (took >= 0.09)
+		error_exit("idle: wake() ignored, woke after %fs", took);
+
+	free_system(mb, m1, m2, m3, p);
+}
+
+void test_throttle()
+{
+	dolog(" + test_throttle");
+
+	// 10MHz: 50 slices of 1ms
+	throttle *t = new throttle(10.0, 1000);
+
+	double start_ts = get_ts();
+	uint64_t cycle = 1000;
+
+	for(int loop=0; loop<50; loop++)
+	{
+		cycle += 10000;
+		t -> account(cycle);
+	}
+
+	double took = get_ts() - start_ts;
+	if (took < 0.045 || took > 0.5)
+		error_exit("throttle: 50ms of cycles took %fs", took);
+
+	if (t -> get_n_sleeps() == 0 || t -> get_behind_ns())
+		error_exit("throttle: %llu sleeps, %llu ns behind", t -> get_n_sleeps(), t -> get_behind_ns());
+
+	// a host that falls behind does not catch up
+	usleep((THROTTLE_MAX_LAG_MS + 50) * 1000);
+	t -> account(cycle);
+
+	if (t -> get_behind_ns() < (THROTTLE_MAX_LAG_MS + 50) * 1000000ll)
+		error_exit("throttle: %llu ns behind", t -> get_behind_ns());
+
+	uint64_t n_sleeps = t -> get_n_sleeps();
+	cycle += 10000;
+	t -> account(cycle);
+
+	if (t -> get_n_sleeps() != n_sleeps + 1)
+		error_exit("throttle: lag not written off");
+
+	delete t;
+}
+
+void test_input_log()
+{
+	dolog(" + test_input_log");
+	memory_bus *mb = NULL;
+	memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+	processor *p = NULL;
+	create_system(&mb, &m1, &m2, &m3, &p);
+
+	std::string file = format("/tmp/testcases-input.%d", getpid());
+	uint64_t now = p -> get_cycle_count();
+
+	input_log *il = new input_log(file, false);
+	il -> record_serial(0, now + 100, 'a');
+	uint32_t r = il -> get_random(now + 150);
+	il -> record_serial(1, now + 150, 'b');
+	il -> record_serial(0, now + 100000, 'c');
+	il -> record_serial(0, now + 100400, 'd');
+	delete il;
+
+	il = new input_log(file, true);
+	uint8_t c = 0;
+
+	if (il -> replay_serial(0, now + 99, &c))
+		error_exit("input log: serial input replayed too early");
+
+	if (!il -> replay_serial(0, now + 100, &c) || c != 'a')
+		error_exit("input log: first character not replayed (%02x)", c);
+
+	if (il -> get_random(now + 150) != r)
+		error_exit("input log: random number differs");
+
+	if (il -> replay_serial(0, now + 150, &c))
+		error_exit("input log: input of channel 2 replayed to channel 1");
+
+	if (!il -> replay_serial(1, now + 150, &c) || c != 'b')
+		error_exit("input log: second character not replayed (%02x)", c);
+
+	// the serial chip takes the character when the guest looks for it
+	p -> set_PC(0);
+	while(p -> get_cycle_count() < now + 100000)
+		tick(p);
+
+	if (p -> get_cycle_count() != now + 100000)
+		error_exit("input log: cycle %llu skipped", now + 100000);
+
+	z85c30 *ser = new z85c30(dc, p);
+	ser -> set_input_log(il, 0);
+
+	if (!(ser -> ser_command_read() & 1) || ser -> ser_data_read() != 'c')
+		error_exit("input log: serial input not replayed");
+
+	if (ser -> ser_command_read() & 1)
+		error_exit("input log: more serial input than recorded");
+
+	// with rx interrupts on the recording took it in an input event: the
+	// replay raises the interrupt at that cycle, without a register read
+	ser -> ser_command_write(9);
+	ser -> ser_command_write(0x08);	// master interrupt enable
+	ser -> ser_command_write(1);
+	ser -> ser_command_write(0x10);	// rx interrupt on all characters
+
+	while(!ser -> get_irq_state() && p -> get_cycle_count() < now + 200000)
+		tick(p);
+
+	if (p -> get_cycle_count() != now + 100400 || ser -> ser_data_read() != 'd')
+		error_exit("input log: rx interrupt at cycle %llu, recorded at %llu", p -> get_cycle_count() - now, 100400ull);
+
+	delete ser;
+	delete il;
+	unlink(file.c_str());
+
+	free_system(mb, m1, m2, m3, p);
+}
+
+void test_snapshot()
+{
+	dolog(" + test_snapshot");
+	std::string file = format("/tmp/testcases-snapshot.%d", getpid());
+	std::string sram = format("/tmp/testcases-sram.%d", getpid());
+	uint64_t pc = 0, cycles = 0, size = 0;
+
+	for(int restore=0; restore<2; restore++)
+	{
+		memory_bus *mb = NULL;
+		memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+		processor *p = NULL;
+		int m1s = 0;
+		create_system(&mb, &m1, &m2, &m3, &p, &m1s);
+
+		mc *pmc = new mc(p, dc);
+		hpc3 *h = new hpc3(dc, p, sram);
+
+		snapshot *snap = new snapshot(p, pmc, h);
+		snap -> add_ram("m1", m1);
+		snap -> add_ram("m2", m2);
+		snap -> add_rom("m3", m3);
+
+		if (!restore)
+		{
+			// memory is filled with NOPs
+			p -> set_PC(0);
+			for(int loop=0; loop<100; loop++)
+				tick(p);
+
+			p -> set_register_64b(9, 0x1234567890abcdefll);
+			p -> set_C0_register(11, 0, p -> get_C0_register(9, 0) + 1000);
+			m1 -> write_32b(0x1000, 0xdeadbeef);
+			m1 -> write_32b(m1s - 4, 0xcafebabe);
+			h -> get_int2() -> write(INT2_LOCAL0_MASK, 0x42);
+
+			pc = p -> get_PC();
+			cycles = p -> get_cycle_count();
+			size = m1s;
+
+			// in the background, while the memory changes
+			snap -> save(file, true);
+			m1 -> write_32b(0x1000, 0);
+
+			double start_ts = get_ts();
+			while(snap -> poll())
+			{
+				if (get_ts() - start_ts > 5.0)
+					error_exit("snapshot: background writer did not finish");
+
+				usleep(1000);
+			}
+
+			struct stat st;
+			if (stat(file.c_str(), &st) == -1)
+				error_exit("snapshot: %s not written", file.c_str());
+
+			// only a few pages are not zero
+			if (uint64_t(st.st_blocks) * 512 >= size)
+				error_exit("snapshot: zero pages stored (%llu bytes allocated)", uint64_t(st.st_blocks) * 512);
+		}
+		else
+		{
+			snap -> load(file);
+
+			uint32_t v1 = 0, v2 = 0;
+			m1 -> read_32b(0x1000, &v1);
+			m1 -> read_32b(size - 4, &v2);
+
+			if (v1 != 0xdeadbeef || v2 != 0xcafebabe)
+				error_exit("snapshot: RAM restored as %08x %08x", v1, v2);
+
+			if (p -> get_PC() != pc || p -> get_cycle_count() != cycles || p -> get_register_64b_unsigned(9) != 0x1234567890abcdefll)
+				error_exit("snapshot: processor state not restored");
+
+			if (h -> get_int2() -> read(INT2_LOCAL0_MASK) != 0x42)
+				error_exit("snapshot: INT2 state not restored");
+
+			// the Compare match is scheduled again
+			if (p -> get_scheduler() -> get_next_event() != cycles + 1000 * COUNT_DIVIDER - cycles % COUNT_DIVIDER)
+				error_exit("snapshot: Compare event at %llu", p -> get_scheduler() -> get_next_event());
+
+			// the restored memory is private
+			m1 -> write_32b(0x1000, 1);
+			tick(p);
+		}
+
+		delete snap;
+		delete h;
+		delete pmc;
+
+		free_system(mb, m1, m2, m3, p);
+	}
+
+	unlink(file.c_str());
+	unlink(sram.c_str());
+}
+
+typedef struct
+{
+	std::string path;
+	int console_fd;
+	pid_t pid;
+	std::atomic_bool *stop;
+} fork_client_t;
+
+static void * fork_client_thread(void *arg)
+{
+	fork_client_t *fc = (fork_client_t *)arg;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0x00, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, fc -> path.c_str());
+	if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == -1)
+		error_exit("fork_server: cannot connect to %s", fc -> path.c_str());
+
+	char request[] = "cycles 1000";
+	char control[CMSG_SPACE(sizeof(int))];
+	memset(control, 0x00, sizeof control);
+	struct iovec iov = { request, sizeof request - 1 };
+
+	struct msghdr msg;
+	memset(&msg, 0x00, sizeof msg);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof control;
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg -> cmsg_level = SOL_SOCKET;
+	cmsg -> cmsg_type = SCM_RIGHTS;
+	cmsg -> cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fc -> console_fd, sizeof(int));
+
+	if (sendmsg(fd, &msg, 0) == -1)
+		error_exit("fork_server: sendmsg failed");
+
+	char reply[32] = { 0 };
+	if (read(fd, reply, sizeof reply - 1) <= 0)
+		error_exit("fork_server: no reply");
+
+	fc -> pid = atoi(reply);
+
+	close(fd);
+
+	*fc -> stop = true;
+
+	return NULL;
+}
+
+void test_fork_server()
+{
+	dolog(" + test_fork_server");
+	memory_bus *mb = NULL;
+	memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+	processor *p = NULL;
+	create_system(&mb, &m1, &m2, &m3, &p);
+
+	std::string path = format("/tmp/testcases-fork.%d", getpid());
+
+	// boot conditions
+	fork_server *fs = new fork_server(path, "pc:40");
+	p -> set_PC(0);	// NOPs
+	while(!fs -> reached(p))
+		tick(p);
+	if (p -> get_PC() != 0x40)
+		error_exit("fork_server: pc condition at %016llx", p -> get_PC());
+	delete fs;
+
+	fs = new fork_server(path, "serial:login:");
+	const char *text = "lolog logilogin:";
+	for(int index=0; text[index]; index++)
+	{
+		if (fs -> reached(p))
+			error_exit("fork_server: serial condition met at \"%s\"", &text[index]);
+
+		fork_server::serial_tx(fs, text[index]);
+	}
+	if (!fs -> reached(p))
+		error_exit("fork_server: serial condition not met");
+	delete fs;
+
+	// a job gets the console that the client sent
+	fs = new fork_server(path, "");
+
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1)
+		error_exit("fork_server: socketpair failed");
+
+	std::atomic_bool stop(false);
+	fork_client_t fc = { path, sv[1], -1, &stop };
+	pthread_t th;
+	pthread_create(&th, NULL, fork_client_thread, &fc);
+
+	int console_fd = -1;
+	uint64_t max_cycles = 0;
+	if (fs -> serve(stop, &console_fd, &max_cycles))
+	{
+		// the job
+		const char *msg = max_cycles == 1000 ? "ok" : "no";
+		_exit(write(console_fd, msg, 2) == 2 ? 0 : 1);
+	}
+
+	pthread_join(th, NULL);
+	delete fs;
+
+	char buffer[3] = { 0 };
+	if (read(sv[0], buffer, 2) != 2 || strcmp(buffer, "ok") != 0)
+		error_exit("fork_server: job did not write to its console (%s)", buffer);
+
+	int status = 0;
+	if (fc.pid <= 0 || (waitpid(fc.pid, &status, 0) == fc.pid && (!WIFEXITED(status) || WEXITSTATUS(status))))
+		error_exit("fork_server: job %d failed", fc.pid);
+
+	close(sv[0]);
+	close(sv[1]);
+
+	free_system(mb, m1, m2, m3, p);
+}
+
+void test_checkpoint()
+{
+	dolog(" + test_checkpoint");
+	std::string file = format("/tmp/testcases-checkpoint.%d", getpid());
+	std::string delta_file = file + ".delta";
+	std::string sram = format("/tmp/testcases-sram.%d", getpid());
+	uint64_t pc = 0, cycles = 0;
+	int size = 0;
+
+	for(int restore=0; restore<2; restore++)
+	{
+		memory_bus *mb = NULL;
+		memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+		processor *p = NULL;
+		int m1s = 0;
+		create_system(&mb, &m1, &m2, &m3, &p, &m1s);
+
+		mc *pmc = new mc(p, dc);
+		hpc3 *h = new hpc3(dc, p, sram);
+
+		snapshot *snap = new snapshot(p, pmc, h);
+		snap -> add_ram("m1", m1);
+		snap -> add_ram("m2", m2);
+		snap -> add_rom("m3", m3);
+
+		if (!restore)
+		{
+			snap -> enable_checkpoints();
+
+			p -> set_PC(0);
+			m1 -> write_32b(0x1000, 0x11111111);
+
+			snap -> save(file, false);
+
+			if (!snap -> have_chain())
+				error_exit("checkpoint: no chain after a snapshot");
+
+			for(int loop=0; loop<10; loop++)
+				tick(p);
+
+			m1 -> write_32b(0x1000, 0x22222222);
+			m1 -> write_32b(0x20000, 0x33333333);
+			snap -> checkpoint(file);
+
+			// the device state and only the pages that changed
+			struct stat st;
+			if (stat(delta_file.c_str(), &st) == -1)
+				error_exit("checkpoint: %s not written", delta_file.c_str());
+
+			if (st.st_size >= m1s)
+				error_exit("checkpoint: %llu bytes written", uint64_t(st.st_size));
+
+			for(int loop=0; loop<10; loop++)
+				tick(p);
+
+			// changed pages that the ram_compactor compressed meanwhile
+			ram_compactor *rc = new ram_compactor(0);
+			rc -> add(m1);
+			rc -> set_release_callback(snapshot::release_callback, snap);
+
+			m1 -> write_32b(0x1000, 0x44444444);
+			m1 -> write_32b(m1s - 4, 0x55555555);
+			p -> set_register_64b(9, 0x1234567890abcdefll);
+
+			rc -> scan();
+			rc -> scan();
+			if (rc -> get_n_compressed() == 0)
+				error_exit("checkpoint: nothing compressed");
+
+			snap -> checkpoint(file);
+			delete rc;
+
+			pc = p -> get_PC();
+			cycles = p -> get_cycle_count();
+			size = m1s;
+
+			// a checkpoint that was cut off while writing is ignored
+			FILE *fh = fopen(delta_file.c_str(), "ab");
+			fwrite(CHECKPOINT_MAGIC, 1, 8, fh);
+			fwrite(&cycles, 1, 4, fh);
+			fclose(fh);
+
+			m1 -> write_32b(0x1000, 0x66666666);
+		}
+		else
+		{
+			snap -> load(file);
+
+			uint32_t v1 = 0, v2 = 0, v3 = 0;
+			m1 -> read_32b(0x1000, &v1);
+			m1 -> read_32b(0x20000, &v2);
+			m1 -> read_32b(size - 4, &v3);
+
+			if (v1 != 0x44444444 || v2 != 0x33333333 || v3 != 0x55555555)
+				error_exit("checkpoint: RAM restored as %08x %08x %08x", v1, v2, v3);
+
+			if (p -> get_PC() != pc || p -> get_cycle_count() != cycles || p -> get_register_64b_unsigned(9) != 0x1234567890abcdefll)
+				error_exit("checkpoint: processor state not restored");
+		}
+
+		delete snap;
+		delete h;
+		delete pmc;
+
+		free_system(mb, m1, m2, m3, p);
+	}
+
+	unlink(file.c_str());
+	unlink(delta_file.c_str());
+	unlink(sram.c_str());
+}
+
+static int resident_pages(const memory *m, uint64_t offset, uint64_t n)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	std::vector<unsigned char> vec(n / page_size);
+
+	if (mincore((void *)(m -> get_data() + offset), n, vec.data()) == -1)
+		error_exit("mincore failed");
+
+	int count = 0;
+	for(size_t index=0; index<vec.size(); index++)
+		count += vec[index] & 1;
+
+	return count;
+}
+
+void test_ram_compactor()
+{
+	dolog(" + test_ram_compactor");
+	const uint64_t size = 32 * COMPACT_CHUNK;
+
+	memory *m = new memory(size, true);
+
+	// chunk 0: text, chunk 1: random, the rest zero
+	const char text[] = "ram_compactor: test pattern that compresses well. ";
+	for(uint64_t offset=0; offset<COMPACT_CHUNK; offset++)
+		m -> write_8b(offset, text[offset % (sizeof text - 1)]);
+
+	srand(1);
+	std::vector<uint8_t> random(COMPACT_CHUNK);
+	for(size_t index=0; index<random.size(); index++)
+		random[index] = rand();
+	m -> write_block(COMPACT_CHUNK, random.data(), random.size());
+
+	m -> write_32b(5 * COMPACT_CHUNK + 16, 0);
+
+	// the compressor on its own: long literal runs and matches
+	std::vector<uint8_t> packed(COMPACT_CHUNK * 2), unpacked(COMPACT_CHUNK);
+	size_t n = lz_compress(random.data(), random.size(), packed.data(), packed.size());
+	if (n == 0 || !lz_decompress(packed.data(), n, unpacked.data(), unpacked.size()) || unpacked != random)
+		error_exit("ram_compactor: random data does not survive lz");
+
+	n = lz_compress(m -> get_data(), COMPACT_CHUNK, packed.data(), packed.size());
+	if (n == 0 || n > COMPACT_CHUNK / 20 || !lz_decompress(packed.data(), n, unpacked.data(), unpacked.size()) || memcmp(unpacked.data(), m -> get_data(), COMPACT_CHUNK) != 0)
+		error_exit("ram_compactor: text compressed to %zu bytes", n);
+
+	if (lz_decompress(packed.data(), n / 2, unpacked.data(), unpacked.size()))
+		error_exit("ram_compactor: truncated input accepted");
+
+	ram_compactor *rc = new ram_compactor(0);
+	rc -> add(m);
+
+	// arm, then compress what was not touched in between
+	rc -> scan();
+	rc -> scan();
+
+	if (rc -> get_n_compressed() != 31)
+		error_exit("ram_compactor: %llu chunks compressed", rc -> get_n_compressed());
+
+	if (rc -> get_pool_bytes() >= COMPACT_CHUNK / 20)
+		error_exit("ram_compactor: pool is %llu bytes", rc -> get_pool_bytes());
+
+	if (resident_pages(m, 0, COMPACT_CHUNK) != 0 || resident_pages(m, 2 * COMPACT_CHUNK, size - 2 * COMPACT_CHUNK) != 0)
+		error_exit("ram_compactor: compressed chunks still resident");
+
+	// faulted back in on access
+	uint8_t c = 0;
+	m -> read_8b(COMPACT_CHUNK - 1, &c);
+	if (c != text[(COMPACT_CHUNK - 1) % (sizeof text - 1)])
+		error_exit("ram_compactor: read %02x after decompressing", c);
+
+	m -> write_32b(7 * COMPACT_CHUNK + 8, 0x12345678);
+
+	if (rc -> get_n_decompressed() != 2 || rc -> get_n_compressed() != 29)
+		error_exit("ram_compactor: %llu chunks decompressed", rc -> get_n_decompressed());
+
+	// the random chunk is armed again now, touching it only disarms it
+	rc -> scan();
+
+	uint32_t v = 0;
+	uint64_t faults = rc -> get_n_faults();
+	m -> read_32b(COMPACT_CHUNK, &v);
+	if (rc -> get_n_faults() != faults + 1 || rc -> get_n_decompressed() != 2)
+		error_exit("ram_compactor: access to an armed chunk");
+
+	// a child gets the compressed chunks too
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		uint32_t c = 0;
+		m -> read_32b(7 * COMPACT_CHUNK + 8, &c);
+		_exit(c == 0x12345678 ? 0 : 1);
+	}
+
+	int status = 0;
+	rc -> scan();
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		error_exit("ram_compactor: child read compressed memory wrong");
+
+	delete rc;
+
+	if (memcmp(m -> get_data() + COMPACT_CHUNK, random.data(), random.size()) != 0 || m -> get_data()[5 * COMPACT_CHUNK + 16] != 0)
+		error_exit("ram_compactor: memory changed");
+
+	m -> read_32b(7 * COMPACT_CHUNK + 8, &v);
+	if (v != 0x12345678)
+		error_exit("ram_compactor: write lost");
+
+	delete m;
+}
+
+static void zero_release(void *ctx, memory *m, uint64_t offset, uint64_t n)
+{
+	*(uint64_t *)ctx += n;
+}
+
+void test_zero_reclaimer()
+{
+	dolog(" + test_zero_reclaimer");
+	std::string file = format("/tmp/testcases-zero.%d", getpid());
+	const uint64_t size = 4 * ZERO_SCAN_BLOCK;
+	uint64_t page_size = sysconf(_SC_PAGESIZE);
+
+	memory_bus *mb = NULL;
+	memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+	processor *p = NULL;
+	create_system(&mb, &m1, &m2, &m3, &p);
+
+	// the second one is mapped from a file that is not zero: released
+	// pages must not show its contents again
+	std::vector<uint8_t> ones(size, 0x11);
+	int fd = open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1 || write(fd, ones.data(), size) != ssize_t(size))
+		error_exit("zero_reclaimer: cannot create %s", file.c_str());
+
+	memory *m[2] = { new memory(size, true), new memory(size, true) };
+	m[1] -> map_file(fd, 0);
+	close(fd);
+
+	uint64_t released = 0;
+	zero_reclaimer *zr = new zero_reclaimer(p, NULL);
+	zr -> set_release_callback(zero_release, &released);
+
+	for(int nr=0; nr<2; nr++)
+	{
+		m[nr] -> write_block(0, ones.data(), size);
+
+		// what a guest that zeroes memory leaves behind: a few pages and
+		// a whole huge page
+		std::vector<uint8_t> zero(ZERO_SCAN_BLOCK);
+		m[nr] -> write_block(page_size, zero.data(), 3 * page_size);
+		m[nr] -> write_block(2 * ZERO_SCAN_BLOCK - uintptr_t(m[nr] -> get_data()) % ZERO_SCAN_BLOCK, zero.data(), ZERO_SCAN_BLOCK);
+
+		// one byte is enough to keep a page
+		m[nr] -> write_8b(2 * page_size + 100, 1);
+
+		zr -> add(m[nr]);
+	}
+
+	zr -> start();
+
+	uint64_t now = p -> get_cycle_count();
+	if (p -> get_scheduler() -> get_next_event() != now + uint64_t(ZERO_SCAN_PERIOD_US) * (CPU_CLOCK_HZ / 1000000))
+		error_exit("zero_reclaimer: step not scheduled");
+
+	// a step compares at most ZERO_SCAN_CHECK_BYTES
+	for(int steps=0; zr -> get_n_passes() == 0; steps++)
+	{
+		if (steps == 10)
+			error_exit("zero_reclaimer: no complete pass");
+
+		zr -> step(now);
+	}
+
+	uint64_t expected = 2 * (2 + ZERO_SCAN_BLOCK / page_size);
+	if (zr -> get_n_reclaimed() != expected || released != expected * page_size)
+		error_exit("zero_reclaimer: %llu pages reclaimed, %llu bytes reported", zr -> get_n_reclaimed(), released);
+
+	for(int nr=0; nr<2; nr++)
+	{
+		unsigned char vec[4];
+		if (mincore((void *)(m[nr] -> get_data() + page_size), 4 * page_size, vec) == -1)
+			error_exit("mincore failed");
+
+		if ((vec[0] & 1) || !(vec[1] & 1) || (vec[2] & 1) || !(vec[3] & 1))
+			error_exit("zero_reclaimer: residency %d %d %d %d", vec[0], vec[1], vec[2], vec[3]);
+
+		uint64_t zero_block = 2 * ZERO_SCAN_BLOCK - uintptr_t(m[nr] -> get_data()) % ZERO_SCAN_BLOCK;
+		uint64_t offsets[] = { page_size, 3 * page_size + 8, zero_block, zero_block + ZERO_SCAN_BLOCK - 1 };
+
+		for(int index=0; index<4; index++)
+		{
+			uint8_t v = 0xff;
+			m[nr] -> read_8b(offsets[index], &v);
+
+			if (v != 0)
+				error_exit("zero_reclaimer: %02x at %llx of region %d", v, offsets[index], nr);
+		}
+
+		uint8_t v = 0;
+		m[nr] -> read_8b(2 * page_size + 100, &v);
+		if (v != 1)
+			error_exit("zero_reclaimer: page with data released");
+
+		m[nr] -> read_8b(size - 1, &v);
+		if (v != 0x11)
+			error_exit("zero_reclaimer: data lost");
+	}
+
+	delete zr;
+
+	for(int nr=0; nr<2; nr++)
+		delete m[nr];
+
+	// scattered zero pages in a file mapping: a mapping each, up to a limit
+	uint64_t n_pages = 2 * MEMORY_MAX_REMAPS + 4;
+	fd = open(file.c_str(), O_RDWR | O_TRUNC);
+	if (fd == -1 || ftruncate(fd, n_pages * page_size) == -1)
+		error_exit("zero_reclaimer: cannot resize %s", file.c_str());
+
+	memory *scattered = new memory(n_pages * page_size, true);
+	scattered -> map_file(fd, 0);
+	close(fd);
+
+	uint64_t n_released = 0;
+	for(uint64_t page=0; page<n_pages; page += 2)
+		n_released += scattered -> release(page * page_size, page_size);
+
+	if (n_released != MEMORY_MAX_REMAPS)
+		error_exit("zero_reclaimer: %llu scattered pages released", n_released);
+
+	delete scattered;
+
+	free_system(mb, m1, m2, m3, p);
+
+	unlink(file.c_str());
+}
+
+typedef struct
+{
+	fleet *f;
+	machine *m[2];
+} fleet_test_stop_t;
+
+static void *fleet_test_stop(void *arg)
+{
+	fleet_test_stop_t *s = (fleet_test_stop_t *)arg;
+
+	for(int nr=0; nr<2; nr++)
+	{
+		usleep(20000);
+		s -> f -> stop_machine(s -> m[nr]);
+	}
+
+	return NULL;
+}
+
+void test_fleet()
+{
+	dolog(" + test_fleet");
+	std::string log = format("/tmp/testcases-fleet-log.%d", getpid());
+	const int n = 5;
+	const uint64_t run = CPU_CLOCK_HZ / 20;	// 50ms guest time each
+	machine *m[n];
+	fleet *f = new fleet(2);
+
+	unlink(log.c_str());
+
+	for(int nr=0; nr<n; nr++)
+	{
+		machine_config_t cfg;
+		cfg.name = format("t%d", nr);
+		cfg.logfile = nr == 0 ? log : "";
+		cfg.prom_file = "ip24prom.070-9101-007.bin";
+		cfg.sram_file = format("/tmp/testcases-fleet-sram.%d.%d", getpid(), nr);
+
+		m[nr] = new machine(dc, cfg);
+
+		// the last one waits in an idle loop: lw t0,0x100(zero);
+		// beq t0,zero,0; nop, the others count: addiu t1,t1,1; b 0; nop
+		memory_bus *mb = m[nr] -> get_memory_bus();
+		if (nr == n - 1)
+			mb -> write_32b(0x00, make_cmd_I_TYPE(0, 8, 0x23, 0x100));
+		else
+			mb -> write_32b(0x00, make_cmd_I_TYPE(9, 9, 0x09, 1));
+		mb -> write_32b(0x04, make_cmd_I_TYPE(0, 8, 0x04, 0xfffe));
+
+		m[nr] -> get_processor() -> set_PC(0);
+
+		f -> add(m[nr], run);
+	}
+
+	// the machines are not shared with the test thread while they run
+	if (get_machine_context() == m[0] -> get_context())
+		error_exit("fleet: context of a machine is current");
+
+	std::atomic_bool stop(false);
+	double start_ts = get_ts();
+	f -> run(stop);
+	double took = get_ts() - start_ts;
+
+	for(int nr=0; nr<n; nr++)
+	{
+		processor *p = m[nr] -> get_processor();
+
+		if (p -> get_cycle_count() < run)
+			error_exit("fleet: machine %d stopped at %llu", nr, p -> get_cycle_count());
+
+		if ((nr == n - 1) != (p -> get_idle_cycles() > 0))
+			error_exit("fleet: machine %d was idle for %llu cycles", nr, p -> get_idle_cycles());
+	}
+
+	// 50ms guest time of the busy ones take 5 slices at least
+	if (f -> get_n_slices() < (n - 1) * (run / (FLEET_SLICE_US * (CPU_CLOCK_HZ / 1000000))))
+		error_exit("fleet: %llu slices", f -> get_n_slices());
+
+	// the idle one was parked, not run in a sleeping worker: it cannot
+	// finish before its guest time has passed for real
+	if (took < 0.04)
+		error_exit("fleet: done after %fs", took);
+
+	// a report every MACHINE_REPORT_S of guest time
+	set_machine_context(m[0] -> get_context());
+	m[0] -> get_processor() -> get_scheduler() -> run(uint64_t(MACHINE_REPORT_S) * CPU_CLOCK_HZ);
+	set_machine_context(NULL);
+
+	// the log of a machine goes where its context says, through the
+	// queue of its I/O thread
+	m[0] -> get_reactor() -> flush_log();
+
+	std::string contents;
+	FILE *fh = fopen(log.c_str(), "r");
+	if (fh)
+	{
+		char buffer[4096];
+		size_t rc = 0;
+
+		while((rc = fread(buffer, 1, sizeof buffer, fh)) > 0)
+			contents.append(buffer, rc);
+
+		fclose(fh);
+	}
+
+	if (contents.find("[t0] fleet: t0 done") == std::string::npos || contents.find("[t0] idle: ") == std::string::npos || contents.find("[t0] LG1: FIFO high water") == std::string::npos || contents.find("of the cycles in the last") == std::string::npos || contents.find("[t1]") != std::string::npos)
+		error_exit("fleet: log of t0 is \"%s\"", contents.substr(0, 200).c_str());
+
+	delete f;
+
+	// machines without an end, one running and one parked, stopped one
+	// by one from another thread
+	f = new fleet(1);
+	f -> add(m[0], 0);
+	f -> add(m[n - 1], 0);
+
+	fleet_test_stop_t s = { f, { m[0], m[n - 1] } };
+	pthread_t th;
+	pthread_create(&th, NULL, fleet_test_stop, &s);
+
+	start_ts = get_ts();
+	f -> run(stop);
+	took = get_ts() - start_ts;
+
+	pthread_join(th, NULL);
+
+	if (stop || took > 2.0)
+		error_exit("fleet: stopping the machines took %fs", took);
+
+	if (!m[0] -> get_context() -> terminate || !m[n - 1] -> get_context() -> terminate)
+		error_exit("fleet: terminate not set");
+
+	delete f;
+
+	for(int nr=0; nr<n; nr++)
+	{
+		delete m[nr];
+		unlink(format("/tmp/testcases-fleet-sram.%d.%d", getpid(), nr).c_str());
+	}
+
+	unlink(log.c_str());
+}
+
+void test_placement()
+{
+	dolog(" + test_placement");
+	std::vector<int> cpus;
+
+	if (!parse_cpu_list("0-3,8,10-11\n", &cpus) || cpus.size() != 7 || cpus[3] != 3 || cpus[4] != 8 || cpus[6] != 11)
+		error_exit("placement: cpu list parsed to %zu cores", cpus.size());
+
+	if (parse_cpu_list("3-1", &cpus) || parse_cpu_list("1,x", &cpus) || parse_cpu_list("", &cpus))
+		error_exit("placement: invalid cpu list accepted");
+
+	if (set_placement("cpu=0-1,io") || set_placement("gpu=1") || set_placement("cpu=a"))
+		error_exit("placement: invalid spec accepted");
+
+	// only cores this process may use: later tests run with this placement
+	cpu_set_t org;
+	if (sched_getaffinity(0, sizeof org, &org) == -1)
+		error_exit("placement: sched_getaffinity failed");
+
+	std::string allowed;
+	int first = -1;
+	for(int cpu=0; cpu<CPU_SETSIZE; cpu++)
+	{
+		if (!CPU_ISSET(cpu, &org))
+			continue;
+
+		if (first == -1)
+			first = cpu;
+
+		allowed += format("%s%d", allowed.empty() ? "" : ",", cpu);
+	}
+
+	if (!set_placement(format("cpu=%s,io=%d,render=%s", allowed.c_str(), first, allowed.c_str()).c_str()))
+		error_exit("placement: cannot set cpu=%s", allowed.c_str());
+
+	// the first core of the cpu role, as for fleet worker 0
+	place_thread(PLACE_CPU, "test", 0);
+
+	cpu_set_t now;
+	if (sched_getaffinity(0, sizeof now, &now) == -1 || CPU_COUNT(&now) != 1 || !CPU_ISSET(first, &now))
+		error_exit("placement: not pinned to core %d", first);
+
+	sched_setaffinity(0, sizeof org, &org);
+
+	// guest RAM follows the node of the cpu role
+	int node = cpu_to_node(first);
+	set_ram_node(PLACE_NODE_AUTO);
+
+	if (get_ram_node() != (node == -1 ? PLACE_NODE_NONE : node))
+		error_exit("placement: RAM on node %d, cores on %d", get_ram_node(), node);
+
+	// that of a fleet machine follows the core of its worker
+	int node1 = get_thread_node(PLACE_CPU, 1);
+	if (get_thread_node(PLACE_CPU, 0) != node || get_ram_node(1) != (node1 == -1 ? PLACE_NODE_NONE : node1))
+		error_exit("placement: RAM of worker 1 on node %d, its core on %d", get_ram_node(1), node1);
+
+	if (node != -1)
+	{
+		memory *m = new memory(1024 * 1024, true);
+		m -> set_node(node);
+
+		if (m -> get_node() != node)
+			error_exit("placement: memory not bound to node %d", node);
+
+		m -> write_32b(4096, 0x12345678);
+
+		int page_node = -1;
+		uint8_t *p = (uint8_t *)m -> get_data() + 4096;
+		if (syscall(SYS_get_mempolicy, &page_node, NULL, 0, p, MPOL_F_NODE | MPOL_F_ADDR) == -1 || page_node != node)
+			error_exit("placement: page on node %d instead of %d", page_node, node);
+
+		delete m;
+	}
+
+	set_ram_node(PLACE_NODE_NONE);
+
+	std::vector<std::string> report = placement_report();
+	if (report.size() != PLACE_N_ROLES + 1 || report[PLACE_N_ROLES] != "guest RAM: not bound")
+		error_exit("placement: report ends with \"%s\"", report.back().c_str());
+}
+
+typedef struct
+{
+	std::atomic_int n_reads, n_timer, n_requests;
+	pthread_t requested_on;
+} reactor_test_t;
+
+static void reactor_test_read(void *ctx, int fd, uint32_t events)
+{
+	char buffer[16];
+
+	if (read(fd, buffer, sizeof buffer) > 0)
+		((reactor_test_t *)ctx) -> n_reads++;
+}
+
+static void reactor_test_timer(void *ctx)
+{
+	((reactor_test_t *)ctx) -> n_timer++;
+}
+
+static void reactor_test_request(void *ctx)
+{
+	reactor_test_t *rt = (reactor_test_t *)ctx;
+
+	rt -> requested_on = pthread_self();
+	rt -> n_requests++;
+}
+
+void test_io_reactor()
+{
+	dolog(" + test_io_reactor");
+
+	reactor_test_t rt;
+	rt.n_reads = rt.n_timer = rt.n_requests = 0;
+	rt.requested_on = pthread_self();
+
+	io_reactor *io = new io_reactor("test");
+
+	// host descriptors are served by the I/O thread
+	int fds[2];
+	if (pipe(fds) == -1)
+		error_exit("io_reactor: pipe failed");
+
+	io -> add(fds[0], EPOLLIN, reactor_test_read, &rt);
+
+	if (write(fds[1], "x", 1) != 1)
+		error_exit("io_reactor: write failed");
+
+	double start_ts = get_ts();
+	while(rt.n_reads == 0 && get_ts() - start_ts < 5.0)
+		usleep(1000);
+
+	if (rt.n_reads != 1)
+		error_exit("io_reactor: %d reads", int(rt.n_reads));
+
+	io -> remove(fds[0]);
+
+	// after remove() the handler is not called anymore
+	if (write(fds[1], "y", 1) != 1)
+		error_exit("io_reactor: write failed");
+
+	usleep(20000);
+
+	if (rt.n_reads != 1)
+		error_exit("io_reactor: handler called after remove()");
+
+	// periodic timers
+	io -> add_timer(1000, reactor_test_timer, &rt);
+
+	start_ts = get_ts();
+	while(rt.n_timer < 5 && get_ts() - start_ts < 5.0)
+		usleep(1000);
+
+	io -> remove_timer(reactor_test_timer, &rt);
+	int n_timer = rt.n_timer;
+
+	if (n_timer < 5)
+		error_exit("io_reactor: timer ran %d times", n_timer);
+
+	usleep(20000);
+
+	if (rt.n_timer != n_timer)
+		error_exit("io_reactor: timer ran after remove_timer()");
+
+	// requests of the emulation thread run on the I/O thread
+	for(int nr=0; nr<3; nr++)
+		io -> request(reactor_test_request, &rt);
+
+	start_ts = get_ts();
+	while(rt.n_requests < 3 && get_ts() - start_ts < 5.0)
+		usleep(1000);
+
+	if (rt.n_requests != 3 || pthread_equal(rt.requested_on, pthread_self()))
+		error_exit("io_reactor: %d requests", int(rt.n_requests));
+
+	// a full queue is not waited for nor run here: the request is dropped
+	int n_accepted = 0;
+	for(int nr=0; nr<REACTOR_REQUESTS * 4; nr++)
+		n_accepted += io -> request(reactor_test_request, &rt);
+
+	start_ts = get_ts();
+	while(rt.n_requests < 3 + n_accepted && get_ts() - start_ts < 5.0)
+		usleep(1000);
+
+	if (rt.n_requests != 3 + n_accepted || n_accepted + io -> get_n_requests_dropped() != REACTOR_REQUESTS * 4 || pthread_equal(rt.requested_on, pthread_self()))
+		error_exit("io_reactor: %d of %d requests run, %llu dropped", int(rt.n_requests) - 3, n_accepted, io -> get_n_requests_dropped());
+
+	// the log lines of a machine go through the queue, also when it is
+	// full, and none is lost
+	std::string log = format("/tmp/testcases-reactor-log.%d", getpid());
+	unlink(log.c_str());
+
+	machine_context ctx("r", log);
+	ctx.reactor = io;
+	set_machine_context(&ctx);
+
+	const int n_lines = REACTOR_LOG_LINES * 2 + 10;
+	for(int nr=0; nr<n_lines; nr++)
+		dolog("line %d", nr);
+
+	set_machine_context(NULL);
+
+	io -> flush_log();
+
+	FILE *fh = fopen(log.c_str(), "r");
+	if (!fh)
+		error_exit("io_reactor: no log file");
+
+	// the thread may not have kept up: lines are dropped then, never
+	// reordered, and a note says how many are missing
+	char buffer[256];
+	int n_found = 0, next = 0;
+	unsigned long long n_noted = 0;
+	while(fgets(buffer, sizeof buffer, fh))
+	{
+		int nr = -1;
+
+		if (sscanf(buffer, "io_reactor: %llu log lines dropped", &n_noted) == 1)
+		{
+			next += n_noted;
+			continue;
+		}
+
+		if (sscanf(buffer, "[r] line %d", &nr) != 1 || nr != next)
+			error_exit("io_reactor: log line %d is \"%s\"", next, buffer);
+
+		n_found++;
+		next++;
+	}
+
+	fclose(fh);
+
+	if (n_found + io -> get_n_log_dropped() != uint64_t(n_lines))
+		error_exit("io_reactor: %d of %d log lines, %llu dropped", n_found, n_lines, io -> get_n_log_dropped());
+
+	delete io;
+
+	close(fds[0]);
+	close(fds[1]);
+	unlink(log.c_str());
+}
+
+typedef struct
+{
+	std::atomic_int n_work;
+	int n_done;
+	uint64_t done_at;
+	pthread_t worked_on;
+} device_test_t;
+
+static void device_test_work(void *ctx)
+{
+	device_test_t *dt = (device_test_t *)ctx;
+
+	dt -> worked_on = pthread_self();
+	dt -> n_work++;
+}
+
+static void device_test_done(void *ctx, uint64_t now)
+{
+	device_test_t *dt = (device_test_t *)ctx;
+
+	dt -> n_done++;
+	dt -> done_at = now;
+}
+
+void test_device_thread()
+{
+	dolog(" + test_device_thread");
+	memory_bus *mb = NULL;
+	memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+	processor *p = NULL;
+	create_system(&mb, &m1, &m2, &m3, &p);
+
+	scheduler *s = p -> get_scheduler();
+	const uint64_t quantum = 1000;
+
+	device_thread *dt = new device_thread(p, quantum);
+	p -> set_device_thread(dt);
+
+	// posted in quantum 0: runs during quantum 1, done at its end
+	device_test_t t;
+	t.n_work = 0;
+	t.n_done = 0;
+	t.done_at = 0;
+	t.worked_on = pthread_self();
+
+	dt -> post(device_test_work, device_test_done, &t);
+
+	if (s -> get_next_event() != quantum)
+		error_exit("device thread: boundary at %llu, expected %llu", s -> get_next_event(), quantum);
+
+	s -> run(quantum);
+
+	if (t.n_done != 0 || s -> get_next_event() != 2 * quantum)
+		error_exit("device thread: job done after one quantum");
+
+	s -> run(2 * quantum);
+
+	if (t.n_work != 1 || t.n_done != 1 || t.done_at != 2 * quantum)
+		error_exit("device thread: %d works, %d dones at %llu", int(t.n_work), t.n_done, t.done_at);
+
+	if (pthread_equal(t.worked_on, pthread_self()))
+		error_exit("device thread: work ran on the processor thread");
+
+	if (s -> get_next_event() != UINT64_MAX || !dt -> idle())
+		error_exit("device thread: boundary left without jobs");
+
+	// a rendezvous completes everything at once
+	dt -> post(device_test_work, device_test_done, &t);
+	dt -> sync(p -> get_cycle_count());
+
+	if (t.n_work != 2 || t.n_done != 2 || dt -> get_n_syncs() != 1 || s -> get_next_event() != UINT64_MAX)
+		error_exit("device thread: sync did not complete the job");
+
+	// PBUS DMA: a receive (HAL2: silence) into plain memory is copied there
+	std::string sram = format("/tmp/testcases-sram.%d", getpid());
+	hpc3 *h = new hpc3(dc, p, sram);
+
+	const uint32_t n = 4096;
+	for(uint32_t index=0; index<n; index += 4)
+		mb -> write_32b(0x2000 + index, 0xffffffff);
+
+	mb -> write_32b(0x1000, 0x2000);
+	mb -> write_32b(0x1004, n | PBUS_DESC_EOX | PBUS_DESC_XIE);
+	mb -> write_32b(0x1008, 0);
+
+	const uint64_t channel = 0x80000 + 3 * 0x2000;
+	h -> write_32b(channel + PBUS_DMA_DP, 0x1000);
+	h -> write_32b(channel + PBUS_DMA_CTRL, PBUS_DMA_CTRL_ACT | PBUS_DMA_CTRL_RECEIVE);
+
+	uint64_t now = p -> get_cycle_count();
+	s -> run(now);
+
+	uint64_t writes = mb -> get_n_writes();
+
+	s -> run(quantum);
+	s -> run(2 * quantum);
+
+	if (mb -> get_n_writes() != writes + 1)
+		error_exit("device thread: DMA write not counted");
+
+	uint32_t temp_32b = 0;
+	for(uint32_t index=0; index<n; index += 4)
+	{
+		mb -> read_32b(0x2000 + index, &temp_32b);
+		if (temp_32b)
+			error_exit("device thread: %08x at %08x after receive DMA", temp_32b, 0x2000 + index);
+	}
+
+	h -> read_32b(channel + PBUS_DMA_BP, &temp_32b);
+	if (temp_32b != 0x2000 + n)
+		error_exit("device thread: buffer pointer %08x after DMA", temp_32b);
+
+	h -> read_32b(channel + PBUS_DMA_CTRL, &temp_32b);
+	if ((temp_32b & PBUS_DMA_CTRL_ACT) || !(temp_32b & PBUS_DMA_CTRL_INT))
+		error_exit("device thread: ctrl %08x at end of chain", temp_32b);
+
+	// the driver looks at the channel before the boundary: synchronised
+	uint64_t syncs = dt -> get_n_syncs();
+
+	h -> write_32b(channel + PBUS_DMA_DP, 0x1000);
+	h -> write_32b(channel + PBUS_DMA_CTRL, PBUS_DMA_CTRL_ACT | PBUS_DMA_CTRL_RECEIVE);
+	s -> run(p -> get_cycle_count());
+
+	h -> read_32b(channel + PBUS_DMA_CTRL, &temp_32b);
+	if ((temp_32b & PBUS_DMA_CTRL_ACT) || !(temp_32b & PBUS_DMA_CTRL_INT) || dt -> get_n_syncs() != syncs + 1)
+		error_exit("device thread: ctrl %08x, channel not synchronised", temp_32b);
+
+	if (s -> get_next_event() != UINT64_MAX)
+		error_exit("device thread: events left after the DMA");
+
+	delete dt;
+	p -> set_device_thread(NULL);
+
+	delete h;
+	unlink(sram.c_str());
+
+	free_system(mb, m1, m2, m3, p);
+}
+
+static void hostcall_test_ring(memory_bus *mb, hostcall *h, uint32_t op, uint32_t handle, uint32_t len, uint64_t offset, uint32_t buf, uint32_t arg)
+{
+	const uint32_t ring = 0x10000;
+	uint32_t head = 0;
+	mb -> read_32b(ring + HC_RING_HEAD, &head);
+
+	uint32_t desc = ring + HC_RING_DESC + (head & 3) * HC_DESC_SIZE;
+	mb -> write_32b(desc + HC_DESC_OP, op);
+	mb -> write_32b(desc + HC_DESC_RESULT, 0x12345678);
+	mb -> write_32b(desc + HC_DESC_HANDLE, handle);
+	mb -> write_32b(desc + HC_DESC_LEN, len);
+	mb -> write_32b(desc + HC_DESC_OFFSET_HI, offset >> 32);
+	mb -> write_32b(desc + HC_DESC_OFFSET_LO, offset);
+	mb -> write_32b(desc + HC_DESC_BUF, buf);
+	mb -> write_32b(desc + HC_DESC_ARG, arg);
+
+	mb -> write_32b(ring + HC_RING_HEAD, head + 1);
+	h -> write_32b(HC_REG_DOORBELL, 0);
+}
+
+// runs the scheduler like the processor would until the tail reaches head
+static int32_t hostcall_test_wait(memory_bus *mb, processor *p)
+{
+	const uint32_t ring = 0x10000;
+	uint32_t head = 0, tail = 0, result = 0;
+	mb -> read_32b(ring + HC_RING_HEAD, &head);
+
+	double start_ts = get_ts();
+	for(;;)
+	{
+		mb -> read_32b(ring + HC_RING_TAIL, &tail);
+		if (tail == head)
+			break;
+
+		if (get_ts() - start_ts > 5.0)
+			error_exit("hostcall: tail %u, head %u", tail, head);
+
+		if (p -> get_scheduler() -> get_next_event() <= p -> get_cycle_count())
+			p -> get_scheduler() -> run(p -> get_cycle_count());
+		else
+			usleep(100);
+	}
+
+	mb -> read_32b(ring + HC_RING_DESC + ((head - 1) & 3) * HC_DESC_SIZE + HC_DESC_RESULT, &result);
+
+	return result;
+}
+
+static int32_t hostcall_test_call(memory_bus *mb, processor *p, hostcall *h, uint32_t op, uint32_t handle, uint32_t len, uint64_t offset, uint32_t buf, uint32_t arg)
+{
+	hostcall_test_ring(mb, h, op, handle, len, offset, buf, arg);
+
+	return hostcall_test_wait(mb, p);
+}
+
+void test_hostcall()
+{
+	dolog(" + test_hostcall");
+	memory_bus *mb = NULL;
+	memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+	processor *p = NULL;
+	create_system(&mb, &m1, &m2, &m3, &p);
+
+	char dir[] = "/tmp/testcases-hostcall.XXXXXX";
+	if (!mkdtemp(dir))
+		error_exit("hostcall: mkdtemp failed");
+
+	// the file I/O goes to the I/O thread
+	io_reactor *io = new io_reactor("hostcall");
+	hostcall *h = new hostcall(dc, p, io, NULL, dir);
+	const uint64_t base = 0xffffffffbf600000;
+	mb -> register_memory(base, h -> get_size(), h);
+
+	uint32_t temp_32b = 0;
+	mb -> read_32b(base + HC_REG_ID, &temp_32b);
+	if (temp_32b != HC_ID)
+		error_exit("hostcall: id %08x", temp_32b);
+
+	// a ring of 4 slots: the calls below wrap around a few times
+	mb -> write_32b(0x10000 + HC_RING_HEAD, 0);
+	mb -> write_32b(0x10000 + HC_RING_TAIL, 0);
+	mb -> write_32b(base + HC_REG_RING, 0x10000);
+	mb -> write_32b(base + HC_REG_ENTRIES, 4);
+
+	const char name[] = "data.bin";
+	mb -> write_block(0x20000, (const uint8_t *)name, strlen(name));
+
+	mb -> write_32b(base + HC_REG_IRQ_ENABLE, 1);
+
+	// the results only come in at a scheduler run, not in the doorbell
+	// store
+	hostcall_test_ring(mb, h, HC_OP_OPEN, 0, strlen(name), 0, 0x20000, HC_O_READ | HC_O_WRITE | HC_O_CREATE | HC_O_TRUNCATE);
+	uint32_t tail_before = 0;
+	mb -> read_32b(0x10000 + HC_RING_TAIL, &tail_before);
+	if (tail_before != 0)
+		error_exit("hostcall: tail %u before the scheduler ran", tail_before);
+
+	int32_t handle = hostcall_test_wait(mb, p);
+	if (handle < 0)
+		error_exit("hostcall: open returned %d", handle);
+
+	mb -> read_32b(base + HC_REG_IRQ_STATUS, &temp_32b);
+	if (temp_32b != 1)
+		error_exit("hostcall: no completion interrupt");
+
+	mb -> write_32b(base + HC_REG_IRQ_STATUS, 0);
+	mb -> read_32b(base + HC_REG_IRQ_STATUS, &temp_32b);
+	if (temp_32b != 0)
+		error_exit("hostcall: interrupt not acknowledged");
+
+	// more than one chunk
+	const uint32_t n = 100000;
+	for(uint32_t index=0; index<n; index++)
+		mb -> write_8b(0x30000 + index, index * 7);
+
+	int32_t rc = hostcall_test_call(mb, p, h, HC_OP_WRITE, handle, n, 0, 0x30000, 0);
+	if (rc != int32_t(n))
+		error_exit("hostcall: write returned %d", rc);
+
+	unsigned char *data = NULL;
+	uint64_t len = 0;
+	std::string file = format("%s/%s", dir, name);
+	load_file(file, &data, &len);
+
+	if (len != n || data[0] != 0 || data[n - 1] != uint8_t((n - 1) * 7))
+		error_exit("hostcall: host file is %llu bytes", len);
+
+	delete [] data;
+
+	rc = hostcall_test_call(mb, p, h, HC_OP_READ, handle, n, 0, 0x50000, 0);
+	if (rc != int32_t(n))
+		error_exit("hostcall: read returned %d", rc);
+
+	for(uint32_t index=0; index<n; index++)
+	{
+		uint8_t temp_8b = 0;
+		mb -> read_8b(0x50000 + index, &temp_8b);
+		if (temp_8b != uint8_t(index * 7))
+			error_exit("hostcall: byte %u read back as %02x", index, temp_8b);
+	}
+
+	// a snapshot or the zero reclaimer does not see a batch half done
+	hostcall_test_ring(mb, h, HC_OP_READ, handle, 4, 0, 0x60000, 0);
+	p -> sync_devices();
+
+	uint32_t sync_head = 0, sync_tail = 0;
+	mb -> read_32b(0x10000 + HC_RING_HEAD, &sync_head);
+	mb -> read_32b(0x10000 + HC_RING_TAIL, &sync_tail);
+	mb -> read_32b(0x60000, &temp_32b);
+	if (sync_tail != sync_head || temp_32b != 0x00070e15)
+		error_exit("hostcall: after sync_devices, tail %u, head %u, data %08x", sync_tail, sync_head, temp_32b);
+
+	// and the completion that was posted is gone
+	if (hostcall_test_wait(mb, p) != 4 || h -> get_n_served() != 4)
+		error_exit("hostcall: batch completed twice, %u served", h -> get_n_served());
+
+	rc = hostcall_test_call(mb, p, h, HC_OP_READ, handle, 100, n - 10, 0x50000, 0);
+	if (rc != 10)
+		error_exit("hostcall: read at the end returned %d", rc);
+
+	rc = hostcall_test_call(mb, p, h, HC_OP_SIZE, handle, 0, 0, 0x40000, 0);
+	uint32_t hi = 0, lo = 0;
+	mb -> read_32b(0x40000, &hi);
+	mb -> read_32b(0x40004, &lo);
+	if (rc != 0 || hi != 0 || lo != n)
+		error_exit("hostcall: size returned %d, %08x%08x", rc, hi, lo);
+
+	// errors
+	const char escape[] = "sub/../../x";
+	mb -> write_block(0x20000, (const uint8_t *)escape, strlen(escape));
+	if ((rc = hostcall_test_call(mb, p, h, HC_OP_OPEN, 0, strlen(escape), 0, 0x20000, HC_O_READ)) != HC_EPERM)
+		error_exit("hostcall: opening %s returned %d", escape, rc);
+
+	if ((rc = hostcall_test_call(mb, p, h, HC_OP_OPEN, 0, 3, 0, 0x20000, HC_O_READ)) != HC_ENOENT)
+		error_exit("hostcall: opening a missing file returned %d", rc);
+
+	if ((rc = hostcall_test_call(mb, p, h, HC_OP_READ, HC_MAX_HANDLES + 1, 10, 0, 0x50000, 0)) != HC_EBADF)
+		error_exit("hostcall: read from an invalid handle returned %d", rc);
+
+	if ((rc = hostcall_test_call(mb, p, h, HC_OP_READ, handle, 10, 0, 0x5000000, 0)) != HC_EFAULT)
+		error_exit("hostcall: read to unmapped memory returned %d", rc);
+
+	if ((rc = hostcall_test_call(mb, p, h, 99, 0, 0, 0, 0, 0)) != HC_ENOSYS)
+		error_exit("hostcall: unknown operation returned %d", rc);
+
+	// the clock
+	uint64_t t[2];
+	for(int nr=0; nr<2; nr++)
+	{
+		if (hostcall_test_call(mb, p, h, HC_OP_CLOCK, 0, 0, 0, 0x40000, 0) != 0)
+			error_exit("hostcall: clock failed");
+
+		mb -> read_32b(0x40000, &hi);
+		mb -> read_32b(0x40004, &lo);
+		t[nr] = (uint64_t(hi) << 32) | lo;
+	}
+
+	if (t[0] == 0 || t[1] < t[0])
+		error_exit("hostcall: clock %llu, then %llu", t[0], t[1]);
+
+	// console output goes through a serial_output
+	int fds[2];
+	if (pipe(fds) == -1)
+		error_exit("hostcall: pipe failed");
+
+	serial_output *so = new serial_output(io, fds[1]);
+	h -> set_console(so, NULL);
+
+	const char hello[] = "hello";
+	mb -> write_block(0x20000, (const uint8_t *)hello, 5);
+	if ((rc = hostcall_test_call(mb, p, h, HC_OP_CONSOLE_WRITE, 0, 5, 0, 0x20000, 0)) != 5)
+		error_exit("hostcall: console write returned %d", rc);
+
+	if ((rc = hostcall_test_call(mb, p, h, HC_OP_CONSOLE_READ, 0, 5, 0, 0x20000, 0)) != 0)
+		error_exit("hostcall: console read without input returned %d", rc);
+
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+	std::string out;
+	double start_ts = get_ts();
+	while(out.size() < 5 && get_ts() - start_ts < 2.0)
+	{
+		char buffer[16];
+		ssize_t got = read(fds[0], buffer, sizeof buffer);
+		if (got > 0)
+			out.append(buffer, got);
+		else
+			usleep(1000);
+	}
+
+	if (out != "hello")
+		error_exit("hostcall: console got \"%s\"", out.c_str());
+
+	h -> set_console(NULL, NULL);
+	delete so;
+	close(fds[0]);
+	close(fds[1]);
+
+	if (hostcall_test_call(mb, p, h, HC_OP_CLOSE, handle, 0, 0, 0, 0) != 0 || hostcall_test_call(mb, p, h, HC_OP_CLOSE, handle, 0, 0, 0, 0) != HC_EBADF)
+		error_exit("hostcall: close");
+
+	mb -> read_32b(base + HC_REG_DOORBELL, &temp_32b);
+	if (temp_32b != h -> get_n_served() || temp_32b != 17)
+		error_exit("hostcall: %u requests served", temp_32b);
+
+	// without an I/O thread all of it is done in the doorbell store
+	delete h;
+	h = new hostcall(dc, p, NULL, NULL, dir);
+	h -> write_32b(HC_REG_RING, 0x10000);
+	h -> write_32b(HC_REG_ENTRIES, 4);
+
+	uint32_t head = 0, tail = 0;
+	mb -> write_block(0x20000, (const uint8_t *)name, strlen(name));
+	hostcall_test_ring(mb, h, HC_OP_OPEN, 0, strlen(name), 0, 0x20000, HC_O_READ);
+	mb -> read_32b(0x10000 + HC_RING_HEAD, &head);
+	mb -> read_32b(0x10000 + HC_RING_TAIL, &tail);
+	if (tail != head || hostcall_test_wait(mb, p) != 0)
+		error_exit("hostcall: inline open, tail %u, head %u", tail, head);
+
+	delete h;
+	delete io;
+	unlink(file.c_str());
+	rmdir(dir);
+
+	free_system(mb, m1, m2, m3, p);
+}
+
+void arcs_test_halt(void *ctx)
+{
+	(*(int *)ctx)++;
+}
+
+void test_arcs()
+{
+	dolog(" + test_arcs");
+	memory_bus *mb = NULL;
+	memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+	processor *p = NULL;
+	create_system(&mb, &m1, &m2, &m3, &p);
+
+	// a kernel at 0x80010000 that uses the firmware vector
+	const uint32_t code[] = {
+		make_cmd_I_TYPE(0, 8, 0x0f, 0xa000),		// lui t0,0xa000
+		make_cmd_I_TYPE(8, 9, 0x23, 0x1020),		// lw t1,0x1020(t0): firmware vector
+		make_cmd_I_TYPE(9, 10, 0x23, ARCS_WRITE * 4),	// lw t2,Write(t1)
+		make_cmd_I_TYPE(0, 4, 0x09, ARCS_STDOUT),	// addiu a0,zero,1
+		make_cmd_I_TYPE(0, 5, 0x0f, 0x8001),		// a1: "hello"
+		make_cmd_I_TYPE(5, 5, 0x0d, 0x0100),
+		make_cmd_I_TYPE(0, 6, 0x09, 5),
+		make_cmd_I_TYPE(0, 7, 0x0f, 0x8001),		// a3: count
+		make_cmd_I_TYPE(7, 7, 0x0d, 0x0200),
+		(10 << 21) | (31 << 11) | 9,			// jalr t2
+		0,
+		make_cmd_I_TYPE(0, 11, 0x0f, 0x8001),		// lui t3,0x8001
+		make_cmd_I_TYPE(11, 2, 0x2b, 0x0300),		// sw v0,0x300(t3)
+		make_cmd_I_TYPE(9, 10, 0x23, ARCS_GET_ENV * 4),
+		make_cmd_I_TYPE(0, 4, 0x0f, 0x8001),		// a0: "foo"
+		make_cmd_I_TYPE(4, 4, 0x0d, 0x0110),
+		(10 << 21) | (31 << 11) | 9,
+		0,
+		make_cmd_I_TYPE(11, 2, 0x2b, 0x0304),
+		make_cmd_I_TYPE(9, 10, 0x23, ARCS_GET_MEMORY_DESC * 4),
+		make_cmd_I_TYPE(0, 4, 0x09, 0),			// the first one
+		(10 << 21) | (31 << 11) | 9,
+		0,
+		make_cmd_I_TYPE(11, 2, 0x2b, 0x0308),
+		make_cmd_I_TYPE(9, 10, 0x23, ARCS_HALT * 4),
+		(10 << 21) | (31 << 11) | 9,
+		0,
+		make_cmd_I_TYPE(0, 0, 0x04, 0xffff),		// not reached
+		0
+	};
+
+	std::vector<uint8_t> elf(0x100 + 0x400);
+
+	Elf32_Ehdr *eh = (Elf32_Ehdr *)elf.data();
+	memcpy(eh -> e_ident, ELFMAG, SELFMAG);
+	eh -> e_ident[EI_CLASS] = ELFCLASS32;
+	eh -> e_ident[EI_DATA] = ELFDATA2MSB;
+	eh -> e_ident[EI_VERSION] = EV_CURRENT;
+	eh -> e_type = htobe16(ET_EXEC);
+	eh -> e_machine = htobe16(EM_MIPS);
+	eh -> e_version = htobe32(EV_CURRENT);
+	eh -> e_entry = htobe32(0x80010000);
+	eh -> e_phoff = htobe32(sizeof(Elf32_Ehdr));
+	eh -> e_ehsize = htobe16(sizeof(Elf32_Ehdr));
+	eh -> e_phentsize = htobe16(sizeof(Elf32_Phdr));
+	eh -> e_phnum = htobe16(1);
+
+	Elf32_Phdr *ph = (Elf32_Phdr *)&elf[sizeof(Elf32_Ehdr)];
+	ph -> p_type = htobe32(PT_LOAD);
+	ph -> p_offset = htobe32(0x100);
+	ph -> p_vaddr = htobe32(0x80010000);
+	ph -> p_filesz = htobe32(0x400);
+	ph -> p_memsz = htobe32(0x1000);
+
+	for(size_t index=0; index<sizeof code / sizeof code[0]; index++)
+	{
+		uint32_t word = htobe32(code[index]);
+		memcpy(&elf[0x100 + index * 4], &word, 4);
+	}
+
+	memcpy(&elf[0x200], "hello", 5);
+	memcpy(&elf[0x210], "foo", 4);
+
+	std::string file = format("/tmp/testcases-kernel.%d.elf", getpid());
+	FILE *fh = fopen(file.c_str(), "wb");
+	if (!fh || fwrite(elf.data(), 1, elf.size(), fh) != elf.size())
+		error_exit("arcs: cannot write %s", file.c_str());
+	fclose(fh);
+
+	int fds[2];
+	if (pipe(fds) == -1)
+		error_exit("arcs: pipe failed");
+
+	io_reactor *io = new io_reactor("arcs");
+	serial_output *so = new serial_output(io, fds[1]);
+
+	int n_halts = 0;
+	arcs *fw = new arcs(dc, p, m1, 0);
+	fw -> add_ram(0, 512 * 1024);
+	fw -> set_console(so, NULL);
+	fw -> set_halt_callback(arcs_test_halt, &n_halts);
+
+	std::vector<std::string> args;
+	args.push_back("foo=bar");
+	fw -> boot(file, args);
+
+	if (p -> get_PC() != 0xffffffff80010000ll || p -> get_register_32b_unsigned(4) != 2)
+		error_exit("arcs: entered at %016llx with argc %d", p -> get_PC(), p -> get_register_32b_unsigned(4));
+
+	uint32_t temp_32b = 0;
+	mb -> read_32b(0xffffffffa0001000ll, &temp_32b);
+	if (temp_32b != ARCS_SPB_SIGNATURE)
+		error_exit("arcs: SPB signature %08x", temp_32b);
+
+	// argv[1]
+	mb -> read_32b(int32_t(p -> get_register_32b_unsigned(5)) + 4, &temp_32b);
+	uint8_t arg[8] = { 0 };
+	mb -> read_block(int32_t(temp_32b), arg, 7);
+	if (memcmp(arg, "foo=bar", 8))
+		error_exit("arcs: argv[1] is \"%s\"", arg);
+
+	for(int nr=0; nr<200 && n_halts == 0; nr++)
+		p -> tick();
+
+	// halted: waits in the stub, but guest time goes on
+	uint64_t halt_cycles = p -> get_cycle_count();
+	p -> tick();
+	p -> tick();
+
+	if (n_halts != 3 || (p -> get_PC() & 0xffffffff) != 0x80000000 + ARCS_STUBS + ARCS_HALT * ARCS_STUB_SIZE)
+		error_exit("arcs: not halted (%d), PC %016llx", n_halts, p -> get_PC());
+
+	if (p -> get_cycle_count() < halt_cycles + 2 * HLE_WAIT_CYCLES)
+		error_exit("arcs: %llu cycles while halted", p -> get_cycle_count() - halt_cycles);
+
+	mb -> read_32b(0xffffffff80010200ll, &temp_32b);
+	if (temp_32b != 5)
+		error_exit("arcs: Write wrote %u bytes", temp_32b);
+
+	mb -> read_32b(0xffffffff80010300ll, &temp_32b);
+	if (temp_32b != ARCS_ESUCCESS)
+		error_exit("arcs: Write returned %u", temp_32b);
+
+	// GetEnvironmentVariable
+	mb -> read_32b(0xffffffff80010304ll, &temp_32b);
+	uint8_t value[4] = { 0 };
+	if (temp_32b)
+		mb -> read_block(int32_t(temp_32b), value, 4);
+	if (memcmp(value, "bar", 4))
+		error_exit("arcs: foo is \"%s\" (%08x)", value, temp_32b);
+
+	// the memory map: firmware pages, the kernel, the stack, the rest free
+	const uint32_t expected[][3] = {
+		{ ARCS_MEM_EXCEPTION_BLOCK, 0x00, 1 },
+		{ ARCS_MEM_SPB, 0x01, 1 },
+		{ ARCS_MEM_FREE, 0x02, 0x0e },
+		{ ARCS_MEM_LOADED_PROGRAM, 0x10, 1 },
+		{ ARCS_MEM_FREE, 0x11, 0x5f },
+		{ ARCS_MEM_FIRMWARE_TEMPORARY, 0x70, 0x10 }
+	};
+
+	mb -> read_32b(0xffffffff80010308ll, &temp_32b);
+	for(int nr=0; nr<6; nr++)
+	{
+		uint32_t d[3] = { 0 };
+		for(int field=0; field<3; field++)
+			mb -> read_32b(int32_t(temp_32b) + nr * ARCS_MEM_DESC_SIZE + field * 4, &d[field]);
+
+		if (d[0] != expected[nr][0] || d[1] != expected[nr][1] || d[2] != expected[nr][2])
+			error_exit("arcs: memory descriptor %d is %u %x %x", nr, d[0], d[1], d[2]);
+	}
+
+	// Write, GetEnvironmentVariable, GetMemoryDescriptor, then Halt for
+	// as long as it ticks
+	if (fw -> get_n_calls() < 4)
+		error_exit("arcs: %llu calls", fw -> get_n_calls());
+
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+	std::string out;
+	double start_ts = get_ts();
+	while(out.size() < 5 && get_ts() - start_ts < 2.0)
+	{
+		char buffer[16];
+		ssize_t got = read(fds[0], buffer, sizeof buffer);
+		if (got > 0)
+			out.append(buffer, got);
+		else
+			usleep(1000);
+	}
+
+	if (out != "hello")
+		error_exit("arcs: console got \"%s\"", out.c_str());
+
+	fw -> set_console(NULL, NULL);
+	delete fw;
+	delete so;
+	delete io;
+	close(fds[0]);
+	close(fds[1]);
+	unlink(file.c_str());
+
+	free_system(mb, m1, m2, m3, p);
+}
+
+void test_pbus_dma_hal2()
+{
+	dolog(" + test_pbus_dma_hal2");
+	memory_bus *mb = NULL;
+	memory *m1 = NULL, *m2 = NULL, *m3 = NULL;
+	processor *p = NULL;
+	create_system(&mb, &m1, &m2, &m3, &p);
+
+	std::string sram = format("/tmp/testcases-sram.%d", getpid());
+	std::string wav = format("/tmp/testcases-audio.%d.wav", getpid());
+
+	hpc3 *h = new hpc3(dc, p, sram);
+	audio_sink *as = new audio_sink(wav);
+	h -> get_hal2() -> set_sink(as);
+
+	// 48kHz stereo on PBUS DMA channel 2
+	const uint64_t hal2_base = 0xd8000;
+	h -> write_32b(hal2_base + HAL2_ISR, HAL2_ISR_GLOBAL_RESET_N | HAL2_ISR_CODEC_RESET_N);
+
+	const uint32_t iregs[][2] = {
+		{ HAL2_I_BRES1_C1, 0 },
+		{ HAL2_I_BRES1_C2, 0xffff0001 },	// inc 1, mod 1
+		{ HAL2_I_DAC_C1, 2 | (1 << 3) | (2 << 8) },
+		{ HAL2_I_DMA_PORT_EN, HAL2_DMA_PORT_EN_CODECTX }
+	};
+
+	for(size_t index=0; index<sizeof iregs / sizeof iregs[0]; index++)
+	{
+		h -> write_32b(hal2_base + HAL2_IDR0, iregs[index][1] & 0xffff);
+		h -> write_32b(hal2_base + HAL2_IDR1, iregs[index][1] >> 16);
+		h -> write_32b(hal2_base + HAL2_IAR, iregs[index][0]);
+	}
+
+	// two descriptors of 25ms each
+	const uint32_t n = 4800;
+	mb -> write_32b(0x1000, 0x2000);
+	mb -> write_32b(0x1004, n);
+	mb -> write_32b(0x1008, 0x100c);
+	mb -> write_32b(0x100c, 0x4000);
+	mb -> write_32b(0x1010, n | PBUS_DESC_EOX | PBUS_DESC_XIE);
+	mb -> write_32b(0x1014, 0);
+
+	mb -> write_16b(0x2000, 0x1234);
+	mb -> write_16b(0x4000 + n - 2, 0x5678);
+
+	const uint64_t channel = 0x80000 + 2 * 0x2000;
+	h -> write_32b(channel + PBUS_DMA_DP, 0x1000);
+	h -> write_32b(channel + PBUS_DMA_CTRL, PBUS_DMA_CTRL_ACT);
+
+	// the first descriptor is moved by the next event, the second one
+	// when the first would have been played
+	scheduler *s = p -> get_scheduler();
+	uint64_t now = p -> get_cycle_count();
+	if (s -> get_next_event() != now)
+		error_exit("pbus dma: no event for the start of the DMA");
+
+	s -> run(now);
+
+	uint64_t expected = now + uint64_t(CPU_CLOCK_HZ) / 40;
+	if (s -> get_next_event() != expected)
+		error_exit("pbus dma: next descriptor at %llu, expected %llu", s -> get_next_event(), expected);
+
+	uint32_t temp_32b = 0;
+	h -> read_32b(channel + PBUS_DMA_DP, &temp_32b);
+	if (temp_32b != 0x100c)
+		error_exit("pbus dma: descriptor pointer %08x after first descriptor", temp_32b);
+
+	s -> run(expected);
+
+	h -> read_32b(channel + PBUS_DMA_CTRL, &temp_32b);
+	if ((temp_32b & PBUS_DMA_CTRL_ACT) || !(temp_32b & PBUS_DMA_CTRL_INT))
+		error_exit("pbus dma: ctrl %08x at end of chain", temp_32b);
+
+	h -> read_32b(channel + PBUS_DMA_CTRL, &temp_32b);
+	if (temp_32b & PBUS_DMA_CTRL_INT)
+		error_exit("pbus dma: interrupt not cleared by reading ctrl");
+
+	if (s -> get_next_event() != UINT64_MAX)
+		error_exit("pbus dma: events left after end of chain");
+
+	// stopping the channel drops its pending event
+	h -> write_32b(channel + PBUS_DMA_DP, 0x1000);
+	h -> write_32b(channel + PBUS_DMA_CTRL, PBUS_DMA_CTRL_ACT);
+	h -> write_32b(channel + PBUS_DMA_CTRL, 0);
+
+	if (s -> get_next_event() != UINT64_MAX)
+		error_exit("pbus dma: event left after stopping the channel");
+
+	delete as;
+
+	unsigned char *data = NULL;
+	uint64_t len = 0;
+	load_file(wav, &data, &len);
+
+	if (len != 44 + 2 * n)
+		error_exit("hal2: %s is %llu bytes, expected %u", wav.c_str(), len, 44 + 2 * n);
+
+	if (memcmp(data, "RIFF", 4) || data[24] != (48000 & 0xff) || data[25] != (48000 >> 8) || data[22] != 2)
+		error_exit("hal2: invalid WAV header");
+
+	if (data[44] != 0x34 || data[45] != 0x12 || data[len - 2] != 0x78 || data[len - 1] != 0x56)
+		error_exit("hal2: samples not converted to little endian");
+
+	delete [] data;
+	unlink(wav.c_str());
+
+	delete h;
+	unlink(sram.c_str());
+
+	free_system(mb, m1, m2, m3, p);
+}
+
+int main(int argc, char *argv[])
+{
+	test_untows_complement();
+	test_twos_complement();
+	test_sign_extend();
+	test_count_leading();
+	test_rotate_right();
+	test_make_instruction();
+
+	test_memory();
+	test_memory_bus();
+	test_processor();
+
+	// devices and infrastructure before the instruction tests, some of
+	// those still fail
+	test_scheduler();
+	test_z85c30();
+	test_lg1_kernels();
+	test_graphics_lg1();
+	test_lg1_shm();
+	test_pbus_dma_hal2();
+	test_int2();
+	test_pit8254();
+	test_count_compare();
+
+	test_idle();
+
+	test_throttle();
+
+	test_input_log();
+
+	test_snapshot();
+
+	test_fork_server();
+	test_checkpoint();
+	test_ram_compactor();
+	test_zero_reclaimer();
+	test_fleet();
+	test_placement();
+	test_io_reactor();
+	test_device_thread();
+	test_hostcall();
+	test_arcs();
+
+	test_test_tc_overflow_32b();
 
 	test_ADDI();
 	test_ADDIU();
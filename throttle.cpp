@@ -0,0 +1,95 @@
+#include <errno.h>
+#include <time.h>
+
+#include "error.h"
+#include "log.h"
+#include "throttle.h"
+
+throttle::throttle(double mhz, uint64_t now_cycle) : cycles_per_ns(mhz / 1000.0)
+{
+	if (mhz <= 0.0)
+		error_exit("throttle: invalid speed %f MHz", mhz);
+
+	start_ns = base_ns = report_ns = get_ns();
+	start_cycle = base_cycle = now_cycle;
+
+	slice = uint64_t(THROTTLE_MIN_SLICE_US * 1000 * cycles_per_ns) + 1;
+
+	behind_ns = reported_behind_ns = 0;
+	n_sleeps = 0;
+}
+
+throttle::~throttle()
+{
+}
+
+uint64_t throttle::get_ns()
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		error_exit("clock_gettime failed");
+
+	return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void throttle::account(uint64_t now_cycle)
+{
+	uint64_t now_ns = get_ns();
+	uint64_t due_ns = base_ns + uint64_t((now_cycle - base_cycle) / cycles_per_ns);
+	uint64_t min_slice = uint64_t(THROTTLE_MIN_SLICE_US * 1000 * cycles_per_ns) + 1;
+	uint64_t max_slice = uint64_t(THROTTLE_MAX_SLICE_US * 1000 * cycles_per_ns) + 1;
+
+	if (due_ns > now_ns)
+	{
+		uint64_t ahead_ns = due_ns - now_ns;
+
+		if (ahead_ns < THROTTLE_MIN_SLEEP_US * 1000)
+		{
+			// carried over to the next slice
+			if (slice < max_slice)
+				slice *= 2;
+		}
+		else
+		{
+			if (ahead_ns > 4 * THROTTLE_MIN_SLEEP_US * 1000 && slice / 2 >= min_slice)
+				slice /= 2;
+
+			struct timespec ts;
+			ts.tv_sec = due_ns / 1000000000;
+			ts.tv_nsec = due_ns % 1000000000;
+
+			while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			{
+			}
+
+			n_sleeps++;
+		}
+	}
+	else if (now_ns - due_ns > THROTTLE_MAX_LAG_MS * 1000000ll)
+	{
+		behind_ns += now_ns - due_ns;
+
+		base_ns = now_ns;
+		base_cycle = now_cycle;
+
+		if (slice < max_slice)
+			slice *= 2;
+	}
+
+	if (now_ns - report_ns >= THROTTLE_REPORT_S * 1000000000ll)
+	{
+		if (behind_ns != reported_behind_ns)
+			dolog("throttle: %.1fms behind real time in the last %ds, %.1f MHz effective", (behind_ns - reported_behind_ns) / 1000000.0, THROTTLE_REPORT_S, get_effective_mhz(now_cycle));
+
+		reported_behind_ns = behind_ns;
+		report_ns = now_ns;
+	}
+}
+
+double throttle::get_effective_mhz(uint64_t now_cycle) const
+{
+	uint64_t took_ns = get_ns() - start_ns;
+
+	return took_ns ? (now_cycle - start_cycle) * 1000.0 / took_ns : 0.0;
+}
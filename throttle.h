@@ -0,0 +1,51 @@
+#ifndef __THROTTLE__H__
+#define __THROTTLE__H__
+
+#include <stdint.h>
+
+#define THROTTLE_MIN_SLICE_US	100
+#define THROTTLE_MAX_SLICE_US	20000
+#define THROTTLE_MIN_SLEEP_US	200	// shorter sleeps are mostly overhead
+#define THROTTLE_MAX_LAG_MS	100	// further behind is not caught up with
+#define THROTTLE_REPORT_S	10
+
+// Limits the emulation speed to a given number of cycles per second. The
+// run loop executes a slice of cycles and then calls account(), which
+// compares the cycles with CLOCK_MONOTONIC and sleeps when the guest is
+// ahead. The slice grows while the sleeps would be too short to be
+// accurate and shrinks again when they get long, so a fast host checks the
+// clock often and a slow one hardly at all.
+//
+// A host that cannot keep up runs flat out; once it is more than
+// THROTTLE_MAX_LAG_MS behind, the lag is written off (and reported)
+// instead of letting the guest race to catch up.
+class throttle
+{
+private:
+	double cycles_per_ns;
+
+	uint64_t base_ns, base_cycle;
+	uint64_t slice;	// in cycles
+
+	uint64_t start_ns, start_cycle;
+	uint64_t behind_ns, reported_behind_ns, report_ns;
+	uint64_t n_sleeps;
+
+	static uint64_t get_ns();
+
+public:
+	throttle(double mhz, uint64_t now_cycle);
+	~throttle();
+
+	// cycle at which the current slice ends
+	uint64_t get_slice_end(uint64_t now_cycle) const { return now_cycle + slice; }
+
+	void account(uint64_t now_cycle);
+
+	uint64_t get_slice() const { return slice; }
+	uint64_t get_behind_ns() const { return behind_ns; }
+	uint64_t get_n_sleeps() const { return n_sleeps; }
+	double get_effective_mhz(uint64_t now_cycle) const;
+};
+
+#endif
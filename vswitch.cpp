@@ -0,0 +1,450 @@
+#include <algorithm>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "error.h"
+#include "log.h"
+#include "placement.h"
+#include "vswitch.h"
+
+#define PORT_QUEUE_SIZE	256	// frames, must be a power of 2
+
+static uint64_t get_mac(const uint8_t *p)
+{
+	uint64_t mac = 0;
+
+	for(int index=0; index<6; index++)
+		mac = (mac << 8) | p[index];
+
+	return mac;
+}
+
+static void make_unix_address(std::string path, struct sockaddr_un *addr)
+{
+	memset(addr, 0x00, sizeof(*addr));
+	addr -> sun_family = AF_UNIX;
+
+	if (path.size() >= sizeof addr -> sun_path)
+		error_exit("unix socket path %s too long", path.c_str());
+
+	memcpy(addr -> sun_path, path.c_str(), path.size());
+}
+
+static void *vswitch_thread(void *arg)
+{
+	place_thread(PLACE_IO, "vswitch");
+
+	((vswitch *)arg) -> run();
+
+	return NULL;
+}
+
+vswitch::vswitch(std::string path_in, pcap_writer *pcap_in) : path(path_in), pcap(pcap_in), thread_running(false), stop_flag(false), n_frames_in(0), n_frames_out(0), n_frames_dropped(0)
+{
+	fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd == -1)
+		error_exit("vswitch: cannot create socket");
+
+	struct sockaddr_un addr;
+	make_unix_address(path, &addr);
+
+	unlink(path.c_str());
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof addr) == -1)
+		error_exit("vswitch: cannot bind to %s", path.c_str());
+
+	// so that run() notices stop() within a reasonable time
+	struct timeval tv = { 0, 100000 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+	int buffer_size = 4 * 1024 * 1024;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof buffer_size);
+}
+
+vswitch::~vswitch()
+{
+	stop();
+
+	close(fd);
+
+	unlink(path.c_str());
+
+	dolog("vswitch: %llu frames in, %llu out, %llu dropped", (unsigned long long)n_frames_in, (unsigned long long)n_frames_out, (unsigned long long)n_frames_dropped);
+}
+
+void vswitch::start()
+{
+	if (pthread_create(&th, NULL, vswitch_thread, this))
+		error_exit("vswitch: cannot start thread");
+
+	thread_running = true;
+}
+
+void vswitch::stop()
+{
+	stop_flag = true;
+
+	if (thread_running)
+	{
+		pthread_join(th, NULL);
+
+		thread_running = false;
+	}
+}
+
+size_t vswitch::find_peer(const struct sockaddr_un & addr, socklen_t addr_len)
+{
+	for(size_t index=0; index<peers.size(); index++)
+	{
+		if (peers.at(index).addr_len == addr_len && memcmp(&peers.at(index).addr, &addr, addr_len) == 0)
+			return index;
+	}
+
+	vswitch_peer_t peer;
+	peer.addr = addr;
+	peer.addr_len = addr_len;
+	peers.push_back(peer);
+
+	dolog("vswitch: new port %zu", peers.size() - 1);
+
+	return peers.size() - 1;
+}
+
+void vswitch::forget_peer(size_t nr)
+{
+	dolog("vswitch: port %zu went away", nr);
+
+	peers.erase(peers.begin() + nr);
+
+	// indexes above nr shifted down by one
+	std::map<uint64_t, size_t>::iterator it = fdb.begin();
+	while(it != fdb.end())
+	{
+		if (it -> second == nr)
+			fdb.erase(it++);
+		else
+		{
+			if (it -> second > nr)
+				it -> second--;
+
+			it++;
+		}
+	}
+}
+
+void vswitch::run()
+{
+	net_frame_t in[VSWITCH_BATCH];
+	struct mmsghdr in_msgs[VSWITCH_BATCH];
+	struct iovec in_iovs[VSWITCH_BATCH];
+	struct sockaddr_un in_addrs[VSWITCH_BATCH];
+
+	// each received frame goes to at most all other ports
+	std::vector<struct mmsghdr> out_msgs;
+	std::vector<struct iovec> out_iovs;
+	std::vector<size_t> out_peer;
+
+	while(!stop_flag)
+	{
+		for(int index=0; index<VSWITCH_BATCH; index++)
+		{
+			in_iovs[index].iov_base = in[index].data;
+			in_iovs[index].iov_len = sizeof in[index].data;
+
+			memset(&in_msgs[index], 0x00, sizeof in_msgs[index]);
+			in_msgs[index].msg_hdr.msg_iov = &in_iovs[index];
+			in_msgs[index].msg_hdr.msg_iovlen = 1;
+			in_msgs[index].msg_hdr.msg_name = &in_addrs[index];
+			in_msgs[index].msg_hdr.msg_namelen = sizeof in_addrs[index];
+		}
+
+		int n = recvmmsg(fd, in_msgs, VSWITCH_BATCH, MSG_WAITFORONE, NULL);
+		if (n == -1)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				continue;
+
+			error_exit("vswitch: recvmmsg failed");
+		}
+
+		out_msgs.clear();
+		out_iovs.clear();
+		out_peer.clear();
+		out_iovs.reserve(n * (peers.size() + 1));
+
+		for(int index=0; index<n; index++)
+		{
+			size_t src = find_peer(in_addrs[index], in_msgs[index].msg_hdr.msg_namelen);
+			uint32_t len = in_msgs[index].msg_len;
+
+			// a zero length datagram only announces the port
+			if (len < 14)
+				continue;
+
+			n_frames_in++;
+
+			if (pcap)
+				pcap -> add_frame(in[index].data, len);
+
+			uint64_t dst_mac = get_mac(&in[index].data[0]);
+			uint64_t src_mac = get_mac(&in[index].data[6]);
+
+			if ((src_mac & 0x010000000000ll) == 0)
+				fdb[src_mac] = src;
+
+			std::map<uint64_t, size_t>::iterator it = fdb.find(dst_mac);
+			bool unicast = (dst_mac & 0x010000000000ll) == 0 && it != fdb.end();
+
+			for(size_t port=0; port<peers.size(); port++)
+			{
+				if (port == src || (unicast && it -> second != port))
+					continue;
+
+				struct iovec iov = { in[index].data, len };
+				out_iovs.push_back(iov);
+				out_peer.push_back(port);
+			}
+		}
+
+		out_msgs.resize(out_iovs.size());
+		for(size_t index=0; index<out_iovs.size(); index++)
+		{
+			memset(&out_msgs.at(index), 0x00, sizeof(struct mmsghdr));
+			out_msgs.at(index).msg_hdr.msg_iov = &out_iovs.at(index);
+			out_msgs.at(index).msg_hdr.msg_iovlen = 1;
+			out_msgs.at(index).msg_hdr.msg_name = &peers.at(out_peer.at(index)).addr;
+			out_msgs.at(index).msg_hdr.msg_namelen = peers.at(out_peer.at(index)).addr_len;
+		}
+
+		std::vector<size_t> gone;
+
+		size_t done = 0;
+		while(done < out_msgs.size())
+		{
+			int rc = sendmmsg(fd, &out_msgs.at(done), out_msgs.size() - done, MSG_DONTWAIT);
+
+			if (rc > 0)
+			{
+				n_frames_out += rc;
+				done += rc;
+				continue;
+			}
+
+			if (errno == EINTR)
+				continue;
+
+			// the port at `done' is full (drop the frame) or is gone
+			n_frames_dropped++;
+
+			if (errno == ECONNREFUSED || errno == ENOENT)
+			{
+				size_t port = out_peer.at(done);
+				gone.push_back(port);
+
+				// drop everything else queued for it as well
+				size_t out = done + 1;
+				for(size_t index=done + 1; index<out_msgs.size(); index++)
+				{
+					if (out_peer.at(index) == port)
+						continue;
+
+					out_msgs.at(out) = out_msgs.at(index);
+					out_peer.at(out) = out_peer.at(index);
+					out++;
+				}
+
+				out_msgs.resize(out);
+				out_peer.resize(out);
+			}
+
+			done++;
+		}
+
+		// highest index first as forget_peer() shifts the ones above it
+		std::sort(gone.begin(), gone.end());
+		for(size_t index=gone.size(); index>0; index--)
+			forget_peer(gone.at(index - 1));
+
+		if (pcap)
+			pcap -> flush();
+	}
+}
+
+static void vswitch_port_event(void *ctx, int fd, uint32_t events)
+{
+	((vswitch_port *)ctx) -> receive_batch();
+}
+
+static void vswitch_port_flush(void *ctx)
+{
+	((vswitch_port *)ctx) -> flush_tx();
+}
+
+vswitch_port::vswitch_port(io_reactor *io_in, std::string switch_path, pcap_writer *pcap_in) : io(io_in), pcap(pcap_in), rx(PORT_QUEUE_SIZE), tx(PORT_QUEUE_SIZE), flush_scheduled(false), n_rx(0), n_tx(0), n_rx_dropped(0)
+{
+	fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (fd == -1)
+		error_exit("vswitch_port: cannot create socket");
+
+	// autobind to an abstract address so that the switch can reply
+	struct sockaddr_un local;
+	memset(&local, 0x00, sizeof local);
+	local.sun_family = AF_UNIX;
+	if (bind(fd, (struct sockaddr *)&local, sizeof(sa_family_t)) == -1)
+		error_exit("vswitch_port: cannot bind");
+
+	struct sockaddr_un addr;
+	make_unix_address(switch_path, &addr);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof addr) == -1)
+		error_exit("vswitch_port: cannot connect to switch at %s", switch_path.c_str());
+
+	int buffer_size = 4 * 1024 * 1024;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof buffer_size);
+
+	// announce ourselves so that broadcasts reach us before we send anything
+	if (send(fd, "", 0, 0) == -1)
+		error_exit("vswitch_port: cannot announce to switch at %s", switch_path.c_str());
+
+	io -> add(fd, EPOLLIN, vswitch_port_event, this);
+}
+
+vswitch_port::~vswitch_port()
+{
+	io -> remove(fd);
+
+	// also sends the frames the device queued last
+	io -> run_requests();
+	flush_tx();
+
+	close(fd);
+}
+
+bool vswitch_port::send_frame(const uint8_t *data, uint16_t len)
+{
+	if (len > NET_MAX_FRAME)
+		return false;
+
+	net_frame_t *slot = tx.reserve();
+	if (!slot)
+		return false;
+
+	slot -> len = len;
+	memcpy(slot -> data, data, len);
+	tx.commit();
+
+	// the I/O thread drains the queue completely so it only needs to be
+	// asked when no flush is pending; flush_tx() clears the flag before
+	// it looks at the queue, so this frame is seen either way
+	if (!flush_scheduled.exchange(true) && !io -> request(vswitch_port_flush, this))
+		flush_scheduled = false;	// the next frame asks again
+
+	return true;
+}
+
+bool vswitch_port::receive_frame(net_frame_t *frame)
+{
+	net_frame_t *slot = rx.peek();
+	if (!slot)
+		return false;
+
+	frame -> len = slot -> len;
+	memcpy(frame -> data, slot -> data, slot -> len);
+	rx.consume();
+
+	return true;
+}
+
+void vswitch_port::flush_tx()
+{
+	struct mmsghdr msgs[VSWITCH_BATCH];
+	struct iovec iovs[VSWITCH_BATCH];
+
+	// copy a batch out of the queue so that the device can refill it
+	// while sendmmsg() runs
+	net_frame_t out[VSWITCH_BATCH];
+
+	// frames committed from now on ask for a new flush
+	flush_scheduled = false;
+
+	for(;;)
+	{
+		int n = 0;
+		while(n < VSWITCH_BATCH && tx.pop(&out[n]))
+		{
+			iovs[n].iov_base = out[n].data;
+			iovs[n].iov_len = out[n].len;
+
+			memset(&msgs[n], 0x00, sizeof msgs[n]);
+			msgs[n].msg_hdr.msg_iov = &iovs[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+
+			if (pcap)
+				pcap -> add_frame(out[n].data, out[n].len);
+
+			n++;
+		}
+
+		if (n == 0)
+			break;
+
+		int done = 0;
+		while(done < n)
+		{
+			int rc = sendmmsg(fd, &msgs[done], n - done, 0);
+			if (rc == -1)
+			{
+				if (errno == EINTR)
+					continue;
+
+				// switch gone or full: drop the frame
+				done++;
+				continue;
+			}
+
+			done += rc;
+		}
+
+		n_tx += n;
+	}
+}
+
+void vswitch_port::receive_batch()
+{
+	net_frame_t in[VSWITCH_BATCH];
+	struct mmsghdr msgs[VSWITCH_BATCH];
+	struct iovec iovs[VSWITCH_BATCH];
+
+	for(int index=0; index<VSWITCH_BATCH; index++)
+	{
+		iovs[index].iov_base = in[index].data;
+		iovs[index].iov_len = sizeof in[index].data;
+
+		memset(&msgs[index], 0x00, sizeof msgs[index]);
+		msgs[index].msg_hdr.msg_iov = &iovs[index];
+		msgs[index].msg_hdr.msg_iovlen = 1;
+	}
+
+	int n = recvmmsg(fd, msgs, VSWITCH_BATCH, MSG_DONTWAIT, NULL);
+
+	for(int index=0; index<n; index++)
+	{
+		in[index].len = msgs[index].msg_len;
+
+		if (pcap)
+			pcap -> add_frame(in[index].data, in[index].len);
+
+		if (rx.push(in[index]))
+			n_rx++;
+		else
+			n_rx_dropped++;
+	}
+}
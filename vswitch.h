@@ -0,0 +1,101 @@
+#ifndef __VSWITCH__H__
+#define __VSWITCH__H__
+
+#include <atomic>
+#include <map>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "io_reactor.h"
+#include "pcap_writer.h"
+#include "ring_buffer.h"
+
+#define NET_MAX_FRAME	1536
+#define VSWITCH_BATCH	32	// frames per recvmmsg/sendmmsg call
+
+typedef struct
+{
+	uint16_t len;
+	uint8_t data[NET_MAX_FRAME];
+} net_frame_t;
+
+typedef struct
+{
+	struct sockaddr_un addr;
+	socklen_t addr_len;
+} vswitch_peer_t;
+
+// A learning ethernet switch on a unix datagram socket. Every emulator
+// instance (vswitch_port) sends its frames to it, the switch forwards
+// them to the port that owns the destination MAC or floods them.
+// Can run in a thread of the emulator (start()) or as the main loop of
+// the miep-vswitch sidecar (run()).
+class vswitch
+{
+private:
+	int fd;
+	std::string path;
+	pcap_writer *pcap;
+
+	std::vector<vswitch_peer_t> peers;
+	std::map<uint64_t, size_t> fdb;	// MAC -> index in peers
+
+	pthread_t th;
+	bool thread_running;
+	std::atomic_bool stop_flag;
+
+	uint64_t n_frames_in, n_frames_out, n_frames_dropped;
+
+	size_t find_peer(const struct sockaddr_un & addr, socklen_t addr_len);
+	void forget_peer(size_t nr);
+
+public:
+	vswitch(std::string path, pcap_writer *pcap);
+	~vswitch();
+
+	void start();
+	void run();
+	void stop();
+
+	uint64_t get_n_frames_in() const { return n_frames_in; }
+	uint64_t get_n_frames_out() const { return n_frames_out; }
+};
+
+// One NIC-side connection to a vswitch. The I/O thread of the machine
+// moves frames between the socket (batched) and two lock-free queues so
+// that the device model never makes a socket call.
+class vswitch_port
+{
+private:
+	io_reactor *io;
+	int fd;
+	pcap_writer *pcap;
+
+	ring_buffer<net_frame_t> rx, tx;
+	std::atomic_bool flush_scheduled;	// a flush_tx() request is queued or running
+
+	std::atomic<uint64_t> n_rx, n_tx, n_rx_dropped;
+
+public:
+	vswitch_port(io_reactor *io_in, std::string switch_path, pcap_writer *pcap);
+	~vswitch_port();
+
+	// I/O thread
+	void flush_tx();
+	void receive_batch();
+
+	// called from the emulated device
+	bool send_frame(const uint8_t *data, uint16_t len);
+	bool receive_frame(net_frame_t *frame);
+	bool has_frame() const { return !rx.empty(); }
+
+	uint64_t get_n_rx() const { return n_rx; }
+	uint64_t get_n_tx() const { return n_tx; }
+	uint64_t get_n_rx_dropped() const { return n_rx_dropped; }
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include <atomic>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "pcap_writer.h"
+#include "vswitch.h"
+
+const char *logfile = NULL;
+
+vswitch *vs = NULL;
+
+void help()
+{
+	fprintf(stderr, "-s x   unix socket to listen on (required)\n");
+	fprintf(stderr, "-w x   write all switched frames to pcap file x\n");
+	fprintf(stderr, "-l x   logfile to write to\n");
+	fprintf(stderr, "-h     this help & exit\n");
+}
+
+void sig_handler(int sig)
+{
+	vs -> stop();
+}
+
+int main(int argc, char *argv[])
+{
+	int c = -1;
+	const char *path = NULL, *pcap_file = NULL;
+
+	while((c = getopt(argc, argv, "s:w:l:h")) != -1)
+	{
+		switch(c)
+		{
+			case 's':
+				path = optarg;
+				break;
+
+			case 'w':
+				pcap_file = optarg;
+				break;
+
+			case 'l':
+				logfile = optarg;
+				break;
+
+			default:
+				help();
+				return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!path)
+	{
+		help();
+		return 1;
+	}
+
+	pcap_writer *pcap = pcap_file ? new pcap_writer(pcap_file) : NULL;
+
+	vs = new vswitch(path, pcap);
+
+	signal(SIGTERM, sig_handler);
+	signal(SIGINT , sig_handler);
+
+	vs -> run();
+
+	printf("%llu frames in, %llu frames out\n", (unsigned long long)vs -> get_n_frames_in(), (unsigned long long)vs -> get_n_frames_out());
+
+	delete vs;
+	delete pcap;
+
+	return 0;
+}
@@ -1,21 +1,137 @@
+#include <algorithm>
 #include <stdint.h>
 #include <string.h>
 
 #include "debug.h"
+#include "processor.h"
 #include "z85c30.h"
 
-z85c30::z85c30(debug_console *pdc_in)
+static void z85c30_event(void *ctx, uint64_t now)
 {
-	pdc = pdc_in;
+	z85c30 *z = (z85c30 *)ctx;
 
+	z -> update_interrupt(now);
+}
+
+z85c30::z85c30(debug_console *pdc_in, processor *pp_in) : pdc(pdc_in), pp(pp_in), out(NULL), in(NULL), ilog(NULL), channel(0), rx_valid(false), rx_next(0), input_posted(false), irq_cb(NULL), irq_ctx(NULL), tx_cb(NULL), tx_ctx(NULL), irq_state(false), event(SCHED_NONE)
+{
 	memset(d, 0x00, sizeof d);
 	cr = 0;
 
-	tx_full = false;
+	// 8N1 until the guest programs the channel
+	d[4] = 0x04;
+	d[5] = 0x60;
+
+	tx_busy_until = 0;
+	tx_int_pending = false;
+
+	rx_data = 0;
+
+	update_baud_rate();
 }
 
 z85c30::~z85c30()
 {
+	if (ilog && ilog -> is_replaying())
+		ilog -> remove_reader(replay_notify, this);
+
+	pp -> get_scheduler() -> cancel(event);
+	pp -> get_scheduler() -> cancel_posted(this);
+}
+
+void z85c30::set_input(serial_host *in_in)
+{
+	in = in_in;
+
+	if (in)
+		in -> set_input_callback(input_callback, this);
+
+	update_interrupt();
+}
+
+void z85c30::set_input_log(input_log *ilog_in, int channel_in)
+{
+	if (ilog && ilog -> is_replaying())
+		ilog -> remove_reader(replay_notify, this);
+
+	ilog = ilog_in;
+	channel = channel_in;
+
+	if (ilog && ilog -> is_replaying())
+		ilog -> add_reader(replay_notify, this);
+
+	update_interrupt();
+}
+
+// one posted event per burst of input
+void z85c30::input_callback(void *ctx)
+{
+	z85c30 *z = (z85c30 *)ctx;
+
+	if (z -> input_posted.exchange(true))
+		return;
+
+	z -> pp -> get_scheduler() -> post(input_event, z);
+	z -> pp -> wake();
+}
+
+void z85c30::input_event(void *ctx, uint64_t now)
+{
+	z85c30 *z = (z85c30 *)ctx;
+
+	z -> input_posted = false;
+
+	z -> update_interrupt(now);
+}
+
+// the next record of the input log changed, maybe to one for this channel
+void z85c30::replay_notify(void *ctx)
+{
+	z85c30 *z = (z85c30 *)ctx;
+
+	z -> reschedule(z -> pp -> get_cycle_count());
+}
+
+void z85c30::update_baud_rate()
+{
+	static const int clock_multiplier[] = { 1, 16, 32, 64 };
+	static const int data_bits[] = { 5, 7, 6, 8 };
+	static const double stop_bits[] = { 0.0, 1.0, 1.5, 2.0 };
+
+	double baud = 9600.0;	// until the baud rate generator is set up
+
+	if (d[14] & 1)	// WR14: baud rate generator enable
+	{
+		uint32_t time_constant = (d[13] << 8) | d[12];
+
+		baud = double(Z85C30_PCLK) / (2.0 * clock_multiplier[d[4] >> 6] * (time_constant + 2));
+	}
+
+	double bits = 1.0 + data_bits[(d[5] >> 5) & 3] + (d[4] & 1) + stop_bits[(d[4] >> 2) & 3];
+
+	cycles_per_char = uint64_t(double(CPU_CLOCK_HZ) * bits / baud);
+
+	DEBUG(pdc -> dc_log("serial: %.0f baud, %llu cycles per character", baud, (unsigned long long)cycles_per_char));
+}
+
+void z85c30::transmit(uint8_t data)
+{
+	uint64_t now = pp -> get_cycle_count();
+
+	tx_busy_until = (now > tx_busy_until ? now : tx_busy_until) + cycles_per_char;
+
+	// becomes visible when the buffer empties again
+	tx_int_pending = true;
+
+	if (out)
+		out -> put(data);
+
+	if (tx_cb)
+		tx_cb(tx_ctx, data);
+
+	DEBUG(pdc -> dc_log("serial OUTPUT: %c (%02x)", data, data));
+
+	update_interrupt();
 }
 
 void z85c30::ser_command_write(uint8_t data)
@@ -30,21 +146,28 @@ void z85c30::ser_command_write(uint8_t data)
 		else
 			cr = data & 7;
 
-		pdc -> dc_log("serial: select register %d, command code %d, crc reset code %d", cr, command_code, crc_reset_code);
+		if (command_code == 5) // reset Tx int pending
+		{
+			tx_int_pending = false;
+			update_interrupt();
+		}
+
+		DEBUG(pdc -> dc_log("serial: select register %d, command code %d, crc reset code %d", cr, command_code, crc_reset_code));
 	}
 	else
 	{
-		pdc -> dc_log("serial: write %02x to register %d", data, cr);
+		DEBUG(pdc -> dc_log("serial: write %02x to register %d", data, cr));
 
 		if (cr == 8)
+			transmit(data == 0x0d ? '\n' : data);
+		else
 		{
-			if (data == 0x0d)
-				pdc -> dc_term("\n");
-			else
-				pdc -> dc_term("%c", data);
+			d[cr] = data;
 
-			pdc -> dc_log("serial OUTPUT: %c (%02x)", data, data);
-			// tx_full = true; not neccessary
+			if (cr == 4 || cr == 5 || cr == 12 || cr == 13 || cr == 14)
+				update_baud_rate();
+			else if (cr == 1 || cr == 9)
+				update_interrupt();
 		}
 
 		cr = 0;
@@ -54,17 +177,35 @@ void z85c30::ser_command_write(uint8_t data)
 uint8_t z85c30::ser_command_read()
 {
 	uint8_t ret = -1;
+	uint64_t now = pp -> get_cycle_count();
 
 	if (cr == 0)
 	{
-		ret = 0x28 | (tx_full ? 0 : 4); // 00101t00 CTS/DCD, t: set when empty
+		// the transmit buffer is empty as soon as the last character
+		// moved into the shift register
+		bool tx_empty = now + cycles_per_char >= tx_busy_until;
 
-		tx_full = false;
+		ret = 0x28 | (tx_empty ? 4 : 0) | (rx_available(now) ? 1 : 0); // 00101t0r CTS/DCD, t: set when empty, r: rx char available
 	}
+	else if (cr == 1)
+	{
+		ret = 0x06 | (now >= tx_busy_until ? 1 : 0); // all sent
+	}
+	else if (cr == 3)
+	{
+		// interrupt pending bits, in the channel A positions
+		ret = 0;
 
-	cr = 0;
+		if ((d[1] & 0x18) && rx_available(now))
+			ret |= 0x20;
+
+		if ((d[1] & 2) && tx_int_pending && now + cycles_per_char >= tx_busy_until)
+			ret |= 0x10;
+	}
+
+	DEBUG(pdc -> dc_log("serial: read from register %d: %02x", cr, ret));
 
-	pdc -> dc_log("serial: read from register %d: %02x", cr, ret);
+	cr = 0;
 
 	return ret;
 }
@@ -73,14 +214,133 @@ void z85c30::ser_data_write(uint8_t data)
 {
 	ASSERT(cr < 16);
 
-	pdc -> dc_term("%c", data);
-
-	pdc -> dc_log("serial: write DATA %02x", data);
+	transmit(data);
 }
 
 uint8_t z85c30::ser_data_read()
 {
-	pdc -> dc_log("serial: read DATA");
+	// without new input the last character is read again, like the
+	// receive buffer of the real chip
+	if (rx_available(pp -> get_cycle_count()))
+	{
+		rx_data = rx_next;
+		rx_valid = false;
+	}
+
+	DEBUG(pdc -> dc_log("serial: read DATA %02x", rx_data));
+
+	update_interrupt();
+
+	return rx_data;
+}
+
+bool z85c30::rx_available(uint64_t now)
+{
+	if (rx_valid)
+		return true;
+
+	if (ilog && ilog -> is_replaying())
+		rx_valid = ilog -> replay_serial(channel, now, &rx_next);
+	else if (in && in -> get_input(&rx_next))
+	{
+		rx_valid = true;
+
+		if (ilog)
+			ilog -> record_serial(channel, now, rx_next);
+	}
+
+	return rx_valid;
+}
+
+bool z85c30::interrupt_pending()
+{
+	return interrupt_pending(pp -> get_cycle_count());
+}
+
+bool z85c30::interrupt_pending(uint64_t now)
+{
+	if ((d[9] & 8) == 0)	// master interrupt enable
+		return false;
+
+	if ((d[1] & 0x18) && rx_available(now))	// rx int on all characters / first character
+		return true;
+
+	if ((d[1] & 2) && tx_int_pending && now + cycles_per_char >= tx_busy_until)
+		return true;
+
+	return false;
+}
+
+void z85c30::reschedule(uint64_t now)
+{
+	scheduler *s = pp -> get_scheduler();
+	uint64_t when = UINT64_MAX;
+
+	// the transmitter changes state (buffer empty, all sent) without an
+	// access by the guest: a guest that polls for it waits in an idle loop,
+	// and idle skipping must stop there, interrupts enabled or not
+	if (now + cycles_per_char < tx_busy_until)
+		when = tx_busy_until - cycles_per_char;
+	else if (now < tx_busy_until)
+		when = tx_busy_until;
+
+	// the character that the recording took from an input event; not
+	// while the last one was not read, a recording takes none then either
+	uint64_t next_cycle = 0;
+	uint8_t next_type = 0;
+
+	if ((d[9] & 8) && (d[1] & 0x18) && !rx_valid && ilog && ilog -> is_replaying() && ilog -> peek(&next_cycle, &next_type) && next_type == ((IL_SERIAL_RX << 4) | channel))
+		when = std::min(when, std::max(next_cycle, now));
+
+	s -> cancel(event);
+	event = when == UINT64_MAX ? SCHED_NONE : s -> schedule(when, z85c30_event, this);
+}
+
+void z85c30::update_interrupt()
+{
+	update_interrupt(pp -> get_cycle_count());
+}
+
+void z85c30::update_interrupt(uint64_t now)
+{
+	bool state = interrupt_pending(now);
+
+	if (state != irq_state)
+	{
+		irq_state = state;
+
+		DEBUG(pdc -> dc_log("serial: interrupt %s", state ? "raised" : "cleared"));
+
+		if (irq_cb)
+			irq_cb(irq_ctx);
+	}
+
+	reschedule(now);
+}
+
+void z85c30::save_state(snapshot_writer & sw) const
+{
+	sw.put_bytes(d, sizeof d);
+	sw.put_u8(cr);
+	sw.put_u64(tx_busy_until);
+	sw.put_bool(tx_int_pending);
+	sw.put_u8(rx_data);
+	sw.put_bool(rx_valid);
+	sw.put_u8(rx_next);
+	sw.put_bool(irq_state);
+}
+
+void z85c30::load_state(snapshot_reader & sr)
+{
+	sr.get_bytes(d, sizeof d);
+	cr = sr.get_u8();
+	tx_busy_until = sr.get_u64();
+	tx_int_pending = sr.get_bool();
+	rx_data = sr.get_u8();
+	rx_valid = sr.get_bool();
+	rx_next = sr.get_u8();
+	irq_state = sr.get_bool();
 
-	return 0;
+	update_baud_rate();
+	update_interrupt();
 }
@@ -1,21 +1,100 @@
+#ifndef __Z85C30__H__
+#define __Z85C30__H__
+
+#include <atomic>
+
 #include "debug_console.h"
+#include "input_log.h"
+#include "scheduler.h"
+#include "serial_output.h"
+#include "serial_host.h"
+#include "snapshot_state.h"
+
+class processor;
+
+#define Z85C30_PCLK	3672000	// Hz, baud rate generator input on the Indy
 
 class z85c30
 {
 private:
 	debug_console *pdc;
+	processor *pp;
+	serial_output *out;
+	serial_host *in;
 
-	unsigned char d[16];
+	unsigned char d[16];	// write registers
 	uint8_t cr;
-	bool tx_full;
+
+	// the transmitter is modeled from the baud rate, not from the host:
+	// the cycle count at which the last written character has been
+	// shifted out completely
+	uint64_t tx_busy_until, cycles_per_char;
+	bool tx_int_pending;
+
+	uint8_t rx_data;
+
+	// the next character, taken from the host (or the input log) when
+	// the guest first looks for it
+	input_log *ilog;
+	int channel;
+	bool rx_valid;
+	uint8_t rx_next;
+
+	bool rx_available(uint64_t now);
+
+	// the interrupt output is pushed to irq_cb when it changes; an event
+	// re-evaluates it when the transmitter changes state. Host input
+	// re-evaluates it through input_callback(), which the I/O thread
+	// calls; in a replay an event does that at the cycle of the next
+	// recorded character.
+	std::atomic_bool input_posted;
+
+	void (*irq_cb)(void *ctx);
+	void *irq_ctx;
+
+	// sees every transmitted character
+	void (*tx_cb)(void *ctx, uint8_t c);
+	void *tx_ctx;
+	bool irq_state;
+	sched_id_t event;
+
+	void update_baud_rate();
+	void transmit(uint8_t data);
+	void reschedule(uint64_t now);
+	bool interrupt_pending(uint64_t now);
+
+	static void input_event(void *ctx, uint64_t now);
+	static void replay_notify(void *ctx);
 
 public:
-	z85c30(debug_console *pdc_in);
+	z85c30(debug_console *pdc_in, processor *pp_in);
 	~z85c30();
 
+	void set_output(serial_output *out_in) { out = out_in; }
+	// installs input_callback() at in_in: set it before input can arrive
+	void set_input(serial_host *in_in);
+	// record or replay the input of channel `channel_in'
+	void set_input_log(input_log *ilog_in, int channel_in);
+	void set_irq_callback(void (*cb)(void *ctx), void *ctx) { irq_cb = cb; irq_ctx = ctx; }
+	void set_tx_callback(void (*cb)(void *ctx, uint8_t c), void *ctx) { tx_cb = cb; tx_ctx = ctx; }
+
+	bool interrupt_pending();
+	bool get_irq_state() const { return irq_state; }
+
+	// I/O thread: host input was queued
+	static void input_callback(void *ctx);
+
+	void update_interrupt();
+	void update_interrupt(uint64_t now);
+
+	void save_state(snapshot_writer & sw) const;
+	void load_state(snapshot_reader & sr);
+
 	uint8_t ser_command_read();
 	uint8_t ser_data_read();
 
 	void ser_command_write(uint8_t data);
 	void ser_data_write(uint8_t data);
 };
+
+#endif
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "error.h"
+#include "log.h"
+#include "zero_reclaimer.h"
+
+static void zero_reclaimer_event(void *ctx, uint64_t now)
+{
+	((zero_reclaimer *)ctx) -> step(now);
+}
+
+zero_reclaimer::zero_reclaimer(processor *pp_in, const ram_compactor *rc_in) : pp(pp_in), rc(rc_in), cur_region(0), cur_offset(0), event(SCHED_NONE), cb(NULL), cb_ctx(NULL), n_reclaimed(0), n_passes(0)
+{
+	page_size = sysconf(_SC_PAGESIZE);
+
+	residency.resize(ZERO_SCAN_BLOCK / page_size + 1);
+}
+
+zero_reclaimer::~zero_reclaimer()
+{
+	pp -> get_scheduler() -> cancel(event);
+}
+
+void zero_reclaimer::add(memory *m)
+{
+	if (uintptr_t(m -> get_data()) % page_size)
+		error_exit("zero_reclaimer: memory is not page aligned");
+
+	regions.push_back(m);
+}
+
+void zero_reclaimer::start()
+{
+	if (regions.empty())
+		return;
+
+	event = pp -> get_scheduler() -> schedule(pp -> get_cycle_count() + uint64_t(ZERO_SCAN_PERIOD_US) * (CPU_CLOCK_HZ / 1000000), zero_reclaimer_event, this);
+}
+
+bool zero_reclaimer::is_zero(const uint8_t *p, size_t n)
+{
+	size_t index = 0;
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+
+	// 64 bytes per compare
+	for(; index + 64 <= n; index += 64)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)&p[index]);
+		__m128i b = _mm_loadu_si128((const __m128i *)&p[index + 16]);
+		__m128i c = _mm_loadu_si128((const __m128i *)&p[index + 32]);
+		__m128i d = _mm_loadu_si128((const __m128i *)&p[index + 48]);
+
+		__m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xffff)
+			return false;
+	}
+#endif
+
+	for(; index<n; index++)
+	{
+		if (p[index])
+			return false;
+	}
+
+	return true;
+}
+
+void zero_reclaimer::release(memory *m, uint64_t offset, uint64_t n)
+{
+	// restored from a snapshot: may run out of mappings
+	if (!m -> release(offset, n))
+		return;
+
+	n_reclaimed += n / page_size;
+
+	if (cb)
+		cb(cb_ctx, m, offset, n);
+}
+
+// returns the number of bytes compared
+uint64_t zero_reclaimer::reclaim_block(memory *m, uint64_t offset, uint64_t n)
+{
+	const uint8_t *base = m -> get_data();
+	uint64_t n_pages = n / page_size, checked = 0;
+
+	if (mincore((void *)&base[offset], n_pages * page_size, residency.data()) == -1)
+		error_exit("zero_reclaimer: mincore failed");
+
+	uint64_t run_start = 0, run_len = 0;
+
+	for(uint64_t page=0; page<n_pages; page++)
+	{
+		uint64_t page_offset = offset + page * page_size;
+		bool zero = false;
+
+		if ((residency[page] & 1) && (!rc || rc -> is_resident(&base[page_offset])))
+		{
+			zero = is_zero(&base[page_offset], page_size);
+			checked += page_size;
+		}
+
+		if (zero)
+		{
+			if (run_len == 0)
+				run_start = page_offset;
+
+			run_len += page_size;
+		}
+		else if (run_len)
+		{
+			release(m, run_start, run_len);
+			run_len = 0;
+		}
+	}
+
+	if (run_len)
+		release(m, run_start, run_len);
+
+	return checked;
+}
+
+void zero_reclaimer::step(uint64_t now)
+{
+	// also when called directly
+	pp -> get_scheduler() -> cancel(event);
+	event = SCHED_NONE;
+
+	// nor a DMA copy or a host call batch on another thread
+	pp -> sync_devices();
+
+	uint64_t checked = 0;
+
+	for(int block=0; block<ZERO_SCAN_BLOCKS && checked < ZERO_SCAN_CHECK_BYTES; block++)
+	{
+		memory *m = regions[cur_region];
+		uint64_t len = m -> get_size() / page_size * page_size;
+
+		// blocks on host huge page boundaries
+		uint64_t end = ((uintptr_t(m -> get_data()) + cur_offset) / ZERO_SCAN_BLOCK + 1) * ZERO_SCAN_BLOCK - uintptr_t(m -> get_data());
+		end = std::min(end, len);
+
+		if (cur_offset < end)
+			checked += reclaim_block(m, cur_offset, end - cur_offset);
+
+		cur_offset = end;
+
+		if (cur_offset >= len)
+		{
+			cur_offset = 0;
+
+			if (++cur_region == regions.size())
+			{
+				cur_region = 0;
+
+				if (n_passes++ % 100 == 0)
+					dolog("zero_reclaimer: %llu pages reclaimed", n_reclaimed);
+			}
+		}
+	}
+
+	event = pp -> get_scheduler() -> schedule(now + uint64_t(ZERO_SCAN_PERIOD_US) * (CPU_CLOCK_HZ / 1000000), zero_reclaimer_event, this);
+}
@@ -0,0 +1,70 @@
+#ifndef __ZERO_RECLAIMER__H__
+#define __ZERO_RECLAIMER__H__
+
+#include <stdint.h>
+#include <vector>
+
+#include "memory.h"
+#include "processor.h"
+#include "ram_compactor.h"
+#include "scheduler.h"
+
+#define ZERO_SCAN_PERIOD_US	100000	// the longest idle sleep: no extra wakeups
+#define ZERO_SCAN_BLOCK		(2 * 1024 * 1024)	// a huge page
+#define ZERO_SCAN_BLOCKS	32	// visited per step
+#define ZERO_SCAN_CHECK_BYTES	(4 * 1024 * 1024)	// compared per step
+
+// Gives guest RAM pages that the guest filled with zeros (memory tests,
+// the page zeroing of the kernel) back to the host.
+//
+// A scheduler event walks the RAM in steps: per 2MB block mincore()
+// tells which host pages are resident, only those are compared with zero
+// and runs of zero pages are released. A block that is zero completely
+// is released in one go, so a transparent huge page is not split. Running
+// in the emulation thread between two instructions means that no guest
+// store can come in between the compare and the release. Other threads
+// do write guest RAM (DMA on the device thread, host call batches on the
+// I/O thread): processor::sync_devices() waits for those first.
+class zero_reclaimer
+{
+private:
+	processor *pp;
+	const ram_compactor *rc;
+
+	std::vector<memory *> regions;
+	size_t cur_region;
+	uint64_t cur_offset;
+
+	sched_id_t event;
+	long page_size;
+	std::vector<unsigned char> residency;
+
+	memory_release_callback_t cb;
+	void *cb_ctx;
+
+	uint64_t n_reclaimed, n_passes;
+
+	uint64_t reclaim_block(memory *m, uint64_t offset, uint64_t n);
+	void release(memory *m, uint64_t offset, uint64_t n);
+
+public:
+	// rc: chunks it has taken away are not looked at, may be NULL
+	zero_reclaimer(processor *pp_in, const ram_compactor *rc_in);
+	~zero_reclaimer();
+
+	// plain memory only
+	void add(memory *m);
+	void start();
+
+	void set_release_callback(memory_release_callback_t cb_in, void *ctx) { cb = cb_in; cb_ctx = ctx; }
+
+	// scheduler callback
+	void step(uint64_t now);
+
+	static bool is_zero(const uint8_t *p, size_t n);
+
+	uint64_t get_n_reclaimed() const { return n_reclaimed; }
+	uint64_t get_n_passes() const { return n_passes; }
+};
+
+#endif